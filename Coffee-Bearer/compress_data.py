@@ -2,6 +2,10 @@
 import os
 import gzip
 import shutil
+import hashlib
+import itertools
+import json
+import re
 from pathlib import Path
 
 # This line is crucial - it imports PlatformIO's build environment
@@ -61,6 +65,339 @@ def compress_web_assets(source, target, env):
 
     print("\n" + "="*15 + ">> Asset Processing Complete <<" + "="*15 + "\n")
 
+# Assets embedded in the firmware image, keyed by extension
+EMBED_TYPES = {
+    ".html": ("text/html", True),
+    ".css": ("text/css", True),
+    ".js": ("text/javascript", True),
+    ".ico": ("image/x-icon", False),
+}
+
+# Brotli is optional: without the module only gzip variants are embedded
+try:
+    import brotli
+except ImportError:
+    brotli = None
+
+# ---------------------------------------------------------------------------
+# Minifiers. Deliberately conservative: they only drop comments and
+# whitespace that can never be significant, and leave strings, template
+# literals and regex literals untouched. JS keeps its line breaks so that
+# automatic semicolon insertion behaves exactly as in the source.
+# ---------------------------------------------------------------------------
+
+def minify_js(src):
+    out = []
+    i, n = 0, len(src)
+    last = ""          # last significant character emitted (regex detection)
+    templates = []     # brace depth of each open ${...} inside template literals
+    while i < n:
+        c = src[i]
+        nxt = src[i + 1] if i + 1 < n else ""
+        if c in "'\"`" or (c == "}" and templates and templates[-1] == 0):
+            # String or template literal (also resumes a template after ${...})
+            if c == "}":
+                templates.pop()
+                quote = "`"
+            else:
+                quote = c
+            start = i
+            i += 1
+            while i < n and src[i] != quote:
+                if src[i] == "\\":
+                    i += 1
+                elif quote == "`" and src.startswith("${", i):
+                    templates.append(0)
+                    i += 2
+                    break
+                i += 1
+            else:
+                i += 1
+            out.append(src[start:i])
+            last = quote
+            continue
+        if c == "/" and nxt == "/":
+            while i < n and src[i] != "\n":
+                i += 1
+            continue
+        if c == "/" and nxt == "*":
+            end = src.find("*/", i + 2)
+            i = n if end == -1 else end + 2
+            continue
+        if c == "/" and (last == "" or last in "(,=:[!&|?{};+-*%<>~^\n" or
+                         re.search(r"\b(return|typeof|case|in|of)\s*$", "".join(out[-8:]))):
+            # Regex literal: copy through its closing slash and flags
+            start = i
+            i += 1
+            in_class = False
+            while i < n and (src[i] != "/" or in_class):
+                if src[i] == "\\":
+                    i += 1
+                elif src[i] == "[":
+                    in_class = True
+                elif src[i] == "]":
+                    in_class = False
+                i += 1
+            i += 1
+            while i < n and src[i].isalpha():
+                i += 1
+            out.append(src[start:i])
+            last = "/"
+            continue
+        if c in " \t\r\n":
+            # Collapse whitespace: a newline survives (ASI), otherwise one space
+            start = i
+            while i < n and src[i] in " \t\r\n":
+                i += 1
+            gap = "\n" if "\n" in src[start:i] else " "
+            if out and last not in ("", "\n"):
+                prev = out[-1][-1:]
+                following = src[i:i + 1]
+                word = lambda ch: ch.isalnum() or ch in "_$"
+                if gap == "\n" or (word(prev) and word(following)) or (prev in "+-" and following == prev):
+                    out.append(gap)
+                    last = gap if gap == "\n" else last
+            continue
+        if templates:
+            if c == "{":
+                templates[-1] += 1
+            elif c == "}":
+                templates[-1] -= 1
+        out.append(c)
+        last = c
+        i += 1
+    return "".join(out).strip() + "\n"
+
+def minify_css(src):
+    src = re.sub(r"/\*.*?\*/", "", src, flags=re.S)
+    parts = re.split(r"(\"(?:\\.|[^\"\\])*\"|'(?:\\.|[^'\\])*')", src)
+    for k in range(0, len(parts), 2):
+        text = re.sub(r"\s+", " ", parts[k])
+        text = re.sub(r"\s*([{};,>])\s*", r"\1", text)
+        text = re.sub(r":\s+", ":", text)
+        parts[k] = text.replace(";}", "}")
+    return "".join(parts).strip()
+
+def minify_html(html):
+    # Scripts and styles go through their own minifiers; <pre>/<textarea> stay as-is
+    pieces = re.split(r"(<(script|style|pre|textarea)\b[^>]*>.*?</\2>)", html, flags=re.S | re.I)
+    out = []
+    for k, piece in enumerate(pieces):
+        if k % 3 == 2:
+            continue   # captured tag name
+        if k % 3 == 1:
+            tag = pieces[k + 1].lower()
+            open_end = piece.index(">") + 1
+            close_start = piece.lower().rindex("</")
+            body = piece[open_end:close_start]
+            if tag == "script" and body.strip() and "src=" not in piece[:open_end]:
+                body = minify_js(body)
+            elif tag == "style":
+                body = minify_css(body)
+            out.append(piece[:open_end] + body + piece[close_start:])
+            continue
+        piece = re.sub(r"<!--(?!\[if).*?-->", "", piece, flags=re.S)
+        piece = re.sub(r"[ \t]*\n\s*", "\n", piece)
+        out.append(piece)
+    return "".join(out).strip() + "\n"
+
+# ---------------------------------------------------------------------------
+# Critical CSS: the rules a page can match on first paint are inlined in
+# <head>; the full stylesheet (hashed, immutable) loads without blocking.
+# A rule is critical when every class and id in one of its selectors
+# appears in the page markup; rules for classes added later by JS arrive
+# with the full stylesheet.
+# ---------------------------------------------------------------------------
+
+def split_css_blocks(css):
+    """ Yields (prelude, body) for each top-level block of minified CSS. """
+    i = 0
+    while i < len(css):
+        brace = css.find("{", i)
+        if brace == -1:
+            return
+        depth, j = 1, brace + 1
+        while j < len(css) and depth:
+            depth += {"{": 1, "}": -1}.get(css[j], 0)
+            j += 1
+        yield css[i:brace].strip(), css[brace + 1:j - 1]
+        i = j
+
+def critical_css(css, classes, ids):
+    out = []
+    for prelude, body in split_css_blocks(css):
+        if prelude.startswith("@media"):
+            inner = critical_css(body, classes, ids)
+            if inner:
+                out.append(f"{prelude}{{{inner}}}")
+        elif prelude.startswith("@"):
+            continue   # keyframes, font-face: not needed before first paint
+        else:
+            for selector in prelude.split(","):
+                needed_classes = set(re.findall(r"\.([\w-]+)", selector))
+                needed_ids = set(re.findall(r"#([\w-]+)", selector))
+                if needed_classes <= classes and needed_ids <= ids:
+                    out.append(f"{prelude}{{{body}}}")
+                    break
+    return "".join(out)
+
+def page_tokens(html):
+    classes = set()
+    for value in re.findall(r'class="([^"]*)"', html):
+        classes.update(value.split())
+    return classes, set(re.findall(r'id="([^"]*)"', html))
+
+def hashed_url(url, raw):
+    """ /css/style.css -> /css/style.1abec688.css """
+    stem, dot, ext = url.rpartition(".")
+    return f"{stem}.{hashlib.sha256(raw).hexdigest()[:8]}.{ext}"
+
+SCRIPT_RUN = re.compile(r'(?:[ \t]*<script src="(/js/[\w.-]+\.js)"></script>\s*)+')
+
+def build_pages(sources):
+    """
+    Returns {path: bytes} for everything that gets embedded, the manifest of
+    hashed URLs, and per-page before/after stats. Each run of consecutive
+    local <script src> tags becomes one bundle shared by every page that
+    loads the same scripts.
+    """
+    assets = {}
+    manifest = {}
+    stats = []
+
+    for path, raw in sources.items():
+        if path.endswith(".css"):
+            assets[path] = minify_css(raw.decode("utf-8")).encode("utf-8")
+        elif not path.endswith((".html", ".js")):
+            assets[path] = raw
+    for path, raw in assets.items():
+        manifest[path] = hashed_url(path, raw)
+
+    for path, raw in sources.items():
+        if not path.endswith(".html"):
+            continue
+        html = raw.decode("utf-8")
+        requests_before = len(re.findall(r'(?:href|src)="/(?:css|js)/', html))
+        bytes_before = len(gzip.compress(raw, 9)) + sum(
+            len(gzip.compress(sources[ref], 9)) for ref in re.findall(r'(?:href|src)="(/(?:css|js)/[^"]+)"', html)
+            if ref in sources)
+
+        def bundle(match):
+            refs = re.findall(r'src="([^"]+)"', match.group(0))
+            indent = re.match(r"[ \t]*", match.group(0)).group(0)
+            tags = []
+            # Consecutive existing files share a bundle; a missing file keeps its own tag
+            for missing, group in itertools.groupby(refs, key=lambda ref: ref not in sources):
+                group = list(group)
+                if missing:
+                    tags += [f'<script src="{ref}"></script>' for ref in group]
+                    continue
+                bundle_path = "/js/" + "-".join(Path(ref).stem for ref in group) + ".js"
+                if bundle_path not in assets:
+                    code = ";\n".join(sources[ref].decode("utf-8") for ref in group)
+                    assets[bundle_path] = minify_js(code).encode("utf-8")
+                    manifest[bundle_path] = hashed_url(bundle_path, assets[bundle_path])
+                tags.append(f'<script src="{manifest[bundle_path]}"></script>')
+            return "".join(f"{indent}{tag}\n" for tag in tags)
+        html = SCRIPT_RUN.sub(bundle, html)
+
+        def inline_critical(match):
+            sheet = match.group(1)
+            if sheet not in assets:
+                return match.group(0)
+            classes, ids = page_tokens(html)
+            critical = critical_css(assets[sheet].decode("utf-8"), classes, ids)
+            url = manifest[sheet]
+            return (f'<style>{critical}</style>'
+                    f'<link rel="preload" href="{url}" as="style" onload="this.onload=null;this.rel=\'stylesheet\'">'
+                    f'<noscript><link rel="stylesheet" href="{url}"></noscript>')
+        html = re.sub(r'<link rel="stylesheet" href="(/css/[^"]+)">', inline_critical, html)
+
+        for plain, hashed in manifest.items():
+            html = html.replace(f'="{plain}"', f'="{hashed}"')
+        assets[path] = minify_html(html).encode("utf-8")
+
+        # The deferred stylesheet still counts: it just no longer blocks rendering
+        refs = set(re.findall(r'(?:href|src)="(/(?:css|js)/[^"]+)"', html))
+        by_url = {v: k for k, v in manifest.items()}
+        bytes_after = len(gzip.compress(assets[path], 9)) + sum(
+            len(gzip.compress(assets[by_url[ref]], 9)) for ref in refs if ref in by_url)
+        stats.append((path, requests_before, len(refs), bytes_before, bytes_after))
+
+    return assets, manifest, stats
+
+def c_array(name, data):
+    lines = []
+    for i in range(0, len(data), 20):
+        lines.append("    " + ", ".join(f"0x{b:02x}" for b in data[i:i + 20]) + ",")
+    return f"static const uint8_t {name}[] PROGMEM = {{\n" + "\n".join(lines) + "\n};\n"
+
+def generate_asset_header(env):
+    """
+    Writes include/web_assets_data.h with the minified, bundled web_src pages
+    as gzip (and Brotli, when available) blobs in flash, so they are served
+    with beginResponse_P and never touch SPIFFS. Static assets get
+    content-hashed URLs (cacheable forever); the HTML references them through
+    the manifest, so a firmware update changes the page's ETag and the
+    browser picks up the new files.
+    Runs on every build; the header is only rewritten when its content changes.
+    """
+    src_dir = Path(env.subst("$PROJECT_DIR")) / "web_src"
+    header_path = Path(env.subst("$PROJECT_INCLUDE_DIR")) / "web_assets_data.h"
+    manifest_path = Path(env.subst("$BUILD_DIR")) / "web_assets_manifest.json"
+
+    if not src_dir.exists():
+        print(f"Warning: Source directory '{src_dir}' not found. Skipping asset embedding.")
+        return
+    if brotli is None:
+        print("Note: 'brotli' module not installed; embedding gzip variants only.")
+
+    files = sorted(p for p in src_dir.rglob("*") if p.is_file() and p.suffix in EMBED_TYPES)
+    sources = {"/" + p.relative_to(src_dir).as_posix(): p.read_bytes() for p in files}
+    assets, manifest, stats = build_pages(sources)
+
+    blobs = []
+    entries = []
+    for index, (path, raw) in enumerate(sorted(assets.items())):
+        content_type, compress = EMBED_TYPES[Path(path).suffix]
+
+        # mtime=0 keeps the output identical between builds
+        data = gzip.compress(raw, compresslevel=9, mtime=0) if compress else raw
+        etag = hashlib.sha256(raw).hexdigest()[:16]
+        url = manifest.get(path, path)
+        blobs.append(f"// {path} ({len(raw)} -> {len(data)} bytes)\n" + c_array(f"WEB_ASSET_{index}", data))
+
+        br_fields = "nullptr, 0, nullptr"
+        if compress and brotli is not None:
+            br = brotli.compress(raw, quality=11)
+            if len(br) < len(data):
+                blobs.append(f"// {path} brotli ({len(br)} bytes)\n" + c_array(f"WEB_ASSET_{index}_BR", br))
+                br_fields = f'WEB_ASSET_{index}_BR, {len(br)}, "\\"{etag}-br\\""'
+
+        entries.append(f'    {{ "{path}", "{url}", "{content_type}", WEB_ASSET_{index}, {len(data)}, '
+                       f'"\\"{etag}\\"", {"true" if compress else "false"}, {br_fields} }},')
+
+    header = ("// Generated by compress_data.py from web_src/ - do not edit\n"
+              "#pragma once\n\n"
+              "#include \"web_assets.h\"\n\n"
+              + "\n".join(blobs) +
+              "\nstatic const WebAsset WEB_ASSETS[] = {\n" + "\n".join(entries) + "\n};\n\n"
+              f"static const size_t WEB_ASSET_COUNT = {len(entries)};\n")
+
+    manifest_path.parent.mkdir(parents=True, exist_ok=True)
+    manifest_path.write_text(json.dumps(manifest, indent=2, sort_keys=True))
+
+    if header_path.exists() and header_path.read_text() == header:
+        print("✔ Skipping (up-to-date): web_assets_data.h")
+        return
+    header_path.write_text(header)
+    print(f"📦 Embedded {len(entries)} web assets → {header_path.name}")
+    for page, req_before, req_after, bytes_before, bytes_after in stats:
+        print(f"   {page}: {req_before} → {req_after} asset requests, "
+              f"{bytes_before} → {bytes_after} gzip bytes")
+
 # --- PlatformIO Integration ---
+# The firmware embeds the assets on every build; SPIFFS keeps a copy as fallback.
+generate_asset_header(env) # type: ignore
 # This hook ties our function to the filesystem build process.
 env.AddPreAction("$BUILD_DIR/spiffs.bin", compress_web_assets) # type: ignore
\ No newline at end of file
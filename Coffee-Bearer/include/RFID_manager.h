@@ -10,6 +10,8 @@ Leitura e processamento de tags RFID
 #include <Arduino.h>
 #include <SPI.h>
 #include <MFRC522.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
 #include "config.h"
 #include "user_manager.h"
 #include "coffee_controller.h"
@@ -24,6 +26,7 @@ enum RFIDResult {
     RFID_SYSTEM_BUSY,
     RFID_NO_COFFEE,
     RFID_MASTER_KEY,
+    RFID_QUEUED,
     RFID_ERROR
 };
 
@@ -32,6 +35,22 @@ enum ScanMode {
     SCAN_FOR_ADD
 };
 
+// Contadores do leitor (desde o boot)
+struct RFIDStats {
+    uint32_t reads;             // Seriais lidos com sucesso
+    uint32_t readErrors;        // Cartão presente mas serial ilegível
+    uint32_t duplicates;        // Mesmo cartão dentro da janela anti-repetição
+    uint32_t results[RFID_ERROR + 1];   // Indexado por RFIDResult
+    uint64_t readTimeUs;        // Soma do tempo de PICC_ReadCardSerial
+    uint32_t maxReadTimeUs;
+    uint32_t taps;              // Leituras que acionaram o relé
+    uint64_t tapLatencyUs;      // Soma do tempo entre detectar o cartão e ligar o relé
+    uint32_t maxTapLatencyUs;
+    uint32_t lateTaps;          // Acima de TAP_LATENCY_BUDGET_US
+    uint32_t polls;             // REQA enviados (IRQ) ou PICC_IsNewCardPresent (varredura)
+    uint32_t irqWakeups;        // Respostas de cartão sinalizadas pelo pino IRQ
+};
+
 struct RFIDEvent {
     String uid;
     String userName;
@@ -47,6 +66,16 @@ private:
     unsigned long lastReadTime;
     unsigned long cooldownEndTime;
     bool initialized;
+
+    // Detecção: REQA sem espera + IRQ do MFRC522, ou varredura com intervalo adaptativo
+    bool irqEnabled;
+    uint32_t pollInterval;
+    unsigned long lastActivity;
+    int64_t detectedAt;         // esp_timer (µs) da detecção do cartão corrente
+    static volatile bool irqFired;
+    static volatile int64_t irqAt;
+    static TaskHandle_t irqTask;
+    static void IRAM_ATTR onCardIrq();
     
     // Referências para outros managers
     UserManager& userManager;
@@ -54,13 +83,19 @@ private:
     FeedbackManager& feedbackManager;
     Logger& logger;
     ScanMode currentMode;
+    RFIDStats stats;
     
     String readUID();
     bool isInCooldown();
     void startCooldown();
+    void setupCardIrq();
+    void armCardDetect();
+    bool cardDetected();
+    void processCard();
     RFIDResult processNormalUser(const String& uid);
     void processMasterKey();
     void handleRFIDResult(const String& uid, const String& userName, RFIDResult result);
+    void recordTapLatency(int64_t tappedAt);
     
 public:
     RFIDManager(UserManager& users, CoffeeController& coffee, Logger& log, FeedbackManager& feedback);
@@ -71,8 +106,10 @@ public:
     void end();
     void setManagers(UserManager* users, CoffeeController* coffee, Logger* log);
     
-    // Loop principal (deve ser chamado no loop principal)
-    void loop();
+    // Varredura do leitor (chamada pela tarefa RFID/relé); retorna em quantos ms chamar de novo
+    uint32_t loop();
+    // Dorme até o prazo ou até o IRQ de um cartão
+    void waitForCard(uint32_t waitMs);
     
     // Configurações
     void setCooldownTime(unsigned long timeMs);
@@ -83,6 +120,9 @@ public:
     String getLastUID() { return lastUID; }
     unsigned long getLastReadTime() { return lastReadTime; }
     unsigned long getRemainingCooldown();
+    const RFIDStats& getStats() { return stats; }
+    uint32_t getPollInterval() { return pollInterval; }
+    bool isIrqEnabled() { return irqEnabled; }
     
     // Utilitários
     bool testRFID();
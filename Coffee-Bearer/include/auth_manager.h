@@ -4,7 +4,11 @@
 #include <Arduino.h>
 #include <vector>
 #include <ESPAsyncWebServer.h>
+#include <mbedtls/md.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
 #include "config.h"
+#include "maintenance_scheduler.h"
 
 enum UserRole {
     ROLE_GUEST = 0,
@@ -12,44 +16,180 @@ enum UserRole {
     ROLE_ADMIN = 2
 };
 
+struct SessionToken {
+    uint8_t bytes[SESSION_TOKEN_BYTES];
+};
+
+// Senha derivada (iterations == 0: SHA-256 legado sem salt, migrado no próximo login)
+struct PasswordRecord {
+    uint32_t iterations;
+    uint8_t salt[AUTH_PASSWORD_SALT_BYTES];
+    uint8_t hash[AUTH_PASSWORD_HASH_BYTES];
+};
+
+// Conta web gravada como registro de tamanho fixo; o índice do slot é o ID da conta
+struct AuthAccount {
+    char username[AUTH_USERNAME_MAX + 1];         // "" = slot livre
+    char rfidUid[AUTH_ACCOUNT_UID_MAX + 1];       // Cartão vinculado ("" = nenhum)
+    uint8_t role;                                 // UserRole
+    uint32_t minTokenId;                          // Tokens anteriores estão revogados
+    PasswordRecord password;
+};
+
 struct AuthSession {
-    String sessionId;
-    String username;
+    SessionToken token;
+    char username[AUTH_USERNAME_MAX + 1];
     UserRole role;
     unsigned long createdAt;
     unsigned long lastAccess;
-    String ipAddress;
+    uint32_t ipAddress;
     bool isActive;
 };
 
 struct LoginAttempt {
-    String ipAddress;
-    unsigned long timestamp;
-    int attemptCount;
-    unsigned long lockoutUntil;
+    uint32_t ipAddress;
+    uint8_t attemptCount;
+    unsigned long updatedAt;       // Referência do decaimento do contador
+    unsigned long lockoutUntil;    // 0 quando não bloqueado
+};
+
+// Contadores de ataque (desde o boot)
+struct LoginSecurityStats {
+    uint32_t failedLogins;
+    uint32_t lockouts;
+    uint32_t blockedAttempts;
+    uint32_t evictions;
+    uint8_t trackedIps;
+    uint8_t lockedIps;
 };
 
 class AuthManager {
 private:
-    // Use std::vector instead of unordered_map to avoid hash issues
-    std::vector<std::pair<String, String>> adminCredentials;
-    std::vector<std::pair<String, String>> userCredentials;
-    std::vector<AuthSession> activeSessions;
-    std::vector<LoginAttempt> loginAttempts;
+    // Contas web: slots estáveis e índice hash (endereçamento aberto) nome -> slot
+    std::vector<AuthAccount> accounts;
+    std::vector<int16_t> accountIndex;
+
+    // Tentativas de login: pool fixo, buckets pelo hash do IP e lista LRU
+    struct AttemptSlot {
+        LoginAttempt attempt;
+        int8_t next;
+        int8_t lruPrev;
+        int8_t lruNext;
+        bool used;
+    };
+    AttemptSlot attemptSlots[LOGIN_ATTEMPT_SLOTS];
+    int8_t attemptBuckets[LOGIN_ATTEMPT_BUCKETS];
+    int8_t attemptFreeHead;
+    int8_t attemptLruHead;    // Mais recente
+    int8_t attemptLruTail;    // Menos recente
+    uint8_t attemptCount;
+    LoginSecurityStats securityStats;
+
+    // Tabela de sessões: pool fixo, buckets encadeados pelo hash do token
+    // e um min-heap de expiração (chave <= expiração real, atualizada sob demanda)
+    struct SessionSlot {
+        AuthSession session;
+        unsigned long expiresAt;
+        unsigned long heapKey;
+        int8_t next;
+        uint8_t heapPos;
+    };
+    SessionSlot sessionSlots[MAX_ACTIVE_SESSIONS];
+    int8_t sessionBuckets[SESSION_HASH_BUCKETS];
+    int8_t freeSlotHead;
+    uint8_t expiryHeap[MAX_ACTIVE_SESSIONS];
+    uint8_t sessionCount;
+
+    // Tokens sem estado: contexto HMAC com a chave já carregada, IDs
+    // sequenciais e um bitmap de revogação dos últimos AUTH_REVOCATION_BITS
+    mbedtls_md_context_t tokenHmac;
+    bool tokenKeyReady;
+    uint32_t nextTokenId;
+    uint32_t reservedTokenId;
+    uint8_t revokedTokens[AUTH_REVOCATION_BITS / 8];
+
+    // Renovação deslizante, emitida só ao montar a resposta: cada token de
+    // origem guarda o seu substituto, reenviado às requisições que ainda
+    // chegarem com o antigo (sem gastar um ID novo a cada uma)
+    struct TokenRefresh {
+        uint32_t fromId;
+        uint32_t fromExpiresAt;     // Epoch; entrada livre depois disso
+        uint32_t toId;
+        String token;
+    };
+    TokenRefresh refreshes[AUTH_REFRESH_SLOTS];
+
+    // Contexto HMAC reutilizado pelo PBKDF2 (evita setup/free a cada login)
+    mbedtls_md_context_t passwordHmac;
+    bool passwordHmacReady;
+
+    // Contas, sessões, tentativas e tokens são usados pelas tarefas async_tcp,
+    // RFID, loop e manutenção. Recursivo porque métodos públicos chamam uns
+    // aos outros; consultas devolvem cópias, nunca ponteiros para as tabelas
+    SemaphoreHandle_t lock;
+    void acquire();
+    void release();
+    friend class AuthLock;
 
     // Private methods
-    String generateSessionId();
-    String hashPassword(const String& password);
-    bool verifyPassword(const String& password, const String& hash);
+    void generateSessionToken(SessionToken& token);
+    bool derivePassword(const String& password, const uint8_t* salt, uint32_t iterations, uint8_t* out);
+    bool createPasswordRecord(const String& password, PasswordRecord& record);
+    bool verifyPassword(const String& password, const PasswordRecord& record);
+
+    // Contas
+    bool loadAccounts();
+    bool saveAccounts();
+    void migrateLegacyCredentials();
+    static uint32_t hashUsername(const char* username);
+    void rebuildAccountIndex();
+    void accountIndexInsert(int slot);
+    int findAccountSlot(const String& username);
+    const AuthAccount* accountAt(size_t slot);
+    int allocateAccountSlot();
+    int countAdmins();
+    void trimFreeSlots();
     void cleanupExpiredSessions();
+    void resetSessionTable();
+    int findSessionSlot(const SessionToken& token);
+    int acquireSessionSlot(const SessionToken& token);
+    void releaseSessionSlot(int slot);
+    bool touchSession(const SessionToken& token, AuthSession& out);
+    bool heapLess(uint8_t a, uint8_t b);
+    void heapSwap(uint8_t a, uint8_t b);
+    void heapSiftUp(uint8_t pos);
+    void heapSiftDown(uint8_t pos);
+    void heapRemove(uint8_t pos);
+    static bool tokensEqual(const SessionToken& a, const SessionToken& b);
+    static bool parseSessionToken(const char* hex, size_t len, SessionToken& token);
+    static String sessionTokenToString(const SessionToken& token);
+    static bool hexToBytes(const char* hex, size_t len, uint8_t* out);
+    static String bytesToHex(const uint8_t* data, size_t len);
+    bool sessionValueFromRequest(AsyncWebServerRequest *req, const char*& value, size_t& len);
+    bool resolveSession(const char* value, size_t len, AuthSession& out);
+
+    // Tokens sem estado
+    bool loadTokenKey();
+    bool statelessAvailable();
+    String issueStatelessToken(int accountId, uint32_t* tokenIdOut = nullptr);
+    bool validateStatelessToken(const char* hex, size_t len, AuthSession& out,
+                                uint32_t* tokenIdOut = nullptr, uint32_t* expiresAtOut = nullptr);
+    void computeTokenMac(const uint8_t* payload, uint8_t* mac);
+    uint32_t allocateTokenId();
+    void revokeStatelessToken(uint32_t tokenId);
+    bool revokeAccountTokens(int accountId);
+    void saveTokenState();
+
     void cleanupOldAttempts();
-    LoginAttempt* findLoginAttempt(const String& ip);
-    
-    // Helper methods to find credentials
-    String findAdminPassword(const String& username);
-    String findUserPassword(const String& username);
-    bool hasAdminCredentials(const String& username);
-    bool hasUserCredentials(const String& username);
+    void resetAttemptTable();
+    static int attemptBucket(uint32_t ip);
+    int findAttemptSlot(uint32_t ip);
+    int acquireAttemptSlot(uint32_t ip);
+    void releaseAttemptSlot(int slot);
+    void lruUnlink(int slot);
+    void lruPushFront(int slot);
+    bool decayAttempt(LoginAttempt& attempt, unsigned long now);
+    LoginAttempt* findLoginAttempt(uint32_t ip);
 
 public:
     AuthManager();
@@ -57,22 +197,37 @@ public:
     bool begin();
     void resetToDefault();
     
-    // Credential management
-    bool setAdminCredentials(const String& username, const String& password);
-    bool setUserCredentials(const String& username, const String& password);
+    // Contas web
+    bool addAccount(const String& username, const String& password, UserRole role, const String& rfidUid = "");
+    bool updateAccount(const String& username, const String& password, UserRole role, const String& rfidUid);
+    bool removeAccount(const String& username);
     bool changePassword(const String& username, const String& oldPassword, const String& newPassword);
+    bool findAccount(const String& username, AuthAccount& out);
+    bool getAccountAt(size_t slot, AuthAccount& out);
+    size_t getAccountSlotCount() { return accounts.size(); }
+    int getAccountCount();
+    static bool isValidUsername(const String& username);
+    static bool normalizeCardUid(const String& uid, char* out);
+    
+    // Backup/Restore (exporta apenas salt e hash em hex, nunca a senha)
+    static String encodePasswordRecord(const PasswordRecord& record);
+    static bool decodePasswordRecord(const String& hex, PasswordRecord& record);
+    int restoreAccounts(const std::vector<AuthAccount>& restored);
     
     // Authentication
-    String login(const String& username, const String& password, const String& ipAddress);
+    String login(const String& username, const String& password, uint32_t ipAddress);
     bool logout(const String& sessionId);
     bool isValidSession(const String& sessionId);
-    AuthSession* getSession(const String& sessionId);
+    bool getSession(const String& sessionId, AuthSession& out);
     UserRole getSessionRole(const String& sessionId);
     
     // Security
-    bool isIpBlocked(const String& ipAddress);
-    void recordFailedLogin(const String& ipAddress);
-    unsigned long getBlockTimeRemaining(const String& ipAddress);
+    bool isIpBlocked(uint32_t ipAddress);
+    void recordFailedLogin(uint32_t ipAddress);
+    void clearFailedLogins(uint32_t ipAddress);
+    unsigned long getBlockTimeRemaining(uint32_t ipAddress);
+    LoginSecurityStats getSecurityStats();
+    std::vector<LoginAttempt> getLoginAttempts();
     
     // Session management
     void updateSessionAccess(const String& sessionId);
@@ -93,10 +248,13 @@ public:
     // Web server integration
     String getSessionIdFromRequest(AsyncWebServerRequest *req);
     bool isAuthenticated(AsyncWebServerRequest *req, UserRole minimumRole = ROLE_USER);
+    bool getSessionFromRequest(AsyncWebServerRequest *req, AuthSession& out);
+    String refreshedCookieFor(AsyncWebServerRequest *req);
     String getUserRoleFromRequest(AsyncWebServerRequest *req);
+    bool hasMetricsToken(AsyncWebServerRequest *req);
     
-    // Maintenance
-    void maintenance();
+    // Maintenance jobs (expired sessions, stale login attempts)
+    void registerJobs(MaintenanceScheduler& scheduler);
 };
 
 #endif
\ No newline at end of file
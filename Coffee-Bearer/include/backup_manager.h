@@ -0,0 +1,70 @@
+/*
+==================================================
+GERENCIADOR DE BACKUP
+Exportação e restauração em streaming (NDJSON)
+==================================================
+*/
+
+#pragma once
+
+#include <Arduino.h>
+#include <vector>
+#include "config.h"
+#include "user_manager.h"
+#include "coffee_controller.h"
+#include "auth_manager.h"
+
+// Estado de uma exportação em andamento (uma linha em memória por vez)
+struct BackupExportCursor {
+    uint8_t stage;
+    size_t index;
+    char line[BACKUP_LINE_MAX];
+    size_t lineLength;
+    size_t linePosition;
+};
+
+class BackupManager {
+private:
+    UserManager& userManager;
+    CoffeeController& coffeeController;
+    AuthManager& authManager;
+
+    // Estado da restauração (apenas uma por vez)
+    const void* restoreOwner;
+    unsigned long restoreLastActivity;
+    char restoreLine[BACKUP_LINE_MAX];
+    size_t restoreLineLength;
+    int restoreLineNumber;
+    bool restoreFailed;
+    bool restoreHeaderSeen;
+    bool restoreEndSeen;
+    String restoreError;
+
+    // Dados preparados, aplicados somente ao final
+    std::vector<UserCredits> stagedUsers;
+    UIDSet stagedUids;
+    unsigned long stagedLastReset;
+    int stagedDuplicates;
+    bool stagedHasCoffee;
+    CoffeeStats stagedCoffee;
+    std::vector<AuthAccount> stagedAccounts;
+
+    bool nextExportLine(BackupExportCursor& cursor);
+    void processRestoreLine();
+    void failRestore(const String& message);
+    void resetRestoreState();
+
+public:
+    BackupManager(UserManager& users, CoffeeController& coffee, AuthManager& auth);
+
+    // Exportação: preenche o buffer e retorna 0 quando terminar
+    void beginExport(BackupExportCursor& cursor);
+    size_t fillExport(BackupExportCursor& cursor, uint8_t* buffer, size_t maxLen);
+
+    // Restauração incremental
+    bool beginRestore(const void* owner);
+    bool isRestoreOwner(const void* owner);
+    void feedRestore(const uint8_t* data, size_t len);
+    bool finishRestore(const void* owner, bool overwriteUsers, bool restoreSettings, String& message);
+    void abortRestore(const void* owner);
+};
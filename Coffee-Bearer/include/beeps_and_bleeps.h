@@ -4,6 +4,9 @@
 
 #include <Arduino.h>
 #include <FastLED.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/queue.h>
+#include <freertos/task.h>
 #include "config.h"
 
 #define FASTLED_ESP32_RMT_CHAN_OVERRIDE 0
@@ -15,7 +18,9 @@ public:
 
     // --- Core Methods ---
     bool begin();
-    void update(); // Must be called in the main loop
+    // Must be called periodically by the feedback task. Commands sent from
+    // other tasks are queued and applied here; `wait` blocks until one arrives.
+    void update(TickType_t wait = 0);
     void setBrightness(uint8_t brightness);
 
     // --- Continuous Status Indicators ---
@@ -31,12 +36,28 @@ public:
     void signalSuccess();
     void signalError();
     void signalServing();
+    void signalQueued();
     void signalRefill();
     void signalMasterKey();
     void signalUnknownUser();
     void signalNoCredits();
 
+    uint32_t getDroppedCommands() { return droppedCommands; }
+
 private:
+    // --- Cross-task command queue ---
+    enum FeedbackCommand : uint8_t {
+        FB_STATUS_READY, FB_STATUS_BUSY, FB_STATUS_LOW, FB_STATUS_EMPTY, FB_STATUS_ERROR,
+        FB_STATUS_INITIALIZING, FB_TURN_OFF,
+        FB_SIGNAL_SUCCESS, FB_SIGNAL_ERROR, FB_SIGNAL_SERVING, FB_SIGNAL_QUEUED, FB_SIGNAL_REFILL, FB_SIGNAL_NO_CREDITS
+    };
+    QueueHandle_t commandQueue;
+    TaskHandle_t ownerTask;     // Task that last ran update(); its calls apply immediately
+    uint32_t droppedCommands;
+
+    bool defer(FeedbackCommand command);
+    void apply(FeedbackCommand command);
+
 // --- LED Members ---
     CRGB leds[NEOPIXEL_COUNT];
     enum LedState { LED_STATIC, LED_ANIMATING };
@@ -8,8 +8,15 @@ Gerencia o preparo e controle de café
 #pragma once
 
 #include <Arduino.h>
+#include <esp_timer.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/semphr.h>
 #include "config.h"
 #include "beeps_and_bleeps.h"
+#include "maintenance_scheduler.h"
+#include "coffee_ledger.h"
+#include "user_manager.h"
 
 enum CoffeeStatus {
     COFFEE_READY,
@@ -22,39 +29,117 @@ struct CoffeeStats {
     int totalServed;
     int remainingCoffees;
     unsigned long totalServeTime;
-    unsigned long lastServed;
+    unsigned long lastServed;       // Epoch do último café (0 = desconhecido)
     int dailyCount;
-    unsigned long dailyResetTime;
+};
+
+// Resultado de um pedido de café
+enum ServeRequestResult : uint8_t {
+    SERVE_STARTED,          // Relé ligado na hora
+    SERVE_QUEUED,
+    SERVE_ALREADY_QUEUED,   // Cartão já na fila (ou sendo servido): mantém a posição
+    SERVE_QUEUE_FULL,
+    SERVE_NO_COFFEE,        // Garrafa sem café para mais um pedido
+    SERVE_NO_CREDITS
+};
+
+struct ServeTicket {
+    ServeRequestResult result;
+    uint32_t ticket;        // 0 quando o pedido foi recusado
+    uint8_t position;       // 0 = servindo; 1 = próximo da fila
+};
+
+// Pedido na fila; o crédito do cartão já foi descontado na entrada
+struct ServeRequest {
+    uint32_t ticket;
+    ServeSource source;
+    PackedUID uid;          // len 0 = sem cartão (web/serial)
+    char requestedBy[AUTH_USERNAME_MAX + 1];   // Conta web que pediu ("" fora da web)
+    bool creditReserved;
+    int64_t queuedAt;       // esp_timer (µs)
+};
+
+// Destino dos pedidos (desde o boot)
+struct ServeQueueStats {
+    uint32_t queued;        // Pedidos que esperaram na fila
+    uint32_t started;       // Serviços iniciados (direto ou da fila)
+    uint32_t cancelled;
+    uint32_t timedOut;
+    uint32_t rejected;      // Fila cheia ou garrafa comprometida
+    uint32_t repeatTaps;    // Toques de quem já estava na fila
+    uint8_t maxDepth;
+};
+
+// Precisão do desligamento do relé (tempo medido x configurado)
+struct RelayStats {
+    uint32_t pours;
+    uint64_t onTimeUs;          // Soma dos tempos de relé ligado
+    uint32_t lastOnTimeUs;
+    uint32_t maxOverrunUs;      // Maior atraso em relação ao tempo configurado
+    uint32_t fallbackStops;     // Desligamentos feitos pela tarefa (timer indisponível)
 };
 
 class CoffeeController {
 private:
     FeedbackManager& feedbackManager;
+    UserManager& userManager;
+    CoffeeLedger ledger;    // Contadores e estatísticas derivam dos eventos
     bool systemBusy;
     int remainingCoffees;
-    int totalServed;
-    unsigned long totalServeTime;
-    unsigned long lastServed;
-    int dailyCount;
-    unsigned long dailyResetTime;
     unsigned long lastSave;
     bool dataChanged;
-    unsigned long coffeeServeEndTime;
+    uint32_t stateVersion;  // Incrementado a cada alteração (cache do /api/status)
+    int64_t relayOnTime;    // esp_timer (µs) do último acionamento do relé
+    int64_t serveDurationUs;
+    esp_timer_handle_t relayTimer;
+    volatile int64_t relayOffTime;
+    volatile bool relayOffPending;  // Relé já desligado; falta a contabilidade
+    TaskHandle_t relayTask;         // Tarefa acordada pelo timer (RFID/relé)
+    RelayStats relayStats;
+
+    // O callback do timer e a tarefa do relé disputam o desligamento: cada
+    // serviço tem uma geração, e as transições do relé acontecem em relayMux
+    portMUX_TYPE relayMux = portMUX_INITIALIZER_UNLOCKED;
+    uint32_t serveGeneration;
+    uint32_t armedGeneration;       // Serviço com o timer armado (0 = nenhum)
+
+    // Fila FIFO: web, serial e a tarefa RFID entram; a tarefa do relé drena
+    ServeRequest queue[SERVE_QUEUE_MAX];
+    uint8_t queueCount;
+    uint32_t nextTicket;
+    uint32_t servingTicket;         // 0 sem serviço em andamento
+    int64_t nextStartAt;            // esp_timer (µs): fim do intervalo entre serviços
+    uint32_t queueVersion;
+    ServeQueueStats queueStats;
+    SemaphoreHandle_t lock;         // Fila, garrafa e transições de systemBusy
+    ServeSource serveSource;  // Origem e usuário do serviço em andamento
+    PackedUID serveUid;
+    bool serveCreditReserved; // Crédito cobrado na fila (devolvido se o serviço for interrompido)
     
+    void markChanged() { dataChanged = true; stateVersion++; }
     void saveToPreferences();
     void loadFromPreferences();
-    void checkDailyReset();
+    bool switchRelayOff(uint32_t generation);
+    void finishServe(bool completed = true);
+    void startNext();
+    void dropRequest(uint8_t index);
+    void expireRequests();
+    void acquire();
+    void release();
+    static void onRelayTimer(void* arg);
     
 public:
-    CoffeeController(FeedbackManager& feedback);
+    CoffeeController(FeedbackManager& feedback, UserManager& users);
 
     // Inicialização
     bool begin();
     void clearAllData();
     
     // Controle principal
-    bool serveCoffee(const String& userName, int* userCredits);
-    void refillContainer();
+    // Serve na hora se livre; senão entra na fila (crédito do cartão reservado)
+    ServeTicket requestServe(ServeSource source, const String& uid = "", const char* requestedBy = nullptr);
+    bool cancelServe(uint32_t ticket);
+    void refillContainer(ServeSource source);
     void emergencyStop();
     
     // Status
@@ -65,11 +150,26 @@ public:
     
     // Getters
     int getRemainingCoffees() { return remainingCoffees; }
-    int getTotalServed() { return totalServed; }
-    int getDailyCount() { return dailyCount; }
-    unsigned long getLastServedTime() { return lastServed; }
-    unsigned long getTotalServeTime() { return totalServeTime; }
+    int getTotalServed() { return ledger.getTotals().served; }
+    int getDailyCount() { return ledger.getServedToday(); }
+    unsigned long getLastServedTime() { return ledger.getTotals().lastServedAt; }
+    unsigned long getTotalServeTime() { return ledger.getTotals().serveTimeMs; }
+    unsigned long getServeTimeRemaining();
+    // Em quantos ms updateRelay() tem trabalho (reserva do relé, fila, timeout)
+    uint32_t getRelayWait();
+    uint32_t getStateVersion() { return stateVersion; }
+    int64_t getRelayOnTime() { return relayOnTime; }
+    RelayStats getRelayStats() { return relayStats; }
     float getAverageServeTime();
+    CoffeeLedger& getLedger() { return ledger; }
+    
+    // Fila
+    uint8_t getQueueLength() { return queueCount; }
+    uint8_t getQueue(ServeRequest* out, uint8_t max);
+    uint32_t getServingTicket() { return servingTicket; }
+    uint32_t getQueueVersion() { return queueVersion; }
+    ServeQueueStats getQueueStats() { return queueStats; }
+    static const char* serveResultName(ServeRequestResult result);
     
     // Setters
     void setRemainingCoffees(int count);
@@ -77,13 +177,17 @@ public:
     
     // Estatísticas
     CoffeeStats getStats();
+    void restoreStats(const CoffeeStats& stats);
     void printStats();
-    void resetDailyStats();
     
     // Configurações
     void setServeTime(unsigned long timeMs);
     unsigned long getServeTime();
     
-    // Manutenção (deve ser chamado periodicamente)
-    void maintenance();
+    // Fim do serviço: o timer desliga o relé; aqui (tarefa RFID/relé) ficam
+    // a contabilidade, o desligamento de reserva e a drenagem da fila
+    void updateRelay();
+
+    // Jobs de manutenção (gravação na NVS e do ledger)
+    void registerJobs(MaintenanceScheduler& scheduler);
 };
\ No newline at end of file
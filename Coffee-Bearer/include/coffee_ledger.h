@@ -0,0 +1,114 @@
+/*
+==================================================
+LEDGER DE CAFÉ
+Eventos de serviço só acrescentados; contadores e
+agregados diários derivados incrementalmente
+==================================================
+*/
+
+#pragma once
+
+#include <Arduino.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include "config.h"
+#include "user_manager.h"
+#include "maintenance_scheduler.h"
+#include "stats_rollups.h"
+
+enum LedgerEventType : uint8_t {
+    LEDGER_SERVE,
+    LEDGER_REFILL
+};
+
+enum ServeSource : uint8_t {
+    SERVE_SOURCE_RFID,
+    SERVE_SOURCE_WEB,
+    SERVE_SOURCE_SERIAL,
+    SERVE_SOURCE_COUNT
+};
+
+#define LEDGER_NO_USER 0xFF
+
+// Registro gravado no anel do arquivo
+struct LedgerEvent {
+    uint32_t timestamp;     // Epoch (s); 0 se o relógio ainda não sincronizou
+    uint16_t durationMs;    // Tempo real de relé ligado (serviços)
+    uint8_t type;           // LedgerEventType
+    uint8_t source;         // ServeSource
+    uint8_t user;           // Índice no dicionário de UIDs; LEDGER_NO_USER sem cartão
+};
+
+// Contadores derivados dos eventos (persistidos no cabeçalho do arquivo,
+// pois o anel descarta os eventos mais antigos)
+struct LedgerTotals {
+    uint32_t sequence;      // Eventos acrescentados desde sempre
+    uint32_t served;
+    uint32_t refills;
+    uint32_t serveTimeMs;
+    uint32_t lastServedAt;  // Epoch do último serviço com relógio válido
+    uint32_t bySource[SERVE_SOURCE_COUNT];
+};
+
+// Entrada do dicionário: os eventos guardam só o índice; o UID fica aqui,
+// estável mesmo quando a tabela de usuários é compactada
+struct LedgerUser {
+    PackedUID uid;
+    uint32_t served;
+    uint32_t lastSeen;      // sequence do último evento do usuário
+};
+
+class CoffeeLedger {
+private:
+    LedgerTotals totals;
+    LedgerUser users[LEDGER_MAX_USERS];
+    uint8_t userCount;
+    StatsRollups rollups;   // Por hora/dia/semana, derivados dos mesmos eventos
+
+    // Eventos ainda não gravados: append() roda na tarefa do relé e não espera
+    // o SPIFFS (fila cheia descarta o evento). Saem da fila só depois de gravados
+    LedgerEvent pending[LEDGER_PENDING_MAX];
+    uint8_t pendingCount;
+    uint32_t droppedEvents;
+    uint32_t revision;      // Alterações no estado; diferente de savedRevision = a regravar
+    uint32_t savedRevision;
+
+    MaintenanceScheduler* scheduler;
+    JobId flushJob;
+    SemaphoreHandle_t lock;
+    SemaphoreHandle_t fileLock;   // Uma gravação do arquivo por vez (antes de lock)
+
+    void append(LedgerEvent& event, const PackedUID* uid);
+    void apply(const LedgerEvent& event);
+    uint8_t userSlot(const PackedUID& uid);
+    bool flush();
+    bool load();
+    void resetState();
+    void acquire();
+    void release();
+
+public:
+    CoffeeLedger();
+
+    bool begin();
+    void clear();
+
+    // Acrescenta eventos (qualquer tarefa); a gravação vai para o job ledger.flush
+    void recordServe(ServeSource source, const PackedUID* uid, uint32_t durationMs);
+    void recordRefill(ServeSource source);
+
+    // Leituras derivadas
+    LedgerTotals getTotals();
+    uint32_t getServedToday();
+    uint32_t getServedLastDays(uint8_t count);
+    StatsRollups& getRollups() { return rollups; }
+    uint8_t getTopUsers(LedgerUser* out, uint8_t count);
+    uint32_t getDroppedEvents() { return droppedEvents; }
+
+    // Restauração de backup: substitui os contadores acumulados
+    void restoreTotals(uint32_t served, uint32_t serveTimeMs);
+
+    static const char* sourceName(uint8_t source);
+
+    void registerJobs(MaintenanceScheduler& scheduler);
+};
@@ -22,6 +22,9 @@ CONFIGURAÇÕES CENTRALIZADAS DO SISTEMA
 #ifndef RFID_SS_PIN
 #define RFID_SS_PIN 5
 #endif
+#ifndef RFID_IRQ_PIN
+#define RFID_IRQ_PIN -1   // Pino IRQ do MFRC522; -1 = não ligado (só varredura)
+#endif
 #ifndef BUZZER_PIN
 #define BUZZER_PIN 15
 #endif
@@ -67,13 +70,70 @@ CONFIGURAÇÕES CENTRALIZADAS DO SISTEMA
 #define MAX_COFFEES 10
 #define INITIAL_CREDITS 10
 #define COFFEE_SERVE_TIME_MS 8000
+#define RELAY_FALLBACK_GRACE_MS 250   // Sem o timer do relé, a tarefa RFID desliga após este atraso
 #define COOLDOWN_TIME_MS 3000
+#define USER_UID_MAX_BYTES 10      // UID mais longo do MFRC522 (cartões de tamanho triplo)
+
+// Operações em lote de usuários (/api/users/batch), lidas em streaming
+#define USER_BATCH_MAX_OPS 1000
+#define USER_BATCH_MAX_BODY (160UL * 1024UL)   // Corpo inteiro (~110 bytes por operação)
+#define USER_BATCH_OP_MAX 256                  // Texto de um único objeto de operação
+#define USER_BATCH_NAME_ARENA 32768            // Soma dos nomes de um lote
+#define USER_BATCH_TIMEOUT_MS (30UL * 1000UL)  // Lote abandonado (cliente caiu)
+
+// Benchmark de varredura (comando serial "bench scan"): duas cópias da tabela
+#define USER_BENCH_MAX_USERS 2000
+#define USER_BENCH_BYTES_PER_USER 160
+#define USER_BENCH_HEAP_RESERVE 32768
 
 // Timings
 #define WEEKLY_RESET_INTERVAL_MS (7UL * 24UL * 60UL * 60UL * 1000UL)  // 7 dias
-#define WEEKLY_RESET_CHECK_INTERVAL (60UL * 60UL * 1000UL)            // 1 hora
 #define DATA_SAVE_INTERVAL_MS (5UL * 60UL * 1000UL)                   // 5 minutos
 
+// ============== FILA DE SERVIÇO ==============
+// Toques e pedidos durante um preparo esperam a vez
+#define SERVE_QUEUE_MAX 8
+#define SERVE_QUEUE_TIMEOUT_MS 120000UL   // Pedido que não começou nesse prazo sai da fila (crédito devolvido)
+
+// ============== TAREFAS FREERTOS ==============
+// Core 1 (APP): leitura RFID/relé e animações; core 0 (PRO, junto do WiFi e
+// do async_tcp): gravações e manutenção. O loop() do Arduino (core 1,
+// prioridade 1) fica com serial, WiFi, NTP e reset semanal.
+#define RFID_TASK_NAME "rfid"
+#define RFID_TASK_CORE 1
+#define RFID_TASK_PRIORITY 5
+#define RFID_TASK_STACK 4096
+#define RFID_POLL_MIN_MS 20                        // Intervalo logo após um cartão
+#define RFID_POLL_MAX_MS 200                       // Teto do intervalo com o leitor ocioso
+#define RFID_POLL_IDLE_MS 10000UL                  // Sem cartões por esse tempo, o intervalo dobra a cada rodada
+
+#define FEEDBACK_TASK_NAME "feedback"
+#define FEEDBACK_TASK_CORE 1
+#define FEEDBACK_TASK_PRIORITY 3
+#define FEEDBACK_TASK_STACK 3072
+#define FEEDBACK_TASK_PERIOD_MS 10                 // Passo das animações de LED e buzzer
+#define FEEDBACK_QUEUE_LENGTH 16                   // Comandos de LED/buzzer vindos de outras tarefas
+
+#define MAINTENANCE_TASK_NAME "maintenance"
+#define MAINTENANCE_TASK_CORE 0
+#define MAINTENANCE_TASK_PRIORITY 2
+#define MAINTENANCE_TASK_STACK 6144
+
+#define HOUSEKEEPING_PERIOD_MS 20                  // Pausa do loop() entre rodadas
+
+// Agendador da tarefa de manutenção: heap de prazos, a tarefa dorme até o próximo
+#define SCHEDULER_MAX_JOBS 16
+#define SCHEDULER_MAX_SLEEP_MS 1000UL              // Teto do sono (prazos chegam também por notificação)
+
+// Períodos dos jobs de manutenção
+#define WEEKLY_RESET_CHECK_INTERVAL (60UL * 60UL * 1000UL)            // 1 hora
+#define AUTH_CLEANUP_INTERVAL_MS (10UL * 1000UL)
+#define LOG_FLUSH_INTERVAL_MS (60UL * 1000UL)
+#define LOG_CLEANUP_INTERVAL_MS (60UL * 60UL * 1000UL)
+
+// Latência entre aproximar o cartão e ligar o relé
+#define TAP_LATENCY_BUDGET_US 50000UL              // Acima disso a leitura é contada como atrasada
+
 // UID da chave mestra (deve ser definido em credentials.h)
 #ifndef MASTER_UID
     #define MASTER_UID "FF FF FF FF"
@@ -98,6 +158,42 @@ CONFIGURAÇÕES CENTRALIZADAS DO SISTEMA
 #define MAX_LOGIN_ATTEMPTS 5
 #define LOCKOUT_TIME_MS (15UL * 60UL * 1000UL)     // 15 minutos
 
+// Tentativas de login: tabela fixa com LRU, chave = IPv4 em binário
+#define LOGIN_ATTEMPT_SLOTS 32                     // Ao encher, descarta a menos recente
+#define LOGIN_ATTEMPT_BUCKETS 32                   // Potência de 2
+#define LOGIN_ATTEMPT_DECAY_MS (5UL * 60UL * 1000UL)  // Esquece uma falha a cada 5 minutos
+
+// Senhas: PBKDF2-HMAC-SHA256 com salt aleatório, gravadas em bytes na NVS
+#ifndef AUTH_PBKDF2_ITERATIONS
+#define AUTH_PBKDF2_ITERATIONS 1000
+#endif
+#define AUTH_PASSWORD_SALT_BYTES 16
+#define AUTH_PASSWORD_HASH_BYTES 32
+
+// Tabela de sessões (capacidade fixa, sem alocação por requisição)
+#define SESSION_TOKEN_BYTES 16                     // Token binário de 128 bits
+#define MAX_ACTIVE_SESSIONS 32                     // Ao encher, expira a mais antiga
+#define SESSION_HASH_BUCKETS 32                    // Potência de 2
+#define AUTH_USERNAME_MAX 32
+
+// Contas web (arquivo binário no SPIFFS, índice hash por nome de usuário)
+#define AUTH_MAX_ACCOUNTS 256
+#define AUTH_ACCOUNT_UID_MAX 23                    // Mesmo limite de UserManager::isValidUID
+#define AUTH_ACCOUNTS_FILE "/accounts.bin"
+
+// Tokens sem estado assinados com HMAC-SHA256 (sobrevivem a reinicializações).
+// Exigem relógio sincronizado via NTP; sem ele, usa-se a tabela de sessões.
+#ifndef AUTH_STATELESS_TOKENS
+#define AUTH_STATELESS_TOKENS 1
+#endif
+#define AUTH_TOKEN_KEY_BYTES 32                    // Chave do dispositivo (NVS)
+#define AUTH_TOKEN_PAYLOAD_BYTES 16
+#define AUTH_TOKEN_MAC_BYTES 16                    // HMAC truncado
+#define AUTH_REVOCATION_BITS 1024                  // Janela de tokens revogáveis
+#define AUTH_TOKEN_ID_BLOCK 64                     // IDs reservados por gravação na NVS
+#define AUTH_REFRESH_SLOTS 4                       // Renovações deslizantes lembradas (por token de origem)
+#define AUTH_MIN_VALID_EPOCH 1700000000UL          // Relógio considerado sincronizado
+
 
 // ============== CONFIGURAÇÕES DE LOG ==============
 #define MAX_LOG_ENTRIES 500
@@ -116,6 +212,24 @@ enum LogLevel { LOG_DEBUG = 0, LOG_INFO = 1, LOG_WARNING = 2, LOG_ERROR = 3, LOG
 #endif
 
 
+// ============== LEDGER DE CAFÉ ==============
+// Eventos de serviço/reabastecimento só são acrescentados; contadores e
+// agregados diários são derivados deles
+#define LEDGER_FILE "/ledger.bin"
+#define LEDGER_CAPACITY 1024                       // Eventos mantidos no arquivo (anel)
+#define LEDGER_PENDING_MAX 32                      // Eventos em RAM aguardando gravação
+#define LEDGER_MAX_USERS 64                        // Dicionário de UIDs do ledger (>= MAX_USERS)
+#define LEDGER_FLUSH_INTERVAL_MS (60UL * 1000UL)
+
+// Agregados por hora/dia/semana (baldes de 20 bytes, ~6 KB no total)
+#define STATS_FILE "/rollups.bin"
+#define STATS_HOURS 168                            // 7 dias
+#define STATS_DAYS 90
+#define STATS_WEEKS 52
+#define STATS_SAVE_INTERVAL_MS (5UL * 60UL * 1000UL)
+#define STATS_TOP_USERS 5
+
+
 // ============== PADRÕES VISUAIS E DE ÁUDIO ==============
 // Animação
 #define LED_ANIMATION_SPEED 100
@@ -136,6 +250,8 @@ enum LogLevel { LOG_DEBUG = 0, LOG_INFO = 1, LOG_WARNING = 2, LOG_ERROR = 3, LOG
 #define TONE_COFFEE_FREQ1   1300
 #define TONE_COFFEE_FREQ2   1600
 #define TONE_COFFEE_DURATION 100
+#define TONE_QUEUED_FREQ    1000
+#define TONE_QUEUED_DURATION 60
 
 #define TONE_REFILL_FREQ1   1500
 #define TONE_REFILL_FREQ2   1800
@@ -145,6 +261,42 @@ enum LogLevel { LOG_DEBUG = 0, LOG_INFO = 1, LOG_WARNING = 2, LOG_ERROR = 3, LOG
 #define WEB_SERVER_PORT 80
 #define WEBSOCKET_PORT 81
 
+// Snapshot do status (compartilhado entre /api/status e WebSocket)
+#define STATUS_SNAPSHOT_BUFFER 768                 // Corpo JSON serializado
+#define STATUS_DOC_SIZE 1024                       // Documento do status (atual e patch pendente)
+#define STATUS_SNAPSHOT_MAX_AGE_MS 5000UL          // Idade máxima de uptime/heap no snapshot
+#define STATUS_PUSH_INTERVAL_MS 1000UL             // Intervalo mínimo entre pushes automáticos
+
+// Difusor WebSocket: eventos agrupados por tick em um único buffer compartilhado
+#define WS_BROADCAST_TICK_MS 100UL
+#define WS_BROADCAST_MAX_CLIENTS 8                 // Clientes excedentes são recusados
+#define WS_BROADCAST_MAX_FRAME 4096                // Lote maior é descartado (todos ressincronizam)
+#define WS_CLIENT_QUEUE_BUDGET 4                   // Mensagens na fila antes de descartar para o cliente
+
+// Métricas por rota (/api/metrics): entradas fixas, rotas excedentes ficam sem métricas
+#define ROUTE_METRICS_MAX 40
+
+// Exportação Prometheus (/metrics): maior linha formatada de uma amostra
+#define METRICS_LINE_MAX 256
+
+// Acesso do coletor ao /metrics, além da sessão de admin: token enviado em
+// "Authorization: Bearer <token>" ("" desativa) ou leitura aberta (rede confiável).
+// Ambos podem ser definidos em credentials.h
+#ifndef METRICS_BEARER_TOKEN
+#define METRICS_BEARER_TOKEN ""
+#endif
+#ifndef METRICS_PUBLIC
+#define METRICS_PUBLIC 0
+#endif
+#if METRICS_PUBLIC
+    #warning "SEGURANCA: /metrics aberto sem autenticacao (METRICS_PUBLIC)"
+#endif
+
+// Server-Sent Events (/api/events): feed somente leitura para displays
+#define SSE_REPLAY_SIZE 16                         // Eventos guardados para retomada via Last-Event-ID
+#define SSE_RESUME_WINDOW_MS 60000UL               // Sem displays por mais tempo, o histórico é descartado
+#define SSE_RETRY_MS 3000                          // Intervalo de reconexão sugerido ao navegador
+
 // Caminhos dos arquivos web
 #define WEB_ROOT_PATH "/web"
 #define ADMIN_PATH "/admin"
@@ -162,6 +314,11 @@ enum LogLevel { LOG_DEBUG = 0, LOG_INFO = 1, LOG_WARNING = 2, LOG_ERROR = 3, LOG
 #define BACKUP_INTERVAL_MS (24UL * 60UL * 60UL * 1000UL)  // 24 horas
 #define MAX_BACKUP_FILES 7
 
+// Formato do backup: um registro JSON por linha (NDJSON)
+#define BACKUP_FORMAT_VERSION 1
+#define BACKUP_LINE_MAX 256                                // Tamanho máximo de uma linha
+#define BACKUP_RESTORE_TIMEOUT_MS (60UL * 1000UL)          // Restauração abandonada
+
 
 // ============== MACROS UTILITÁRIAS E VALIDAÇÃO ==============
 #if DEBUG_MODE
@@ -0,0 +1,59 @@
+/*
+==================================================
+FLUXO SERVER-SENT EVENTS (/api/events)
+Feed somente leitura para displays, com retomada por Last-Event-ID
+==================================================
+*/
+
+#pragma once
+
+#include <Arduino.h>
+#include <functional>
+#include <ESPAsyncWebServer.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include "config.h"
+
+class EventStream {
+private:
+    struct ReplayEntry {
+        uint32_t id;
+        const char* type;       // Nome do evento SSE (literal, mesmo "type" do WebSocket)
+        String data;
+    };
+
+    AsyncEventSource& source;
+
+    // Anel com os últimos eventos; head aponta para o mais antigo
+    ReplayEntry ring[SSE_REPLAY_SIZE];
+    uint8_t head;
+    uint8_t count;
+    uint32_t nextId;
+
+    unsigned long lastListenerSeen;
+    bool recording;
+    SemaphoreHandle_t lock;
+
+    std::function<String()> snapshotProvider;
+
+    void onConnect(AsyncEventSourceClient* client);
+    bool canReplayFrom(uint32_t lastId);
+    void acquire();
+    void release();
+
+public:
+    EventStream(AsyncEventSource& eventSource);
+
+    void begin();
+
+    // Quadro completo do status, enviado em conexões novas ou sem retomada possível
+    void setSnapshotProvider(std::function<String()> provider) { snapshotProvider = provider; }
+
+    // true enquanto há displays conectados ou algum pode voltar e retomar
+    bool wantsEvents();
+
+    // Envia a todos os displays e guarda no anel de retomada
+    void publish(const char* type, const String& frame);
+
+    size_t clients() const { return source.count(); }
+};
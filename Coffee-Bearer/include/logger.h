@@ -9,7 +9,10 @@ Registro detalhado de eventos do sistema
 
 #include <Arduino.h>
 #include <vector>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
 #include "config.h"
+#include "maintenance_scheduler.h"
 
 struct LogEntry {
     unsigned long timestamp;
@@ -26,8 +29,28 @@ private:
     bool fileLogging;
     bool serialLogging;
     LogLevel minimumLevel;
+    uint32_t stateVersion;  // Incrementado a cada entrada (cache do /api/status)
+
+    // Contadores desde o boot (o buffer é circular; estes não diminuem)
+    uint32_t levelTotals[LOG_CRITICAL + 1];
+    uint32_t filteredEntries;   // Abaixo do nível mínimo
+    uint32_t evictedEntries;    // Descartadas do buffer para abrir espaço
+
+    // Com o agendador, a gravação no SPIFFS vira um job: log() só antecipa o flush
+    MaintenanceScheduler* scheduler;
+    JobId flushJob;
+    size_t flushedIndex;        // Entradas do buffer já gravadas no arquivo
+
+    // log() é chamado das tarefas RFID, async_tcp, loop e manutenção.
+    // O lock só cobre o buffer: Serial e SPIFFS ficam fora dele
+    SemaphoreHandle_t lock;
+    void acquire();
+    void release();
+    void dropFront(size_t count);
     
     void flushToFile();
+    void flushAndRotate();
+    void requestFlush();
     String formatLogEntry(const LogEntry& entry);
     String levelToString(LogLevel level);
     String getTimestamp();
@@ -72,10 +95,15 @@ public:
     
     // Estatísticas
     int getTotalLogCount();
+    uint32_t getStateVersion() { return stateVersion; }
     int getLogCountByLevel(LogLevel level);
     int getLogCountByCategory(const String& category);
     unsigned long getOldestLogTime();
     unsigned long getNewestLogTime();
+    uint32_t getLevelTotal(LogLevel level) { return levelTotals[level]; }
+    uint32_t getFilteredCount() { return filteredEntries; }
+    uint32_t getEvictedCount() { return evictedEntries; }
+    unsigned long getLastFlushTime() { return lastFlush; }
     
     // Gestão de arquivo
     void clearLogs();
@@ -90,6 +118,6 @@ public:
     String getLogsAsJson(int count = 50);
     String getLogSummary();
     
-    // Manutenção (deve ser chamado periodicamente)
-    void maintenance();
+    // Jobs de manutenção (flush, rotação e limpeza); a partir daqui o flush é adiado
+    void registerJobs(MaintenanceScheduler& jobs);
 };
\ No newline at end of file
@@ -0,0 +1,89 @@
+/*
+==================================================
+AGENDADOR DE MANUTENÇÃO
+Tarefas periódicas e pontuais ordenadas por prazo
+==================================================
+*/
+
+#pragma once
+
+#include <Arduino.h>
+#include <functional>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include <freertos/task.h>
+#include "config.h"
+
+typedef int8_t JobId;                       // -1 = nenhuma
+typedef std::function<void()> MaintenanceJob;
+
+struct JobStats {
+    const char* name;           // Literal passado no registro
+    uint32_t period;            // 0 = execução única
+    uint32_t runs;
+    uint32_t triggers;          // Execuções antecipadas por trigger()
+    uint64_t totalUs;
+    uint32_t maxUs;
+    uint32_t maxLateMs;         // Maior atraso em relação ao prazo
+    uint32_t lastRun;           // millis() da última execução
+};
+
+// Heap mínimo de prazos em millis(), comparados pela diferença com sinal
+// (seguro na virada do contador). Só a tarefa que chama runDue() executa os
+// jobs; registro, trigger() e cancel() podem vir de qualquer tarefa.
+class MaintenanceScheduler {
+private:
+    struct Job {
+        JobStats stats;
+        MaintenanceJob run;
+        uint32_t deadline;
+        int8_t heapIndex;       // -1 fora do heap (livre ou executando)
+        bool used;
+        bool cancelled;         // Cancelado durante a execução
+        bool retrigger;         // trigger() durante a execução
+    };
+
+    Job jobs[SCHEDULER_MAX_JOBS];
+    uint8_t heap[SCHEDULER_MAX_JOBS];
+    uint8_t heapSize;
+    JobId running;
+    TaskHandle_t owner;         // Acordada quando um prazo mais cedo aparece
+    SemaphoreHandle_t lock;
+
+    static bool before(uint32_t a, uint32_t b) { return (int32_t)(a - b) < 0; }
+
+    JobId add(const char* name, uint32_t delayMs, uint32_t periodMs, MaintenanceJob job);
+    void heapPush(uint8_t slot);
+    void heapRemove(uint8_t index);
+    void heapSiftUp(uint8_t index);
+    void heapSiftDown(uint8_t index);
+    void heapSwap(uint8_t a, uint8_t b);
+    void execute(uint8_t slot, uint32_t now);
+    void wakeOwner();
+    void acquire();
+    void release();
+
+public:
+    MaintenanceScheduler();
+
+    void begin();
+
+    // Primeira execução após um período; -1 se a tabela encheu
+    JobId every(const char* name, uint32_t periodMs, MaintenanceJob job);
+    // Execução única; o slot é liberado depois de rodar
+    JobId after(const char* name, uint32_t delayMs, MaintenanceJob job);
+
+    // Antecipa o job para agora (qualquer tarefa)
+    void trigger(JobId id);
+    void cancel(JobId id);
+
+    // Executa os jobs vencidos; retorna quantos ms dormir até o próximo prazo
+    uint32_t runDue();
+
+    // Dorme até o próximo prazo ou até um trigger() (corpo da tarefa dona)
+    void sleep(uint32_t waitMs);
+
+    // Leitura das estatísticas por slot (false se o slot está livre)
+    bool getJobStats(uint8_t slot, JobStats& out);
+    void writeJson(Print& out);
+};
@@ -0,0 +1,56 @@
+/*
+==================================================
+EXPORTADOR DE MÉTRICAS PROMETHEUS
+Formato texto 0.0.4 gerado linha a linha em /metrics
+==================================================
+*/
+
+#pragma once
+
+#include <Arduino.h>
+#include <memory>
+#include "config.h"
+
+class Logger;
+class CoffeeController;
+class UserManager;
+class AuthManager;
+class RFIDManager;
+class RouteMetrics;
+class WsBroadcaster;
+class EventStream;
+class MaintenanceScheduler;
+
+// Estado de um scrape em andamento (definido em metrics_exporter.cpp)
+struct MetricsCursor;
+
+// As famílias de métricas ficam numa tabela constante em flash; um scrape
+// aloca só o cursor (valores lidos no início + uma linha) e escreve cada
+// linha direto no buffer da resposta chunked.
+class MetricsExporter {
+private:
+    Logger& logger;
+    CoffeeController& coffeeController;
+    UserManager& userManager;
+    AuthManager& authManager;
+    RFIDManager& rfidManager;
+    RouteMetrics& routeMetrics;
+    WsBroadcaster& broadcaster;
+    EventStream& eventStream;
+    MaintenanceScheduler& scheduler;
+
+    void takeSnapshot(MetricsCursor& cursor);
+    bool nextLine(MetricsCursor& cursor);
+    int formatSample(MetricsCursor& cursor, uint16_t sample);
+
+public:
+    MetricsExporter(Logger& log, CoffeeController& coffee, UserManager& users, AuthManager& auth,
+                    RFIDManager& rfid, RouteMetrics& routes, WsBroadcaster& ws, EventStream& sse,
+                    MaintenanceScheduler& jobs);
+
+    // Novo scrape: lê os contadores de todos os subsistemas de uma vez
+    std::shared_ptr<MetricsCursor> beginScrape();
+
+    // Preenche o buffer do chunk; 0 quando a exposição terminou
+    size_t fill(MetricsCursor& cursor, uint8_t* buffer, size_t maxLen);
+};
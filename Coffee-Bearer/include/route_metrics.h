@@ -0,0 +1,63 @@
+/*
+==================================================
+MÉTRICAS DAS ROTAS HTTP
+Contagem, status, bytes e histograma de latência por rota
+==================================================
+*/
+
+#pragma once
+
+#include <Arduino.h>
+#include <ESPAsyncWebServer.h>
+#include "config.h"
+
+// Limites superiores (µs) dos baldes do histograma; o último balde é "acima disso"
+static const uint32_t ROUTE_LATENCY_BUCKETS_US[] = { 100, 250, 500, 1000, 2500, 5000, 10000, 25000, 50000 };
+#define ROUTE_LATENCY_BUCKET_COUNT (sizeof(ROUTE_LATENCY_BUCKETS_US) / sizeof(ROUTE_LATENCY_BUCKETS_US[0]) + 1)
+
+struct RouteStats {
+    const char* route;          // Literal (ou string de vida longa) da rota registrada
+    WebRequestMethodComposite method;
+    uint32_t requests;
+    uint32_t status[5];         // 1xx..5xx
+    uint32_t bytes;             // Corpo das respostas com tamanho conhecido
+    uint64_t totalUs;           // Tempo de CPU dentro do handler
+    uint32_t maxUs;
+    uint32_t histogram[ROUTE_LATENCY_BUCKET_COUNT];
+};
+
+// Todos os handlers rodam na task do async_tcp, um de cada vez: a rota
+// corrente fica num único campo e nada aqui precisa de lock.
+class RouteMetrics {
+private:
+    RouteStats routes[ROUTE_METRICS_MAX];
+    uint8_t routeCount;
+    int current;                // Rota cujo handler está rodando (-1 fora de um handler)
+    int64_t startedAt;
+    uint32_t unmetered;         // Registros que não couberam na tabela
+
+public:
+    RouteMetrics();
+
+    // Reserva a entrada de uma rota (ou reaproveita a de mesmo nome/método); -1 se a tabela encheu
+    int add(const char* route, WebRequestMethodComposite method);
+
+    // Delimitam a execução de um handler
+    void begin(int slot);
+    void end();
+
+    // Chamado ao enviar a resposta dentro do handler corrente
+    void recordResponse(int code, size_t bytes);
+
+    // Leitura de código e tamanho de uma resposta já montada
+    static int responseCode(AsyncWebServerResponse* response);
+    static size_t responseLength(AsyncWebServerResponse* response);
+
+    // Leitura da tabela (exportador Prometheus)
+    uint8_t getRouteCount() { return routeCount; }
+    const RouteStats& getRoute(uint8_t index) { return routes[index]; }
+    uint32_t getUnmeteredCount() { return unmetered; }
+    static const char* methodName(WebRequestMethodComposite method);
+
+    void writeJson(Print& out);
+};
@@ -0,0 +1,74 @@
+/*
+==================================================
+AGREGADOS DE ESTATÍSTICAS
+Tabelas circulares por hora, dia e semana
+alimentadas pelos eventos do ledger
+==================================================
+*/
+
+#pragma once
+
+#include <Arduino.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include "config.h"
+
+struct LedgerEvent;
+
+enum RollupScale : uint8_t {
+    ROLLUP_HOURLY,
+    ROLLUP_DAILY,
+    ROLLUP_WEEKLY,
+    ROLLUP_SCALE_COUNT
+};
+
+// Um intervalo de tempo (hora, dia ou semana local)
+struct RollupBucket {
+    uint32_t period;        // Horas/dias/semanas desde a época; 0 = vazio
+    uint16_t served;
+    uint8_t refills;
+    uint8_t uniqueUsers;
+    uint32_t serveTimeMs;
+    uint32_t users[2];      // Bit por índice do dicionário de UIDs do ledger (20 bytes sem uint64)
+};
+
+// Cada evento toca um balde de cada escala em O(1): o slot é period % tamanho
+// e um balde de período antigo é zerado ao ser reutilizado. O arquivo é um
+// checkpoint com a sequence do ledger já aplicada; no boot o ledger reaplica
+// só os eventos posteriores.
+class StatsRollups {
+private:
+    RollupBucket hours[STATS_HOURS];
+    RollupBucket days[STATS_DAYS];
+    RollupBucket weeks[STATS_WEEKS];
+    uint32_t appliedSequence;
+    bool dirty;
+    SemaphoreHandle_t lock;
+
+    RollupBucket* table(RollupScale scale);
+    void applyTo(RollupScale scale, const LedgerEvent& event);
+    void acquire();
+    void release();
+
+public:
+    StatsRollups();
+
+    void begin();
+    bool load();
+    bool save();
+    void clear();
+
+    // Chamado pelo ledger para cada evento, na ordem da sequence
+    void apply(const LedgerEvent& event, uint32_t sequence);
+    uint32_t getAppliedSequence() { return appliedSequence; }
+
+    // Balde de um período; false se vazio ou já sobrescrito
+    bool getBucket(RollupScale scale, uint32_t period, RollupBucket& out);
+
+    static uint16_t capacity(RollupScale scale);
+    static uint32_t periodOf(RollupScale scale, uint32_t timestamp);
+    // Período corrente ou 0 sem relógio sincronizado
+    static uint32_t currentPeriod(RollupScale scale);
+    // Início do período em segundos locais desde a época (rótulos)
+    static uint32_t periodStart(RollupScale scale, uint32_t period);
+};
@@ -3,6 +3,8 @@
 #define SYSTEM_UTILS_H
 
 #include <ArduinoJson.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
 #include "logger.h"
 #include "coffee_controller.h"
 #include "user_manager.h"  // Add UserManager
@@ -15,4 +17,62 @@ void systemStatusToJson(JsonDocument &doc,
                         UserManager &userManager,
                         AuthManager &authManager);
 
+// Snapshot do status serializado uma única vez e reaproveitado por
+// /api/status e pelo WebSocket. É reconstruído quando algum contador de
+// versão muda (café, usuários, logs, sessões, WiFi) ou quando os campos
+// voláteis passam de STATUS_SNAPSHOT_MAX_AGE_MS.
+//
+// Cada reconstrução acumula os campos alterados em um patch pendente por
+// tópico ("coffee", "users"...), sempre com o valor mais recente; assim o
+// patch é idempotente sobre qualquer snapshot completo já entregue.
+class StatusSnapshot {
+public:
+    StatusSnapshot(Logger &logger, CoffeeController &coffee, UserManager &userManager, AuthManager &authManager);
+
+    void begin();
+
+    // Cópia consistente do corpo JSON (HTTP)
+    void copyBody(String &body, String &etag);
+
+    // Quadro completo {"type":"system_status","seq":N,"data":{...}} (conexão/resync)
+    String copyFrame();
+
+    // Quadro {"type":"status_patch","seq":N+1,"data":{...}} com os campos
+    // alterados desde o último patch; false se nada mudou
+    bool takePatch(String &frame);
+
+    // Registro STATUS do protocolo binário com o mesmo seq; 0 se não coube
+    size_t copyBinary(uint8_t *out, size_t capacity);
+
+private:
+    Logger &logger;
+    CoffeeController &coffee;
+    UserManager &userManager;
+    AuthManager &authManager;
+
+    char buffer[STATUS_SNAPSHOT_BUFFER];
+    size_t bodyLength;
+    char etag[24];
+
+    StaticJsonDocument<STATUS_DOC_SIZE> latest;
+    StaticJsonDocument<STATUS_DOC_SIZE> pendingPatch;
+    uint32_t sequence;
+
+    uint32_t coffeeVersion;
+    uint32_t usersVersion;
+    uint32_t logVersion;
+    int sessionCount;
+    bool wifiConnected;
+    unsigned long builtAt;
+    uint32_t generation;
+    uint32_t bootId;
+    bool valid;
+    SemaphoreHandle_t lock;
+
+    bool rebuildIfNeeded();
+    void mergeChanges(JsonDocument &next);
+    void acquire();
+    void release();
+};
+
 #endif
\ No newline at end of file
@@ -9,21 +9,134 @@ Controle de créditos e acesso
 
 #include <Arduino.h>
 #include <vector>
+#include <functional>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
 #include "config.h"
+#include "maintenance_scheduler.h"
+
+enum UserBatchOpType {
+    BATCH_ADD,
+    BATCH_REMOVE,
+    BATCH_SET_CREDITS,
+    BATCH_RENAME,
+    BATCH_INVALID
+};
+
+// UID em binário (len == 0 marca uma posição removida durante um lote)
+struct PackedUID {
+    uint8_t len;
+    uint8_t bytes[USER_UID_MAX_BYTES];
+};
+
+// Operação de um lote já decodificada; o nome fica na arena do UserBatch
+struct UserBatchOp {
+    UserBatchOpType type;
+    PackedUID uid;          // len == 0: UID ausente ou inválido
+    int32_t credits;        // -1: ausente
+    uint16_t nameOffset;
+    uint8_t nameLength;
+};
+
+struct UserBatchResult {
+    bool success;
+    const char* error;
+};
+
+// Corpo de /api/users/batch ({"ops":[{...},...]}) recebido em partes: cada
+// objeto de operação é recortado do fluxo e decodificado sozinho, então o
+// lote não precisa caber num único documento JSON
+class UserBatch {
+public:
+    std::vector<UserBatchOp> ops;
+
+    UserBatch();
+    void feed(const uint8_t* data, size_t len);
+    bool finish();
+    void fail(int code, const char* message);  // Mantém só o primeiro erro
+    String nameOf(const UserBatchOp& op) const;
+    const char* getError() const { return error; }
+    int getErrorCode() const { return errorCode; }
+
+private:
+    std::vector<char> names;
+    char object[USER_BATCH_OP_MAX];
+    size_t objectLength;
+    char key[8];
+    size_t keyLength;
+    uint8_t depth;
+    bool inString;
+    bool escaped;
+    bool inOps;
+    bool sawOps;
+    const char* error;
+    int errorCode;
+
+    void parseOp();
+};
+
+// Conjunto de UIDs (endereçamento aberto) para deduplicar importações;
+// comporta até `capacity` inserções
+class UIDSet {
+public:
+    explicit UIDSet(size_t capacity = 0);
+    void reset(size_t capacity);        // 0 libera a memória
+    bool insert(const PackedUID& uid);  // false se o UID já estava no conjunto
+
+private:
+    std::vector<PackedUID> slots;  // len == 0: posição livre
+};
+
+#define USER_FLAG_ACTIVE 0x01
 
 class UserManager {
 private:
-    std::vector<UserCredits> users;
+    // Tabela quente em estrutura de arrays: o toque do cartão e as
+    // estatísticas varrem só estes vetores, sem passar pelos nomes
+    std::vector<PackedUID> uids;
+    std::vector<int16_t> credits;
+    std::vector<uint32_t> lastUsed;   // Epoch em segundos (0 = nunca)
+    std::vector<uint8_t> flags;
+    
+    // Tabela fria, mesma posição da quente
+    std::vector<String> names;
+    
+    bool persistent;                // false: tabela de rascunho, nunca gravada (benchmarks)
+    std::vector<int16_t> uidIndex;  // Tabela hash (endereçamento aberto) UID -> posição
     unsigned long lastWeeklyReset;
     unsigned long lastSave;
     bool dataChanged;
+    uint32_t stateVersion;  // Incrementado a cada alteração (cache do /api/status)
     
+    // Usado pelas tarefas RFID, async_tcp, loop e manutenção. Recursivo porque
+    // métodos públicos chamam uns aos outros; a NVS é gravada fora dele
+    SemaphoreHandle_t lock;
+    MaintenanceScheduler* scheduler;
+    JobId saveJob;
+    std::function<void()> weeklyResetHandler;
+    void acquire();
+    void release();
+    void requestSave();
+    friend class UserLock;
+    
+    void markChanged() { dataChanged = true; stateVersion++; }
     void saveToPreferences();
     void loadFromPreferences();
     int findUserByUID(const String& uid);
+    int findPacked(const PackedUID& uid);
+    void rebuildIndex();
+    void indexInsert(int position);
+    int appendUser(const PackedUID& uid, const String& name, int userCredits, uint32_t used, bool active);
+    void eraseUser(int position);
+    void compactRemoved();
+    void clearTable();
+    void fillUser(int position, UserCredits& out);
+    void touchLastUsed(int index);
+    int countActiveOn(uint32_t day);
+    static int16_t clampCredits(long value);
     
 public:
-    UserManager();
+    explicit UserManager(bool persistent = true);
     
     // Inicialização
     bool begin();
@@ -35,8 +148,14 @@ public:
     bool updateUser(const String& uid, const String& newName);
     bool userExists(const String& uid);
     
+    // Operações em lote (uma única gravação no final)
+    int applyBatch(const UserBatch& batch, std::vector<UserBatchResult>& results);
+    static UserBatchOpType batchOpFromString(const char* op);
+    static void benchmarkBatch(uint16_t opCount, Print& out);
+    static void benchmarkScan(uint16_t userCount, Print& out);
+    
     // Consulta de usuários
-    UserCredits* getUserByUID(const String& uid);
+    bool getUser(const String& uid, UserCredits& out);
     String getUserName(const String& uid);
     int getUserCredits(const String& uid);
     std::vector<UserCredits> getAllUsers();
@@ -44,8 +163,8 @@ public:
     
     // Gerenciamento de créditos
     bool consumeCredit(const String& uid);
-    bool addCredits(const String& uid, int credits);
-    bool setCredits(const String& uid, int credits);
+    bool addCredits(const String& uid, int amount);
+    bool setCredits(const String& uid, int amount);
     int getTotalCreditsInSystem();
     
     // Reset semanal
@@ -53,19 +172,25 @@ public:
     void performWeeklyReset();
     unsigned long getTimeSinceLastReset();
     unsigned long getNextResetTime();
+    // Avisado (tarefa de manutenção, fora do lock) depois de cada reset semanal
+    void setWeeklyResetHandler(std::function<void()> handler) { weeklyResetHandler = handler; }
     
     // Estatísticas
     int getTotalUsers();
     int getActiveUsersCount();
     int getActiveTodayCount();
+    uint32_t getStateVersion() { return stateVersion; }
     UserCredits getMostActiveUser();
     std::vector<UserCredits> getTopUsers(int count = 5);
     
     // Utilitários
     void printUserList();
     void updateLastUsed(const String& uid);
-    bool isValidUID(const String& uid);
-    String sanitizeName(const String& name);
+    static bool isValidUID(const String& uid);
+    static bool packUID(const String& uid, PackedUID& out);
+    static String uidToString(const PackedUID& uid);
+    static uint32_t hashUID(const PackedUID& uid);
+    static String sanitizeName(const String& name);
 
     // Serialização para API
     String listUsersJson();
@@ -75,7 +200,11 @@ public:
     // Backup/Restore
     String exportUsers();
     bool importUsers(const String& data);
+    bool getUserAt(size_t index, UserCredits& out);
+    bool normalizeImportedUser(UserCredits& user);
+    bool applyImportedUsers(const std::vector<UserCredits>& imported, bool overwrite, unsigned long lastReset);
+    unsigned long getLastWeeklyReset() { return lastWeeklyReset; }
     
-    // Manutenção (deve ser chamado periodicamente)
-    void maintenance();
+    // Jobs de manutenção (gravação periódica na NVS)
+    void registerJobs(MaintenanceScheduler& jobs);
 };
\ No newline at end of file
@@ -0,0 +1,29 @@
+/*
+==================================================
+ARQUIVOS WEB EMBUTIDOS NO FIRMWARE
+Minificados e agrupados por compress_data.py a partir de web_src/
+==================================================
+*/
+
+#pragma once
+
+#include <Arduino.h>
+
+struct WebAsset {
+    const char* path;           // Relativo a web_src, ex.: "/admin/dashboard.html"
+    const char* url;            // Com hash do conteúdo ("/css/style.1abec688.css"); HTML mantém o path
+    const char* contentType;
+    const uint8_t* data;        // Em flash (PROGMEM), servido direto sem cópia
+    size_t length;
+    const char* etag;           // ETag forte (já entre aspas) do conteúdo servido
+    bool gzipped;
+    const uint8_t* brData;      // Variante Brotli; nullptr se não foi gerada
+    size_t brLength;
+    const char* brEtag;
+};
+
+// Busca pelo caminho exato; nullptr se o arquivo não foi embutido
+const WebAsset* findWebAsset(const char* path);
+
+// Tabela completa (para registrar as rotas dos arquivos estáticos)
+const WebAsset* getWebAssets(size_t& count);
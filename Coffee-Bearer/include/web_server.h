@@ -7,40 +7,94 @@
 #include <SPIFFS.h>
 #include <AsyncJson.h>
 #include "system_utils.h"
+#include "ws_broadcaster.h"
+#include "event_stream.h"
+#include "route_metrics.h"
+#include "metrics_exporter.h"
+#include "maintenance_scheduler.h"
+#include "web_assets.h"
 #include "RFID_manager.h"
 
 class AuthManager;
 class Logger;
 class UserManager;
+class UserBatch;
 class CoffeeController;
+class BackupManager;
 
 class WebServerManager {
 public:
-    WebServerManager(AuthManager &auth, Logger &log, UserManager &users, CoffeeController &coffee, FeedbackManager &feedback);
+    WebServerManager(AuthManager &auth, Logger &log, UserManager &users, CoffeeController &coffee, FeedbackManager &feedback, BackupManager &backup, MaintenanceScheduler &jobs);
 
     void begin();
 
-    // Push events to all WS clients
+    // Push events to all WS and SSE clients
     void pushStatus();
     void pushLog(const String &log);
     void pushUserUpdate(const String &uid);
     void pushScannedUID(const String &uid);
+    void pushServeQueue();
+
+    // Jobs de push do status e de envio dos lotes WebSocket
+    void registerJobs();
+    // Antecipa o push do status (ex.: relé ligou ou desligou)
+    void requestStatusPush();
 
 private:
     AsyncWebServer server;
     AsyncWebSocket ws;
+    WsBroadcaster broadcaster;
+    AsyncEventSource events;
+    EventStream eventStream;
+    RouteMetrics metrics;
+    MetricsExporter metricsExporter;
 
     AuthManager &authManager;
     Logger &logger;
     UserManager &userManager;
     CoffeeController &coffeeController;
     FeedbackManager &feedbackManager; // ADD THIS LINE
+    BackupManager &backupManager;
+    MaintenanceScheduler &scheduler;
+    StatusSnapshot statusSnapshot;
+    JobId statusJob;
+
+    // Lote de usuários sendo recebido (um por vez, como a restauração). O dono
+    // é identificado pelo número do lote guardado na própria requisição, não
+    // pelo endereço dela (que pode ser reaproveitado por outra conexão)
+    UserBatch *userBatch;
+    uint32_t userBatchId;       // 0 sem lote em andamento
+    uint32_t nextUserBatchId;
+    unsigned long userBatchActivity;
     
     void setupStaticRoutes();
     void sendHtmlFile(AsyncWebServerRequest* req, const String& baseDir, const String& page);
     void setupAuthRoutes();
     void setupApiRoutes();
+    void setupBackupRoutes();
     void setupWebSocket();
+    void setupEventStream();
+
+    // Registro de rotas com métricas (contagem, status, bytes, latência do handler)
+    void on(const char *uri, WebRequestMethodComposite method, ArRequestHandlerFunction handler, const char *label = nullptr);
+    void on(const char *uri, WebRequestMethodComposite method, ArRequestHandlerFunction handler, ArUploadHandlerFunction upload);
+    void on(const char *uri, WebRequestMethodComposite method, ArRequestHandlerFunction handler, ArBodyHandlerFunction body);
+    AsyncCallbackJsonWebHandler *onJson(const char *uri, ArJsonRequestHandlerFunction handler, size_t jsonBufferSize = DYNAMIC_JSON_DOCUMENT_SIZE);
+    ArRequestHandlerFunction metered(int slot, ArRequestHandlerFunction handler);
+
+    // Envio de respostas contabilizado na rota corrente
+    void reply(AsyncWebServerRequest *req, int code, const String &type = String(), const String &body = String());
+    void reply(AsyncWebServerRequest *req, AsyncWebServerResponse *res);
+    void reply(AsyncWebServerRequest *req, AsyncResponseStream *res);
+    void addRefreshedCookie(AsyncWebServerRequest *req, AsyncWebServerResponse *res);
+    void sendWebAsset(AsyncWebServerRequest *request, const WebAsset *asset, const char *cacheControl);
+    void sendStatusSnapshot(AsyncWebSocketClient *client, bool binary);
+    void writeStatsJson(Print &out, RollupScale scale, uint16_t count, bool lifetime);
+    void buildServeQueueJson(JsonObject data);
+    void dropUserBatch();
+    static uint32_t userBatchIdOf(AsyncWebServerRequest *request);
+    bool wantsJsonEvents();
+    void publishEvent(const char *type, const String &frame);
 };
 
 #endif
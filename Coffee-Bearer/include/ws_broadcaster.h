@@ -0,0 +1,103 @@
+/*
+==================================================
+DIFUSOR WEBSOCKET
+Agrupa eventos por tick e respeita a fila de cada cliente
+==================================================
+*/
+
+#pragma once
+
+#include <Arduino.h>
+#include <vector>
+#include <functional>
+#include <ESPAsyncWebServer.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include "config.h"
+
+// Contadores do difusor (desde o boot)
+struct WsBroadcastStats {
+    uint32_t eventsQueued;
+    uint32_t eventsCoalesced;   // Eventos que viajaram junto com outros no mesmo quadro
+    uint32_t framesBuilt;
+    uint32_t framesSent;        // Somatório por cliente
+    uint32_t bytesSent;
+    uint32_t drops;             // Quadros não entregues a clientes acima do orçamento
+    uint32_t resyncs;
+    uint16_t clients;
+    uint16_t binaryClients;
+    uint16_t backedUpClients;
+    uint16_t maxQueueDepth;     // Maior fila observada no último tick
+    uint16_t pendingEvents;
+    uint16_t buffersInFlight;
+};
+
+class WsBroadcaster {
+private:
+    // O flush roda na tarefa de manutenção, fora do async_tcp. Ele nunca
+    // percorre a lista de clientes da biblioteca: usa os ponteiros guardados
+    // aqui. A biblioteca só libera um cliente depois do WS_EVT_DISCONNECT,
+    // cujo removeClient espera o lock, então um ponteiro registrado continua
+    // válido enquanto o lock estiver tomado
+    struct ClientBudget {
+        AsyncWebSocketClient* client;
+        uint32_t id;
+        uint32_t drops;
+        bool used;
+        bool binary;            // Protocolo binário (ws_protocol.h) em vez de JSON
+        bool needsResync;       // Perdeu um quadro: recebe o snapshot completo antes do próximo
+    };
+
+    ClientBudget clients[WS_BROADCAST_MAX_CLIENTS];
+    uint8_t clientCount;
+    uint8_t binaryCount;
+
+    // Eventos JSON pendentes, separados por vírgula (viram um array no envio)
+    String pending;
+    uint16_t pendingCount;
+
+    // Registros binários pendentes, concatenados (um quadro já é uma sequência de registros)
+    std::vector<uint8_t> pendingBinary;
+    uint16_t pendingBinaryCount;
+    SemaphoreHandle_t lock;
+
+    // Buffers compartilhados ainda referenciados por alguma fila de cliente
+    std::vector<AsyncWebSocketMessageBuffer*> inFlight;
+
+    std::function<void(AsyncWebSocketClient*, bool)> resyncHandler;
+    WsBroadcastStats stats;
+
+    int findClient(uint32_t id);
+    void reapBuffers();
+    void markAllForResync();
+    AsyncWebSocketMessageBuffer* makeShared(const uint8_t* prefix, const uint8_t* data, size_t len, const uint8_t* suffix);
+    void acquire();
+    void release();
+
+public:
+    WsBroadcaster();
+
+    void begin();
+
+    // Envia o snapshot completo a clientes que perderam mensagens (bool = binário)
+    void setResyncHandler(std::function<void(AsyncWebSocketClient*, bool)> handler) { resyncHandler = handler; }
+
+    // Registro dos clientes (chamado pelos eventos do WebSocket)
+    bool addClient(AsyncWebSocketClient* client);
+    void removeClient(AsyncWebSocketClient* client);
+    bool setBinary(AsyncWebSocketClient* client, bool binary);
+    bool isBinary(AsyncWebSocketClient* client);
+
+    // Permite aos produtores pular a codificação que ninguém vai receber
+    bool hasTextClients() { return clientCount > binaryCount; }
+    bool hasBinaryClients() { return binaryCount > 0; }
+
+    // Enfileiram um evento (JSON ou registro binário); enviados no próximo tick
+    void send(const String& message);
+    void sendBinary(const uint8_t* record, size_t len);
+
+    // Monta um único quadro com os eventos do tick e o entrega (job "ws.flush", a cada tick)
+    void flush();
+
+    WsBroadcastStats getStats();
+};
@@ -0,0 +1,70 @@
+/*
+==================================================
+PROTOCOLO BINÁRIO DO WEBSOCKET ("cb-bin.1")
+Registros compactos para painéis de alta frequência
+==================================================
+
+Ativado por cliente com {"type":"set_protocol","data":{"protocol":"cb-bin.1"}}
+(a biblioteca não devolve Sec-WebSocket-Protocol no handshake, então a
+negociação é feita dentro do próprio canal). Um quadro binário contém um
+ou mais registros, cada um iniciado pelo byte de tipo. Inteiros fixos são
+little-endian; "varint" é LEB128 sem sinal.
+
+  0x01 STATUS (tamanho fixo, WS_STATUS_RECORD_SIZE bytes)
+       u32 seq, u32 uptime, u32 freeHeap, u8[4] wifiIP, u8 flags
+       (bit0 wifiConnected, bit1 coffeeBusy), u16 remaining,
+       u16 maxCapacity, u32 totalServed, u16 usersTotal, u16 activeToday,
+       u16 activeSessions, u16 logsTotal, u16 logErrors, u16 logWarnings
+  0x02 SCANNED_UID    u8 len, bytes do UID
+  0x03 USER_ACTIVITY  u8 len, bytes do UID, varint credits,
+                      varint lastUsed (epoch s), u8 flags (bit0 isActive),
+                      varint len, nome UTF-8
+  0x04 LOG_ENTRY      varint len, entrada em JSON UTF-8
+*/
+
+#pragma once
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include "config.h"
+#include "user_manager.h"
+
+#define WS_BINARY_PROTOCOL "cb-bin.1"
+
+enum WsRecordType : uint8_t {
+    WS_RECORD_STATUS = 0x01,
+    WS_RECORD_SCANNED_UID = 0x02,
+    WS_RECORD_USER_ACTIVITY = 0x03,
+    WS_RECORD_LOG_ENTRY = 0x04
+};
+
+#define WS_STATUS_RECORD_SIZE 38
+
+// Escritor sobre um buffer fixo; overflow() indica que o registro não coube
+class WsBinaryWriter {
+private:
+    uint8_t* data;
+    size_t capacity;
+    size_t position;
+    bool overflowed;
+
+public:
+    WsBinaryWriter(uint8_t* buffer, size_t size) :
+        data(buffer), capacity(size), position(0), overflowed(false) {}
+
+    void u8(uint8_t value);
+    void u16(uint16_t value);
+    void u32(uint32_t value);
+    void varint(uint32_t value);
+    void bytes(const uint8_t* src, size_t len);
+    void string(const String& value);
+
+    size_t length() const { return overflowed ? 0 : position; }
+    bool overflow() const { return overflowed; }
+};
+
+// Codificadores dos registros; retornam o tamanho escrito (0 se não coube)
+size_t wsEncodeStatus(const JsonDocument& status, uint32_t seq, uint8_t* out, size_t capacity);
+size_t wsEncodeScannedUid(const String& uid, uint8_t* out, size_t capacity);
+size_t wsEncodeUserActivity(const UserCredits& user, uint8_t* out, size_t capacity);
+size_t wsEncodeLogEntry(const String& json, uint8_t* out, size_t capacity);
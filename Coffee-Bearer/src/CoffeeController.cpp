@@ -1,26 +1,60 @@
 #include "coffee_controller.h"
 #include "beeps_and_bleeps.h"
 #include <Preferences.h>
+#include <esp_timer.h>
+#include <time.h>
 
-CoffeeController::CoffeeController(FeedbackManager& feedback) :
+static bool sameUID(const PackedUID& a, const PackedUID& b) {
+    return a.len == b.len && memcmp(a.bytes, b.bytes, a.len) == 0;
+}
+
+CoffeeController::CoffeeController(FeedbackManager& feedback, UserManager& users) :
     feedbackManager(feedback),
+    userManager(users),
     systemBusy(false),
     remainingCoffees(MAX_COFFEES),
-    totalServed(0),
-    totalServeTime(0),
-    lastServed(0),
-    dailyCount(0),
-    dailyResetTime(0),
     lastSave(0),
-    dataChanged(false) 
+    dataChanged(false),
+    stateVersion(0),
+    relayOnTime(0),
+    serveDurationUs(COFFEE_SERVE_TIME_MS * 1000LL),
+    relayTimer(nullptr),
+    relayOffTime(0),
+    relayOffPending(false),
+    relayTask(nullptr),
+    serveGeneration(0),
+    armedGeneration(0),
+    queueCount(0),
+    nextTicket(1),
+    servingTicket(0),
+    nextStartAt(0),
+    queueVersion(0),
+    lock(nullptr),
+    serveSource(SERVE_SOURCE_RFID),
+    serveCreditReserved(false)
 {
+    memset(&serveUid, 0, sizeof(serveUid));
+    memset(&relayStats, 0, sizeof(relayStats));
+    memset(&queueStats, 0, sizeof(queueStats));
 }
 
 bool CoffeeController::begin() {
+    lock = xSemaphoreCreateMutex();
     pinMode(RELAY_PIN, OUTPUT);
     digitalWrite(RELAY_PIN, LOW);
+
+    // Desligamento do relé fora do laço: o atraso de uma tarefa não vira café a mais
+    esp_timer_create_args_t timerArgs = {};
+    timerArgs.callback = &CoffeeController::onRelayTimer;
+    timerArgs.arg = this;
+    timerArgs.dispatch_method = ESP_TIMER_TASK;
+    timerArgs.name = "relay_off";
+    if (esp_timer_create(&timerArgs, &relayTimer) != ESP_OK) {
+        relayTimer = nullptr;
+        DEBUG_PRINTLN("Timer do relé indisponível: desligamento pela tarefa RFID");
+    }
+
     loadFromPreferences();
-    checkDailyReset();
     feedbackManager.signalSuccess();
     
     DEBUG_PRINTLN("Coffee Controller inicializado");
@@ -32,132 +66,264 @@ void CoffeeController::clearAllData() {
     prefs.begin("coffee", false);
     prefs.clear();
     prefs.end();
+    ledger.clear();
     
+    // Usuários também foram apagados: a fila sai sem devolver créditos
+    acquire();
+    queueCount = 0;
+    queueVersion++;
     systemBusy = false;
     remainingCoffees = MAX_COFFEES;
-    totalServed = 0;
-    totalServeTime = 0;
-    lastServed = 0;
-    dailyCount = 0;
-    dailyResetTime = millis();
-    dataChanged = true;
+    markChanged();
+    release();
     
     DEBUG_PRINTLN("Todos os dados da cafeteira foram limpos");
 }
 
-bool CoffeeController::serveCoffee(const String& userName, int* userCredits) {
-    if (systemBusy || remainingCoffees <= 0 || (userCredits != nullptr && *userCredits <= 0)) {
-        feedbackManager.signalError(); // Now directly calls the correct instance
-        return false;
+ServeTicket CoffeeController::requestServe(ServeSource source, const String& uid, const char* requestedBy) {
+    ServeTicket out = { SERVE_QUEUE_FULL, 0, 0 };
+    PackedUID packed;
+    if (uid.isEmpty() || !UserManager::packUID(uid, packed)) {
+        packed.len = 0;
     }
-    
-    if (userCredits != nullptr) {
-        (*userCredits)--;
+
+    acquire();
+    // Toque repetido de quem já espera: nada é cobrado de novo, só a posição volta
+    if (packed.len) {
+        if (systemBusy && sameUID(serveUid, packed)) {
+            out = { SERVE_ALREADY_QUEUED, servingTicket, 0 };
+        }
+        for (uint8_t i = 0; i < queueCount && !out.ticket; i++) {
+            if (sameUID(queue[i].uid, packed)) {
+                out = { SERVE_ALREADY_QUEUED, queue[i].ticket, (uint8_t)(i + 1) };
+            }
+        }
+        if (out.ticket) {
+            queueStats.repeatTaps++;
+            release();
+            return out;
+        }
     }
-    
-    systemBusy = true;
-    feedbackManager.signalServing(); // Correctly signals serving start
 
-    digitalWrite(RELAY_PIN, HIGH);
-    coffeeServeEndTime = millis() + COFFEE_SERVE_TIME_MS;
-    
-    return true;
+    // Cada pedido aceito já conta um café da garrafa
+    int committed = queueCount + (systemBusy ? 1 : 0);
+    if (committed >= remainingCoffees) {
+        out.result = SERVE_NO_COFFEE;
+        queueStats.rejected++;
+    } else if (queueCount >= SERVE_QUEUE_MAX) {
+        out.result = SERVE_QUEUE_FULL;
+        queueStats.rejected++;
+    } else if (packed.len && !userManager.consumeCredit(uid)) {
+        out.result = SERVE_NO_CREDITS;
+    } else {
+        ServeRequest& request = queue[queueCount++];
+        request.ticket = nextTicket++;
+        if (nextTicket == 0) nextTicket = 1;
+        request.source = source;
+        request.uid = packed;
+        strlcpy(request.requestedBy, requestedBy ? requestedBy : "", sizeof(request.requestedBy));
+        request.creditReserved = packed.len > 0;
+        request.queuedAt = esp_timer_get_time();
+        out.ticket = request.ticket;
+
+        if (!systemBusy && queueCount == 1 && request.queuedAt >= nextStartAt) {
+            startNext();
+            out.result = SERVE_STARTED;
+        } else {
+            out.result = SERVE_QUEUED;
+            out.position = queueCount;
+            queueStats.queued++;
+            if (queueCount > queueStats.maxDepth) queueStats.maxDepth = queueCount;
+            queueVersion++;
+            stateVersion++;
+            DEBUG_PRINTF("Pedido #%u na fila (posição %u)\n", (unsigned)out.ticket, out.position);
+        }
+    }
+    release();
+
+    // A tarefa do relé recalcula o prazo e publica a fila
+    if (out.ticket && relayTask && relayTask != xTaskGetCurrentTaskHandle()) {
+        xTaskNotifyGive(relayTask);
+    }
+    return out;
+}
+
+bool CoffeeController::cancelServe(uint32_t ticket) {
+    bool found = false;
+    acquire();
+    for (uint8_t i = 0; i < queueCount; i++) {
+        if (queue[i].ticket == ticket) {
+            queueStats.cancelled++;
+            dropRequest(i);
+            found = true;
+            break;
+        }
+    }
+    release();
+
+    if (found) {
+        DEBUG_PRINTF("Pedido #%u cancelado\n", (unsigned)ticket);
+        if (relayTask) xTaskNotifyGive(relayTask);
+    }
+    return found;
+}
+
+uint8_t CoffeeController::getQueue(ServeRequest* out, uint8_t max) {
+    acquire();
+    uint8_t count = min(max, queueCount);
+    memcpy(out, queue, count * sizeof(ServeRequest));
+    release();
+    return count;
+}
+
+const char* CoffeeController::serveResultName(ServeRequestResult result) {
+    switch (result) {
+        case SERVE_STARTED: return "started";
+        case SERVE_QUEUED: return "queued";
+        case SERVE_ALREADY_QUEUED: return "already_queued";
+        case SERVE_QUEUE_FULL: return "queue_full";
+        case SERVE_NO_COFFEE: return "no_coffee";
+        case SERVE_NO_CREDITS: return "no_credits";
+        default: return "unknown";
+    }
 }
 
-void CoffeeController::refillContainer() {
+void CoffeeController::refillContainer(ServeSource source) {
     DEBUG_PRINTLN("Reabastecendo recipiente de café...");
+    acquire();
     remainingCoffees = MAX_COFFEES;
-    dataChanged = true;
+    ledger.recordRefill(source);
+    markChanged();
+    release();
     feedbackManager.signalRefill();
-    DEBUG_PRINTF("Recipiente reabastecido! Cafés disponíveis: %d\n", remainingCoffees);
+    DEBUG_PRINTF("Recipiente reabastecido! Cafés disponíveis: %d\n", MAX_COFFEES);
 }
 
 void CoffeeController::emergencyStop() {
+    acquire();
+    if (relayTimer) esp_timer_stop(relayTimer);
+    if (systemBusy) {
+        // Relé já desligado pelo timer: serviço completo, contabilizado normalmente.
+        // Ainda ligado: dose interrompida (ver finishServe)
+        bool interrupted = switchRelayOff(serveGeneration);
+        finishServe(!interrupted);
+    }
+    portENTER_CRITICAL(&relayMux);
     digitalWrite(RELAY_PIN, LOW);
+    relayOffPending = false;
     systemBusy = false;
+    armedGeneration = 0;
+    portEXIT_CRITICAL(&relayMux);
+    servingTicket = 0;
+    // Quem esperava não vai ser servido: créditos devolvidos
+    while (queueCount > 0) {
+        queueStats.cancelled++;
+        dropRequest(queueCount - 1);
+    }
+    nextStartAt = esp_timer_get_time() + COOLDOWN_TIME_MS * 1000LL;
+    stateVersion++;
+    queueVersion++;
+    release();
     feedbackManager.signalError();
     DEBUG_PRINTLN("Sistema de café parado com segurança");
 }
 
 CoffeeStatus CoffeeController::getStatus() {
-    if (systemBusy) {
-        return COFFEE_BUSY;
-    } else if (remainingCoffees <= 0) {
-        return COFFEE_EMPTY;
-    } else {
-        return COFFEE_READY;
-    }
+    acquire();
+    CoffeeStatus status = systemBusy ? COFFEE_BUSY :
+                          (remainingCoffees <= 0 ? COFFEE_EMPTY : COFFEE_READY);
+    release();
+    return status;
 }
 
 float CoffeeController::getAverageServeTime() {
-    if (totalServed == 0) {
+    LedgerTotals totals = ledger.getTotals();
+    if (totals.served == 0) {
         return 0.0;
     }
-    return (float)totalServeTime / (float)totalServed;
+    return (float)totals.serveTimeMs / (float)totals.served;
 }
 
 void CoffeeController::setRemainingCoffees(int count) {
     if (count < 0) count = 0;
     if (count > MAX_COFFEES) count = MAX_COFFEES;
     
+    acquire();
     remainingCoffees = count;
-    dataChanged = true;
+    markChanged();
+    release();
     
     DEBUG_PRINTF("Cafés restantes definidos para: %d\n", count);
 }
 
 bool CoffeeController::adjustCoffeeCount(int adjustment) {
+    acquire();
     int newCount = remainingCoffees + adjustment;
     
     if (newCount < 0 || newCount > MAX_COFFEES) {
+        release();
         return false;
     }
     
     remainingCoffees = newCount;
-    dataChanged = true;
+    markChanged();
+    release();
     
     DEBUG_PRINTF("Contagem de café ajustada: %+d (total: %d)\n", 
-                adjustment, remainingCoffees);
+                adjustment, newCount);
     
     return true;
 }
 
 CoffeeStats CoffeeController::getStats() {
+    LedgerTotals totals = ledger.getTotals();
     CoffeeStats stats;
-    stats.totalServed = totalServed;
+    stats.totalServed = totals.served;
     stats.remainingCoffees = remainingCoffees;
-    stats.totalServeTime = totalServeTime;
-    stats.lastServed = lastServed;
-    stats.dailyCount = dailyCount;
-    stats.dailyResetTime = dailyResetTime;
+    stats.totalServeTime = totals.serveTimeMs;
+    stats.lastServed = totals.lastServedAt;
+    stats.dailyCount = ledger.getServedToday();
     
     return stats;
 }
 
+void CoffeeController::restoreStats(const CoffeeStats& stats) {
+    // A contagem do dia é derivada dos eventos e não é restaurada
+    int remaining = constrain(stats.remainingCoffees, 0, MAX_COFFEES);
+    acquire();
+    remainingCoffees = remaining;
+    ledger.restoreTotals(max(0, stats.totalServed), stats.totalServeTime);
+    markChanged();
+    release();
+    saveToPreferences();
+    
+    DEBUG_PRINTF("Estatísticas restauradas: %d servidos, %d restantes\n", 
+                max(0, stats.totalServed), remaining);
+}
+
 void CoffeeController::printStats() {
+    LedgerTotals totals = ledger.getTotals();
     DEBUG_PRINTLN("\n=== ESTATÍSTICAS DA CAFETEIRA ===");
     DEBUG_PRINTF("Status: %s\n", 
         systemBusy ? "Ocupado" : 
         (remainingCoffees > 0 ? "Pronto" : "Vazio"));
     DEBUG_PRINTF("Cafés restantes: %d/%d\n", remainingCoffees, MAX_COFFEES);
-    DEBUG_PRINTF("Total servido: %d cafés\n", totalServed);
-    DEBUG_PRINTF("Servidos hoje: %d cafés\n", dailyCount);
-    String lastCoffeeText = lastServed > 0 ? 
-        String(millis() - lastServed) + " ms atrás" : 
+    DEBUG_PRINTF("Total servido: %u cafés (RFID %u, web %u, serial %u)\n", (unsigned)totals.served,
+                (unsigned)totals.bySource[SERVE_SOURCE_RFID], (unsigned)totals.bySource[SERVE_SOURCE_WEB],
+                (unsigned)totals.bySource[SERVE_SOURCE_SERIAL]);
+    DEBUG_PRINTF("Servidos hoje: %u cafés\n", (unsigned)ledger.getServedToday());
+    DEBUG_PRINTF("Reabastecimentos: %u\n", (unsigned)totals.refills);
+    DEBUG_PRINTF("Fila: %u pedidos (%u atendidos, %u cancelados, %u expirados)\n", queueCount,
+                (unsigned)queueStats.started, (unsigned)queueStats.cancelled, (unsigned)queueStats.timedOut);
+    String lastCoffeeText = totals.lastServedAt > 0 ? 
+        String((uint32_t)time(nullptr) - totals.lastServedAt) + " s atrás" : 
         "Nunca";
-    DEBUG_PRINTF("Último café: %s\n", lastCoffeeText.c_str());    DEBUG_PRINTF("Tempo médio de preparo: %.1f ms\n", getAverageServeTime());
-    DEBUG_PRINTF("Tempo total de preparo: %lu ms\n", totalServeTime);
+    DEBUG_PRINTF("Último café: %s\n", lastCoffeeText.c_str());
+    DEBUG_PRINTF("Tempo médio de preparo: %.1f ms\n", getAverageServeTime());
+    DEBUG_PRINTF("Tempo total de preparo: %u ms\n", (unsigned)totals.serveTimeMs);
     DEBUG_PRINTLN("================================\n");
 }
 
-void CoffeeController::resetDailyStats() {
-    dailyCount = 0;
-    dailyResetTime = millis();
-    dataChanged = true;
-    
-    DEBUG_PRINTLN("Estatísticas diárias resetadas");
-}
-
 void CoffeeController::setServeTime(unsigned long timeMs) {
     // Validar tempo (entre 1 segundo e 30 segundos)
     if (timeMs < 1000 || timeMs > 30000) {
@@ -175,44 +341,222 @@ unsigned long CoffeeController::getServeTime() {
     return COFFEE_SERVE_TIME_MS;
 }
 
-void CoffeeController::maintenance() {
-    if (systemBusy && millis() >= coffeeServeEndTime) {
-        digitalWrite(RELAY_PIN, LOW);
-        remainingCoffees--;
-        totalServed++;
-        dailyCount++;
-        lastServed = millis();
-        dataChanged = true;
-        feedbackManager.signalSuccess();
-        systemBusy = false;
-        DEBUG_PRINTF("Café servido com sucesso! Restam: %d\n", remainingCoffees);
+unsigned long CoffeeController::getServeTimeRemaining() {
+    if (!systemBusy || relayOffPending) return 0;
+    // esp_timer em µs (64 bits) não dá a volta como o millis()
+    int64_t remaining = relayOnTime + serveDurationUs - esp_timer_get_time();
+    return remaining > 0 ? (unsigned long)((remaining + 999) / 1000) : 0;
+}
+
+uint32_t CoffeeController::getRelayWait() {
+    uint32_t wait = UINT32_MAX;
+    int64_t now = esp_timer_get_time();
+
+    acquire();
+    if (systemBusy) {
+        wait = relayOffPending ? 0 : getServeTimeRemaining() + RELAY_FALLBACK_GRACE_MS;
+    } else if (queueCount > 0) {
+        wait = nextStartAt > now ? (uint32_t)((nextStartAt - now + 999) / 1000) : 0;
     }
-    
-    checkDailyReset();
-    
-    if (dataChanged && (millis() - lastSave > DATA_SAVE_INTERVAL_MS)) {
-        saveToPreferences();
+    if (queueCount > 0) {
+        int64_t expiresAt = queue[0].queuedAt + SERVE_QUEUE_TIMEOUT_MS * 1000LL;
+        wait = min(wait, expiresAt > now ? (uint32_t)((expiresAt - now + 999) / 1000) : 0);
     }
+    release();
+    return wait;
+}
+
+void CoffeeController::updateRelay() {
+    relayTask = xTaskGetCurrentTaskHandle();
+
+    acquire();
+    if (systemBusy) {
+        // Reserva: timer não armado ou atrasado além da tolerância
+        if (!relayOffPending &&
+            esp_timer_get_time() - relayOnTime >= serveDurationUs + RELAY_FALLBACK_GRACE_MS * 1000LL) {
+            if (relayTimer) esp_timer_stop(relayTimer);
+            if (switchRelayOff(serveGeneration)) {
+                relayStats.fallbackStops++;
+                DEBUG_PRINTLN("Relé desligado pela tarefa RFID (timer atrasado)");
+            }
+        }
+
+        if (relayOffPending) {
+            finishServe();
+        }
+    }
+
+    expireRequests();
+
+    if (!systemBusy && queueCount > 0) {
+        // Garrafa ajustada para baixo depois das reservas: os últimos da fila saem
+        while (queueCount > max(remainingCoffees, 0)) {
+            queueStats.rejected++;
+            dropRequest(queueCount - 1);
+        }
+        // Próximo da fila assim que termina o intervalo entre serviços
+        if (queueCount > 0 && esp_timer_get_time() >= nextStartAt) {
+            startNext();
+        }
+    }
+    release();
+}
+
+void CoffeeController::registerJobs(MaintenanceScheduler& scheduler) {
+    // O relé fica com a tarefa RFID/relé; aqui só o que pode esperar
+    scheduler.every("coffee.save", DATA_SAVE_INTERVAL_MS, [this]() { saveToPreferences(); });
+    ledger.registerJobs(scheduler);
 }
 
 // Métodos privados
 
+void CoffeeController::onRelayTimer(void* arg) {
+    CoffeeController* self = static_cast<CoffeeController*>(arg);
+
+    // Disparo atrasado de um serviço anterior: o timer já foi desarmado, ou
+    // rearmado para um serviço que ainda não cumpriu o tempo
+    portENTER_CRITICAL(&self->relayMux);
+    uint32_t generation = self->armedGeneration;
+    bool due = generation != 0 &&
+               esp_timer_get_time() - self->relayOnTime >= self->serveDurationUs;
+    portEXIT_CRITICAL(&self->relayMux);
+
+    // A contabilidade (ledger, feedback) fica com a tarefa do relé
+    if (due && self->switchRelayOff(generation) && self->relayTask) {
+        xTaskNotifyGive(self->relayTask);
+    }
+}
+
+bool CoffeeController::switchRelayOff(uint32_t generation) {
+    // Só desliga o serviço da geração indicada, e uma única vez
+    portENTER_CRITICAL(&relayMux);
+    bool current = systemBusy && !relayOffPending && generation == serveGeneration;
+    if (current) {
+        digitalWrite(RELAY_PIN, LOW);
+        relayOffTime = esp_timer_get_time();
+        relayOffPending = true;
+        armedGeneration = 0;
+    }
+    portEXIT_CRITICAL(&relayMux);
+    return current;
+}
+
+void CoffeeController::finishServe(bool completed) {
+    portENTER_CRITICAL(&relayMux);
+    int64_t offTime = relayOffTime;
+    relayOffPending = false;
+    systemBusy = false;
+    portEXIT_CRITICAL(&relayMux);
+    servingTicket = 0;
+    nextStartAt = offTime + COOLDOWN_TIME_MS * 1000LL;
+    queueVersion++;
+
+    // Tempo real de relé ligado, medido entre os dois instantes do esp_timer
+    int64_t onTimeUs = offTime - relayOnTime;
+    if (onTimeUs < 0) onTimeUs = 0;
+
+    // Dose interrompida (parada de emergência): não conta como café servido,
+    // não sai da garrafa nem do ledger, e o crédito cobrado volta ao usuário
+    if (!completed) {
+        if (serveCreditReserved) {
+            userManager.addCredits(UserManager::uidToString(serveUid), 1);
+        }
+        stateVersion++;
+        DEBUG_PRINTF("Serviço interrompido após %lu us; não contabilizado\n", (unsigned long)onTimeUs);
+        return;
+    }
+
+    int64_t overrunUs = onTimeUs - serveDurationUs;
+    relayStats.pours++;
+    relayStats.onTimeUs += onTimeUs;
+    relayStats.lastOnTimeUs = (uint32_t)onTimeUs;
+    if (overrunUs > (int64_t)relayStats.maxOverrunUs) relayStats.maxOverrunUs = (uint32_t)overrunUs;
+
+    remainingCoffees--;
+    ledger.recordServe(serveSource, &serveUid, (uint32_t)((onTimeUs + 500) / 1000));
+    markChanged();
+    feedbackManager.signalSuccess();
+    DEBUG_PRINTF("Café servido com sucesso! Relé ligado por %lu us. Restam: %d\n",
+                (unsigned long)onTimeUs, remainingCoffees);
+}
+
+void CoffeeController::startNext() {
+    ServeRequest request = queue[0];
+    queueCount--;
+    memmove(queue, queue + 1, queueCount * sizeof(ServeRequest));
+
+    // Origem e cartão vão para o ledger quando o relé desligar
+    servingTicket = request.ticket;
+    serveSource = request.source;
+    serveUid = request.uid;
+    serveCreditReserved = request.creditReserved;
+    queueStats.started++;
+    queueVersion++;
+
+    stateVersion++;
+    feedbackManager.signalServing();
+
+    // Nova geração: um disparo atrasado do serviço anterior não corta este
+    portENTER_CRITICAL(&relayMux);
+    if (++serveGeneration == 0) serveGeneration = 1;
+    systemBusy = true;
+    relayOffPending = false;
+    serveDurationUs = COFFEE_SERVE_TIME_MS * 1000LL;
+    digitalWrite(RELAY_PIN, HIGH);
+    relayOnTime = esp_timer_get_time();
+    armedGeneration = serveGeneration;
+    portEXIT_CRITICAL(&relayMux);
+    if (!relayTimer || esp_timer_start_once(relayTimer, serveDurationUs) != ESP_OK) {
+        DEBUG_PRINTLN("Falha ao armar o timer do relé");
+    }
+}
+
+void CoffeeController::dropRequest(uint8_t index) {
+    ServeRequest& request = queue[index];
+    if (request.creditReserved) {
+        userManager.addCredits(UserManager::uidToString(request.uid), 1);
+    }
+    queueCount--;
+    memmove(queue + index, queue + index + 1, (queueCount - index) * sizeof(ServeRequest));
+    queueVersion++;
+    stateVersion++;
+}
+
+void CoffeeController::expireRequests() {
+    // FIFO: o primeiro da fila é sempre o que espera há mais tempo
+    int64_t now = esp_timer_get_time();
+    while (queueCount > 0 && now - queue[0].queuedAt >= SERVE_QUEUE_TIMEOUT_MS * 1000LL) {
+        DEBUG_PRINTF("Pedido #%u expirou na fila\n", (unsigned)queue[0].ticket);
+        queueStats.timedOut++;
+        dropRequest(0);
+    }
+}
+
+void CoffeeController::acquire() {
+    if (lock) xSemaphoreTake(lock, portMAX_DELAY);
+}
+
+void CoffeeController::release() {
+    if (lock) xSemaphoreGive(lock);
+}
+
 void CoffeeController::saveToPreferences() {
-    if (!dataChanged) return;
+    acquire();
+    if (!dataChanged) {
+        release();
+        return;
+    }
+    int remaining = remainingCoffees;
+    dataChanged = false;
+    release();
     
+    // Só o estado da garrafa; contadores e estatísticas ficam no ledger.
+    // A NVS é gravada fora do lock para não segurar a tarefa do relé
     Preferences prefs;
     prefs.begin("coffee", false);
-    
-    prefs.putInt("remaining", remainingCoffees);
-    prefs.putInt("totalServed", totalServed);
-    prefs.putULong("totalTime", totalServeTime);
-    prefs.putULong("lastServed", lastServed);
-    prefs.putInt("dailyCount", dailyCount);
-    prefs.putULong("dailyReset", dailyResetTime);
-    
+    prefs.putInt("remaining", remaining);
     prefs.end();
     
-    dataChanged = false;
     lastSave = millis();
     
     DEBUG_PRINTLN("Dados da cafeteira salvos");
@@ -220,38 +564,28 @@ void CoffeeController::saveToPreferences() {
 
 void CoffeeController::loadFromPreferences() {
     Preferences prefs;
-    prefs.begin("coffee", true);
+    prefs.begin("coffee", false);
     
     remainingCoffees = prefs.getInt("remaining", MAX_COFFEES);
-    totalServed = prefs.getInt("totalServed", 0);
-    totalServeTime = prefs.getULong("totalTime", 0);
-    lastServed = prefs.getULong("lastServed", 0);
-    dailyCount = prefs.getInt("dailyCount", 0);
-    dailyResetTime = prefs.getULong("dailyReset", millis());
+    
+    // Sem arquivo do ledger, os contadores antigos da NVS viram o ponto de
+    // partida; as chaves só saem depois que o ledger já foi gravado
+    if (ledger.begin()) {
+        prefs.remove("totalServed");
+        prefs.remove("totalTime");
+        prefs.remove("lastServed");
+        prefs.remove("dailyCount");
+        prefs.remove("dailyReset");
+    } else if (prefs.isKey("totalServed")) {
+        ledger.restoreTotals(max(0, prefs.getInt("totalServed", 0)), prefs.getULong("totalTime", 0));
+        DEBUG_PRINTLN("Contadores da NVS migrados para o ledger");
+    }
     
     prefs.end();
     
     // Validar dados carregados
     if (remainingCoffees < 0) remainingCoffees = 0;
     if (remainingCoffees > MAX_COFFEES) remainingCoffees = MAX_COFFEES;
-    if (totalServed < 0) totalServed = 0;
-    if (dailyCount < 0) dailyCount = 0;
     
     DEBUG_PRINTLN("Dados da cafeteira carregados");
 }
-
-void CoffeeController::checkDailyReset() {
-    unsigned long currentTime = millis();
-    
-    // Verificar overflow do millis()
-    if (currentTime < dailyResetTime) {
-        dailyResetTime = currentTime;
-        dataChanged = true;
-    }
-    
-    // Verificar se passou um dia desde o último reset
-    if ((currentTime - dailyResetTime) >= MILLIS_PER_DAY) {
-        DEBUG_PRINTLN("Executando reset diário das estatísticas");
-        resetDailyStats();
-    }
-}
\ No newline at end of file
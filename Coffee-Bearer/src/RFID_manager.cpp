@@ -1,7 +1,12 @@
 #include "RFID_manager.h"
+#include <esp_timer.h>
 
 extern WebServerManager webServer;
 
+volatile bool RFIDManager::irqFired = false;
+volatile int64_t RFIDManager::irqAt = 0;
+TaskHandle_t RFIDManager::irqTask = nullptr;
+
 // --- Constructor ---
 RFIDManager::RFIDManager(UserManager& users, CoffeeController& coffee, Logger& log, FeedbackManager& feedback) : 
     mfrc522(nullptr),
@@ -13,8 +18,13 @@ RFIDManager::RFIDManager(UserManager& users, CoffeeController& coffee, Logger& l
     lastReadTime(0),
     cooldownEndTime(0),
     initialized(false),
+    irqEnabled(false),
+    pollInterval(RFID_POLL_MIN_MS),
+    lastActivity(0),
+    detectedAt(0),
     currentMode(SCAN_NORMAL)
 {
+    memset(&stats, 0, sizeof(stats));
 }
 
 RFIDManager::~RFIDManager() {
@@ -43,6 +53,10 @@ bool RFIDManager::begin() {
         return false;
     }
     
+    if (RFID_IRQ_PIN >= 0) {
+        setupCardIrq();
+    }
+    
     initialized = true;
     DEBUG_PRINTLN("RFID Manager inicializado com sucesso");
     printRFIDInfo();
@@ -51,6 +65,10 @@ bool RFIDManager::begin() {
 }
 
 void RFIDManager::end() {
+    if (irqEnabled) {
+        detachInterrupt(digitalPinToInterrupt(RFID_IRQ_PIN));
+        irqEnabled = false;
+    }
     if (mfrc522) {
         delete mfrc522;
         mfrc522 = nullptr;
@@ -58,14 +76,130 @@ void RFIDManager::end() {
     initialized = false;
 }
 
-void RFIDManager::loop() {
-    if (!initialized || !mfrc522 || isInCooldown()) {
-        return;
+uint32_t RFIDManager::loop() {
+    if (!initialized || !mfrc522) {
+        return RFID_POLL_MAX_MS;
+    }
+    if (isInCooldown()) {
+        return getRemainingCooldown();
+    }
+    
+    if (cardDetected()) {
+        processCard();
+        // A conversa com o cartão também aciona o IRQ: descarta antes do próximo REQA
+        irqFired = false;
+        lastActivity = millis();
+        pollInterval = RFID_POLL_MIN_MS;
+    } else if (millis() - lastActivity >= RFID_POLL_IDLE_MS && pollInterval < RFID_POLL_MAX_MS) {
+        // Ninguém na máquina: menos tráfego SPI a cada rodada, até o teto
+        pollInterval = min(pollInterval * 2, (uint32_t)RFID_POLL_MAX_MS);
+    }
+    
+    if (isInCooldown()) {
+        return getRemainingCooldown();
+    }
+    
+    // Com IRQ, o próximo REQA sai agora; a resposta do cartão acorda a tarefa
+    if (irqEnabled) {
+        armCardDetect();
+    }
+    return pollInterval;
+}
+
+void RFIDManager::waitForCard(uint32_t waitMs) {
+    irqTask = xTaskGetCurrentTaskHandle();
+    ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(waitMs));
+}
+
+unsigned long RFIDManager::getRemainingCooldown() {
+    long remaining = (long)(cooldownEndTime - millis());
+    return remaining > 0 ? remaining : 0;
+}
+
+void RFIDManager::setScanMode(ScanMode mode) {
+    this->currentMode = mode;
+    if (mode == SCAN_FOR_ADD) {
+        // Alguém vai aproximar um cartão: volta ao intervalo curto
+        pollInterval = RFID_POLL_MIN_MS;
+        lastActivity = millis();
+        DEBUG_PRINTLN("RFID Manager: Modo de leitura para adicionar usuário ativado.");
+    } else {
+        DEBUG_PRINTLN("RFID Manager: Modo de leitura normal ativado.");
+    }
+}
+
+// --- Private Methods ---
+
+void IRAM_ATTR RFIDManager::onCardIrq() {
+    irqFired = true;
+    irqAt = esp_timer_get_time();
+    
+    BaseType_t woken = pdFALSE;
+    if (irqTask) {
+        vTaskNotifyGiveFromISR(irqTask, &woken);
+    }
+    portYIELD_FROM_ISR(woken);
+}
+
+void RFIDManager::setupCardIrq() {
+    pinMode(RFID_IRQ_PIN, INPUT_PULLUP);
+    
+    // IRqInv (pino ativo em nível baixo) + RxIEn: só a resposta de um cartão gera IRQ
+    mfrc522->PCD_WriteRegister(MFRC522::ComIEnReg, 0xA0);
+    mfrc522->PCD_WriteRegister(MFRC522::ComIrqReg, 0x7F);
+    attachInterrupt(digitalPinToInterrupt(RFID_IRQ_PIN), onCardIrq, FALLING);
+    irqEnabled = true;
+    
+    armCardDetect();
+    DEBUG_PRINTF("RFID: detecção por IRQ no GPIO %d\n", RFID_IRQ_PIN);
+}
+
+void RFIDManager::armCardDetect() {
+    // Um REQA de 7 bits sem esperar pela resposta (PICC_IsNewCardPresent fica
+    // consultando ComIrqReg até o timeout do chip quando não há cartão)
+    irqFired = false;
+    mfrc522->PCD_WriteRegister(MFRC522::CommandReg, MFRC522::PCD_Idle);
+    mfrc522->PCD_WriteRegister(MFRC522::ComIrqReg, 0x7F);
+    mfrc522->PCD_WriteRegister(MFRC522::FIFOLevelReg, 0x80);
+    mfrc522->PCD_WriteRegister(MFRC522::FIFODataReg, MFRC522::PICC_CMD_REQA);
+    mfrc522->PCD_WriteRegister(MFRC522::CommandReg, MFRC522::PCD_Transceive);
+    mfrc522->PCD_WriteRegister(MFRC522::BitFramingReg, 0x87);   // StartSend
+    stats.polls++;
+}
+
+bool RFIDManager::cardDetected() {
+    if (!irqEnabled) {
+        stats.polls++;
+        if (!mfrc522->PICC_IsNewCardPresent()) {
+            return false;
+        }
+        detectedAt = esp_timer_get_time();
+        return true;
     }
     
-    if (!mfrc522->PICC_IsNewCardPresent() || !mfrc522->PICC_ReadCardSerial()) {
+    if (!irqFired) {
+        return false;
+    }
+    
+    // O cartão respondeu ao REQA e está em READY: segue direto para a anticolisão
+    irqFired = false;
+    detectedAt = irqAt;
+    stats.irqWakeups++;
+    mfrc522->PCD_WriteRegister(MFRC522::CommandReg, MFRC522::PCD_Idle);
+    mfrc522->PCD_WriteRegister(MFRC522::ComIrqReg, 0x7F);
+    return true;
+}
+
+void RFIDManager::processCard() {
+    int64_t readStart = esp_timer_get_time();
+    if (!mfrc522->PICC_ReadCardSerial()) {
+        stats.readErrors++;
         return;
     }
+    uint32_t readUs = (uint32_t)(esp_timer_get_time() - readStart);
+    stats.reads++;
+    stats.readTimeUs += readUs;
+    if (readUs > stats.maxReadTimeUs) stats.maxReadTimeUs = readUs;
     
     String uid = readUID();
     if (uid.isEmpty()) {
@@ -75,6 +209,7 @@ void RFIDManager::loop() {
     
     // Prevent rapid re-reads of the same card
     if (uid == lastUID && (millis() - lastReadTime) < 2000) {
+        stats.duplicates++;
         mfrc522->PICC_HaltA();
         return;
     }
@@ -111,6 +246,10 @@ void RFIDManager::loop() {
             }
         }
         handleRFIDResult(uid, userName, result);
+        stats.results[result]++;
+        if (result == RFID_SUCCESS) {
+            recordTapLatency(detectedAt);
+        }
     }
     
     startCooldown();
@@ -118,38 +257,38 @@ void RFIDManager::loop() {
     mfrc522->PCD_StopCrypto1();
 }
 
-void RFIDManager::setScanMode(ScanMode mode) {
-    this->currentMode = mode;
-    if (mode == SCAN_FOR_ADD) {
-        DEBUG_PRINTLN("RFID Manager: Modo de leitura para adicionar usuário ativado.");
-    } else {
-        DEBUG_PRINTLN("RFID Manager: Modo de leitura normal ativado.");
-    }
-}
-
-// --- Private Methods ---
-
 RFIDResult RFIDManager::processNormalUser(const String& uid) {
-    if (coffeeController.isBusy()) return RFID_SYSTEM_BUSY;
     if (coffeeController.isEmpty()) return RFID_NO_COFFEE;
     
-    UserCredits* user = userManager.getUserByUID(uid);
-    if (!user) return RFID_ACCESS_DENIED;
-    if (user->credits <= 0) return RFID_NO_CREDITS;
+    // Créditos vêm da tabela quente; o nome só é lido para o log
+    int credits = userManager.getUserCredits(uid);
+    if (credits < 0) return RFID_ACCESS_DENIED;
     
-    if (coffeeController.serveCoffee(user->name, &user->credits)) {
-        userManager.updateLastUsed(uid);
-        logger.logRFIDEvent(uid, user->name, "CAFE_SERVIDO", true);
-        return RFID_SUCCESS;
-    } else {
-        logger.logRFIDEvent(uid, user->name, "FALHA_SERVIR", false);
-        return RFID_ERROR;
+    // Ocupado não é recusa: o pedido entra na fila com o crédito reservado
+    ServeTicket ticket = coffeeController.requestServe(SERVE_SOURCE_RFID, uid);
+    switch (ticket.result) {
+        case SERVE_STARTED:
+            logger.logRFIDEvent(uid, userManager.getUserName(uid), "CAFE_SERVIDO", true);
+            return RFID_SUCCESS;
+        case SERVE_QUEUED:
+            logger.logRFIDEvent(uid, userManager.getUserName(uid), "NA_FILA_" + String(ticket.position), true);
+            return RFID_QUEUED;
+        case SERVE_ALREADY_QUEUED:
+            // Sem log: quem toca de novo só ouve que continua na fila
+            return RFID_QUEUED;
+        case SERVE_NO_CREDITS:
+            return RFID_NO_CREDITS;
+        case SERVE_NO_COFFEE:
+            return RFID_NO_COFFEE;
+        default:
+            logger.logRFIDEvent(uid, userManager.getUserName(uid), "FILA_CHEIA", false);
+            return RFID_SYSTEM_BUSY;
     }
 }
 
 void RFIDManager::processMasterKey() {
     DEBUG_PRINTLN("CHAVE MESTRA DETECTADA!");
-    coffeeController.refillContainer();
+    coffeeController.refillContainer(SERVE_SOURCE_RFID);
     logger.logRFIDEvent(MASTER_UID, "MASTER", "REABASTECIMENTO", true);
 }
 
@@ -161,6 +300,9 @@ void RFIDManager::handleRFIDResult(const String& uid, const String& userName, RF
         case RFID_MASTER_KEY:
             feedbackManager.signalMasterKey();
             break;
+        case RFID_QUEUED:
+            feedbackManager.signalQueued();
+            break;
         case RFID_ACCESS_DENIED:
             feedbackManager.signalUnknownUser();
             break;
@@ -173,6 +315,17 @@ void RFIDManager::handleRFIDResult(const String& uid, const String& userName, RF
     }
 }
 
+void RFIDManager::recordTapLatency(int64_t tappedAt) {
+    uint32_t latency = (uint32_t)(coffeeController.getRelayOnTime() - tappedAt);
+    stats.taps++;
+    stats.tapLatencyUs += latency;
+    if (latency > stats.maxTapLatencyUs) stats.maxTapLatencyUs = latency;
+    if (latency > TAP_LATENCY_BUDGET_US) {
+        stats.lateTaps++;
+        DEBUG_PRINTF("RFID: relé acionado %u µs após a leitura (limite %lu)\n", (unsigned)latency, TAP_LATENCY_BUDGET_US);
+    }
+}
+
 // --- Helper and Debug Methods (Unchanged) ---
 
 String RFIDManager::readUID() {
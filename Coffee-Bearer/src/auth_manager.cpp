@@ -1,321 +1,532 @@
 #include "auth_manager.h"
 #include <Preferences.h>
+#include <SPIFFS.h>
 #include <WiFi.h>
 #include <mbedtls/md.h>
+#include <mbedtls/pkcs5.h>
+#include <esp_system.h>
+#include <time.h>
 
-AuthManager::AuthManager() {
-    // Constructor - vectors are automatically initialized
+// Formato do token sem estado (64 caracteres hex = payload + HMAC truncado):
+// [0] versão, [1] papel, [2..3] conta, [4..7] ID, [8..11] emissão, [12..15] expiração
+#define STATELESS_TOKEN_VERSION 1
+#define STATELESS_TOKEN_HEX_LEN ((AUTH_TOKEN_PAYLOAD_BYTES + AUTH_TOKEN_MAC_BYTES) * 2)
+
+// Arquivo de contas: cabeçalho seguido dos registros AuthAccount, na ordem dos slots
+#define ACCOUNTS_FILE_MAGIC 0x43414342UL           // "BCAC"
+#define ACCOUNTS_FILE_VERSION 1
+#define ACCOUNTS_TEMP_FILE "/accounts.tmp"
+
+struct AccountsFileHeader {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t recordSize;
+    uint16_t count;
+    uint16_t reserved;
+};
+
+// Segura o lock do AuthManager até o fim do escopo (métodos com vários retornos)
+class AuthLock {
+public:
+    explicit AuthLock(AuthManager& auth) : auth(auth) { auth.acquire(); }
+    ~AuthLock() { auth.release(); }
+
+private:
+    AuthManager& auth;
+};
+
+AuthManager::AuthManager() :
+    tokenKeyReady(false),
+    nextTokenId(0),
+    reservedTokenId(0),
+    passwordHmacReady(false),
+    lock(nullptr) {
+    resetSessionTable();
+    resetAttemptTable();
+    memset(&securityStats, 0, sizeof(securityStats));
+    memset(revokedTokens, 0, sizeof(revokedTokens));
+    for (TokenRefresh& entry : refreshes) {
+        entry.fromId = 0;
+        entry.fromExpiresAt = 0;
+        entry.toId = 0;
+    }
 }
 
 bool AuthManager::begin() {
-    // Carregar credenciais salvas ou usar padrões
-    Preferences prefs;
-    prefs.begin("auth", true);
-    
-    // Carregar credenciais de admin
-    String adminUser = prefs.getString("admin_user", DEFAULT_ADMIN_USER);
-    String adminPass = prefs.getString("admin_pass", "");
-    
-    if (adminPass.length() == 0) {
-        // Primeira inicialização - usar senha padrão
-        adminPass = hashPassword(DEFAULT_ADMIN_PASS);
-        prefs.end();
-        prefs.begin("auth", false);
-        prefs.putString("admin_user", adminUser);
-        prefs.putString("admin_pass", adminPass);
-        prefs.end();
-        prefs.begin("auth", true);
-    }
-    
-    adminCredentials.clear();
-    adminCredentials.push_back(std::make_pair(adminUser, adminPass));
-    
-    // Carregar credenciais de usuário
-    String userUser = prefs.getString("user_user", DEFAULT_USER_USER);
-    String userPass = prefs.getString("user_pass", "");
-    
-    if (userPass.length() == 0) {
-        // Primeira inicialização - usar senha padrão
-        userPass = hashPassword(DEFAULT_USER_PASS);
-        prefs.end();
-        prefs.begin("auth", false);
-        prefs.putString("user_user", userUser);
-        prefs.putString("user_pass", userPass);
-        prefs.end();
-        prefs.begin("auth", true);
-    }
-    
-    userCredentials.clear();
-    userCredentials.push_back(std::make_pair(userUser, userPass));
-    prefs.end();
+    if (!lock) {
+        lock = xSemaphoreCreateRecursiveMutex();
+    }
+    AuthLock guard(*this);
+    
+    if (!passwordHmacReady) {
+        mbedtls_md_init(&passwordHmac);
+        passwordHmacReady = mbedtls_md_setup(&passwordHmac, mbedtls_md_info_from_type(MBEDTLS_MD_SHA256), 1) == 0;
+    }
+    
+    // Tokens antes das contas: contas novas partem do próximo ID de token
+#if AUTH_STATELESS_TOKENS
+    if (!loadTokenKey()) {
+        DEBUG_PRINTLN("Falha ao carregar chave de tokens, usando apenas sessões em memória");
+    }
+#endif
+    
+    // Carregar contas salvas ou migrar as credenciais antigas (um admin e um usuário)
+    if (!loadAccounts()) {
+        migrateLegacyCredentials();
+    }
     
     DEBUG_PRINTLN("Auth Manager inicializado");
-    DEBUG_PRINTF("Admin user: %s\n", adminUser.c_str());
-    DEBUG_PRINTF("User user: %s\n", userUser.c_str());
+    DEBUG_PRINTF("Contas web: %d\n", getAccountCount());
     
     return true;
 }
 
 void AuthManager::resetToDefault() {
+    AuthLock guard(*this);
     Preferences prefs;
     prefs.begin("auth", false);
     prefs.clear();
     prefs.end();
+    SPIFFS.remove(AUTH_ACCOUNTS_FILE);
     
-    adminCredentials.clear();
-    userCredentials.clear();
-    activeSessions.clear();
-    loginAttempts.clear();
+    accounts.clear();
+    accountIndex.clear();
+    resetSessionTable();
+    resetAttemptTable();
     
     begin(); // Reinicializar com valores padrão
 }
 
-bool AuthManager::setAdminCredentials(const String& username, const String& password) {
-    if (username.length() < 3 || password.length() < 6) {
+bool AuthManager::addAccount(const String& username, const String& password, UserRole role, const String& rfidUid) {
+    AuthLock guard(*this);
+    AuthAccount account;
+    memset(&account, 0, sizeof(account));
+    
+    if (!isValidUsername(username) || password.length() < 6 || role == ROLE_GUEST ||
+        !normalizeCardUid(rfidUid, account.rfidUid)) {
+        return false;
+    }
+    if (findAccountSlot(username) != -1 || getAccountCount() >= AUTH_MAX_ACCOUNTS) {
+        return false;
+    }
+    if (!createPasswordRecord(password, account.password)) {
         return false;
     }
     
-    String hashedPassword = hashPassword(password);
-    
-    Preferences prefs;
-    prefs.begin("auth", false);
-    prefs.putString("admin_user", username);
-    prefs.putString("admin_pass", hashedPassword);
-    prefs.end();
-    
-    adminCredentials.clear();
-    adminCredentials.push_back(std::make_pair(username, hashedPassword));
+    strlcpy(account.username, username.c_str(), sizeof(account.username));
+    account.role = role;
+    account.minTokenId = nextTokenId;  // Slot reaproveitado não herda tokens antigos
     
-    // Terminar sessões existentes do admin
-    terminateSessionsForUser(username);
+    int slot = allocateAccountSlot();
+    accounts[slot] = account;
+    accountIndexInsert(slot);
+    saveAccounts();
     
+    DEBUG_PRINTF("Conta criada: %s (%s)\n", account.username, roleToString(role).c_str());
     return true;
 }
 
-bool AuthManager::setUserCredentials(const String& username, const String& password) {
-    if (username.length() < 3 || password.length() < 6) {
+bool AuthManager::updateAccount(const String& username, const String& password, UserRole role, const String& rfidUid) {
+    AuthLock guard(*this);
+    int slot = findAccountSlot(username);
+    if (slot == -1 || role == ROLE_GUEST || (password.length() > 0 && password.length() < 6)) {
         return false;
     }
     
-    String hashedPassword = hashPassword(password);
+    AuthAccount& account = accounts[slot];
+    char uid[AUTH_ACCOUNT_UID_MAX + 1];
+    if (!normalizeCardUid(rfidUid, uid)) {
+        return false;
+    }
     
-    Preferences prefs;
-    prefs.begin("auth", false);
-    prefs.putString("user_user", username);
-    prefs.putString("user_pass", hashedPassword);
-    prefs.end();
+    // Nunca deixar o sistema sem administrador
+    if (account.role == ROLE_ADMIN && role != ROLE_ADMIN && countAdmins() <= 1) {
+        return false;
+    }
     
-    userCredentials.clear();
-    userCredentials.push_back(std::make_pair(username, hashedPassword));
+    bool credentialsChanged = (account.role != role);
+    if (password.length() > 0) {
+        if (!createPasswordRecord(password, account.password)) {
+            return false;
+        }
+        credentialsChanged = true;
+    }
+    account.role = role;
+    strlcpy(account.rfidUid, uid, sizeof(account.rfidUid));
+    
+    // Senha ou papel alterados: sessões existentes deixam de valer
+    if (credentialsChanged) {
+        terminateSessionsForUser(username);
+    }
+    saveAccounts();
+    return true;
+}
+
+bool AuthManager::removeAccount(const String& username) {
+    AuthLock guard(*this);
+    int slot = findAccountSlot(username);
+    if (slot == -1) {
+        return false;
+    }
+    if (accounts[slot].role == ROLE_ADMIN && countAdmins() <= 1) {
+        return false;
+    }
     
-    // Terminar sessões existentes do usuário
     terminateSessionsForUser(username);
+    memset(&accounts[slot], 0, sizeof(AuthAccount));
+    trimFreeSlots();
+    rebuildAccountIndex();
+    saveAccounts();
     
+    DEBUG_PRINTF("Conta removida: %s\n", username.c_str());
     return true;
 }
 
 bool AuthManager::changePassword(const String& username, const String& oldPassword, const String& newPassword) {
+    AuthLock guard(*this);
     if (newPassword.length() < 6) {
         return false;
     }
     
     // Verificar senha antiga
-    bool isAdmin = hasAdminCredentials(username);
-    bool isUser = hasUserCredentials(username);
-    
-    if (!isAdmin && !isUser) {
+    int slot = findAccountSlot(username);
+    if (slot == -1 || !verifyPassword(oldPassword, accounts[slot].password)) {
         return false;
     }
     
-    String storedHash = isAdmin ? findAdminPassword(username) : findUserPassword(username);
-    if (storedHash.length() == 0 || !verifyPassword(oldPassword, storedHash)) {
+    // Definir nova senha
+    if (!createPasswordRecord(newPassword, accounts[slot].password)) {
+        return false;
+    }
+    terminateSessionsForUser(username);
+    saveAccounts();
+    return true;
+}
+
+bool AuthManager::findAccount(const String& username, AuthAccount& out) {
+    AuthLock guard(*this);
+    int slot = findAccountSlot(username);
+    if (slot == -1) {
         return false;
     }
+    out = accounts[slot];
+    return true;
+}
+
+bool AuthManager::getAccountAt(size_t slot, AuthAccount& out) {
+    AuthLock guard(*this);
+    const AuthAccount* account = accountAt(slot);
+    if (!account) {
+        return false;
+    }
+    out = *account;
+    return true;
+}
+
+const AuthAccount* AuthManager::accountAt(size_t slot) {
+    if (slot >= accounts.size() || accounts[slot].username[0] == '\0') {
+        return nullptr;
+    }
+    return &accounts[slot];
+}
+
+int AuthManager::getAccountCount() {
+    AuthLock guard(*this);
+    int count = 0;
+    for (const auto& account : accounts) {
+        if (account.username[0] != '\0') count++;
+    }
+    return count;
+}
+
+int AuthManager::restoreAccounts(const std::vector<AuthAccount>& restored) {
+    AuthLock guard(*this);
+    // Insere ou substitui pelo nome de usuário; uma única gravação no final
+    int applied = 0;
+    for (const auto& incoming : restored) {
+        int slot = findAccountSlot(incoming.username);
+        if (slot == -1) {
+            if (getAccountCount() >= AUTH_MAX_ACCOUNTS) {
+                continue;
+            }
+            slot = allocateAccountSlot();
+            accounts[slot] = incoming;
+            accountIndexInsert(slot);
+        } else {
+            // Nunca deixar o sistema sem administrador
+            if (accounts[slot].role == ROLE_ADMIN && incoming.role != ROLE_ADMIN && countAdmins() <= 1) {
+                continue;
+            }
+            accounts[slot] = incoming;
+            terminateSessionsForUser(incoming.username);
+        }
+        accounts[slot].minTokenId = nextTokenId;
+        applied++;
+    }
     
-    // Definir nova senha
-    if (isAdmin) {
-        return setAdminCredentials(username, newPassword);
-    } else {
-        return setUserCredentials(username, newPassword);
+    if (applied > 0) {
+        saveAccounts();
     }
+    return applied;
 }
 
-String AuthManager::login(const String& username, const String& password, const String& ipAddress) {
+String AuthManager::login(const String& username, const String& password, uint32_t ipAddress) {
+    AuthLock guard(*this);
     // Verificar se IP está bloqueado
     if (isIpBlocked(ipAddress)) {
+        securityStats.blockedAttempts++;
         return "";
     }
     
     // Verificar credenciais
-    UserRole role = ROLE_GUEST;
-    String storedHash = "";
-    
-    if (hasAdminCredentials(username)) {
-        storedHash = findAdminPassword(username);
-        role = ROLE_ADMIN;
-    } else if (hasUserCredentials(username)) {
-        storedHash = findUserPassword(username);
-        role = ROLE_USER;
-    } else {
+    int slot = findAccountSlot(username);
+    if (slot == -1) {
+        // Usuário inexistente custa o mesmo PBKDF2 que um existente: o tempo
+        // de resposta não revela quais nomes têm conta
+        static const uint8_t dummySalt[AUTH_PASSWORD_SALT_BYTES] = { 0 };
+        uint8_t dummyHash[AUTH_PASSWORD_HASH_BYTES];
+        derivePassword(password, dummySalt, AUTH_PBKDF2_ITERATIONS, dummyHash);
         recordFailedLogin(ipAddress);
         return "";
     }
-    
-    if (storedHash.length() == 0 || !verifyPassword(password, storedHash)) {
+    if (!verifyPassword(password, accounts[slot].password)) {
         recordFailedLogin(ipAddress);
         return "";
     }
     
-    // Login bem-sucedido - criar sessão
-    String sessionId = generateSessionId();
+    AuthAccount& account = accounts[slot];
+    UserRole role = (UserRole)account.role;
     
-    AuthSession session;
-    session.sessionId = sessionId;
-    session.username = username;
-    session.role = role;
-    session.createdAt = millis();
-    session.lastAccess = millis();
-    session.ipAddress = ipAddress;
-    session.isActive = true;
+    // Hash legado ou com menos iterações: regravar no formato atual
+    if (account.password.iterations < AUTH_PBKDF2_ITERATIONS) {
+        if (createPasswordRecord(password, account.password)) {
+            saveAccounts();
+            DEBUG_PRINTF("Senha de %s migrada para PBKDF2\n", username.c_str());
+        }
+    }
     
-    activeSessions.push_back(session);
+    // Login bem-sucedido - token assinado se o relógio estiver sincronizado,
+    // senão uma sessão na tabela em memória
+    String sessionId;
+#if AUTH_STATELESS_TOKENS
+    if (statelessAvailable()) {
+        sessionId = issueStatelessToken(slot);
+    }
+#endif
     
-    // Limpar tentativas de login para este IP
-    for (auto it = loginAttempts.begin(); it != loginAttempts.end(); ++it) {
-        if (it->ipAddress == ipAddress) {
-            loginAttempts.erase(it);
-            break;
-        }
+    if (sessionId.length() == 0) {
+        SessionToken token;
+        generateSessionToken(token);
+        
+        int slot = acquireSessionSlot(token);
+        AuthSession& session = sessionSlots[slot].session;
+        strlcpy(session.username, username.c_str(), sizeof(session.username));
+        session.role = role;
+        session.createdAt = millis();
+        session.lastAccess = session.createdAt;
+        session.ipAddress = ipAddress;
+        session.isActive = true;
+        
+        sessionId = sessionTokenToString(token);
     }
     
+    // Limpar tentativas de login para este IP
+    clearFailedLogins(ipAddress);
+    
     DEBUG_PRINTF("Login successful: %s (%s)\n", username.c_str(), roleToString(role).c_str());
     return sessionId;
 }
 
 bool AuthManager::logout(const String& sessionId) {
-    for (auto it = activeSessions.begin(); it != activeSessions.end(); ++it) {
-        if (it->sessionId == sessionId) {
-            activeSessions.erase(it);
-            DEBUG_PRINTLN("Logout successful");
-            return true;
+    AuthLock guard(*this);
+#if AUTH_STATELESS_TOKENS
+    uint32_t tokenId;
+    AuthSession session;
+    if (validateStatelessToken(sessionId.c_str(), sessionId.length(), session, &tokenId)) {
+        revokeStatelessToken(tokenId);
+        // Token original e substituto caem juntos, qualquer que seja o usado no logout
+        for (TokenRefresh& entry : refreshes) {
+            if (entry.fromExpiresAt == 0 || (entry.fromId != tokenId && entry.toId != tokenId)) continue;
+            revokeStatelessToken(entry.fromId);
+            revokeStatelessToken(entry.toId);
+            entry.fromExpiresAt = 0;
+            entry.token = "";
         }
+        DEBUG_PRINTLN("Logout successful");
+        return true;
     }
-    return false;
+#endif
+    
+    SessionToken token;
+    if (!parseSessionToken(sessionId.c_str(), sessionId.length(), token)) {
+        return false;
+    }
+    
+    int slot = findSessionSlot(token);
+    if (slot == -1) {
+        return false;
+    }
+    
+    releaseSessionSlot(slot);
+    DEBUG_PRINTLN("Logout successful");
+    return true;
 }
 
 bool AuthManager::isValidSession(const String& sessionId) {
-    cleanupExpiredSessions();
-    
-    for (auto& session : activeSessions) {
-        if (session.sessionId == sessionId && session.isActive) {
-            // Verificar se não expirou
-            if (millis() - session.lastAccess < SESSION_TIMEOUT_MS) {
-                return true;
-            }
-        }
-    }
-    return false;
+    AuthSession session;
+    return getSession(sessionId, session);
 }
 
-AuthSession* AuthManager::getSession(const String& sessionId) {
-    for (auto& session : activeSessions) {
-        if (session.sessionId == sessionId && session.isActive) {
-            return &session;
-        }
-    }
-    return nullptr;
+bool AuthManager::getSession(const String& sessionId, AuthSession& out) {
+    AuthLock guard(*this);
+    return resolveSession(sessionId.c_str(), sessionId.length(), out);
 }
 
 UserRole AuthManager::getSessionRole(const String& sessionId) {
-    AuthSession* session = getSession(sessionId);
-    return session ? session->role : ROLE_GUEST;
+    AuthSession session;
+    return getSession(sessionId, session) ? session.role : ROLE_GUEST;
 }
 
-bool AuthManager::isIpBlocked(const String& ipAddress) {
-    cleanupOldAttempts();
-    
-    LoginAttempt* attempt = findLoginAttempt(ipAddress);
-    if (!attempt) {
-        return false;
-    }
-    
-    return (attempt->attemptCount >= MAX_LOGIN_ATTEMPTS && 
-            millis() < attempt->lockoutUntil);
+bool AuthManager::isIpBlocked(uint32_t ipAddress) {
+    return getBlockTimeRemaining(ipAddress) > 0;
 }
 
-void AuthManager::recordFailedLogin(const String& ipAddress) {
-    cleanupOldAttempts();
+void AuthManager::recordFailedLogin(uint32_t ipAddress) {
+    AuthLock guard(*this);
+    securityStats.failedLogins++;
     
-    LoginAttempt* attempt = findLoginAttempt(ipAddress);
-    if (!attempt) {
-        LoginAttempt newAttempt;
-        newAttempt.ipAddress = ipAddress;
-        newAttempt.timestamp = millis();
-        newAttempt.attemptCount = 1;
-        newAttempt.lockoutUntil = 0;
-        loginAttempts.push_back(newAttempt);
-        return;
+    int slot = findAttemptSlot(ipAddress);
+    if (slot == -1) {
+        slot = acquireAttemptSlot(ipAddress);
+    } else {
+        lruUnlink(slot);
+        lruPushFront(slot);
     }
     
-    attempt->attemptCount++;
-    attempt->timestamp = millis();
+    LoginAttempt& attempt = attemptSlots[slot].attempt;
+    unsigned long now = millis();
+    decayAttempt(attempt, now);
+    if (attempt.attemptCount == 0) {
+        attempt.updatedAt = now;
+    }
+    if (attempt.attemptCount < 255) {
+        attempt.attemptCount++;
+    }
     
-    if (attempt->attemptCount >= MAX_LOGIN_ATTEMPTS) {
-        attempt->lockoutUntil = millis() + LOCKOUT_TIME_MS;
-        DEBUG_PRINTF("IP %s bloqueado por %d minutos\n", 
-                    ipAddress.c_str(), LOCKOUT_TIME_MS / 60000);
+    if (attempt.attemptCount >= MAX_LOGIN_ATTEMPTS && attempt.lockoutUntil == 0) {
+        attempt.lockoutUntil = now + LOCKOUT_TIME_MS;
+        if (attempt.lockoutUntil == 0) attempt.lockoutUntil = 1;
+        securityStats.lockouts++;
+        DEBUG_PRINTF("IP %s bloqueado por %lu minutos\n",
+                    IPAddress(ipAddress).toString().c_str(), LOCKOUT_TIME_MS / 60000);
     }
 }
 
-unsigned long AuthManager::getBlockTimeRemaining(const String& ipAddress) {
+void AuthManager::clearFailedLogins(uint32_t ipAddress) {
+    AuthLock guard(*this);
+    int slot = findAttemptSlot(ipAddress);
+    if (slot != -1) {
+        releaseAttemptSlot(slot);
+    }
+}
+
+unsigned long AuthManager::getBlockTimeRemaining(uint32_t ipAddress) {
+    AuthLock guard(*this);
     LoginAttempt* attempt = findLoginAttempt(ipAddress);
-    if (!attempt || millis() >= attempt->lockoutUntil) {
+    if (!attempt || attempt->lockoutUntil == 0) {
         return 0;
     }
     return attempt->lockoutUntil - millis();
 }
 
-void AuthManager::updateSessionAccess(const String& sessionId) {
-    for (auto& session : activeSessions) {
-        if (session.sessionId == sessionId) {
-            session.lastAccess = millis();
-            break;
+LoginSecurityStats AuthManager::getSecurityStats() {
+    AuthLock guard(*this);
+    cleanupOldAttempts();
+    
+    LoginSecurityStats stats = securityStats;
+    stats.trackedIps = attemptCount;
+    stats.lockedIps = 0;
+    unsigned long now = millis();
+    for (int slot = attemptLruHead; slot != -1; slot = attemptSlots[slot].lruNext) {
+        if (decayAttempt(attemptSlots[slot].attempt, now)) {
+            stats.lockedIps++;
         }
     }
+    return stats;
 }
 
+std::vector<LoginAttempt> AuthManager::getLoginAttempts() {
+    AuthLock guard(*this);
+    cleanupOldAttempts();
+    
+    // Decai antes de copiar: bloqueio vencido sai como 0, não como prazo passado
+    unsigned long now = millis();
+    std::vector<LoginAttempt> attempts;
+    attempts.reserve(attemptCount);
+    for (int slot = attemptLruHead; slot != -1; slot = attemptSlots[slot].lruNext) {
+        decayAttempt(attemptSlots[slot].attempt, now);
+        attempts.push_back(attemptSlots[slot].attempt);
+    }
+    return attempts;
+}
+
+void AuthManager::updateSessionAccess(const String& sessionId) {
+    AuthSession session;
+    getSession(sessionId, session);
+}
+
+// Tokens sem estado não ocupam a tabela e não entram nestas contagens
 int AuthManager::getActiveSessionCount() {
+    AuthLock guard(*this);
     cleanupExpiredSessions();
-    return activeSessions.size();
+    return sessionCount;
 }
 
 std::vector<AuthSession> AuthManager::getActiveSessions() {
+    AuthLock guard(*this);
     cleanupExpiredSessions();
-    return activeSessions;
+    
+    std::vector<AuthSession> sessions;
+    sessions.reserve(sessionCount);
+    for (uint8_t i = 0; i < sessionCount; i++) {
+        sessions.push_back(sessionSlots[expiryHeap[i]].session);
+    }
+    return sessions;
 }
 
 void AuthManager::terminateAllSessions() {
-    activeSessions.clear();
+    AuthLock guard(*this);
+    resetSessionTable();
+    
+    bool changed = false;
+    for (size_t i = 0; i < accounts.size(); i++) {
+        if (accounts[i].username[0] != '\0') {
+            changed |= revokeAccountTokens(i);
+        }
+    }
+    if (changed) {
+        saveAccounts();
+    }
     DEBUG_PRINTLN("Todas as sessões terminadas");
 }
 
 void AuthManager::terminateSessionsForUser(const String& username) {
-    activeSessions.erase(
-        std::remove_if(activeSessions.begin(), activeSessions.end(),
-            [&username](const AuthSession& session) {
-                return session.username == username;
-            }),
-        activeSessions.end()
-    );
+    AuthLock guard(*this);
+    for (int i = 0; i < MAX_ACTIVE_SESSIONS; i++) {
+        if (sessionSlots[i].session.isActive && username == sessionSlots[i].session.username) {
+            releaseSessionSlot(i);
+        }
+    }
+    
+    int slot = findAccountSlot(username);
+    if (slot != -1 && revokeAccountTokens(slot)) {
+        saveAccounts();
+    }
 }
 
 bool AuthManager::requireAuth(const String& sessionId, UserRole minimumRole) {
-    if (!isValidSession(sessionId)) {
-        return false;
-    }
-    
-    UserRole sessionRole = getSessionRole(sessionId);
-    return sessionRole >= minimumRole;
+    AuthSession session;
+    return getSession(sessionId, session) && session.role >= minimumRole;
 }
 
 String AuthManager::extractSessionFromCookie(const String& cookieHeader) {
@@ -351,129 +562,992 @@ UserRole AuthManager::stringToRole(const String& roleStr) {
     return ROLE_GUEST;
 }
 
-void AuthManager::maintenance() {
-    cleanupExpiredSessions();
-    cleanupOldAttempts();
+void AuthManager::registerJobs(MaintenanceScheduler& scheduler) {
+    // Both only look at the heap top / LRU tail, so they are cheap when idle
+    scheduler.every("auth.cleanup", AUTH_CLEANUP_INTERVAL_MS, [this]() {
+        AuthLock guard(*this);
+        cleanupExpiredSessions();
+        cleanupOldAttempts();
+    });
 }
 
 // Private helper methods
 
-String AuthManager::findAdminPassword(const String& username) {
-    for (const auto& cred : adminCredentials) {
-        if (cred.first == username) {
-            return cred.second;
-        }
+// Contas
+
+bool AuthManager::loadAccounts() {
+    File file = SPIFFS.open(AUTH_ACCOUNTS_FILE, "r");
+    if (!file) {
+        return false;
     }
-    return "";
+    
+    AccountsFileHeader header;
+    bool valid = file.read((uint8_t*)&header, sizeof(header)) == sizeof(header) &&
+                 header.magic == ACCOUNTS_FILE_MAGIC &&
+                 header.version == ACCOUNTS_FILE_VERSION &&
+                 header.recordSize == sizeof(AuthAccount) &&
+                 header.count <= AUTH_MAX_ACCOUNTS * 2;
+    
+    if (valid) {
+        accounts.assign(header.count, AuthAccount());
+        size_t bytes = header.count * sizeof(AuthAccount);
+        valid = file.read((uint8_t*)accounts.data(), bytes) == bytes;
+    }
+    file.close();
+    
+    if (!valid) {
+        DEBUG_PRINTLN("Arquivo de contas inválido");
+        accounts.clear();
+        return false;
+    }
+    
+    // Garante terminação das strings vindas do arquivo
+    for (auto& account : accounts) {
+        account.username[AUTH_USERNAME_MAX] = '\0';
+        account.rfidUid[AUTH_ACCOUNT_UID_MAX] = '\0';
+    }
+    trimFreeSlots();
+    rebuildAccountIndex();
+    return getAccountCount() > 0;
 }
 
-String AuthManager::findUserPassword(const String& username) {
-    for (const auto& cred : userCredentials) {
-        if (cred.first == username) {
-            return cred.second;
-        }
+bool AuthManager::saveAccounts() {
+    // Grava em arquivo temporário e troca, para não perder as contas se faltar energia
+    File file = SPIFFS.open(ACCOUNTS_TEMP_FILE, "w");
+    if (!file) {
+        DEBUG_PRINTLN("Erro ao gravar contas");
+        return false;
     }
-    return "";
+    
+    AccountsFileHeader header;
+    header.magic = ACCOUNTS_FILE_MAGIC;
+    header.version = ACCOUNTS_FILE_VERSION;
+    header.recordSize = sizeof(AuthAccount);
+    header.count = accounts.size();
+    header.reserved = 0;
+    
+    size_t bytes = accounts.size() * sizeof(AuthAccount);
+    bool ok = file.write((const uint8_t*)&header, sizeof(header)) == sizeof(header) &&
+              file.write((const uint8_t*)accounts.data(), bytes) == bytes;
+    file.close();
+    
+    if (!ok) {
+        SPIFFS.remove(ACCOUNTS_TEMP_FILE);
+        DEBUG_PRINTLN("Erro ao gravar contas");
+        return false;
+    }
+    
+    SPIFFS.remove(AUTH_ACCOUNTS_FILE);
+    return SPIFFS.rename(ACCOUNTS_TEMP_FILE, AUTH_ACCOUNTS_FILE);
 }
 
-bool AuthManager::hasAdminCredentials(const String& username) {
-    return findAdminPassword(username).length() > 0;
+void AuthManager::migrateLegacyCredentials() {
+    // Formato antigo na NVS: um admin (slot 0) e um usuário (slot 1), mantendo os
+    // IDs de conta dos tokens já emitidos
+    accounts.assign(2, AuthAccount());
+    
+    Preferences prefs;
+    prefs.begin("auth", false);
+    for (int slot = 0; slot < 2; slot++) {
+        bool isAdmin = (slot == 0);
+        AuthAccount& account = accounts[slot];
+        memset(&account, 0, sizeof(account));
+        
+        String username = prefs.getString(isAdmin ? "admin_user" : "user_user",
+                                          isAdmin ? DEFAULT_ADMIN_USER : DEFAULT_USER_USER);
+        strlcpy(account.username, username.c_str(), sizeof(account.username));
+        account.role = isAdmin ? ROLE_ADMIN : ROLE_USER;
+        account.minTokenId = prefs.getUInt(isAdmin ? "tok_min0" : "tok_min1", 0);
+        
+        bool found = prefs.getBytes(isAdmin ? "admin_pwd" : "user_pwd", &account.password,
+                                    sizeof(PasswordRecord)) == sizeof(PasswordRecord);
+        if (!found) {
+            // SHA-256 em hex, migrado no próximo login bem-sucedido
+            found = decodePasswordRecord(prefs.getString(isAdmin ? "admin_pass" : "user_pass", ""), account.password);
+        }
+        if (!found) {
+            // Primeira inicialização - usar senha padrão
+            createPasswordRecord(isAdmin ? DEFAULT_ADMIN_PASS : DEFAULT_USER_PASS, account.password);
+        }
+    }
+    
+    rebuildAccountIndex();
+    if (saveAccounts()) {
+        const char* legacyKeys[] = { "admin_user", "admin_pwd", "admin_pass", "user_user", "user_pwd",
+                                     "user_pass", "tok_min0", "tok_min1" };
+        for (const char* key : legacyKeys) {
+            prefs.remove(key);
+        }
+    }
+    prefs.end();
+    
+    DEBUG_PRINTLN("Credenciais migradas para a tabela de contas");
 }
 
-bool AuthManager::hasUserCredentials(const String& username) {
-    return findUserPassword(username).length() > 0;
+uint32_t AuthManager::hashUsername(const char* username) {
+    // FNV-1a; nomes de usuário diferenciam maiúsculas
+    uint32_t hash = 2166136261UL;
+    for (const char* c = username; *c; c++) {
+        hash ^= (uint8_t)*c;
+        hash *= 16777619UL;
+    }
+    return hash;
 }
 
-// Métodos privados originais
-
-String AuthManager::generateSessionId() {
-    String sessionId = "";
-    const char chars[] = "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz";
-    
-    for (int i = 0; i < 32; i++) {
-        sessionId += chars[random(0, sizeof(chars) - 1)];
+void AuthManager::rebuildAccountIndex() {
+    // Fator de carga máximo de 50% para sondas curtas
+    size_t size = 16;
+    while (size < accounts.size() * 2) {
+        size <<= 1;
     }
+    accountIndex.assign(size, -1);
     
-    return sessionId;
+    size_t mask = size - 1;
+    for (size_t i = 0; i < accounts.size(); i++) {
+        if (accounts[i].username[0] == '\0') continue;
+        size_t slot = hashUsername(accounts[i].username) & mask;
+        while (accountIndex[slot] != -1) {
+            slot = (slot + 1) & mask;
+        }
+        accountIndex[slot] = i;
+    }
 }
 
-String AuthManager::hashPassword(const String& password) {
-    // Usar SHA-256 para hash da senha
-    mbedtls_md_context_t ctx;
-    mbedtls_md_type_t md_type = MBEDTLS_MD_SHA256;
+void AuthManager::accountIndexInsert(int slot) {
+    if (accountIndex.empty() || (size_t)(slot + 1) * 2 > accountIndex.size()) {
+        rebuildAccountIndex();
+        return;
+    }
     
-    mbedtls_md_init(&ctx);
-    mbedtls_md_setup(&ctx, mbedtls_md_info_from_type(md_type), 0);
-    mbedtls_md_starts(&ctx);
-    mbedtls_md_update(&ctx, (const unsigned char*)password.c_str(), password.length());
+    size_t mask = accountIndex.size() - 1;
+    size_t pos = hashUsername(accounts[slot].username) & mask;
+    while (accountIndex[pos] != -1) {
+        pos = (pos + 1) & mask;
+    }
+    accountIndex[pos] = slot;
+}
+
+int AuthManager::findAccountSlot(const String& username) {
+    if (username.length() == 0 || accountIndex.empty()) {
+        return -1;
+    }
     
-    unsigned char hash[32];
-    mbedtls_md_finish(&ctx, hash);
-    mbedtls_md_free(&ctx);
+    size_t mask = accountIndex.size() - 1;
+    size_t pos = hashUsername(username.c_str()) & mask;
     
-    // Converter para hex string
-    String hashString = "";
-    for (int i = 0; i < 32; i++) {
-        char hex[3];
-        sprintf(hex, "%02x", hash[i]);
-        hashString += hex;
+    // Sondagem linear; o slot é sempre conferido contra o nome real
+    while (accountIndex[pos] != -1) {
+        int slot = accountIndex[pos];
+        if (slot < (int)accounts.size() && strcmp(accounts[slot].username, username.c_str()) == 0) {
+            return slot;
+        }
+        pos = (pos + 1) & mask;
+    }
+    return -1;
+}
+
+int AuthManager::allocateAccountSlot() {
+    for (size_t i = 0; i < accounts.size(); i++) {
+        if (accounts[i].username[0] == '\0') {
+            return i;
+        }
+    }
+    accounts.push_back(AuthAccount());
+    memset(&accounts.back(), 0, sizeof(AuthAccount));
+    return accounts.size() - 1;
+}
+
+int AuthManager::countAdmins() {
+    int count = 0;
+    for (const auto& account : accounts) {
+        if (account.username[0] != '\0' && account.role == ROLE_ADMIN) count++;
+    }
+    return count;
+}
+
+void AuthManager::trimFreeSlots() {
+    // Slots livres no meio são mantidos: o índice é o ID da conta nos tokens
+    while (!accounts.empty() && accounts.back().username[0] == '\0') {
+        accounts.pop_back();
+    }
+}
+
+bool AuthManager::isValidUsername(const String& username) {
+    if (username.length() < 3 || username.length() > AUTH_USERNAME_MAX) {
+        return false;
+    }
+    for (char c : username) {
+        if (!isalnum(c) && c != '.' && c != '_' && c != '-' && c != '@') {
+            return false;
+        }
     }
+    return true;
+}
+
+bool AuthManager::normalizeCardUid(const String& uid, char* out) {
+    // Mesmo formato do UserManager: hexadecimal com espaços, em maiúsculas
+    String value = uid;
+    value.trim();
+    value.toUpperCase();
+    out[0] = '\0';
     
-    return hashString;
+    if (value.length() == 0) {
+        return true;
+    }
+    if (value.length() < 8 || value.length() > AUTH_ACCOUNT_UID_MAX) {
+        return false;
+    }
+    for (char c : value) {
+        if (!isxdigit(c) && c != ' ') {
+            return false;
+        }
+    }
+    strlcpy(out, value.c_str(), AUTH_ACCOUNT_UID_MAX + 1);
+    return true;
+}
+
+String AuthManager::encodePasswordRecord(const PasswordRecord& record) {
+    // Legado: só o hash (64 hex). Atual: iterações + salt + hash (104 hex)
+    if (record.iterations == 0) {
+        return bytesToHex(record.hash, AUTH_PASSWORD_HASH_BYTES);
+    }
+    return bytesToHex((const uint8_t*)&record, sizeof(record));
+}
+
+bool AuthManager::decodePasswordRecord(const String& hex, PasswordRecord& record) {
+    if (hex.length() == AUTH_PASSWORD_HASH_BYTES * 2) {
+        memset(&record, 0, sizeof(record));
+        return hexToBytes(hex.c_str(), hex.length(), record.hash);
+    }
+    if (hex.length() == sizeof(record) * 2) {
+        return hexToBytes(hex.c_str(), hex.length(), (uint8_t*)&record) && record.iterations > 0;
+    }
+    return false;
 }
 
-bool AuthManager::verifyPassword(const String& password, const String& hash) {
-    return hashPassword(password) == hash;
+// Métodos privados originais
+
+void AuthManager::generateSessionToken(SessionToken& token) {
+    // RNG de hardware; repete no caso (improvável) de colisão com uma sessão ativa
+    do {
+        esp_fill_random(token.bytes, SESSION_TOKEN_BYTES);
+    } while (findSessionSlot(token) != -1);
+}
+
+bool AuthManager::derivePassword(const String& password, const uint8_t* salt, uint32_t iterations, uint8_t* out) {
+    if (!passwordHmacReady) {
+        return false;
+    }
+    return mbedtls_pkcs5_pbkdf2_hmac(&passwordHmac,
+                                     (const unsigned char*)password.c_str(), password.length(),
+                                     salt, AUTH_PASSWORD_SALT_BYTES, iterations,
+                                     AUTH_PASSWORD_HASH_BYTES, out) == 0;
+}
+
+bool AuthManager::createPasswordRecord(const String& password, PasswordRecord& record) {
+    record.iterations = AUTH_PBKDF2_ITERATIONS;
+    esp_fill_random(record.salt, AUTH_PASSWORD_SALT_BYTES);
+    return derivePassword(password, record.salt, record.iterations, record.hash);
+}
+
+bool AuthManager::verifyPassword(const String& password, const PasswordRecord& record) {
+    uint8_t computed[AUTH_PASSWORD_HASH_BYTES];
+    
+    if (record.iterations == 0) {
+        // SHA-256 legado sem salt
+        if (mbedtls_md(mbedtls_md_info_from_type(MBEDTLS_MD_SHA256),
+                       (const unsigned char*)password.c_str(), password.length(), computed) != 0) {
+            return false;
+        }
+    } else if (!derivePassword(password, record.salt, record.iterations, computed)) {
+        return false;
+    }
+    
+    // Comparação em tempo constante
+    uint8_t diff = 0;
+    for (size_t i = 0; i < AUTH_PASSWORD_HASH_BYTES; i++) {
+        diff |= computed[i] ^ record.hash[i];
+    }
+    return diff == 0;
 }
 
 void AuthManager::cleanupExpiredSessions() {
-    unsigned long currentTime = millis();
+    // Só olha o topo do heap: O(1) quando nada venceu
+    unsigned long now = millis();
     
-    activeSessions.erase(
-        std::remove_if(activeSessions.begin(), activeSessions.end(),
-            [currentTime](const AuthSession& session) {
-                return (currentTime - session.lastAccess) > SESSION_TIMEOUT_MS;
-            }),
-        activeSessions.end()
-    );
+    while (sessionCount > 0) {
+        SessionSlot& top = sessionSlots[expiryHeap[0]];
+        if ((long)(now - top.heapKey) < 0) {
+            break;
+        }
+        if ((long)(now - top.expiresAt) >= 0) {
+            releaseSessionSlot(expiryHeap[0]);
+        } else {
+            // Sessão foi usada desde que entrou no heap: reposiciona
+            top.heapKey = top.expiresAt;
+            heapSiftDown(0);
+        }
+    }
 }
 
 void AuthManager::cleanupOldAttempts() {
-    unsigned long currentTime = millis();
+    // Remove a partir da cauda LRU enquanto as entradas já estiverem zeradas
+    unsigned long now = millis();
     
-    loginAttempts.erase(
-        std::remove_if(loginAttempts.begin(), loginAttempts.end(),
-            [currentTime](const LoginAttempt& attempt) {
-                return (currentTime - attempt.timestamp) > (LOCKOUT_TIME_MS * 2);
-            }),
-        loginAttempts.end()
-    );
+    while (attemptLruTail != -1) {
+        LoginAttempt& attempt = attemptSlots[attemptLruTail].attempt;
+        if (decayAttempt(attempt, now) || attempt.attemptCount > 0) {
+            break;
+        }
+        releaseAttemptSlot(attemptLruTail);
+    }
 }
 
 String AuthManager::getSessionIdFromRequest(AsyncWebServerRequest *req) {
-    if (!req->hasHeader("Cookie")) return "";
-    String cookie = req->header("Cookie");
-    return extractSessionFromCookie(cookie);
+    const char* value;
+    size_t len;
+    if (!sessionValueFromRequest(req, value, len)) return "";
+    
+    char buffer[STATELESS_TOKEN_HEX_LEN + 1];
+    memcpy(buffer, value, len);
+    buffer[len] = '\0';
+    return String(buffer);
 }
 
 bool AuthManager::isAuthenticated(AsyncWebServerRequest *req, UserRole minimumRole) {
-    String sessionId = getSessionIdFromRequest(req);
-    if (sessionId.isEmpty()) return false;
-    return requireAuth(sessionId, minimumRole);
+    AuthSession session;
+    return getSessionFromRequest(req, session) && session.role >= minimumRole;
+}
+
+bool AuthManager::getSessionFromRequest(AsyncWebServerRequest *req, AuthSession& out) {
+    AuthLock guard(*this);
+    const char* value;
+    size_t len;
+    if (!sessionValueFromRequest(req, value, len)) return false;
+    
+#if AUTH_STATELESS_TOKENS
+    if (len == STATELESS_TOKEN_HEX_LEN) {
+        return validateStatelessToken(value, len, out);
+    }
+#endif
+    return resolveSession(value, len, out);
+}
+
+// Expiração deslizante: passada metade da validade, a resposta leva um token
+// novo em Set-Cookie. Só é chamado por quem de fato responde (filtros de
+// SSE/WebSocket e isAuthenticated não renovam). O antigo continua válido
+// até vencer, para requisições já em voo, que recebem o mesmo substituto.
+String AuthManager::refreshedCookieFor(AsyncWebServerRequest *req) {
+#if AUTH_STATELESS_TOKENS
+    AuthLock guard(*this);
+    const char* value;
+    size_t len;
+    if (!sessionValueFromRequest(req, value, len) || len != STATELESS_TOKEN_HEX_LEN) {
+        return "";
+    }
+    
+    AuthSession session;
+    uint32_t tokenId;
+    uint32_t expiresAt;
+    if (!validateStatelessToken(value, len, session, &tokenId, &expiresAt)) return "";
+    uint32_t now = (uint32_t)time(nullptr);
+    if (expiresAt - now >= SESSION_TIMEOUT_MS / 2000) return "";
+    
+    // Substituto já emitido para este token; senão ocupa uma entrada livre
+    // (token de origem vencido) ou a que vence primeiro
+    TokenRefresh* victim = &refreshes[0];
+    for (TokenRefresh& entry : refreshes) {
+        if (entry.fromExpiresAt > now && entry.fromId == tokenId) {
+            return createSessionCookie(entry.token);
+        }
+        if (entry.fromExpiresAt < victim->fromExpiresAt) victim = &entry;
+    }
+    
+    int slot = findAccountSlot(session.username);
+    if (slot == -1) return "";
+    uint32_t newId;
+    String token = issueStatelessToken(slot, &newId);
+    if (token.length() == 0) return "";
+    victim->fromId = tokenId;
+    victim->fromExpiresAt = expiresAt;
+    victim->toId = newId;
+    victim->token = token;
+    return createSessionCookie(token);
+#else
+    return "";
+#endif
+}
+
+bool AuthManager::hasMetricsToken(AsyncWebServerRequest *req) {
+    // Token fixo do coletor Prometheus (METRICS_BEARER_TOKEN), comparado em tempo constante
+    static const char expected[] = METRICS_BEARER_TOKEN;
+    const size_t expectedLen = sizeof(expected) - 1;
+    if (expectedLen == 0) return false;
+    
+    AsyncWebHeader* header = req->getHeader("Authorization");
+    if (!header) return false;
+    
+    const char* value = header->value().c_str();
+    if (strncmp(value, "Bearer ", 7) != 0) return false;
+    value += 7;
+    if (strlen(value) != expectedLen) return false;
+    
+    uint8_t diff = 0;
+    for (size_t i = 0; i < expectedLen; i++) {
+        diff |= value[i] ^ expected[i];
+    }
+    return diff == 0;
 }
 
 String AuthManager::getUserRoleFromRequest(AsyncWebServerRequest *req) {
-    String sessionId = getSessionIdFromRequest(req);
-    if (sessionId.isEmpty()) return "";
-    UserRole role = getSessionRole(sessionId);
-    return roleToString(role);
+    AuthSession session;
+    if (!getSessionFromRequest(req, session)) return "";
+    return roleToString(session.role);
+}
+
+void AuthManager::acquire() {
+    if (lock) xSemaphoreTakeRecursive(lock, portMAX_DELAY);
+}
+
+void AuthManager::release() {
+    if (lock) xSemaphoreGiveRecursive(lock);
+}
+
+LoginAttempt* AuthManager::findLoginAttempt(uint32_t ip) {
+    int slot = findAttemptSlot(ip);
+    if (slot == -1) {
+        return nullptr;
+    }
+    
+    LoginAttempt& attempt = attemptSlots[slot].attempt;
+    decayAttempt(attempt, millis());
+    return &attempt;
+}
+
+// Tabela de tentativas de login
+
+void AuthManager::resetAttemptTable() {
+    for (int i = 0; i < LOGIN_ATTEMPT_BUCKETS; i++) {
+        attemptBuckets[i] = -1;
+    }
+    for (int i = 0; i < LOGIN_ATTEMPT_SLOTS; i++) {
+        attemptSlots[i].used = false;
+        attemptSlots[i].lruPrev = -1;
+        attemptSlots[i].lruNext = -1;
+        attemptSlots[i].next = (i + 1 < LOGIN_ATTEMPT_SLOTS) ? i + 1 : -1;
+    }
+    attemptFreeHead = 0;
+    attemptLruHead = -1;
+    attemptLruTail = -1;
+    attemptCount = 0;
+}
+
+int AuthManager::attemptBucket(uint32_t ip) {
+    // Hash multiplicativo: IPs vizinhos caem em buckets diferentes
+    return ((ip * 2654435761UL) >> 16) & (LOGIN_ATTEMPT_BUCKETS - 1);
+}
+
+int AuthManager::findAttemptSlot(uint32_t ip) {
+    int slot = attemptBuckets[attemptBucket(ip)];
+    while (slot != -1) {
+        if (attemptSlots[slot].attempt.ipAddress == ip) {
+            return slot;
+        }
+        slot = attemptSlots[slot].next;
+    }
+    return -1;
+}
+
+int AuthManager::acquireAttemptSlot(uint32_t ip) {
+    if (attemptFreeHead == -1) {
+        cleanupOldAttempts();
+    }
+    if (attemptFreeHead == -1) {
+        // Tabela cheia: descarta a menos recente, preservando IPs bloqueados
+        // enquanto houver outra opção
+        unsigned long now = millis();
+        int victim = attemptLruTail;
+        for (int slot = attemptLruTail; slot != -1; slot = attemptSlots[slot].lruPrev) {
+            if (!decayAttempt(attemptSlots[slot].attempt, now)) {
+                victim = slot;
+                break;
+            }
+        }
+        releaseAttemptSlot(victim);
+        securityStats.evictions++;
+    }
+    
+    int slot = attemptFreeHead;
+    AttemptSlot& entry = attemptSlots[slot];
+    attemptFreeHead = entry.next;
+    
+    int bucket = attemptBucket(ip);
+    entry.next = attemptBuckets[bucket];
+    attemptBuckets[bucket] = slot;
+    
+    entry.used = true;
+    entry.attempt.ipAddress = ip;
+    entry.attempt.attemptCount = 0;
+    entry.attempt.updatedAt = millis();
+    entry.attempt.lockoutUntil = 0;
+    lruPushFront(slot);
+    attemptCount++;
+    
+    return slot;
+}
+
+void AuthManager::releaseAttemptSlot(int slot) {
+    AttemptSlot& entry = attemptSlots[slot];
+    if (!entry.used) {
+        return;
+    }
+    
+    int8_t* link = &attemptBuckets[attemptBucket(entry.attempt.ipAddress)];
+    while (*link != -1 && *link != slot) {
+        link = &attemptSlots[*link].next;
+    }
+    if (*link == slot) {
+        *link = entry.next;
+    }
+    
+    lruUnlink(slot);
+    entry.used = false;
+    entry.next = attemptFreeHead;
+    attemptFreeHead = slot;
+    attemptCount--;
+}
+
+void AuthManager::lruUnlink(int slot) {
+    AttemptSlot& entry = attemptSlots[slot];
+    if (entry.lruPrev != -1) attemptSlots[entry.lruPrev].lruNext = entry.lruNext;
+    else attemptLruHead = entry.lruNext;
+    if (entry.lruNext != -1) attemptSlots[entry.lruNext].lruPrev = entry.lruPrev;
+    else attemptLruTail = entry.lruPrev;
+    entry.lruPrev = entry.lruNext = -1;
+}
+
+void AuthManager::lruPushFront(int slot) {
+    AttemptSlot& entry = attemptSlots[slot];
+    entry.lruPrev = -1;
+    entry.lruNext = attemptLruHead;
+    if (attemptLruHead != -1) attemptSlots[attemptLruHead].lruPrev = slot;
+    attemptLruHead = slot;
+    if (attemptLruTail == -1) attemptLruTail = slot;
+}
+
+bool AuthManager::decayAttempt(LoginAttempt& attempt, unsigned long now) {
+    // Retorna true enquanto o IP estiver bloqueado
+    if (attempt.lockoutUntil != 0) {
+        if ((long)(now - attempt.lockoutUntil) < 0) {
+            return true;
+        }
+        attempt.lockoutUntil = 0;
+        attempt.updatedAt = now;
+        attempt.attemptCount = 0;
+        return false;
+    }
+    
+    unsigned long steps = (now - attempt.updatedAt) / LOGIN_ATTEMPT_DECAY_MS;
+    if (steps > 0) {
+        attempt.attemptCount = (steps >= attempt.attemptCount) ? 0 : attempt.attemptCount - steps;
+        attempt.updatedAt += steps * LOGIN_ATTEMPT_DECAY_MS;
+    }
+    return false;
 }
 
-LoginAttempt* AuthManager::findLoginAttempt(const String& ip) {
-    for (auto& attempt : loginAttempts) {
-        if (attempt.ipAddress == ip) {
-            return &attempt;
+// Tabela de sessões
+
+void AuthManager::resetSessionTable() {
+    for (int i = 0; i < SESSION_HASH_BUCKETS; i++) {
+        sessionBuckets[i] = -1;
+    }
+    for (int i = 0; i < MAX_ACTIVE_SESSIONS; i++) {
+        sessionSlots[i].session.isActive = false;
+        sessionSlots[i].heapPos = MAX_ACTIVE_SESSIONS;
+        sessionSlots[i].next = (i + 1 < MAX_ACTIVE_SESSIONS) ? i + 1 : -1;
+    }
+    freeSlotHead = 0;
+    sessionCount = 0;
+}
+
+int AuthManager::findSessionSlot(const SessionToken& token) {
+    // Os tokens são aleatórios: os primeiros bytes já servem de hash
+    int slot = sessionBuckets[token.bytes[0] & (SESSION_HASH_BUCKETS - 1)];
+    while (slot != -1) {
+        if (tokensEqual(sessionSlots[slot].session.token, token)) {
+            return slot;
         }
+        slot = sessionSlots[slot].next;
     }
-    return nullptr;
-}
\ No newline at end of file
+    return -1;
+}
+
+int AuthManager::acquireSessionSlot(const SessionToken& token) {
+    // Tabela cheia: descarta a sessão mais próxima de expirar
+    if (freeSlotHead == -1) {
+        cleanupExpiredSessions();
+    }
+    if (freeSlotHead == -1) {
+        releaseSessionSlot(expiryHeap[0]);
+    }
+    
+    int slot = freeSlotHead;
+    SessionSlot& entry = sessionSlots[slot];
+    freeSlotHead = entry.next;
+    
+    memcpy(&entry.session.token, &token, sizeof(SessionToken));
+    int bucket = token.bytes[0] & (SESSION_HASH_BUCKETS - 1);
+    entry.next = sessionBuckets[bucket];
+    sessionBuckets[bucket] = slot;
+    
+    entry.expiresAt = millis() + SESSION_TIMEOUT_MS;
+    entry.heapKey = entry.expiresAt;
+    entry.heapPos = sessionCount;
+    expiryHeap[sessionCount++] = slot;
+    heapSiftUp(entry.heapPos);
+    
+    return slot;
+}
+
+void AuthManager::releaseSessionSlot(int slot) {
+    SessionSlot& entry = sessionSlots[slot];
+    if (entry.heapPos >= MAX_ACTIVE_SESSIONS) {
+        return; // Slot já está livre
+    }
+    
+    // Remover da cadeia do bucket
+    int bucket = entry.session.token.bytes[0] & (SESSION_HASH_BUCKETS - 1);
+    int8_t* link = &sessionBuckets[bucket];
+    while (*link != -1 && *link != slot) {
+        link = &sessionSlots[*link].next;
+    }
+    if (*link == slot) {
+        *link = entry.next;
+    }
+    
+    heapRemove(entry.heapPos);
+    
+    memset(&entry.session, 0, sizeof(AuthSession));
+    entry.session.isActive = false;
+    entry.next = freeSlotHead;
+    freeSlotHead = slot;
+}
+
+bool AuthManager::touchSession(const SessionToken& token, AuthSession& out) {
+    cleanupExpiredSessions();
+    
+    int slot = findSessionSlot(token);
+    if (slot == -1) {
+        return false;
+    }
+    
+    SessionSlot& entry = sessionSlots[slot];
+    unsigned long now = millis();
+    if ((long)(now - entry.expiresAt) >= 0) {
+        releaseSessionSlot(slot);
+        return false;
+    }
+    
+    // Expiração deslizante: só o campo muda; o heap é corrigido ao vencer a chave antiga
+    entry.session.lastAccess = now;
+    entry.expiresAt = now + SESSION_TIMEOUT_MS;
+    out = entry.session;
+    return true;
+}
+
+bool AuthManager::heapLess(uint8_t a, uint8_t b) {
+    return (long)(sessionSlots[expiryHeap[a]].heapKey - sessionSlots[expiryHeap[b]].heapKey) < 0;
+}
+
+void AuthManager::heapSwap(uint8_t a, uint8_t b) {
+    uint8_t tmp = expiryHeap[a];
+    expiryHeap[a] = expiryHeap[b];
+    expiryHeap[b] = tmp;
+    sessionSlots[expiryHeap[a]].heapPos = a;
+    sessionSlots[expiryHeap[b]].heapPos = b;
+}
+
+void AuthManager::heapSiftUp(uint8_t pos) {
+    while (pos > 0) {
+        uint8_t parent = (pos - 1) / 2;
+        if (!heapLess(pos, parent)) break;
+        heapSwap(pos, parent);
+        pos = parent;
+    }
+}
+
+void AuthManager::heapSiftDown(uint8_t pos) {
+    while (true) {
+        uint8_t smallest = pos;
+        uint8_t left = 2 * pos + 1;
+        uint8_t right = left + 1;
+        if (left < sessionCount && heapLess(left, smallest)) smallest = left;
+        if (right < sessionCount && heapLess(right, smallest)) smallest = right;
+        if (smallest == pos) break;
+        heapSwap(pos, smallest);
+        pos = smallest;
+    }
+}
+
+void AuthManager::heapRemove(uint8_t pos) {
+    sessionCount--;
+    if (pos != sessionCount) {
+        heapSwap(pos, sessionCount);
+        heapSiftDown(pos);
+        heapSiftUp(pos);
+    }
+    sessionSlots[expiryHeap[sessionCount]].heapPos = MAX_ACTIVE_SESSIONS;
+}
+
+bool AuthManager::tokensEqual(const SessionToken& a, const SessionToken& b) {
+    // Comparação em tempo constante
+    uint8_t diff = 0;
+    for (size_t i = 0; i < SESSION_TOKEN_BYTES; i++) {
+        diff |= a.bytes[i] ^ b.bytes[i];
+    }
+    return diff == 0;
+}
+
+bool AuthManager::parseSessionToken(const char* hex, size_t len, SessionToken& token) {
+    if (len != SESSION_TOKEN_BYTES * 2) {
+        return false;
+    }
+    return hexToBytes(hex, len, token.bytes);
+}
+
+String AuthManager::sessionTokenToString(const SessionToken& token) {
+    return bytesToHex(token.bytes, SESSION_TOKEN_BYTES);
+}
+
+bool AuthManager::hexToBytes(const char* hex, size_t len, uint8_t* out) {
+    if (len % 2 != 0) {
+        return false;
+    }
+    for (size_t i = 0; i < len / 2; i++) {
+        uint8_t value = 0;
+        for (int j = 0; j < 2; j++) {
+            char c = hex[i * 2 + j];
+            value <<= 4;
+            if (c >= '0' && c <= '9') value |= c - '0';
+            else if (c >= 'a' && c <= 'f') value |= c - 'a' + 10;
+            else if (c >= 'A' && c <= 'F') value |= c - 'A' + 10;
+            else return false;
+        }
+        out[i] = value;
+    }
+    return true;
+}
+
+String AuthManager::bytesToHex(const uint8_t* data, size_t len) {
+    static const char digits[] = "0123456789abcdef";
+    String hex;
+    hex.reserve(len * 2);
+    for (size_t i = 0; i < len; i++) {
+        hex += digits[data[i] >> 4];
+        hex += digits[data[i] & 0x0F];
+    }
+    return hex;
+}
+
+bool AuthManager::sessionValueFromRequest(AsyncWebServerRequest *req, const char*& value, size_t& len) {
+    // Lê o cabeçalho in-place, sem copiar para String
+    AsyncWebHeader* header = req->getHeader("Cookie");
+    if (!header) return false;
+    
+    const char* start = strstr(header->value().c_str(), "session_id=");
+    if (!start) return false;
+    start += 11; // Tamanho de "session_id="
+    
+    value = start;
+    len = strcspn(start, "; ");
+    return len == SESSION_TOKEN_BYTES * 2 || len == STATELESS_TOKEN_HEX_LEN;
+}
+
+bool AuthManager::resolveSession(const char* value, size_t len, AuthSession& out) {
+    // O tamanho do cookie identifica o formato: sessão em memória ou token assinado
+    if (len == SESSION_TOKEN_BYTES * 2) {
+        SessionToken token;
+        if (!parseSessionToken(value, len, token)) return false;
+        return touchSession(token, out);
+    }
+#if AUTH_STATELESS_TOKENS
+    if (len == STATELESS_TOKEN_HEX_LEN) {
+        return validateStatelessToken(value, len, out);
+    }
+#endif
+    return false;
+}
+
+// Tokens sem estado
+
+bool AuthManager::loadTokenKey() {
+    uint8_t key[AUTH_TOKEN_KEY_BYTES];
+    
+    Preferences prefs;
+    prefs.begin("auth", false);
+    if (prefs.getBytes("token_key", key, sizeof(key)) != sizeof(key)) {
+        // Primeira inicialização: chave aleatória do dispositivo
+        esp_fill_random(key, sizeof(key));
+        prefs.putBytes("token_key", key, sizeof(key));
+        DEBUG_PRINTLN("Nova chave de tokens gerada");
+    }
+    
+    // "tok_next" guarda o fim do último bloco reservado: IDs nunca se repetem
+    nextTokenId = prefs.getUInt("tok_next", 0);
+    reservedTokenId = nextTokenId;
+    if (prefs.getBytes("tok_revoked", revokedTokens, sizeof(revokedTokens)) != sizeof(revokedTokens)) {
+        memset(revokedTokens, 0, sizeof(revokedTokens));
+    }
+    prefs.end();
+    
+    if (tokenKeyReady) {
+        mbedtls_md_free(&tokenHmac);
+        tokenKeyReady = false;
+    }
+    
+    // A chave é carregada uma única vez; cada token só faz reset/update/finish
+    mbedtls_md_init(&tokenHmac);
+    int result = mbedtls_md_setup(&tokenHmac, mbedtls_md_info_from_type(MBEDTLS_MD_SHA256), 1);
+    if (result == 0) {
+        result = mbedtls_md_hmac_starts(&tokenHmac, key, sizeof(key));
+    }
+    memset(key, 0, sizeof(key));
+    
+    if (result != 0) {
+        mbedtls_md_free(&tokenHmac);
+        return false;
+    }
+    
+    tokenKeyReady = true;
+    return true;
+}
+
+bool AuthManager::statelessAvailable() {
+    return tokenKeyReady && time(nullptr) >= (time_t)AUTH_MIN_VALID_EPOCH;
+}
+
+String AuthManager::issueStatelessToken(int accountId, uint32_t* tokenIdOut) {
+    uint8_t token[AUTH_TOKEN_PAYLOAD_BYTES + AUTH_TOKEN_MAC_BYTES];
+    uint16_t account = accountId;
+    uint32_t tokenId = allocateTokenId();
+    uint32_t issuedAt = (uint32_t)time(nullptr);
+    uint32_t expiresAt = issuedAt + SESSION_TIMEOUT_MS / 1000;
+    
+    token[0] = STATELESS_TOKEN_VERSION;
+    token[1] = accounts[accountId].role;
+    memcpy(token + 2, &account, sizeof(account));
+    memcpy(token + 4, &tokenId, sizeof(tokenId));
+    memcpy(token + 8, &issuedAt, sizeof(issuedAt));
+    memcpy(token + 12, &expiresAt, sizeof(expiresAt));
+    computeTokenMac(token, token + AUTH_TOKEN_PAYLOAD_BYTES);
+    
+    if (tokenIdOut) {
+        *tokenIdOut = tokenId;
+    }
+    return bytesToHex(token, sizeof(token));
+}
+
+bool AuthManager::validateStatelessToken(const char* hex, size_t len, AuthSession& out,
+                                         uint32_t* tokenIdOut, uint32_t* expiresAtOut) {
+    uint8_t token[AUTH_TOKEN_PAYLOAD_BYTES + AUTH_TOKEN_MAC_BYTES];
+    if (!tokenKeyReady || len != STATELESS_TOKEN_HEX_LEN || !hexToBytes(hex, len, token)) {
+        return false;
+    }
+    
+    // Assinatura primeiro, comparada em tempo constante
+    uint8_t mac[AUTH_TOKEN_MAC_BYTES];
+    computeTokenMac(token, mac);
+    uint8_t diff = 0;
+    for (size_t i = 0; i < AUTH_TOKEN_MAC_BYTES; i++) {
+        diff |= mac[i] ^ token[AUTH_TOKEN_PAYLOAD_BYTES + i];
+    }
+    if (diff != 0 || token[0] != STATELESS_TOKEN_VERSION) {
+        return false;
+    }
+    
+    uint16_t accountId;
+    uint32_t tokenId, issuedAt, expiresAt;
+    memcpy(&accountId, token + 2, sizeof(accountId));
+    memcpy(&tokenId, token + 4, sizeof(tokenId));
+    memcpy(&issuedAt, token + 8, sizeof(issuedAt));
+    memcpy(&expiresAt, token + 12, sizeof(expiresAt));
+    
+    // Sem relógio sincronizado não há como verificar a expiração
+    time_t now = time(nullptr);
+    if (now < (time_t)AUTH_MIN_VALID_EPOCH || (uint32_t)now >= expiresAt) {
+        return false;
+    }
+    
+    // Revogação: ID fora da janela do bitmap, marcado no logout ou anterior
+    // à última troca de credenciais da conta
+    const AuthAccount* account = accountAt(accountId);
+    if (!account ||
+        tokenId >= nextTokenId ||
+        reservedTokenId - tokenId > AUTH_REVOCATION_BITS ||
+        (revokedTokens[(tokenId % AUTH_REVOCATION_BITS) / 8] & (1 << (tokenId % 8))) ||
+        tokenId < account->minTokenId ||
+        token[1] != account->role) {
+        return false;
+    }
+    
+    UserRole role = (UserRole)account->role;
+    
+    // Sessão montada sob demanda, entregue por valor ao chamador
+    memset(&out, 0, sizeof(out));
+    memcpy(out.token.bytes, token, SESSION_TOKEN_BYTES);
+    strlcpy(out.username, account->username, sizeof(out.username));
+    out.role = role;
+    out.createdAt = millis() - ((uint32_t)now - issuedAt) * 1000UL;
+    out.lastAccess = millis();
+    out.isActive = true;
+    
+    if (tokenIdOut) {
+        *tokenIdOut = tokenId;
+    }
+    if (expiresAtOut) {
+        *expiresAtOut = expiresAt;
+    }
+    return true;
+}
+
+void AuthManager::computeTokenMac(const uint8_t* payload, uint8_t* mac) {
+    uint8_t full[32];
+    mbedtls_md_hmac_reset(&tokenHmac);
+    mbedtls_md_hmac_update(&tokenHmac, payload, AUTH_TOKEN_PAYLOAD_BYTES);
+    mbedtls_md_hmac_finish(&tokenHmac, full);
+    memcpy(mac, full, AUTH_TOKEN_MAC_BYTES);
+}
+
+uint32_t AuthManager::allocateTokenId() {
+    // Reserva IDs em blocos para não gravar na NVS a cada login
+    if (nextTokenId >= reservedTokenId) {
+        reservedTokenId = nextTokenId + AUTH_TOKEN_ID_BLOCK;
+        for (uint32_t id = nextTokenId; id < reservedTokenId; id++) {
+            revokedTokens[(id % AUTH_REVOCATION_BITS) / 8] &= ~(1 << (id % 8));
+        }
+        saveTokenState();
+    }
+    return nextTokenId++;
+}
+
+void AuthManager::revokeStatelessToken(uint32_t tokenId) {
+    revokedTokens[(tokenId % AUTH_REVOCATION_BITS) / 8] |= (1 << (tokenId % 8));
+    saveTokenState();
+}
+
+bool AuthManager::revokeAccountTokens(int accountId) {
+    // Só altera a memória; quem chama grava a tabela de contas
+    if (accounts[accountId].minTokenId == nextTokenId) {
+        return false;
+    }
+    accounts[accountId].minTokenId = nextTokenId;
+    return true;
+}
+
+void AuthManager::saveTokenState() {
+    Preferences prefs;
+    prefs.begin("auth", false);
+    prefs.putUInt("tok_next", reservedTokenId);
+    prefs.putBytes("tok_revoked", revokedTokens, sizeof(revokedTokens));
+    prefs.end();
+}
@@ -0,0 +1,386 @@
+#include "backup_manager.h"
+#include <ArduinoJson.h>
+
+// Etapas da exportação, na ordem em que aparecem no arquivo
+enum BackupExportStage {
+    EXPORT_HEADER,
+    EXPORT_COFFEE,
+    EXPORT_AUTH,
+    EXPORT_USERS_META,
+    EXPORT_USERS,
+    EXPORT_END,
+    EXPORT_DONE
+};
+
+static const char* BACKUP_FORMAT_NAME = "coffee-bearer-backup";
+
+// Pool do documento: nós do objeto mais as cópias das strings; o limite
+// real de um registro é a linha (BACKUP_LINE_MAX), verificado na serialização
+static const size_t BACKUP_DOC_SIZE = JSON_OBJECT_SIZE(8) + BACKUP_LINE_MAX;
+
+BackupManager::BackupManager(UserManager& users, CoffeeController& coffee, AuthManager& auth) :
+    userManager(users),
+    coffeeController(coffee),
+    authManager(auth),
+    restoreOwner(nullptr),
+    restoreLastActivity(0) {
+    resetRestoreState();
+}
+
+/* -------------------- Exportação -------------------- */
+
+void BackupManager::beginExport(BackupExportCursor& cursor) {
+    cursor.stage = EXPORT_HEADER;
+    cursor.index = 0;
+    cursor.lineLength = 0;
+    cursor.linePosition = 0;
+}
+
+size_t BackupManager::fillExport(BackupExportCursor& cursor, uint8_t* buffer, size_t maxLen) {
+    size_t written = 0;
+
+    while (written < maxLen) {
+        if (cursor.linePosition >= cursor.lineLength && !nextExportLine(cursor)) {
+            break;
+        }
+
+        size_t chunk = min(maxLen - written, cursor.lineLength - cursor.linePosition);
+        memcpy(buffer + written, cursor.line + cursor.linePosition, chunk);
+        cursor.linePosition += chunk;
+        written += chunk;
+    }
+
+    return written;
+}
+
+bool BackupManager::nextExportLine(BackupExportCursor& cursor) {
+    StaticJsonDocument<BACKUP_DOC_SIZE> doc;
+
+    while (doc.isNull()) {
+        switch (cursor.stage) {
+            case EXPORT_HEADER:
+                doc["type"] = "header";
+                doc["format"] = BACKUP_FORMAT_NAME;
+                doc["version"] = BACKUP_FORMAT_VERSION;
+                doc["system"] = SYSTEM_VERSION;
+                cursor.stage = EXPORT_COFFEE;
+                break;
+
+            case EXPORT_COFFEE: {
+                CoffeeStats stats = coffeeController.getStats();
+                doc["type"] = "coffee";
+                doc["remaining"] = stats.remainingCoffees;
+                doc["totalServed"] = stats.totalServed;
+                doc["totalServeTime"] = stats.totalServeTime;
+                doc["dailyCount"] = stats.dailyCount;
+                cursor.stage = EXPORT_AUTH;
+                cursor.index = 0;
+                break;
+            }
+
+            case EXPORT_AUTH: {
+                // Slots livres são pulados; o laço externo continua até gerar uma linha
+                if (cursor.index >= authManager.getAccountSlotCount()) {
+                    cursor.stage = EXPORT_USERS_META;
+                    break;
+                }
+                // Cópia local: os campos char[] são duplicados no documento
+                AuthAccount account;
+                if (authManager.getAccountAt(cursor.index++, account)) {
+                    doc["type"] = "auth";
+                    doc["role"] = authManager.roleToString((UserRole)account.role);
+                    doc["username"] = account.username;
+                    doc["hash"] = AuthManager::encodePasswordRecord(account.password);
+                    if (account.rfidUid[0] != '\0') {
+                        doc["rfid"] = account.rfidUid;
+                    }
+                }
+                break;
+            }
+
+            case EXPORT_USERS_META:
+                doc["type"] = "users";
+                doc["count"] = userManager.getTotalUsers();
+                doc["lastWeeklyReset"] = userManager.getLastWeeklyReset();
+                cursor.stage = EXPORT_USERS;
+                cursor.index = 0;
+                break;
+
+            case EXPORT_USERS: {
+                // A tabela pode mudar entre chamadas; getUserAt valida o índice
+                UserCredits user;
+                if (userManager.getUserAt(cursor.index, user)) {
+                    doc["type"] = "user";
+                    doc["uid"] = user.uid;
+                    doc["name"] = user.name;
+                    doc["credits"] = user.credits;
+                    doc["lastUsed"] = user.lastUsed;
+                    doc["isActive"] = user.isActive;
+                    cursor.index++;
+                } else {
+                    cursor.stage = EXPORT_END;
+                }
+                break;
+            }
+
+            case EXPORT_END:
+                doc["type"] = "end";
+                doc["users"] = cursor.index;
+                cursor.stage = EXPORT_DONE;
+                break;
+
+            default:
+                return false;
+        }
+    }
+
+    // Registro que não cabe numa linha interrompe a exportação: sem o "end",
+    // a restauração recusa o arquivo em vez de perder campos em silêncio
+    size_t len = 0;
+    if (!doc.overflowed() && measureJson(doc) < sizeof(cursor.line) - 1) {
+        len = serializeJson(doc, cursor.line, sizeof(cursor.line) - 1);
+    }
+    if (len == 0) {
+        const char* type = doc["type"] | "?";
+        DEBUG_PRINTF("Backup: registro \"%s\" #%u não cabe em %u bytes; exportação interrompida\n",
+                     type, (unsigned)cursor.index, (unsigned)BACKUP_LINE_MAX);
+        len = snprintf(cursor.line, sizeof(cursor.line) - 1,
+                       "{\"type\":\"error\",\"record\":\"%s\",\"index\":%u}", type, (unsigned)cursor.index);
+        cursor.stage = EXPORT_DONE;
+    }
+    cursor.line[len++] = '\n';
+    cursor.lineLength = len;
+    cursor.linePosition = 0;
+    return true;
+}
+
+/* -------------------- Restauração -------------------- */
+
+bool BackupManager::beginRestore(const void* owner) {
+    // Uma restauração abandonada (cliente caiu) expira após o timeout
+    if (restoreOwner != nullptr && restoreOwner != owner &&
+        millis() - restoreLastActivity < BACKUP_RESTORE_TIMEOUT_MS) {
+        DEBUG_PRINTLN("Restauração já em andamento");
+        return false;
+    }
+
+    resetRestoreState();
+    restoreOwner = owner;
+    restoreLastActivity = millis();
+    stagedUsers.reserve(MAX_USERS);
+    stagedUids.reset(MAX_USERS + 1);
+
+    DEBUG_PRINTLN("Restauração de backup iniciada");
+    return true;
+}
+
+bool BackupManager::isRestoreOwner(const void* owner) {
+    return restoreOwner != nullptr && restoreOwner == owner;
+}
+
+void BackupManager::feedRestore(const uint8_t* data, size_t len) {
+    restoreLastActivity = millis();
+
+    for (size_t i = 0; i < len && !restoreFailed; i++) {
+        char c = (char)data[i];
+
+        if (c == '\n') {
+            processRestoreLine();
+        } else if (c != '\r') {
+            if (restoreLineLength >= sizeof(restoreLine) - 1) {
+                failRestore("Line " + String(restoreLineNumber + 1) + " too long");
+                return;
+            }
+            restoreLine[restoreLineLength++] = c;
+        }
+    }
+}
+
+bool BackupManager::finishRestore(const void* owner, bool overwriteUsers, bool restoreSettings, String& message) {
+    if (!isRestoreOwner(owner)) {
+        message = "No backup file received";
+        return false;
+    }
+
+    // Última linha sem '\n' final
+    if (!restoreFailed && restoreLineLength > 0) {
+        processRestoreLine();
+    }
+
+    if (!restoreFailed && (!restoreHeaderSeen || !restoreEndSeen)) {
+        failRestore("Backup file is incomplete");
+    }
+
+    if (restoreFailed) {
+        message = restoreError;
+        resetRestoreState();
+        return false;
+    }
+
+    // Tudo validado: aplicar usuários primeiro, pois é a única etapa que pode falhar
+    if (!userManager.applyImportedUsers(stagedUsers, overwriteUsers, stagedLastReset)) {
+        message = "User table would exceed " + String(MAX_USERS) + " users";
+        resetRestoreState();
+        return false;
+    }
+
+    if (stagedHasCoffee) {
+        coffeeController.restoreStats(stagedCoffee);
+    }
+
+    int credentialsRestored = 0;
+    if (restoreSettings && !stagedAccounts.empty()) {
+        credentialsRestored = authManager.restoreAccounts(stagedAccounts);
+    }
+
+    message = String(stagedUsers.size()) + " users restored";
+    if (stagedDuplicates > 0) {
+        message += ", " + String(stagedDuplicates) + " duplicates skipped";
+    }
+    if (credentialsRestored > 0) {
+        message += ", " + String(credentialsRestored) + " credentials restored";
+    }
+
+    DEBUG_PRINTF("Restauração concluída: %s\n", message.c_str());
+    resetRestoreState();
+    return true;
+}
+
+void BackupManager::abortRestore(const void* owner) {
+    if (isRestoreOwner(owner)) {
+        DEBUG_PRINTLN("Restauração cancelada");
+        resetRestoreState();
+    }
+}
+
+void BackupManager::processRestoreLine() {
+    restoreLineNumber++;
+    size_t len = restoreLineLength;
+    restoreLineLength = 0;
+
+    if (len == 0) {
+        return;
+    }
+
+    StaticJsonDocument<BACKUP_LINE_MAX + 128> doc;
+    if (deserializeJson(doc, restoreLine, len)) {
+        failRestore("Line " + String(restoreLineNumber) + " is not valid JSON");
+        return;
+    }
+
+    String type = doc["type"] | "";
+
+    if (!restoreHeaderSeen) {
+        if (type != "header" || doc["format"] != BACKUP_FORMAT_NAME) {
+            failRestore("Not a Coffee-Bearer backup file");
+            return;
+        }
+        if ((doc["version"] | 0) > BACKUP_FORMAT_VERSION) {
+            failRestore("Unsupported backup version");
+            return;
+        }
+        restoreHeaderSeen = true;
+        return;
+    }
+
+    if (restoreEndSeen) {
+        failRestore("Data after end of backup");
+        return;
+    }
+
+    if (type == "user") {
+        UserCredits user;
+        user.uid = doc["uid"] | "";
+        user.name = doc["name"] | "";
+        user.credits = doc["credits"] | INITIAL_CREDITS;
+        user.lastUsed = doc["lastUsed"] | 0UL;
+        user.isActive = doc["isActive"] | true;
+
+        if (!userManager.normalizeImportedUser(user)) {
+            failRestore("Invalid user on line " + String(restoreLineNumber));
+            return;
+        }
+        PackedUID packed;
+        UserManager::packUID(user.uid, packed);
+        if (!stagedUids.insert(packed)) {
+            stagedDuplicates++;
+            return;
+        }
+        if (stagedUsers.size() >= MAX_USERS) {
+            failRestore("Backup has more than " + String(MAX_USERS) + " users");
+            return;
+        }
+        stagedUsers.push_back(user);
+    }
+    else if (type == "users") {
+        stagedLastReset = doc["lastWeeklyReset"] | 0UL;
+    }
+    else if (type == "coffee") {
+        stagedCoffee.remainingCoffees = doc["remaining"] | MAX_COFFEES;
+        stagedCoffee.totalServed = doc["totalServed"] | 0;
+        stagedCoffee.totalServeTime = doc["totalServeTime"] | 0UL;
+        stagedCoffee.dailyCount = doc["dailyCount"] | 0;
+        stagedHasCoffee = true;
+    }
+    else if (type == "auth") {
+        AuthAccount account;
+        memset(&account, 0, sizeof(account));
+        String username = doc["username"] | "";
+        UserRole role = authManager.stringToRole(doc["role"] | "");
+        
+        if (role == ROLE_GUEST || !AuthManager::isValidUsername(username) ||
+            !AuthManager::decodePasswordRecord(doc["hash"] | "", account.password) ||
+            !AuthManager::normalizeCardUid(doc["rfid"] | "", account.rfidUid)) {
+            failRestore("Invalid account on line " + String(restoreLineNumber));
+            return;
+        }
+        if (stagedAccounts.size() >= AUTH_MAX_ACCOUNTS) {
+            failRestore("Too many account records");
+            return;
+        }
+        
+        strlcpy(account.username, username.c_str(), sizeof(account.username));
+        account.role = role;
+        stagedAccounts.push_back(account);
+    }
+    else if (type == "error") {
+        failRestore("Backup export was interrupted at a " + String((const char*)(doc["record"] | "?")) + " record");
+        return;
+    }
+    else if (type == "end") {
+        if ((doc["users"] | -1) != (int)(stagedUsers.size() + stagedDuplicates)) {
+            failRestore("User count mismatch, backup may be truncated");
+            return;
+        }
+        restoreEndSeen = true;
+    }
+    // Tipos desconhecidos são ignorados (compatibilidade com versões futuras)
+}
+
+void BackupManager::failRestore(const String& message) {
+    if (restoreFailed) return;
+    restoreFailed = true;
+    restoreError = message;
+    stagedUsers.clear();
+    DEBUG_PRINTF("Restauração falhou: %s\n", message.c_str());
+}
+
+void BackupManager::resetRestoreState() {
+    restoreOwner = nullptr;
+    restoreLineLength = 0;
+    restoreLineNumber = 0;
+    restoreFailed = false;
+    restoreHeaderSeen = false;
+    restoreEndSeen = false;
+    restoreError = "";
+
+    stagedUsers.clear();
+    stagedUsers.shrink_to_fit();
+    stagedUids.reset(0);
+    stagedLastReset = 0;
+    stagedDuplicates = 0;
+    stagedHasCoffee = false;
+    stagedCoffee = CoffeeStats();
+    stagedAccounts.clear();
+    stagedAccounts.shrink_to_fit();
+}
@@ -11,7 +11,10 @@ FeedbackManager::FeedbackManager() :
     animBlinks(0), animDuration(0),
     buzzerState(BUZZER_IDLE),
     toneQueueIndex(0),
-    nextToneTime(0) 
+    nextToneTime(0),
+    commandQueue(nullptr),
+    ownerTask(nullptr),
+    droppedCommands(0)
 {
     memset(toneQueue, 0, sizeof(toneQueue));
 }
@@ -28,27 +31,44 @@ bool FeedbackManager::begin() {
     FastLED.clear();
     FastLED.show();
     
+    commandQueue = xQueueCreate(FEEDBACK_QUEUE_LENGTH, sizeof(FeedbackCommand));
+
     showStatusInitializing();
     return true;
 }
 
-void FeedbackManager::update() {
+void FeedbackManager::update(TickType_t wait) {
+    ownerTask = xTaskGetCurrentTaskHandle();
+
+    if (commandQueue) {
+        // Wake up as soon as a signal arrives, then drain whatever else is pending
+        FeedbackCommand command;
+        while (xQueueReceive(commandQueue, &command, wait) == pdTRUE) {
+            apply(command);
+            wait = 0;
+        }
+    } else if (wait) {
+        vTaskDelay(wait);
+    }
+
     updateLed();
     updateBuzzer();
 }
 
 // --- Continuous Status Methods ---
-void FeedbackManager::showStatusReady() { ledState = LED_STATIC; staticColor = CRGB::Green; }
-void FeedbackManager::showStatusBusy() { ledState = LED_STATIC; staticColor = CRGB::Orange; }
-void FeedbackManager::showStatusLow() { ledState = LED_STATIC; staticColor = CRGB::DeepSkyBlue; }
-void FeedbackManager::showStatusEmpty() { ledState = LED_STATIC; staticColor = CRGB::DarkRed; }
-void FeedbackManager::showStatusError() { ledState = LED_STATIC; staticColor = CRGB::Red; }
-void FeedbackManager::showStatusInitializing() { ledState = LED_STATIC; staticColor = CRGB::Blue; }
-void FeedbackManager::turnOff() { ledState = LED_STATIC; staticColor = CRGB::Black; }
+void FeedbackManager::showStatusReady() { if (defer(FB_STATUS_READY)) return; ledState = LED_STATIC; staticColor = CRGB::Green; }
+void FeedbackManager::showStatusBusy() { if (defer(FB_STATUS_BUSY)) return; ledState = LED_STATIC; staticColor = CRGB::Orange; }
+void FeedbackManager::showStatusLow() { if (defer(FB_STATUS_LOW)) return; ledState = LED_STATIC; staticColor = CRGB::DeepSkyBlue; }
+void FeedbackManager::showStatusEmpty() { if (defer(FB_STATUS_EMPTY)) return; ledState = LED_STATIC; staticColor = CRGB::DarkRed; }
+void FeedbackManager::showStatusError() { if (defer(FB_STATUS_ERROR)) return; ledState = LED_STATIC; staticColor = CRGB::Red; }
+void FeedbackManager::showStatusInitializing() { if (defer(FB_STATUS_INITIALIZING)) return; ledState = LED_STATIC; staticColor = CRGB::Blue; }
+void FeedbackManager::turnOff() { if (defer(FB_TURN_OFF)) return; ledState = LED_STATIC; staticColor = CRGB::Black; }
 
 
 // --- Event Signal Methods ---
 void FeedbackManager::signalSuccess() {
+    if (defer(FB_SIGNAL_SUCCESS)) return;
+
     const int sequence[] = { TONE_SUCCESS_FREQ1, TONE_SUCCESS_DURATION, 50, TONE_SUCCESS_FREQ2, TONE_SUCCESS_DURATION, 0 };
     playToneSequence(sequence);
     
@@ -61,6 +81,8 @@ void FeedbackManager::signalSuccess() {
 }
 
 void FeedbackManager::signalError() {
+    if (defer(FB_SIGNAL_ERROR)) return;
+
     const int sequence[] = { TONE_ERROR_FREQ, TONE_ERROR_DURATION, 0 };
     playToneSequence(sequence);
     
@@ -73,12 +95,31 @@ void FeedbackManager::signalError() {
 }
 
 void FeedbackManager::signalServing() {
+    if (defer(FB_SIGNAL_SERVING)) return;
+
     const int sequence[] = { TONE_COFFEE_FREQ1, TONE_COFFEE_DURATION, 50, TONE_COFFEE_FREQ2, TONE_COFFEE_DURATION, 0 };
     playToneSequence(sequence);
     showStatusBusy();
 }
 
+void FeedbackManager::signalQueued() {
+    if (defer(FB_SIGNAL_QUEUED)) return;
+
+    // Um bipe curto: o pedido entrou na fila, não precisa tocar de novo
+    const int sequence[] = { TONE_QUEUED_FREQ, TONE_QUEUED_DURATION, 0 };
+    playToneSequence(sequence);
+    
+    ledState = LED_ANIMATING;
+    currentAnimation = ANIM_BLINK;
+    animationStartTime = millis();
+    animColor1 = CRGB::Orange;
+    animBlinks = 1;
+    animDuration = 400;
+}
+
 void FeedbackManager::signalRefill() {
+    if (defer(FB_SIGNAL_REFILL)) return;
+
     const int sequence[] = { TONE_REFILL_FREQ1, 100, 50, TONE_REFILL_FREQ2, 100, 50, TONE_REFILL_FREQ3, 100, 0 };
     playToneSequence(sequence);
     
@@ -100,6 +141,8 @@ void FeedbackManager::signalUnknownUser() {
 }
 
 void FeedbackManager::signalNoCredits() {
+    if (defer(FB_SIGNAL_NO_CREDITS)) return;
+
     const int sequence[] = { TONE_ERROR_FREQ, 100, 50, TONE_ERROR_FREQ, 200, 0 };
     playToneSequence(sequence);
     
@@ -113,6 +156,36 @@ void FeedbackManager::signalNoCredits() {
 }
 
 
+// --- Private Command Queue ---
+bool FeedbackManager::defer(FeedbackCommand command) {
+    // Before the queue exists, or when already running in the owner task, apply directly
+    if (!commandQueue || !ownerTask || xTaskGetCurrentTaskHandle() == ownerTask) {
+        return false;
+    }
+    if (xQueueSend(commandQueue, &command, 0) != pdTRUE) {
+        droppedCommands++;
+    }
+    return true;
+}
+
+void FeedbackManager::apply(FeedbackCommand command) {
+    switch (command) {
+        case FB_STATUS_READY:        showStatusReady(); break;
+        case FB_STATUS_BUSY:         showStatusBusy(); break;
+        case FB_STATUS_LOW:          showStatusLow(); break;
+        case FB_STATUS_EMPTY:        showStatusEmpty(); break;
+        case FB_STATUS_ERROR:        showStatusError(); break;
+        case FB_STATUS_INITIALIZING: showStatusInitializing(); break;
+        case FB_TURN_OFF:            turnOff(); break;
+        case FB_SIGNAL_SUCCESS:      signalSuccess(); break;
+        case FB_SIGNAL_ERROR:        signalError(); break;
+        case FB_SIGNAL_SERVING:      signalServing(); break;
+        case FB_SIGNAL_QUEUED:       signalQueued(); break;
+        case FB_SIGNAL_REFILL:       signalRefill(); break;
+        case FB_SIGNAL_NO_CREDITS:   signalNoCredits(); break;
+    }
+}
+
 // --- Private LED State Machine ---
 void FeedbackManager::updateLed() {
     if (ledState == LED_STATIC) {
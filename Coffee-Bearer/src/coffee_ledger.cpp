@@ -0,0 +1,337 @@
+#include "coffee_ledger.h"
+#include <SPIFFS.h>
+#include <algorithm>
+#include <time.h>
+
+// Arquivo do ledger: cabeçalho (com os contadores), dicionário de UIDs em
+// tamanho fixo e o anel de eventos na posição sequence % LEDGER_CAPACITY
+#define LEDGER_FILE_MAGIC 0x4C474342UL             // "BCGL"
+#define LEDGER_FILE_VERSION 1
+
+struct LedgerFileHeader {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t recordSize;
+    uint16_t capacity;
+    uint16_t userCount;
+    LedgerTotals totals;
+};
+
+static const size_t LEDGER_USERS_OFFSET = sizeof(LedgerFileHeader);
+static const size_t LEDGER_RECORDS_OFFSET = LEDGER_USERS_OFFSET + LEDGER_MAX_USERS * sizeof(LedgerUser);
+
+static bool writeHeader(File& file, const LedgerFileHeader& header, const LedgerUser* users) {
+    size_t bytes = LEDGER_MAX_USERS * sizeof(LedgerUser);
+    return file.seek(0) &&
+           file.write((const uint8_t*)&header, sizeof(header)) == sizeof(header) &&
+           file.write((const uint8_t*)users, bytes) == bytes;
+}
+
+CoffeeLedger::CoffeeLedger() :
+    pendingCount(0),
+    droppedEvents(0),
+    revision(0),
+    savedRevision(0),
+    scheduler(nullptr),
+    flushJob(-1),
+    lock(nullptr),
+    fileLock(nullptr) {
+    resetState();
+}
+
+bool CoffeeLedger::begin() {
+    lock = xSemaphoreCreateMutex();
+    fileLock = xSemaphoreCreateMutex();
+    rollups.begin();
+    bool loaded = load();
+    DEBUG_PRINTF("Ledger: %u eventos, %u cafés servidos\n",
+                (unsigned)totals.sequence, (unsigned)totals.served);
+    return loaded;
+}
+
+void CoffeeLedger::clear() {
+    if (fileLock) xSemaphoreTake(fileLock, portMAX_DELAY);
+    acquire();
+    resetState();
+    pendingCount = 0;
+    savedRevision = revision;
+    SPIFFS.remove(LEDGER_FILE);
+    rollups.clear();
+    release();
+    if (fileLock) xSemaphoreGive(fileLock);
+    DEBUG_PRINTLN("Ledger de café limpo");
+}
+
+void CoffeeLedger::recordServe(ServeSource source, const PackedUID* uid, uint32_t durationMs) {
+    LedgerEvent event;
+    event.type = LEDGER_SERVE;
+    event.source = source;
+    event.durationMs = min(durationMs, (uint32_t)UINT16_MAX);
+    append(event, uid);
+}
+
+void CoffeeLedger::recordRefill(ServeSource source) {
+    LedgerEvent event;
+    event.type = LEDGER_REFILL;
+    event.source = source;
+    event.durationMs = 0;
+    append(event, nullptr);
+}
+
+LedgerTotals CoffeeLedger::getTotals() {
+    acquire();
+    LedgerTotals copy = totals;
+    release();
+    return copy;
+}
+
+uint32_t CoffeeLedger::getServedToday() {
+    return getServedLastDays(1);
+}
+
+uint32_t CoffeeLedger::getServedLastDays(uint8_t count) {
+    uint32_t day = StatsRollups::currentPeriod(ROLLUP_DAILY);
+    if (day == 0) return 0;
+
+    uint32_t served = 0;
+    RollupBucket bucket;
+    for (uint8_t i = 0; i < count && i < STATS_DAYS; i++) {
+        if (rollups.getBucket(ROLLUP_DAILY, day - i, bucket)) served += bucket.served;
+    }
+    return served;
+}
+
+uint8_t CoffeeLedger::getTopUsers(LedgerUser* out, uint8_t count) {
+    uint8_t order[LEDGER_MAX_USERS];
+    acquire();
+    uint8_t available = userCount;
+    for (uint8_t i = 0; i < available; i++) {
+        order[i] = i;
+    }
+    uint8_t limit = min(count, available);
+    std::partial_sort(order, order + limit, order + available,
+        [this](uint8_t a, uint8_t b) {
+            return users[a].served > users[b].served;
+        });
+
+    uint8_t filled = 0;
+    while (filled < limit && users[order[filled]].served > 0) {
+        out[filled] = users[order[filled]];
+        filled++;
+    }
+    release();
+    return filled;
+}
+
+void CoffeeLedger::restoreTotals(uint32_t served, uint32_t serveTimeMs) {
+    acquire();
+    totals.served = served;
+    totals.serveTimeMs = serveTimeMs;
+    revision++;
+    release();
+    if (scheduler) scheduler->trigger(flushJob);
+}
+
+const char* CoffeeLedger::sourceName(uint8_t source) {
+    switch (source) {
+        case SERVE_SOURCE_RFID: return "rfid";
+        case SERVE_SOURCE_WEB: return "web";
+        case SERVE_SOURCE_SERIAL: return "serial";
+        default: return "unknown";
+    }
+}
+
+void CoffeeLedger::registerJobs(MaintenanceScheduler& jobs) {
+    scheduler = &jobs;
+    flushJob = jobs.every("ledger.flush", LEDGER_FLUSH_INTERVAL_MS, [this]() { flush(); });
+    // O checkpoint dos agregados só cita eventos que já estão no arquivo do ledger
+    jobs.every("stats.save", STATS_SAVE_INTERVAL_MS, [this]() {
+        if (flush()) rollups.save();
+    });
+}
+
+// Métodos privados
+
+void CoffeeLedger::append(LedgerEvent& event, const PackedUID* uid) {
+    time_t now = time(nullptr);
+    event.timestamp = now >= (time_t)AUTH_MIN_VALID_EPOCH ? (uint32_t)now : 0;
+
+    acquire();
+    if (pendingCount >= LEDGER_PENDING_MAX) {
+        // Fila cheia (gravação atrasada ou falhando): descarta o evento inteiro
+        // e cobra o job. Totais, agregados e a sequência não avançam, senão o
+        // checkpoint dos agregados apontaria para um evento fora do arquivo.
+        // Nada de gravar aqui: o chamador é a tarefa do relé, com o lock do
+        // CoffeeController tomado
+        droppedEvents++;
+        release();
+        DEBUG_PRINTLN("Ledger: fila cheia, evento descartado");
+        if (scheduler) scheduler->trigger(flushJob);
+        return;
+    }
+    event.user = (uid && uid->len) ? userSlot(*uid) : LEDGER_NO_USER;
+    pending[pendingCount++] = event;
+    totals.sequence++;
+    apply(event);
+    revision++;
+    bool flushNow = pendingCount >= LEDGER_PENDING_MAX / 2;
+    release();
+
+    if (flushNow && scheduler) scheduler->trigger(flushJob);
+}
+
+void CoffeeLedger::apply(const LedgerEvent& event) {
+    rollups.apply(event, totals.sequence);
+    if (event.type == LEDGER_REFILL) {
+        totals.refills++;
+        return;
+    }
+
+    totals.served++;
+    totals.serveTimeMs += event.durationMs;
+    if (event.source < SERVE_SOURCE_COUNT) totals.bySource[event.source]++;
+    if (event.timestamp) totals.lastServedAt = event.timestamp;
+    if (event.user < userCount) {
+        users[event.user].served++;
+        users[event.user].lastSeen = totals.sequence;
+    }
+}
+
+uint8_t CoffeeLedger::userSlot(const PackedUID& uid) {
+    uint8_t oldest = 0;
+    for (uint8_t i = 0; i < userCount; i++) {
+        if (users[i].uid.len == uid.len && memcmp(users[i].uid.bytes, uid.bytes, uid.len) == 0) {
+            return i;
+        }
+        if (users[i].lastSeen < users[oldest].lastSeen) oldest = i;
+    }
+
+    // Dicionário cheio: reaproveita o UID visto há mais tempo (nos baldes
+    // antigos o bit do índice ainda conta como o usuário anterior)
+    uint8_t slot = userCount < LEDGER_MAX_USERS ? userCount++ : oldest;
+    memset(&users[slot], 0, sizeof(LedgerUser));
+    users[slot].uid = uid;
+    return slot;
+}
+
+bool CoffeeLedger::flush() {
+    LedgerEvent batch[LEDGER_PENDING_MAX];
+    LedgerFileHeader header;
+    LedgerUser userCopy[LEDGER_MAX_USERS];
+
+    // Jobs e clear() não gravam ao mesmo tempo: um cabeçalho mais antigo
+    // nunca sobrescreve um mais novo
+    if (fileLock) xSemaphoreTake(fileLock, portMAX_DELAY);
+
+    acquire();
+    if (revision == savedRevision) {
+        release();
+        if (fileLock) xSemaphoreGive(fileLock);
+        return true;
+    }
+    uint8_t count = pendingCount;
+    uint32_t snapshotRevision = revision;
+    memcpy(batch, pending, count * sizeof(LedgerEvent));
+    header.magic = LEDGER_FILE_MAGIC;
+    header.version = LEDGER_FILE_VERSION;
+    header.recordSize = sizeof(LedgerEvent);
+    header.capacity = LEDGER_CAPACITY;
+    header.userCount = userCount;
+    header.totals = totals;
+    memcpy(userCopy, users, sizeof(users));
+    release();
+
+    bool created = !SPIFFS.exists(LEDGER_FILE);
+    File file = SPIFFS.open(LEDGER_FILE, created ? "w" : "r+");
+    bool ok = (bool)file;
+
+    // Arquivo novo: reserva o cabeçalho e o dicionário antes do anel.
+    // Depois, eventos primeiro e cabeçalho por último: se a energia cair no
+    // meio, o cabeçalho anterior continua descrevendo só eventos completos
+    if (ok) {
+        ok = !created || writeHeader(file, header, userCopy);
+        uint32_t first = header.totals.sequence - count;
+        for (uint8_t i = 0; ok && i < count; i++) {
+            size_t offset = LEDGER_RECORDS_OFFSET + ((first + i) % LEDGER_CAPACITY) * sizeof(LedgerEvent);
+            ok = file.seek(offset) &&
+                 file.write((const uint8_t*)&batch[i], sizeof(LedgerEvent)) == sizeof(LedgerEvent);
+        }
+        ok = ok && writeHeader(file, header, userCopy);
+        file.close();
+    }
+
+    // Só o que foi gravado sai da fila; em caso de falha tudo fica para a
+    // próxima tentativa (eventos acrescentados durante a gravação ficam atrás)
+    if (ok) {
+        acquire();
+        pendingCount -= count;
+        memmove(pending, pending + count, pendingCount * sizeof(LedgerEvent));
+        savedRevision = snapshotRevision;
+        release();
+    }
+    if (fileLock) xSemaphoreGive(fileLock);
+
+    if (!ok) {
+        DEBUG_PRINTF("Ledger: erro ao gravar %u eventos (mantidos na fila)\n", count);
+    }
+    return ok;
+}
+
+bool CoffeeLedger::load() {
+    // Os agregados têm arquivo próprio e valem mesmo sem o ledger
+    rollups.load();
+
+    File file = SPIFFS.open(LEDGER_FILE, "r");
+    if (!file) {
+        return false;
+    }
+
+    LedgerFileHeader header;
+    bool valid = file.read((uint8_t*)&header, sizeof(header)) == sizeof(header) &&
+                 header.magic == LEDGER_FILE_MAGIC &&
+                 header.version == LEDGER_FILE_VERSION &&
+                 header.recordSize == sizeof(LedgerEvent) &&
+                 header.capacity == LEDGER_CAPACITY &&
+                 header.userCount <= LEDGER_MAX_USERS &&
+                 file.read((uint8_t*)users, sizeof(users)) == sizeof(users);
+
+    if (valid) {
+        totals = header.totals;
+        userCount = header.userCount;
+
+        // Reaplica os eventos gravados depois do checkpoint dos agregados
+        // (ou todo o anel, se o checkpoint não existir)
+        uint32_t first = totals.sequence - min(totals.sequence, (uint32_t)LEDGER_CAPACITY);
+        uint32_t applied = min(rollups.getAppliedSequence(), totals.sequence);
+        LedgerEvent event;
+        for (uint32_t seq = max(first, applied); valid && seq < totals.sequence; seq++) {
+            size_t offset = LEDGER_RECORDS_OFFSET + (seq % LEDGER_CAPACITY) * sizeof(LedgerEvent);
+            valid = file.seek(offset) &&
+                    file.read((uint8_t*)&event, sizeof(event)) == sizeof(event);
+            if (valid) rollups.apply(event, seq + 1);
+        }
+    }
+    file.close();
+
+    if (!valid) {
+        DEBUG_PRINTLN("Arquivo do ledger inválido");
+        SPIFFS.remove(LEDGER_FILE);
+        resetState();
+        return false;
+    }
+    return true;
+}
+
+void CoffeeLedger::resetState() {
+    memset(&totals, 0, sizeof(totals));
+    memset(users, 0, sizeof(users));
+    userCount = 0;
+}
+
+void CoffeeLedger::acquire() {
+    if (lock) xSemaphoreTake(lock, portMAX_DELAY);
+}
+
+void CoffeeLedger::release() {
+    if (lock) xSemaphoreGive(lock);
+}
@@ -0,0 +1,112 @@
+#include "event_stream.h"
+#include <esp_system.h>
+
+EventStream::EventStream(AsyncEventSource& eventSource) :
+    source(eventSource),
+    head(0),
+    count(0),
+    nextId(1),
+    lastListenerSeen(0),
+    recording(false),
+    lock(nullptr) {}
+
+void EventStream::begin() {
+    lock = xSemaphoreCreateMutex();
+
+    // Ids aleatórios por boot: um Last-Event-ID de antes do reboot não casa com o anel
+    nextId = (esp_random() & 0x3FFFFFFF) + 1;
+
+    source.onConnect([this](AsyncEventSourceClient* client) {
+        this->onConnect(client);
+    });
+}
+
+void EventStream::acquire() {
+    if (lock) xSemaphoreTake(lock, portMAX_DELAY);
+}
+
+void EventStream::release() {
+    if (lock) xSemaphoreGive(lock);
+}
+
+bool EventStream::wantsEvents() {
+    if (source.count() > 0) {
+        lastListenerSeen = millis();
+        recording = true;
+        return true;
+    }
+
+    if (recording && millis() - lastListenerSeen >= SSE_RESUME_WINDOW_MS) {
+        // Ninguém voltou a tempo: libera o anel e queima um id, forçando o
+        // snapshot completo para quem tentar retomar daqui em diante
+        acquire();
+        for (uint8_t i = 0; i < SSE_REPLAY_SIZE; i++) {
+            ring[i].data = String();
+        }
+        head = 0;
+        count = 0;
+        nextId++;
+        recording = false;
+        release();
+        DEBUG_PRINTLN("SSE: sem displays, histórico de retomada descartado");
+    }
+    return recording;
+}
+
+void EventStream::publish(const char* type, const String& frame) {
+    if (frame.length() == 0 || !wantsEvents()) return;
+
+    acquire();
+    uint32_t id = nextId++;
+    uint8_t slot = (head + count) % SSE_REPLAY_SIZE;
+    if (count == SSE_REPLAY_SIZE) {
+        head = (head + 1) % SSE_REPLAY_SIZE;
+    } else {
+        count++;
+    }
+    ring[slot].id = id;
+    ring[slot].type = type;
+    ring[slot].data = frame;
+
+    // Envio sob o lock: um display conectando agora não recebe o evento duas vezes
+    if (source.count() > 0) {
+        source.send(frame.c_str(), type, id);
+    }
+    release();
+}
+
+// Métodos privados
+
+bool EventStream::canReplayFrom(uint32_t lastId) {
+    // Retomada só sem lacunas: lastId precisa estar entre (mais antigo - 1) e o mais recente
+    uint32_t newest = nextId - 1;
+    uint32_t oldest = count > 0 ? ring[head].id : nextId;
+    return (int32_t)(lastId - (oldest - 1)) >= 0 && (int32_t)(newest - lastId) >= 0;
+}
+
+void EventStream::onConnect(AsyncEventSourceClient* client) {
+    uint32_t lastId = client->lastId();
+
+    acquire();
+    if (lastId != 0 && canReplayFrom(lastId)) {
+        uint8_t replayed = 0;
+        for (uint8_t i = 0; i < count; i++) {
+            const ReplayEntry& entry = ring[(head + i) % SSE_REPLAY_SIZE];
+            if ((int32_t)(entry.id - lastId) > 0) {
+                client->send(entry.data.c_str(), entry.type, entry.id, SSE_RETRY_MS);
+                replayed++;
+            }
+        }
+        DEBUG_PRINTF("SSE: display retomado a partir de %u (%u eventos)\n", (unsigned)lastId, replayed);
+    } else if (snapshotProvider) {
+        // Conexão nova ou lacuna grande demais: status completo; os patches
+        // seguintes valem sobre ele porque sempre trazem o valor mais recente
+        String frame = snapshotProvider();
+        if (frame.length() > 0) {
+            client->send(frame.c_str(), "system_status", nextId - 1, SSE_RETRY_MS);
+        }
+    }
+    lastListenerSeen = millis();
+    recording = true;
+    release();
+}
@@ -1,15 +1,25 @@
 #include "logger.h"
 #include <SPIFFS.h>
+#include <algorithm>
 #include <time.h>
 
 Logger::Logger() :
     lastFlush(0),
     fileLogging(true),
     serialLogging(true),
-    minimumLevel(DEBUG_LOG_LEVEL) {
+    minimumLevel(DEBUG_LOG_LEVEL),
+    stateVersion(0),
+    filteredEntries(0),
+    evictedEntries(0),
+    scheduler(nullptr),
+    flushJob(-1),
+    flushedIndex(0),
+    lock(nullptr) {
+    memset(levelTotals, 0, sizeof(levelTotals));
 }
 
 bool Logger::begin() {
+    lock = xSemaphoreCreateMutex();
     logBuffer.clear();
     logBuffer.reserve(MAX_LOG_ENTRIES / 4); // Reserve espaço inicial
     
@@ -38,7 +48,10 @@ bool Logger::begin() {
 void Logger::end() {
     // Flush final antes de finalizar
     flushToFile();
+    acquire();
     logBuffer.clear();
+    flushedIndex = 0;
+    release();
     DEBUG_PRINTLN("Sistema de logging finalizado");
 }
 
@@ -60,10 +73,13 @@ void Logger::enableSerialLogging(bool enable) {
 void Logger::log(LogLevel level, const String& category, const String& message, const String& details) {
     // Verificar nível mínimo
     if (level < minimumLevel) {
+        acquire();
+        filteredEntries++;
+        release();
         return;
     }
     
-    // Criar entrada de log
+    // Criar entrada de log (cópias das Strings fora do lock)
     LogEntry entry;
     entry.timestamp = millis();
     entry.level = level;
@@ -71,13 +87,19 @@ void Logger::log(LogLevel level, const String& category, const String& message,
     entry.message = message;
     entry.details = details;
     
+    acquire();
+    levelTotals[level]++;
+    
     // Adicionar ao buffer
     logBuffer.push_back(entry);
+    stateVersion++;
     
     // Remover entradas antigas se buffer estiver cheio
     if (logBuffer.size() > MAX_LOG_ENTRIES) {
-        logBuffer.erase(logBuffer.begin(), logBuffer.begin() + (MAX_LOG_ENTRIES / 4));
+        dropFront(MAX_LOG_ENTRIES / 4);
+        evictedEntries += MAX_LOG_ENTRIES / 4;
     }
+    release();
     
     // Output serial se habilitado
     if (serialLogging) {
@@ -87,7 +109,7 @@ void Logger::log(LogLevel level, const String& category, const String& message,
     
     // Flush periódico para arquivo
     if (fileLogging && (millis() - lastFlush > 30000 || level >= LOG_ERROR)) {
-        flushToFile();
+        requestFlush();
     }
 }
 
@@ -111,7 +133,7 @@ void Logger::critical(const String& message, const String& details) {
     log(LOG_CRITICAL, "CRITICAL", message, details);
     // Flush imediatamente para logs críticos
     if (fileLogging) {
-        flushToFile();
+        requestFlush();
     }
 }
 
@@ -167,11 +189,13 @@ void Logger::logWebRequest(const String& method, const String& path, const Strin
 std::vector<LogEntry> Logger::getRecentLogs(int count) {
     std::vector<LogEntry> recent;
     
+    acquire();
     int startIndex = max(0, (int)logBuffer.size() - count);
     
     for (int i = startIndex; i < (int)logBuffer.size(); i++) {
         recent.push_back(logBuffer[i]);
     }
+    release();
     
     return recent;
 }
@@ -179,11 +203,13 @@ std::vector<LogEntry> Logger::getRecentLogs(int count) {
 std::vector<LogEntry> Logger::getLogsByLevel(LogLevel level, int count) {
     std::vector<LogEntry> filtered;
     
+    acquire();
     for (auto it = logBuffer.rbegin(); it != logBuffer.rend() && filtered.size() < count; ++it) {
         if (it->level == level) {
             filtered.push_back(*it);
         }
     }
+    release();
     
     return filtered;
 }
@@ -191,11 +217,13 @@ std::vector<LogEntry> Logger::getLogsByLevel(LogLevel level, int count) {
 std::vector<LogEntry> Logger::getLogsByCategory(const String& category, int count) {
     std::vector<LogEntry> filtered;
     
+    acquire();
     for (auto it = logBuffer.rbegin(); it != logBuffer.rend() && filtered.size() < count; ++it) {
         if (it->category.equalsIgnoreCase(category)) {
             filtered.push_back(*it);
         }
     }
+    release();
     
     return filtered;
 }
@@ -203,11 +231,13 @@ std::vector<LogEntry> Logger::getLogsByCategory(const String& category, int coun
 std::vector<LogEntry> Logger::getLogsByTimeRange(unsigned long startTime, unsigned long endTime) {
     std::vector<LogEntry> filtered;
     
+    acquire();
     for (const auto& entry : logBuffer) {
         if (entry.timestamp >= startTime && entry.timestamp <= endTime) {
             filtered.push_back(entry);
         }
     }
+    release();
     
     return filtered;
 }
@@ -217,6 +247,7 @@ std::vector<LogEntry> Logger::searchLogs(const String& searchTerm, int count) {
     String lowerSearchTerm = searchTerm;
     lowerSearchTerm.toLowerCase();
     
+    acquire();
     for (auto it = logBuffer.rbegin(); it != logBuffer.rend() && results.size() < count; ++it) {
         String message = it->message;
         String details = it->details;
@@ -232,46 +263,62 @@ std::vector<LogEntry> Logger::searchLogs(const String& searchTerm, int count) {
             results.push_back(*it);
         }
     }
+    release();
     
     return results;
 }
 
 int Logger::getTotalLogCount() {
-    return logBuffer.size();
+    acquire();
+    int count = logBuffer.size();
+    release();
+    return count;
 }
 
 int Logger::getLogCountByLevel(LogLevel level) {
     int count = 0;
+    acquire();
     for (const auto& entry : logBuffer) {
         if (entry.level == level) {
             count++;
         }
     }
+    release();
     return count;
 }
 
 int Logger::getLogCountByCategory(const String& category) {
     int count = 0;
+    acquire();
     for (const auto& entry : logBuffer) {
         if (entry.category.equalsIgnoreCase(category)) {
             count++;
         }
     }
+    release();
     return count;
 }
 
 unsigned long Logger::getOldestLogTime() {
-    if (logBuffer.empty()) return 0;
-    return logBuffer.front().timestamp;
+    acquire();
+    unsigned long oldest = logBuffer.empty() ? 0 : logBuffer.front().timestamp;
+    release();
+    return oldest;
 }
 
 unsigned long Logger::getNewestLogTime() {
-    if (logBuffer.empty()) return 0;
-    return logBuffer.back().timestamp;
+    acquire();
+    unsigned long newest = logBuffer.empty() ? 0 : logBuffer.back().timestamp;
+    release();
+    return newest;
 }
 
 void Logger::clearLogs() {
+    acquire();
     logBuffer.clear();
+    flushedIndex = 0;
+    stateVersion++;
+    release();
     
     if (fileLogging && SPIFFS.exists(LOG_FILE_PATH)) {
         SPIFFS.remove(LOG_FILE_PATH);
@@ -288,14 +335,15 @@ void Logger::clearLogs() {
 void Logger::clearOldLogs(unsigned long olderThan) {
     unsigned long cutoffTime = millis() - olderThan;
     
-    auto it = logBuffer.begin();
-    while (it != logBuffer.end()) {
-        if (it->timestamp < cutoffTime) {
-            it = logBuffer.erase(it);
-        } else {
-            ++it;
-        }
+    // O buffer está em ordem de chegada: as antigas formam um prefixo
+    acquire();
+    size_t count = 0;
+    while (count < logBuffer.size() && logBuffer[count].timestamp < cutoffTime) {
+        count++;
     }
+    dropFront(count);
+    stateVersion++;
+    release();
     
     DEBUG_PRINTF("Logs antigos removidos (mais antigos que %lu ms)\n", olderThan);
 }
@@ -309,18 +357,23 @@ bool Logger::exportLogs(const String& filename) {
         return false;
     }
     
+    // Cópia sob o lock; a escrita no SPIFFS acontece fora dele
+    acquire();
+    std::vector<LogEntry> entries = logBuffer;
+    release();
+    
     // Cabeçalho JSON
     file.println("{\"logs\":[");
     
-    for (size_t i = 0; i < logBuffer.size(); i++) {
+    for (size_t i = 0; i < entries.size(); i++) {
         if (i > 0) file.print(",");
         
         file.print("{");
-        file.print("\"timestamp\":" + String(logBuffer[i].timestamp) + ",");
-        file.print("\"level\":\"" + levelToString(logBuffer[i].level) + "\",");
-        file.print("\"category\":\"" + logBuffer[i].category + "\",");
-        file.print("\"message\":\"" + logBuffer[i].message + "\",");
-        file.print("\"details\":\"" + logBuffer[i].details + "\"");
+        file.print("\"timestamp\":" + String(entries[i].timestamp) + ",");
+        file.print("\"level\":\"" + levelToString(entries[i].level) + "\",");
+        file.print("\"category\":\"" + entries[i].category + "\",");
+        file.print("\"message\":\"" + entries[i].message + "\",");
+        file.print("\"details\":\"" + entries[i].details + "\"");
         file.println("}");
     }
     
@@ -404,37 +457,50 @@ String Logger::getLogSummary() {
     return summary;
 }
 
-void Logger::maintenance() {
-    // Flush periódico
-    if (fileLogging && (millis() - lastFlush > 60000)) {
+void Logger::registerJobs(MaintenanceScheduler& jobs) {
+    scheduler = &jobs;
+    flushJob = jobs.every("log.flush", LOG_FLUSH_INTERVAL_MS, [this]() { flushAndRotate(); });
+    jobs.every("log.cleanup", LOG_CLEANUP_INTERVAL_MS, [this]() { cleanupOldLogs(); });
+}
+
+// Métodos privados
+
+void Logger::requestFlush() {
+    // A tarefa RFID não pode esperar pelo SPIFFS: a gravação vai para a manutenção
+    if (scheduler) {
+        scheduler->trigger(flushJob);
+    } else {
         flushToFile();
     }
-    
-    // Limpeza de logs antigos
-    static unsigned long lastCleanup = 0;
-    if (millis() - lastCleanup > 3600000) { // A cada hora
-        cleanupOldLogs();
-        lastCleanup = millis();
-    }
-    
-    // Rotação de arquivo se muito grande
-    if (fileLogging && getLogFileSize() > 1024 * 1024) { // 1MB
+}
+
+void Logger::flushAndRotate() {
+    if (!fileLogging) return;
+    flushToFile();
+
+    // Rotação de arquivo se muito grande (só cresce quando há flush)
+    if (getLogFileSize() > 1024 * 1024) { // 1MB
         rotateLogFile();
     }
 }
 
-// Métodos privados
-
 void Logger::flushToFile() {
-    if (!fileLogging || logBuffer.empty()) {
+    if (!fileLogging) {
         return;
     }
     
-    // Encontrar índice da última entrada que foi salva
-    static size_t lastFlushedIndex = 0;
+    // Entradas ainda não gravadas, formatadas sob o lock; o SPIFFS fica fora dele
+    acquire();
+    std::vector<String> pending;
+    pending.reserve(logBuffer.size() - flushedIndex);
+    for (size_t i = flushedIndex; i < logBuffer.size(); i++) {
+        pending.push_back(formatLogEntry(logBuffer[i]));
+    }
+    flushedIndex = logBuffer.size();
+    release();
     
-    if (lastFlushedIndex >= logBuffer.size()) {
-        lastFlushedIndex = 0;
+    if (pending.empty()) {
+        return;
     }
     
     File file = SPIFFS.open(LOG_FILE_PATH, "a");
@@ -445,14 +511,12 @@ void Logger::flushToFile() {
     
     // Escrever novas entradas
     size_t entriesWritten = 0;
-    for (size_t i = lastFlushedIndex; i < logBuffer.size(); i++) {
-        String formatted = formatLogEntry(logBuffer[i]);
+    for (const String& formatted : pending) {
         file.println(formatted);
         entriesWritten++;
     }
     
     file.close();
-    lastFlushedIndex = logBuffer.size();
     lastFlush = millis();
     
     if (entriesWritten > 0) {
@@ -460,6 +524,21 @@ void Logger::flushToFile() {
     }
 }
 
+void Logger::dropFront(size_t count) {
+    // Chamado sob o lock; mantém flushedIndex apontando para a mesma entrada
+    count = std::min(count, logBuffer.size());
+    logBuffer.erase(logBuffer.begin(), logBuffer.begin() + count);
+    flushedIndex = flushedIndex > count ? flushedIndex - count : 0;
+}
+
+void Logger::acquire() {
+    if (lock) xSemaphoreTake(lock, portMAX_DELAY);
+}
+
+void Logger::release() {
+    if (lock) xSemaphoreGive(lock);
+}
+
 String Logger::formatLogEntry(const LogEntry& entry) {
     String formatted = "[";
     
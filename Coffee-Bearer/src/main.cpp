@@ -13,6 +13,8 @@ Admin/Usuário, Autenticação e LED Neopixel
 #include <NTPClient.h>
 #include <WiFiUdp.h>
 #include <ESPmDNS.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
 
 // Inclusão dos módulos customizados
 #include "config.h"
@@ -23,6 +25,8 @@ Admin/Usuário, Autenticação e LED Neopixel
 #include "user_manager.h"
 #include "coffee_controller.h"
 #include "web_server.h"
+#include "backup_manager.h"
+#include "maintenance_scheduler.h"
 
 
 // Instâncias globais
@@ -30,22 +34,31 @@ AsyncWebServer server(80);
 WiFiUDP ntpUDP;
 NTPClient timeClient(ntpUDP, NTP_SERVER, GMT_OFFSET_SEC, DAYLIGHT_OFFSET_SEC);
 
+// Jobs periódicos da tarefa de manutenção
+MaintenanceScheduler scheduler;
+
 // Managers
 FeedbackManager feedbackManager; // Must be created first
 UserManager userManager;
 AuthManager authManager;
 Logger logger;
 // These managers now require other managers to be passed to them
-CoffeeController coffeeController(feedbackManager); 
+CoffeeController coffeeController(feedbackManager, userManager); 
 RFIDManager rfidManager(userManager, coffeeController, logger, feedbackManager);
-WebServerManager webServer(authManager, logger, userManager, coffeeController, feedbackManager);
+BackupManager backupManager(userManager, coffeeController, authManager);
+WebServerManager webServer(authManager, logger, userManager, coffeeController, feedbackManager, backupManager, scheduler);
 
 
 // Variáveis de controle
-unsigned long lastResetCheck = 0;
-unsigned long lastStatusUpdate = 0;
 bool systemInitialized = false;
 
+// Tarefas
+TaskHandle_t rfidTaskHandle = nullptr;
+TaskHandle_t feedbackTaskHandle = nullptr;
+TaskHandle_t maintenanceTaskHandle = nullptr;
+
+void startTasks();
+
 void connectWiFi() {
     Serial.printf("Conectando ao WiFi: %s\n", WIFI_SSID);
     WiFi.mode(WIFI_STA);
@@ -74,6 +87,9 @@ void connectWiFi() {
             logger.error("Falha ao iniciar mDNS");
         }
 
+        // Relógio do sistema via SNTP: valida a expiração dos tokens de sessão
+        configTime(GMT_OFFSET_SEC, DAYLIGHT_OFFSET_SEC, NTP_SERVER);
+
     } else {
         Serial.println(F("\nFalha na conexão WiFi!"));
         logger.error("Falha na conexão WiFi");
@@ -90,6 +106,7 @@ void initializeSystem() {
     Serial.println(F("=================================================="));
     
     feedbackManager.begin();
+    scheduler.begin();
 
     if (!SPIFFS.begin(true)) {
         Serial.println(F("ERRO FATAL: Falha ao montar SPIFFS"));
@@ -112,8 +129,9 @@ void initializeSystem() {
     timeClient.begin();
     timeClient.update();
     
-    systemInitialized = true;
     feedbackManager.showStatusReady();
+    startTasks();
+    systemInitialized = true;
     
     logger.info("Sistema iniciado com sucesso");
     // --- Use the MDNS_HOSTNAME from config.h ---
@@ -204,13 +222,19 @@ void processSerialCommands() {
         Serial.println(F("  credits <uid>     - Mostra créditos"));
         Serial.println(F(""));
         Serial.println(F("Café:"));
-        Serial.println(F("  serve             - Serve café manual"));
+        Serial.println(F("  serve             - Serve café manual (ou entra na fila)"));
+        Serial.println(F("  cancel <pedido>   - Cancela um pedido da fila"));
+        Serial.println(F("  stop              - Parada de emergência (desliga o relé e esvazia a fila)"));
         Serial.println(F("  refill            - Reabastece garrafa"));
         Serial.println(F("  stats             - Estatísticas"));
         Serial.println(F(""));
         Serial.println(F("Logs:"));
         Serial.println(F("  logs              - Mostra logs"));
         Serial.println(F("  clearlogs         - Limpa logs"));
+        Serial.println(F(""));
+        Serial.println(F("Diagnóstico:"));
+        Serial.println(F("  bench batch [n]   - Mede um lote de n operações (padrão 1000)"));
+        Serial.println(F("  bench scan [n]    - Compara varreduras com n usuários (padrão 1000)"));
         Serial.println(F("==========================================\n"));
     }
     else if (cmd == "status") {
@@ -245,14 +269,26 @@ void processSerialCommands() {
         userManager.printUserList();
     }
     else if (cmd == "serve") {
-        if (coffeeController.serveCoffee("MANUAL", nullptr)) {
+        ServeTicket ticket = coffeeController.requestServe(SERVE_SOURCE_SERIAL);
+        if (ticket.result == SERVE_STARTED) {
             Serial.println("Café servido manualmente!");
+        } else if (ticket.result == SERVE_QUEUED) {
+            Serial.printf("Pedido #%u na fila (posição %u)\n", (unsigned)ticket.ticket, ticket.position);
         } else {
-            Serial.println("Não foi possível servir café!");
+            Serial.printf("Não foi possível servir café! (%s)\n", CoffeeController::serveResultName(ticket.result));
         }
     }
+    else if (cmd.startsWith("cancel ")) {
+        uint32_t ticket = originalCmd.substring(7).toInt();
+        Serial.println(coffeeController.cancelServe(ticket) ? "Pedido cancelado!" : "Pedido não encontrado na fila!");
+    }
+    else if (cmd == "stop") {
+        coffeeController.emergencyStop();
+        Serial.println("Parada de emergência executada!");
+        logger.warning("Parada de emergência via serial");
+    }
     else if (cmd == "refill") {
-        coffeeController.refillContainer();
+        coffeeController.refillContainer(SERVE_SOURCE_SERIAL);
         Serial.println("Garrafa reabastecida!");
         logger.info("Garrafa reabastecida via serial");
     }
@@ -266,6 +302,22 @@ void processSerialCommands() {
         logger.clearLogs();
         Serial.println("Logs limpos!");
     }
+    else if (cmd == "bench batch" || cmd.startsWith("bench batch ")) {
+        long count = cmd.length() > 12 ? cmd.substring(12).toInt() : USER_BATCH_MAX_OPS;
+        if (count <= 0 || count > USER_BATCH_MAX_OPS) {
+            Serial.printf("Use 1 a %d operações\n", USER_BATCH_MAX_OPS);
+        } else {
+            UserManager::benchmarkBatch(count, Serial);
+        }
+    }
+    else if (cmd == "bench scan" || cmd.startsWith("bench scan ")) {
+        long count = cmd.length() > 11 ? cmd.substring(11).toInt() : 1000;
+        if (count <= 0 || count > USER_BENCH_MAX_USERS) {
+            Serial.printf("Use 1 a %d usuários\n", USER_BENCH_MAX_USERS);
+        } else {
+            UserManager::benchmarkScan(count, Serial);
+        }
+    }
     else if (cmd == "restart") {
         Serial.println("Reiniciando sistema...");
         logger.info("Sistema reiniciado via serial");
@@ -289,28 +341,14 @@ void processSerialCommands() {
 }
 
 
-void checkWeeklyReset() {
-    static unsigned long lastCheck = 0;
-    if (millis() - lastCheck < WEEKLY_RESET_CHECK_INTERVAL) {
-        return;
-    }
-    
-    lastCheck = millis();
-    
-    if (userManager.shouldPerformWeeklyReset()) {
-        Serial.println("Executando reset semanal de créditos...");
-        userManager.performWeeklyReset();
-        logger.info("Reset semanal de créditos executado");
-        feedbackManager.signalServing();
-        delay(2000);
-        feedbackManager.showStatusReady();
-    }
-}
-
 void updateSystemStatus() {
     // Esta função define a cor de fundo se NENHUMA animação estiver acontecendo.
+    // Servindo: laranja até o relé desligar
+    if (coffeeController.isBusy()) {
+        feedbackManager.showStatusBusy();
+    }
     // A prioridade é mostrar se o café está vazio
-    if (coffeeController.isEmpty()) {
+    else if (coffeeController.isEmpty()) {
         feedbackManager.showStatusEmpty();
     } 
     // Depois, se está acabando (ex: menos de 5 cafés)
@@ -336,10 +374,81 @@ void handleWiFiReconnection() {
     }
 }
 
+// ============== TAREFAS ==============
+
+// Prioridade mais alta: leitura do cartão e relé, sem nada que bloqueie.
+// Dorme pelo intervalo adaptativo do leitor, ou até o IRQ de um cartão.
+void rfidTask(void* param) {
+    // Versões vistas na volta anterior: pedidos da web/serial também acordam esta tarefa
+    uint32_t coffeeVersion = coffeeController.getStateVersion();
+    uint32_t queueVersion = coffeeController.getQueueVersion();
+    
+    for (;;) {
+        uint32_t wait = rfidManager.loop();
+        coffeeController.updateRelay();
+        
+        // Serviço iniciado ou concluído: o status sai sem esperar o próximo período
+        if (coffeeController.getStateVersion() != coffeeVersion) {
+            coffeeVersion = coffeeController.getStateVersion();
+            webServer.requestStatusPush();
+        }
+        // Posições da fila mudaram
+        if (coffeeController.getQueueVersion() != queueVersion) {
+            queueVersion = coffeeController.getQueueVersion();
+            webServer.pushServeQueue();
+        }
+        
+        // O timer desliga o relé e acorda a tarefa; o prazo aqui cobre o
+        // desligamento de reserva, o próximo da fila e os pedidos expirados
+        wait = min(wait, coffeeController.getRelayWait());
+        rfidManager.waitForCard(max(wait, (uint32_t)1));
+    }
+}
+
+// LED e buzzer; sinais de outras tarefas chegam pela fila do FeedbackManager
+void feedbackTask(void* param) {
+    for (;;) {
+        updateSystemStatus();
+        feedbackManager.update(pdMS_TO_TICKS(FEEDBACK_TASK_PERIOD_MS));
+    }
+}
+
+// Gravações no SPIFFS/NVS, push de status e limpezas: dorme até o próximo
+// prazo do agendador ou até um trigger() de outra tarefa
+void maintenanceTask(void* param) {
+    for (;;) {
+        scheduler.sleep(scheduler.runDue());
+    }
+}
+
+void startTasks() {
+    // Cada subsistema registra os próprios jobs; daqui em diante log() não grava no SPIFFS
+    logger.registerJobs(scheduler);
+    userManager.setWeeklyResetHandler([]() {
+        logger.info("Reset semanal de créditos executado");
+        feedbackManager.signalRefill();
+    });
+    userManager.registerJobs(scheduler);
+    coffeeController.registerJobs(scheduler);
+    authManager.registerJobs(scheduler);
+    webServer.registerJobs();
+    
+    xTaskCreatePinnedToCore(maintenanceTask, MAINTENANCE_TASK_NAME, MAINTENANCE_TASK_STACK, nullptr,
+                            MAINTENANCE_TASK_PRIORITY, &maintenanceTaskHandle, MAINTENANCE_TASK_CORE);
+    xTaskCreatePinnedToCore(feedbackTask, FEEDBACK_TASK_NAME, FEEDBACK_TASK_STACK, nullptr,
+                            FEEDBACK_TASK_PRIORITY, &feedbackTaskHandle, FEEDBACK_TASK_CORE);
+    xTaskCreatePinnedToCore(rfidTask, RFID_TASK_NAME, RFID_TASK_STACK, nullptr,
+                            RFID_TASK_PRIORITY, &rfidTaskHandle, RFID_TASK_CORE);
+    
+    DEBUG_PRINTF("Tarefas iniciadas: rfid (core %d), feedback (core %d), maintenance (core %d)\n",
+                 RFID_TASK_CORE, FEEDBACK_TASK_CORE, MAINTENANCE_TASK_CORE);
+}
+
 void setup() {
     initializeSystem();
 }
 
+// Tarefa de menor prioridade (loopTask): serial, WiFi e NTP podem bloquear à vontade
 void loop() {
     if (!systemInitialized) {
         delay(100);
@@ -349,20 +458,9 @@ void loop() {
     // Processar comandos seriais
     processSerialCommands();
     
-    // Processar RFID
-    rfidManager.loop();
-    
-    // Verificar reset semanal
-    checkWeeklyReset();
-    
-    // Atualizar status do sistema
-    updateSystemStatus();
-
     // Gerenciar reconexão WiFi
     handleWiFiReconnection();
     
-    feedbackManager.update(); 
-
     // Atualizar NTP periodicamente
     static unsigned long lastNTPUpdate = 0;
     if (millis() - lastNTPUpdate > 3600000) { // A cada hora
@@ -370,4 +468,5 @@ void loop() {
         lastNTPUpdate = millis();
     }
     
+    delay(HOUSEKEEPING_PERIOD_MS);
 }
\ No newline at end of file
@@ -0,0 +1,267 @@
+#include "maintenance_scheduler.h"
+#include <esp_timer.h>
+
+MaintenanceScheduler::MaintenanceScheduler() :
+    heapSize(0),
+    running(-1),
+    owner(nullptr),
+    lock(nullptr) {
+    for (uint8_t i = 0; i < SCHEDULER_MAX_JOBS; i++) {
+        memset(&jobs[i].stats, 0, sizeof(JobStats));
+        jobs[i].deadline = 0;
+        jobs[i].heapIndex = -1;
+        jobs[i].used = false;
+        jobs[i].cancelled = false;
+        jobs[i].retrigger = false;
+    }
+}
+
+void MaintenanceScheduler::begin() {
+    lock = xSemaphoreCreateMutex();
+}
+
+JobId MaintenanceScheduler::every(const char* name, uint32_t periodMs, MaintenanceJob job) {
+    return add(name, periodMs, periodMs, job);
+}
+
+JobId MaintenanceScheduler::after(const char* name, uint32_t delayMs, MaintenanceJob job) {
+    return add(name, delayMs, 0, job);
+}
+
+void MaintenanceScheduler::trigger(JobId id) {
+    if (id < 0 || id >= SCHEDULER_MAX_JOBS) return;
+
+    acquire();
+    Job& job = jobs[id];
+    if (job.used) {
+        job.stats.triggers++;
+        if (job.heapIndex >= 0) {
+            job.deadline = millis();
+            heapSiftUp(job.heapIndex);
+        } else if (running == id) {
+            job.retrigger = true;
+        }
+    }
+    release();
+    wakeOwner();
+}
+
+void MaintenanceScheduler::cancel(JobId id) {
+    if (id < 0 || id >= SCHEDULER_MAX_JOBS) return;
+
+    acquire();
+    Job& job = jobs[id];
+    if (job.used) {
+        if (running == id) {
+            // A função está rodando: o slot é liberado ao terminar
+            job.cancelled = true;
+        } else {
+            if (job.heapIndex >= 0) heapRemove(job.heapIndex);
+            job.used = false;
+            job.run = nullptr;
+        }
+    }
+    release();
+}
+
+uint32_t MaintenanceScheduler::runDue() {
+    owner = xTaskGetCurrentTaskHandle();
+
+    for (;;) {
+        acquire();
+        if (heapSize == 0) {
+            release();
+            return SCHEDULER_MAX_SLEEP_MS;
+        }
+
+        uint8_t slot = heap[0];
+        uint32_t now = millis();
+        if (before(now, jobs[slot].deadline)) {
+            uint32_t wait = jobs[slot].deadline - now;
+            release();
+            return min(wait, (uint32_t)SCHEDULER_MAX_SLEEP_MS);
+        }
+
+        heapRemove(0);
+        running = slot;
+        release();
+
+        // Fora do lock: o job pode registrar, antecipar ou cancelar outros jobs
+        execute(slot, now);
+    }
+}
+
+void MaintenanceScheduler::sleep(uint32_t waitMs) {
+    ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(waitMs));
+}
+
+bool MaintenanceScheduler::getJobStats(uint8_t slot, JobStats& out) {
+    if (slot >= SCHEDULER_MAX_JOBS) return false;
+
+    acquire();
+    bool used = jobs[slot].used;
+    if (used) out = jobs[slot].stats;
+    release();
+    return used;
+}
+
+void MaintenanceScheduler::writeJson(Print& out) {
+    uint32_t now = millis();
+    bool first = true;
+
+    out.print("{\"jobs\":[");
+    for (uint8_t slot = 0; slot < SCHEDULER_MAX_JOBS; slot++) {
+        JobStats stats;
+        acquire();
+        bool used = jobs[slot].used;
+        int32_t dueIn = (int32_t)(jobs[slot].deadline - now);
+        bool scheduled = jobs[slot].heapIndex >= 0;
+        if (used) stats = jobs[slot].stats;
+        release();
+        if (!used) continue;
+
+        out.printf("%s{\"name\":\"%s\",\"periodMs\":%u,\"runs\":%u,\"triggers\":%u,"
+                   "\"avgUs\":%u,\"maxUs\":%u,\"maxLateMs\":%u,\"lastRunAgoMs\":%d,\"dueInMs\":%d}",
+                   first ? "" : ",", stats.name, (unsigned)stats.period, (unsigned)stats.runs,
+                   (unsigned)stats.triggers,
+                   (unsigned)(stats.runs ? stats.totalUs / stats.runs : 0),
+                   (unsigned)stats.maxUs, (unsigned)stats.maxLateMs,
+                   stats.runs ? (int)(now - stats.lastRun) : -1,
+                   scheduled ? (int)max(dueIn, (int32_t)0) : 0);
+        first = false;
+    }
+    out.printf("],\"pending\":%u}", (unsigned)heapSize);
+}
+
+// Métodos privados
+
+JobId MaintenanceScheduler::add(const char* name, uint32_t delayMs, uint32_t periodMs, MaintenanceJob job) {
+    acquire();
+    JobId id = -1;
+    for (uint8_t slot = 0; slot < SCHEDULER_MAX_JOBS; slot++) {
+        if (!jobs[slot].used) {
+            id = slot;
+            break;
+        }
+    }
+    if (id < 0) {
+        release();
+        DEBUG_PRINTF("Agendador: tabela cheia, job %s descartado\n", name);
+        return -1;
+    }
+
+    Job& entry = jobs[id];
+    memset(&entry.stats, 0, sizeof(JobStats));
+    entry.stats.name = name;
+    entry.stats.period = periodMs;
+    entry.run = job;
+    entry.deadline = millis() + delayMs;
+    entry.used = true;
+    entry.cancelled = false;
+    entry.retrigger = false;
+    heapPush(id);
+    bool earliest = heap[0] == id;
+    release();
+
+    // Prazo mais cedo que o sono atual da tarefa dona
+    if (earliest) wakeOwner();
+    return id;
+}
+
+void MaintenanceScheduler::execute(uint8_t slot, uint32_t now) {
+    Job& job = jobs[slot];
+    uint32_t late = now - job.deadline;
+
+    int64_t started = esp_timer_get_time();
+    job.run();
+    uint32_t elapsed = (uint32_t)(esp_timer_get_time() - started);
+
+    acquire();
+    JobStats& stats = job.stats;
+    stats.runs++;
+    stats.totalUs += elapsed;
+    if (elapsed > stats.maxUs) stats.maxUs = elapsed;
+    if (late > stats.maxLateMs) stats.maxLateMs = late;
+    stats.lastRun = now;
+
+    if (job.cancelled || stats.period == 0) {
+        job.used = false;
+        job.run = nullptr;
+    } else {
+        // Ritmo fixo; se ficou mais de um período para trás, pula as execuções perdidas
+        uint32_t current = millis();
+        job.deadline += stats.period;
+        if (before(job.deadline, current)) {
+            job.deadline = current + stats.period;
+        }
+        if (job.retrigger) {
+            job.deadline = current;
+        }
+        job.retrigger = false;
+        heapPush(slot);
+    }
+    running = -1;
+    release();
+}
+
+void MaintenanceScheduler::wakeOwner() {
+    if (owner && owner != xTaskGetCurrentTaskHandle()) {
+        xTaskNotifyGive(owner);
+    }
+}
+
+void MaintenanceScheduler::heapPush(uint8_t slot) {
+    heap[heapSize] = slot;
+    jobs[slot].heapIndex = heapSize;
+    heapSize++;
+    heapSiftUp(heapSize - 1);
+}
+
+void MaintenanceScheduler::heapRemove(uint8_t index) {
+    uint8_t slot = heap[index];
+    heapSize--;
+    if (index != heapSize) {
+        heapSwap(index, heapSize);
+        heapSiftDown(index);
+        heapSiftUp(index);
+    }
+    jobs[slot].heapIndex = -1;
+}
+
+void MaintenanceScheduler::heapSiftUp(uint8_t index) {
+    while (index > 0) {
+        uint8_t parent = (index - 1) / 2;
+        if (!before(jobs[heap[index]].deadline, jobs[heap[parent]].deadline)) break;
+        heapSwap(index, parent);
+        index = parent;
+    }
+}
+
+void MaintenanceScheduler::heapSiftDown(uint8_t index) {
+    for (;;) {
+        uint8_t smallest = index;
+        uint8_t left = index * 2 + 1;
+        uint8_t right = left + 1;
+        if (left < heapSize && before(jobs[heap[left]].deadline, jobs[heap[smallest]].deadline)) smallest = left;
+        if (right < heapSize && before(jobs[heap[right]].deadline, jobs[heap[smallest]].deadline)) smallest = right;
+        if (smallest == index) break;
+        heapSwap(index, smallest);
+        index = smallest;
+    }
+}
+
+void MaintenanceScheduler::heapSwap(uint8_t a, uint8_t b) {
+    uint8_t tmp = heap[a];
+    heap[a] = heap[b];
+    heap[b] = tmp;
+    jobs[heap[a]].heapIndex = a;
+    jobs[heap[b]].heapIndex = b;
+}
+
+void MaintenanceScheduler::acquire() {
+    if (lock) xSemaphoreTake(lock, portMAX_DELAY);
+}
+
+void MaintenanceScheduler::release() {
+    if (lock) xSemaphoreGive(lock);
+}
@@ -0,0 +1,515 @@
+#include "metrics_exporter.h"
+#include <esp_timer.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include "logger.h"
+#include "coffee_controller.h"
+#include "user_manager.h"
+#include "auth_manager.h"
+#include "RFID_manager.h"
+#include "route_metrics.h"
+#include "ws_broadcaster.h"
+#include "event_stream.h"
+#include "maintenance_scheduler.h"
+
+// Ordem de exposição; indexa a tabela FAMILIES abaixo
+enum MetricFamilyId : uint8_t {
+    MF_UPTIME,
+    MF_HEAP_FREE,
+    MF_HEAP_MIN_FREE,
+    MF_HEAP_MAX_ALLOC,
+    MF_HEAP_SIZE,
+    MF_TASKS,
+    MF_TASK_STACK_FREE,
+    MF_COFFEE_SERVED,
+    MF_COFFEE_SERVED_TODAY,
+    MF_COFFEE_REMAINING,
+    MF_COFFEE_BUSY,
+    MF_COFFEE_SERVE_SECONDS,
+    MF_COFFEE_POUR_SECONDS,
+    MF_COFFEE_POUR_OVERRUN_MAX,
+    MF_COFFEE_RELAY_FALLBACKS,
+    MF_COFFEE_QUEUE_DEPTH,
+    MF_COFFEE_QUEUE_MAX_DEPTH,
+    MF_COFFEE_QUEUE_REQUESTS,
+    MF_USERS,
+    MF_USER_CREDITS,
+    MF_AUTH_ACCOUNTS,
+    MF_AUTH_SESSIONS,
+    MF_AUTH_FAILED_LOGINS,
+    MF_AUTH_LOCKOUTS,
+    MF_AUTH_BLOCKED,
+    MF_AUTH_LOCKED_IPS,
+    MF_LOG_ENTRIES,
+    MF_LOG_FILTERED,
+    MF_LOG_EVICTED,
+    MF_LOG_BUFFERED,
+    MF_LOG_FLUSH_LAG,
+    MF_RFID_READS,
+    MF_RFID_READ_ERRORS,
+    MF_RFID_DUPLICATES,
+    MF_RFID_RESULTS,
+    MF_RFID_READ_SECONDS,
+    MF_RFID_READ_MAX,
+    MF_RFID_TAP_SECONDS,
+    MF_RFID_TAP_MAX,
+    MF_RFID_LATE_TAPS,
+    MF_RFID_POLLS,
+    MF_RFID_IRQ_WAKEUPS,
+    MF_RFID_POLL_INTERVAL,
+    MF_STREAM_CLIENTS,
+    MF_WS_FRAMES_SENT,
+    MF_WS_BYTES_SENT,
+    MF_WS_DROPS,
+    MF_HTTP_REQUESTS,
+    MF_HTTP_RESPONSE_BYTES,
+    MF_HTTP_HANDLER_SECONDS,
+    MF_HTTP_UNMETERED,
+    MF_JOB_RUNS,
+    MF_JOB_SECONDS,
+    MF_JOB_MAX_SECONDS,
+    MF_JOB_MAX_LATE,
+    MF_COUNT
+};
+
+struct MetricFamily {
+    const char* name;
+    const char* type;
+    const char* help;
+};
+
+static const MetricFamily FAMILIES[MF_COUNT] = {
+    { "coffeebearer_uptime_seconds", "gauge", "Time since boot" },
+    { "coffeebearer_heap_free_bytes", "gauge", "Free heap" },
+    { "coffeebearer_heap_min_free_bytes", "gauge", "Lowest free heap since boot" },
+    { "coffeebearer_heap_max_alloc_bytes", "gauge", "Largest allocatable heap block" },
+    { "coffeebearer_heap_size_bytes", "gauge", "Total heap size" },
+    { "coffeebearer_tasks", "gauge", "FreeRTOS tasks" },
+    { "coffeebearer_task_stack_free_bytes", "gauge", "Stack high-water mark per task" },
+    { "coffeebearer_coffee_served_total", "counter", "Coffees served" },
+    { "coffeebearer_coffee_served_today", "gauge", "Coffees served today (local time)" },
+    { "coffeebearer_coffee_remaining", "gauge", "Coffees left in the machine" },
+    { "coffeebearer_coffee_busy", "gauge", "1 while a coffee is being served" },
+    { "coffeebearer_coffee_serve_seconds_total", "counter", "Time spent serving coffee" },
+    { "coffeebearer_coffee_pour_seconds", "summary", "Measured relay on-time per coffee since boot" },
+    { "coffeebearer_coffee_pour_overrun_seconds_max", "gauge", "Largest relay on-time beyond the configured serve time" },
+    { "coffeebearer_coffee_relay_fallback_stops_total", "counter", "Relay switch-offs done by the RFID task because the timer did not fire" },
+    { "coffeebearer_coffee_queue_depth", "gauge", "Serve requests waiting in the queue" },
+    { "coffeebearer_coffee_queue_depth_max", "gauge", "Longest serve queue since boot" },
+    { "coffeebearer_coffee_queue_requests_total", "counter", "Serve requests by outcome" },
+    { "coffeebearer_users", "gauge", "Registered RFID users by state" },
+    { "coffeebearer_user_credits", "gauge", "Credits held by all users" },
+    { "coffeebearer_auth_accounts", "gauge", "Web accounts" },
+    { "coffeebearer_auth_sessions", "gauge", "Active web sessions" },
+    { "coffeebearer_auth_failed_logins_total", "counter", "Failed login attempts" },
+    { "coffeebearer_auth_lockouts_total", "counter", "IP lockouts after repeated failures" },
+    { "coffeebearer_auth_blocked_attempts_total", "counter", "Login attempts rejected while locked out" },
+    { "coffeebearer_auth_locked_ips", "gauge", "IPs currently locked out" },
+    { "coffeebearer_log_entries_total", "counter", "Log entries recorded by level" },
+    { "coffeebearer_log_filtered_total", "counter", "Log entries below the minimum level" },
+    { "coffeebearer_log_evicted_total", "counter", "Log entries dropped from the full buffer" },
+    { "coffeebearer_log_buffered", "gauge", "Log entries held in memory" },
+    { "coffeebearer_log_flush_lag_seconds", "gauge", "Time since the log buffer was written to SPIFFS" },
+    { "coffeebearer_rfid_reads_total", "counter", "Card serials read" },
+    { "coffeebearer_rfid_read_errors_total", "counter", "Cards detected but not read" },
+    { "coffeebearer_rfid_duplicates_total", "counter", "Repeated reads of the same card ignored" },
+    { "coffeebearer_rfid_results_total", "counter", "Processed reads by outcome" },
+    { "coffeebearer_rfid_read_seconds", "summary", "Time spent reading a card serial" },
+    { "coffeebearer_rfid_read_seconds_max", "gauge", "Slowest card serial read" },
+    { "coffeebearer_rfid_tap_to_relay_seconds", "summary", "Time from card detection to relay on" },
+    { "coffeebearer_rfid_tap_to_relay_seconds_max", "gauge", "Slowest card detection to relay on" },
+    { "coffeebearer_rfid_late_taps_total", "counter", "Taps whose relay latency exceeded the budget" },
+    { "coffeebearer_rfid_polls_total", "counter", "Card detection attempts sent to the reader" },
+    { "coffeebearer_rfid_irq_wakeups_total", "counter", "Card answers signalled by the reader IRQ pin" },
+    { "coffeebearer_rfid_poll_interval_seconds", "gauge", "Current adaptive card detection interval" },
+    { "coffeebearer_stream_clients", "gauge", "Connected live-update clients by transport" },
+    { "coffeebearer_ws_frames_sent_total", "counter", "WebSocket frames delivered" },
+    { "coffeebearer_ws_bytes_sent_total", "counter", "WebSocket bytes delivered" },
+    { "coffeebearer_ws_drops_total", "counter", "WebSocket frames dropped for slow clients" },
+    { "coffeebearer_http_requests_total", "counter", "HTTP requests by route and status class" },
+    { "coffeebearer_http_response_bytes_total", "counter", "HTTP response bytes with known length" },
+    { "coffeebearer_http_handler_seconds", "histogram", "Time spent in the route handler" },
+    { "coffeebearer_http_unmetered_routes", "gauge", "Routes registered after the metrics table filled" },
+    { "coffeebearer_job_runs_total", "counter", "Maintenance job executions" },
+    { "coffeebearer_job_seconds_total", "counter", "Time spent running each maintenance job" },
+    { "coffeebearer_job_seconds_max", "gauge", "Slowest run of each maintenance job" },
+    { "coffeebearer_job_late_seconds_max", "gauge", "Largest delay past a maintenance job deadline" }
+};
+
+static const char* const LEVEL_LABELS[LOG_CRITICAL + 1] = { "debug", "info", "warning", "error", "critical" };
+static const char* const RESULT_LABELS[RFID_ERROR + 1] = {
+    "success", "access_denied", "no_credits", "system_busy", "no_coffee", "master_key", "queued", "error"
+};
+static const char* const STATUS_LABELS[5] = { "1xx", "2xx", "3xx", "4xx", "5xx" };
+
+// Tarefas com stack medido; o async_tcp é a tarefa corrente durante o scrape
+static const char* const TASK_LABELS[] = { "loopTask", RFID_TASK_NAME, FEEDBACK_TASK_NAME, MAINTENANCE_TASK_NAME };
+#define METRICS_TASK_COUNT (sizeof(TASK_LABELS) / sizeof(TASK_LABELS[0]))
+
+// Contadores lidos uma vez por scrape: todas as amostras descrevem o mesmo instante
+struct MetricsSnapshot {
+    int64_t uptimeUs;
+    uint32_t heapFree;
+    uint32_t heapMinFree;
+    uint32_t heapMaxAlloc;
+    uint32_t heapSize;
+    uint32_t tasks;
+    uint32_t stackFree[METRICS_TASK_COUNT];
+    uint32_t tcpStackFree;
+
+    uint32_t served;
+    uint32_t servedToday;
+    int32_t remaining;
+    bool busy;
+    uint32_t serveTimeMs;
+    RelayStats relay;
+    uint8_t queueDepth;
+    ServeQueueStats queue;
+
+    uint32_t users;
+    uint32_t activeUsers;
+    uint32_t activeToday;
+    int32_t credits;
+
+    uint32_t accounts;
+    uint32_t sessions;
+    LoginSecurityStats security;
+
+    uint32_t logLevels[LOG_CRITICAL + 1];
+    uint32_t logFiltered;
+    uint32_t logEvicted;
+    uint32_t logBuffered;
+    bool fileLogging;
+    uint32_t flushLagMs;
+
+    RFIDStats rfid;
+    uint32_t rfidPollMs;
+
+    WsBroadcastStats ws;
+    uint32_t sseClients;
+};
+
+struct MetricsCursor {
+    MetricsSnapshot snapshot;
+    uint8_t family;
+    uint16_t sample;            // 0 = cabeçalho HELP/TYPE; n = amostra n-1
+    char line[METRICS_LINE_MAX];
+    size_t lineLength;
+    size_t linePosition;
+};
+
+static int writeValue(char* line, const char* name, const char* suffix, const char* labels, unsigned long long value) {
+    return snprintf(line, METRICS_LINE_MAX, "%s%s%s%s%s %llu\n", name, suffix,
+                    labels ? "{" : "", labels ? labels : "", labels ? "}" : "", value);
+}
+
+static int writeSigned(char* line, const char* name, long long value) {
+    return snprintf(line, METRICS_LINE_MAX, "%s %lld\n", name, value);
+}
+
+static int writeSeconds(char* line, const char* name, const char* suffix, const char* labels, double value) {
+    return snprintf(line, METRICS_LINE_MAX, "%s%s%s%s%s %.6f\n", name, suffix,
+                    labels ? "{" : "", labels ? labels : "", labels ? "}" : "", value);
+}
+
+MetricsExporter::MetricsExporter(Logger& log, CoffeeController& coffee, UserManager& users, AuthManager& auth,
+                                 RFIDManager& rfid, RouteMetrics& routes, WsBroadcaster& ws, EventStream& sse,
+                                 MaintenanceScheduler& jobs) :
+    logger(log),
+    coffeeController(coffee),
+    userManager(users),
+    authManager(auth),
+    rfidManager(rfid),
+    routeMetrics(routes),
+    broadcaster(ws),
+    eventStream(sse),
+    scheduler(jobs) {}
+
+std::shared_ptr<MetricsCursor> MetricsExporter::beginScrape() {
+    // Única alocação do scrape; o resto é escrito direto no buffer do chunk
+    auto cursor = std::make_shared<MetricsCursor>();
+    takeSnapshot(*cursor);
+    cursor->family = 0;
+    cursor->sample = 0;
+    cursor->lineLength = 0;
+    cursor->linePosition = 0;
+    return cursor;
+}
+
+size_t MetricsExporter::fill(MetricsCursor& cursor, uint8_t* buffer, size_t maxLen) {
+    size_t written = 0;
+
+    while (written < maxLen) {
+        if (cursor.linePosition >= cursor.lineLength && !nextLine(cursor)) {
+            break;
+        }
+
+        size_t chunk = min(maxLen - written, cursor.lineLength - cursor.linePosition);
+        memcpy(buffer + written, cursor.line + cursor.linePosition, chunk);
+        cursor.linePosition += chunk;
+        written += chunk;
+    }
+
+    return written;
+}
+
+// Métodos privados
+
+void MetricsExporter::takeSnapshot(MetricsCursor& cursor) {
+    MetricsSnapshot& s = cursor.snapshot;
+
+    s.uptimeUs = esp_timer_get_time();
+    s.heapFree = ESP.getFreeHeap();
+    s.heapMinFree = ESP.getMinFreeHeap();
+    s.heapMaxAlloc = ESP.getMaxAllocHeap();
+    s.heapSize = ESP.getHeapSize();
+    s.tasks = uxTaskGetNumberOfTasks();
+    for (size_t i = 0; i < METRICS_TASK_COUNT; i++) {
+        TaskHandle_t task = xTaskGetHandle(TASK_LABELS[i]);
+        s.stackFree[i] = task ? uxTaskGetStackHighWaterMark(task) : 0;
+    }
+    s.tcpStackFree = uxTaskGetStackHighWaterMark(nullptr);   // O scrape roda na task do async_tcp
+
+    s.served = coffeeController.getTotalServed();
+    s.servedToday = coffeeController.getDailyCount();
+    s.remaining = coffeeController.getRemainingCoffees();
+    s.busy = coffeeController.isBusy();
+    s.serveTimeMs = coffeeController.getTotalServeTime();
+    s.relay = coffeeController.getRelayStats();
+    s.queueDepth = coffeeController.getQueueLength();
+    s.queue = coffeeController.getQueueStats();
+
+    s.users = userManager.getTotalUsers();
+    s.activeUsers = userManager.getActiveUsersCount();
+    s.activeToday = userManager.getActiveTodayCount();
+    s.credits = userManager.getTotalCreditsInSystem();
+
+    s.accounts = authManager.getAccountCount();
+    s.sessions = authManager.getActiveSessionCount();
+    s.security = authManager.getSecurityStats();
+
+    for (int level = LOG_DEBUG; level <= LOG_CRITICAL; level++) {
+        s.logLevels[level] = logger.getLevelTotal((LogLevel)level);
+    }
+    s.logFiltered = logger.getFilteredCount();
+    s.logEvicted = logger.getEvictedCount();
+    s.logBuffered = logger.getTotalLogCount();
+    s.fileLogging = logger.isFileLoggingEnabled();
+    s.flushLagMs = millis() - logger.getLastFlushTime();
+
+    s.rfid = rfidManager.getStats();
+    s.rfidPollMs = rfidManager.getPollInterval();
+
+    s.ws = broadcaster.getStats();
+    s.sseClients = eventStream.clients();
+}
+
+bool MetricsExporter::nextLine(MetricsCursor& cursor) {
+    while (cursor.family < MF_COUNT) {
+        const MetricFamily& family = FAMILIES[cursor.family];
+        int length;
+
+        if (cursor.sample == 0) {
+            length = snprintf(cursor.line, METRICS_LINE_MAX, "# HELP %s %s\n# TYPE %s %s\n",
+                              family.name, family.help, family.name, family.type);
+        } else {
+            length = formatSample(cursor, cursor.sample - 1);
+            if (length < 0) {
+                // Família esgotada: segue para o cabeçalho da próxima
+                cursor.family++;
+                cursor.sample = 0;
+                continue;
+            }
+        }
+
+        // Comprimento 0 pula a amostra (ex.: slot de job livre)
+        cursor.sample++;
+        cursor.lineLength = min((size_t)length, (size_t)METRICS_LINE_MAX - 1);
+        cursor.linePosition = 0;
+        return true;
+    }
+    return false;
+}
+
+// Escreve a amostra de índice `sample` da família corrente; -1 quando não há mais, 0 para pular
+int MetricsExporter::formatSample(MetricsCursor& cursor, uint16_t sample) {
+    const MetricsSnapshot& s = cursor.snapshot;
+    const char* name = FAMILIES[cursor.family].name;
+    char* line = cursor.line;
+    char labels[96];
+
+    switch (cursor.family) {
+        case MF_UPTIME:          return sample ? -1 : writeSeconds(line, name, "", nullptr, s.uptimeUs / 1e6);
+        case MF_HEAP_FREE:       return sample ? -1 : writeValue(line, name, "", nullptr, s.heapFree);
+        case MF_HEAP_MIN_FREE:   return sample ? -1 : writeValue(line, name, "", nullptr, s.heapMinFree);
+        case MF_HEAP_MAX_ALLOC:  return sample ? -1 : writeValue(line, name, "", nullptr, s.heapMaxAlloc);
+        case MF_HEAP_SIZE:       return sample ? -1 : writeValue(line, name, "", nullptr, s.heapSize);
+        case MF_TASKS:           return sample ? -1 : writeValue(line, name, "", nullptr, s.tasks);
+
+        case MF_TASK_STACK_FREE:
+            if (sample > METRICS_TASK_COUNT) return -1;
+            if (sample == METRICS_TASK_COUNT) {
+                return writeValue(line, name, "", "task=\"async_tcp\"", s.tcpStackFree);
+            }
+            snprintf(labels, sizeof(labels), "task=\"%s\"", TASK_LABELS[sample]);
+            return writeValue(line, name, "", labels, s.stackFree[sample]);
+
+        case MF_COFFEE_SERVED:        return sample ? -1 : writeValue(line, name, "", nullptr, s.served);
+        case MF_COFFEE_SERVED_TODAY:  return sample ? -1 : writeValue(line, name, "", nullptr, s.servedToday);
+        case MF_COFFEE_REMAINING:     return sample ? -1 : writeSigned(line, name, s.remaining);
+        case MF_COFFEE_BUSY:          return sample ? -1 : writeValue(line, name, "", nullptr, s.busy ? 1 : 0);
+        case MF_COFFEE_SERVE_SECONDS: return sample ? -1 : writeSeconds(line, name, "", nullptr, s.serveTimeMs / 1000.0);
+        case MF_COFFEE_POUR_SECONDS:
+            switch (sample) {
+                case 0: return writeSeconds(line, name, "_sum", nullptr, s.relay.onTimeUs / 1e6);
+                case 1: return writeValue(line, name, "_count", nullptr, s.relay.pours);
+                default: return -1;
+            }
+        case MF_COFFEE_POUR_OVERRUN_MAX:  return sample ? -1 : writeSeconds(line, name, "", nullptr, s.relay.maxOverrunUs / 1e6);
+        case MF_COFFEE_RELAY_FALLBACKS:   return sample ? -1 : writeValue(line, name, "", nullptr, s.relay.fallbackStops);
+        case MF_COFFEE_QUEUE_DEPTH:       return sample ? -1 : writeValue(line, name, "", nullptr, s.queueDepth);
+        case MF_COFFEE_QUEUE_MAX_DEPTH:   return sample ? -1 : writeValue(line, name, "", nullptr, s.queue.maxDepth);
+        case MF_COFFEE_QUEUE_REQUESTS:
+            switch (sample) {
+                case 0: return writeValue(line, name, "", "outcome=\"started\"", s.queue.started);
+                case 1: return writeValue(line, name, "", "outcome=\"queued\"", s.queue.queued);
+                case 2: return writeValue(line, name, "", "outcome=\"repeat_tap\"", s.queue.repeatTaps);
+                case 3: return writeValue(line, name, "", "outcome=\"cancelled\"", s.queue.cancelled);
+                case 4: return writeValue(line, name, "", "outcome=\"timed_out\"", s.queue.timedOut);
+                case 5: return writeValue(line, name, "", "outcome=\"rejected\"", s.queue.rejected);
+                default: return -1;
+            }
+
+        case MF_USERS:
+            switch (sample) {
+                case 0: return writeValue(line, name, "", "state=\"registered\"", s.users);
+                case 1: return writeValue(line, name, "", "state=\"active\"", s.activeUsers);
+                case 2: return writeValue(line, name, "", "state=\"active_today\"", s.activeToday);
+                default: return -1;
+            }
+        case MF_USER_CREDITS:    return sample ? -1 : writeSigned(line, name, s.credits);
+
+        case MF_AUTH_ACCOUNTS:       return sample ? -1 : writeValue(line, name, "", nullptr, s.accounts);
+        case MF_AUTH_SESSIONS:       return sample ? -1 : writeValue(line, name, "", nullptr, s.sessions);
+        case MF_AUTH_FAILED_LOGINS:  return sample ? -1 : writeValue(line, name, "", nullptr, s.security.failedLogins);
+        case MF_AUTH_LOCKOUTS:       return sample ? -1 : writeValue(line, name, "", nullptr, s.security.lockouts);
+        case MF_AUTH_BLOCKED:        return sample ? -1 : writeValue(line, name, "", nullptr, s.security.blockedAttempts);
+        case MF_AUTH_LOCKED_IPS:     return sample ? -1 : writeValue(line, name, "", nullptr, s.security.lockedIps);
+
+        case MF_LOG_ENTRIES:
+            if (sample > LOG_CRITICAL) return -1;
+            snprintf(labels, sizeof(labels), "level=\"%s\"", LEVEL_LABELS[sample]);
+            return writeValue(line, name, "", labels, s.logLevels[sample]);
+        case MF_LOG_FILTERED:    return sample ? -1 : writeValue(line, name, "", nullptr, s.logFiltered);
+        case MF_LOG_EVICTED:     return sample ? -1 : writeValue(line, name, "", nullptr, s.logEvicted);
+        case MF_LOG_BUFFERED:    return sample ? -1 : writeValue(line, name, "", nullptr, s.logBuffered);
+        case MF_LOG_FLUSH_LAG:
+            // Sem gravação em arquivo não há atraso a medir: a família fica sem amostras
+            if (sample || !s.fileLogging) return -1;
+            return writeSeconds(line, name, "", nullptr, s.flushLagMs / 1000.0);
+
+        case MF_RFID_READS:        return sample ? -1 : writeValue(line, name, "", nullptr, s.rfid.reads);
+        case MF_RFID_READ_ERRORS:  return sample ? -1 : writeValue(line, name, "", nullptr, s.rfid.readErrors);
+        case MF_RFID_DUPLICATES:   return sample ? -1 : writeValue(line, name, "", nullptr, s.rfid.duplicates);
+        case MF_RFID_RESULTS:
+            if (sample > RFID_ERROR) return -1;
+            snprintf(labels, sizeof(labels), "result=\"%s\"", RESULT_LABELS[sample]);
+            return writeValue(line, name, "", labels, s.rfid.results[sample]);
+        case MF_RFID_READ_SECONDS:
+            switch (sample) {
+                case 0: return writeSeconds(line, name, "_sum", nullptr, s.rfid.readTimeUs / 1e6);
+                case 1: return writeValue(line, name, "_count", nullptr, s.rfid.reads);
+                default: return -1;
+            }
+        case MF_RFID_READ_MAX:     return sample ? -1 : writeSeconds(line, name, "", nullptr, s.rfid.maxReadTimeUs / 1e6);
+        case MF_RFID_TAP_SECONDS:
+            switch (sample) {
+                case 0: return writeSeconds(line, name, "_sum", nullptr, s.rfid.tapLatencyUs / 1e6);
+                case 1: return writeValue(line, name, "_count", nullptr, s.rfid.taps);
+                default: return -1;
+            }
+        case MF_RFID_TAP_MAX:      return sample ? -1 : writeSeconds(line, name, "", nullptr, s.rfid.maxTapLatencyUs / 1e6);
+        case MF_RFID_LATE_TAPS:    return sample ? -1 : writeValue(line, name, "", nullptr, s.rfid.lateTaps);
+        case MF_RFID_POLLS:        return sample ? -1 : writeValue(line, name, "", nullptr, s.rfid.polls);
+        case MF_RFID_IRQ_WAKEUPS:  return sample ? -1 : writeValue(line, name, "", nullptr, s.rfid.irqWakeups);
+        case MF_RFID_POLL_INTERVAL: return sample ? -1 : writeSeconds(line, name, "", nullptr, s.rfidPollMs / 1000.0);
+
+        case MF_STREAM_CLIENTS:
+            switch (sample) {
+                case 0: return writeValue(line, name, "", "transport=\"websocket\"", s.ws.clients - s.ws.binaryClients);
+                case 1: return writeValue(line, name, "", "transport=\"websocket_binary\"", s.ws.binaryClients);
+                case 2: return writeValue(line, name, "", "transport=\"sse\"", s.sseClients);
+                default: return -1;
+            }
+        case MF_WS_FRAMES_SENT:  return sample ? -1 : writeValue(line, name, "", nullptr, s.ws.framesSent);
+        case MF_WS_BYTES_SENT:   return sample ? -1 : writeValue(line, name, "", nullptr, s.ws.bytesSent);
+        case MF_WS_DROPS:        return sample ? -1 : writeValue(line, name, "", nullptr, s.ws.drops);
+
+        case MF_HTTP_REQUESTS: {
+            // Rotas são lidas ao vivo: a tabela só cresce no setup e o scrape
+            // roda na mesma task que atualiza os contadores
+            uint16_t route = sample / 5;
+            if (route >= routeMetrics.getRouteCount()) return -1;
+            const RouteStats& stats = routeMetrics.getRoute(route);
+            snprintf(labels, sizeof(labels), "route=\"%s\",method=\"%s\",code=\"%s\"",
+                     stats.route, RouteMetrics::methodName(stats.method), STATUS_LABELS[sample % 5]);
+            return writeValue(line, name, "", labels, stats.status[sample % 5]);
+        }
+        case MF_HTTP_RESPONSE_BYTES: {
+            if (sample >= routeMetrics.getRouteCount()) return -1;
+            const RouteStats& stats = routeMetrics.getRoute(sample);
+            snprintf(labels, sizeof(labels), "route=\"%s\",method=\"%s\"",
+                     stats.route, RouteMetrics::methodName(stats.method));
+            return writeValue(line, name, "", labels, stats.bytes);
+        }
+        case MF_HTTP_HANDLER_SECONDS: {
+            // Por rota: um balde por limite (acumulado), +Inf, _sum e _count
+            const uint16_t perRoute = ROUTE_LATENCY_BUCKET_COUNT + 2;
+            uint16_t route = sample / perRoute;
+            uint16_t part = sample % perRoute;
+            if (route >= routeMetrics.getRouteCount()) return -1;
+            const RouteStats& stats = routeMetrics.getRoute(route);
+            const char* method = RouteMetrics::methodName(stats.method);
+
+            if (part < ROUTE_LATENCY_BUCKET_COUNT) {
+                uint32_t cumulative = 0;
+                for (uint16_t b = 0; b <= part; b++) {
+                    cumulative += stats.histogram[b];
+                }
+                if (part < ROUTE_LATENCY_BUCKET_COUNT - 1) {
+                    snprintf(labels, sizeof(labels), "route=\"%s\",method=\"%s\",le=\"%g\"",
+                             stats.route, method, ROUTE_LATENCY_BUCKETS_US[part] / 1e6);
+                } else {
+                    snprintf(labels, sizeof(labels), "route=\"%s\",method=\"%s\",le=\"+Inf\"", stats.route, method);
+                }
+                return writeValue(line, name, "_bucket", labels, cumulative);
+            }
+
+            snprintf(labels, sizeof(labels), "route=\"%s\",method=\"%s\"", stats.route, method);
+            if (part == ROUTE_LATENCY_BUCKET_COUNT) {
+                return writeSeconds(line, name, "_sum", labels, stats.totalUs / 1e6);
+            }
+            return writeValue(line, name, "_count", labels, stats.requests);
+        }
+        case MF_HTTP_UNMETERED:  return sample ? -1 : writeValue(line, name, "", nullptr, routeMetrics.getUnmeteredCount());
+
+        case MF_JOB_RUNS:
+        case MF_JOB_SECONDS:
+        case MF_JOB_MAX_SECONDS:
+        case MF_JOB_MAX_LATE: {
+            if (sample >= SCHEDULER_MAX_JOBS) return -1;
+            JobStats job;
+            if (!scheduler.getJobStats(sample, job)) return 0;
+            snprintf(labels, sizeof(labels), "job=\"%s\"", job.name);
+            switch (cursor.family) {
+                case MF_JOB_RUNS:        return writeValue(line, name, "", labels, job.runs);
+                case MF_JOB_SECONDS:     return writeSeconds(line, name, "", labels, job.totalUs / 1e6);
+                case MF_JOB_MAX_SECONDS: return writeSeconds(line, name, "", labels, job.maxUs / 1e6);
+                default:                 return writeSeconds(line, name, "", labels, job.maxLateMs / 1000.0);
+            }
+        }
+
+        default:
+            return -1;
+    }
+}
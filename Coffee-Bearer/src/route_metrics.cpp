@@ -0,0 +1,111 @@
+#include "route_metrics.h"
+#include <esp_timer.h>
+
+// _code e _contentLength são protegidos na biblioteca; um ponteiro para membro
+// obtido por uma classe derivada permite lê-los sem alterar o ESPAsyncWebServer
+struct ResponseFields : AsyncWebServerResponse {
+    static constexpr int AsyncWebServerResponse::*code = &ResponseFields::_code;
+    static constexpr size_t AsyncWebServerResponse::*contentLength = &ResponseFields::_contentLength;
+};
+
+const char* RouteMetrics::methodName(WebRequestMethodComposite method) {
+    switch (method) {
+        case HTTP_GET: return "GET";
+        case HTTP_POST: return "POST";
+        case HTTP_PUT: return "PUT";
+        case HTTP_DELETE: return "DELETE";
+        case HTTP_PATCH: return "PATCH";
+        default: return "ANY";
+    }
+}
+
+RouteMetrics::RouteMetrics() :
+    routeCount(0),
+    current(-1),
+    startedAt(0),
+    unmetered(0) {
+    memset(routes, 0, sizeof(routes));
+}
+
+int RouteMetrics::add(const char* route, WebRequestMethodComposite method) {
+    for (int i = 0; i < routeCount; i++) {
+        if (routes[i].method == method && strcmp(routes[i].route, route) == 0) {
+            return i;
+        }
+    }
+    if (routeCount >= ROUTE_METRICS_MAX) {
+        unmetered++;
+        DEBUG_PRINTF("Métricas: tabela cheia, rota %s sem métricas\n", route);
+        return -1;
+    }
+    routes[routeCount].route = route;
+    routes[routeCount].method = method;
+    return routeCount++;
+}
+
+void RouteMetrics::begin(int slot) {
+    current = slot;
+    startedAt = esp_timer_get_time();
+}
+
+void RouteMetrics::end() {
+    if (current < 0) return;
+
+    uint32_t elapsed = (uint32_t)(esp_timer_get_time() - startedAt);
+    RouteStats& stats = routes[current];
+    stats.requests++;
+    stats.totalUs += elapsed;
+    if (elapsed > stats.maxUs) stats.maxUs = elapsed;
+
+    size_t bucket = 0;
+    while (bucket < ROUTE_LATENCY_BUCKET_COUNT - 1 && elapsed > ROUTE_LATENCY_BUCKETS_US[bucket]) {
+        bucket++;
+    }
+    stats.histogram[bucket]++;
+    current = -1;
+}
+
+void RouteMetrics::recordResponse(int code, size_t bytes) {
+    if (current < 0) return;
+
+    RouteStats& stats = routes[current];
+    int group = code / 100 - 1;
+    if (group >= 0 && group < 5) {
+        stats.status[group]++;
+    }
+    stats.bytes += bytes;
+}
+
+int RouteMetrics::responseCode(AsyncWebServerResponse* response) {
+    return response->*ResponseFields::code;
+}
+
+size_t RouteMetrics::responseLength(AsyncWebServerResponse* response) {
+    return response->*ResponseFields::contentLength;
+}
+
+void RouteMetrics::writeJson(Print& out) {
+    out.print("{\"bucketsUs\":[");
+    for (size_t i = 0; i < ROUTE_LATENCY_BUCKET_COUNT - 1; i++) {
+        out.printf("%s%u", i ? "," : "", (unsigned)ROUTE_LATENCY_BUCKETS_US[i]);
+    }
+    out.printf("],\"unmeteredRoutes\":%u,\"routes\":[", (unsigned)unmetered);
+
+    for (int i = 0; i < routeCount; i++) {
+        const RouteStats& stats = routes[i];
+        out.printf("%s{\"route\":\"%s\",\"method\":\"%s\",\"requests\":%u,"
+                   "\"status\":{\"1xx\":%u,\"2xx\":%u,\"3xx\":%u,\"4xx\":%u,\"5xx\":%u},"
+                   "\"bytes\":%u,\"avgUs\":%u,\"maxUs\":%u,\"histogram\":[",
+                   i ? "," : "", stats.route, methodName(stats.method), (unsigned)stats.requests,
+                   (unsigned)stats.status[0], (unsigned)stats.status[1], (unsigned)stats.status[2],
+                   (unsigned)stats.status[3], (unsigned)stats.status[4],
+                   (unsigned)stats.bytes,
+                   (unsigned)(stats.requests ? stats.totalUs / stats.requests : 0),
+                   (unsigned)stats.maxUs);
+        for (size_t b = 0; b < ROUTE_LATENCY_BUCKET_COUNT; b++) {
+            out.printf("%s%u", b ? "," : "", (unsigned)stats.histogram[b]);
+        }
+        out.print("]}");
+    }
+    out.print("]}");
+}
@@ -0,0 +1,235 @@
+#include "stats_rollups.h"
+#include "coffee_ledger.h"
+#include <SPIFFS.h>
+#include <memory>
+#include <time.h>
+
+// Arquivo: cabeçalho seguido das tabelas por hora, dia e semana
+#define STATS_FILE_MAGIC 0x54534342UL              // "BCST"
+#define STATS_FILE_VERSION 1
+#define STATS_TEMP_FILE "/rollups.tmp"
+
+struct StatsFileHeader {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t bucketSize;
+    uint16_t hours;
+    uint16_t days;
+    uint16_t weeks;
+    uint16_t reserved;
+    uint32_t appliedSequence;
+};
+
+static_assert(LEDGER_MAX_USERS <= 64, "RollupBucket::users tem um bit por usuário do ledger");
+static_assert(sizeof(RollupBucket) == 20, "Formato do arquivo de estatísticas");
+
+static const size_t STATS_BUCKET_COUNT = STATS_HOURS + STATS_DAYS + STATS_WEEKS;
+
+StatsRollups::StatsRollups() :
+    appliedSequence(0),
+    dirty(false),
+    lock(nullptr) {
+    memset(hours, 0, sizeof(hours));
+    memset(days, 0, sizeof(days));
+    memset(weeks, 0, sizeof(weeks));
+}
+
+void StatsRollups::begin() {
+    lock = xSemaphoreCreateMutex();
+}
+
+bool StatsRollups::load() {
+    File file = SPIFFS.open(STATS_FILE, "r");
+    if (!file) {
+        return false;
+    }
+
+    StatsFileHeader header;
+    bool valid = file.read((uint8_t*)&header, sizeof(header)) == sizeof(header) &&
+                 header.magic == STATS_FILE_MAGIC &&
+                 header.version == STATS_FILE_VERSION &&
+                 header.bucketSize == sizeof(RollupBucket) &&
+                 header.hours == STATS_HOURS &&
+                 header.days == STATS_DAYS &&
+                 header.weeks == STATS_WEEKS;
+
+    acquire();
+    if (valid) {
+        valid = file.read((uint8_t*)hours, sizeof(hours)) == sizeof(hours) &&
+                file.read((uint8_t*)days, sizeof(days)) == sizeof(days) &&
+                file.read((uint8_t*)weeks, sizeof(weeks)) == sizeof(weeks);
+        appliedSequence = header.appliedSequence;
+    }
+    if (!valid) {
+        memset(hours, 0, sizeof(hours));
+        memset(days, 0, sizeof(days));
+        memset(weeks, 0, sizeof(weeks));
+        appliedSequence = 0;
+    }
+    release();
+    file.close();
+
+    if (!valid) {
+        DEBUG_PRINTLN("Arquivo de estatísticas inválido");
+    }
+    return valid;
+}
+
+bool StatsRollups::save() {
+    // Cópia no heap sob o lock (microssegundos); a gravação acontece fora dele
+    std::unique_ptr<RollupBucket[]> copy(new (std::nothrow) RollupBucket[STATS_BUCKET_COUNT]);
+    if (!copy) {
+        DEBUG_PRINTLN("Estatísticas: sem memória para gravar");
+        return false;
+    }
+
+    StatsFileHeader header;
+    acquire();
+    if (!dirty) {
+        release();
+        return true;
+    }
+    memcpy(copy.get(), hours, sizeof(hours));
+    memcpy(copy.get() + STATS_HOURS, days, sizeof(days));
+    memcpy(copy.get() + STATS_HOURS + STATS_DAYS, weeks, sizeof(weeks));
+    header.appliedSequence = appliedSequence;
+    dirty = false;
+    release();
+
+    header.magic = STATS_FILE_MAGIC;
+    header.version = STATS_FILE_VERSION;
+    header.bucketSize = sizeof(RollupBucket);
+    header.hours = STATS_HOURS;
+    header.days = STATS_DAYS;
+    header.weeks = STATS_WEEKS;
+    header.reserved = 0;
+
+    // Arquivo temporário e troca, como as contas
+    File file = SPIFFS.open(STATS_TEMP_FILE, "w");
+    size_t bytes = STATS_BUCKET_COUNT * sizeof(RollupBucket);
+    bool ok = file &&
+              file.write((const uint8_t*)&header, sizeof(header)) == sizeof(header) &&
+              file.write((const uint8_t*)copy.get(), bytes) == bytes;
+    if (file) file.close();
+
+    if (!ok) {
+        SPIFFS.remove(STATS_TEMP_FILE);
+        acquire();
+        dirty = true;
+        release();
+        DEBUG_PRINTLN("Erro ao gravar estatísticas");
+        return false;
+    }
+
+    SPIFFS.remove(STATS_FILE);
+    return SPIFFS.rename(STATS_TEMP_FILE, STATS_FILE);
+}
+
+void StatsRollups::clear() {
+    acquire();
+    memset(hours, 0, sizeof(hours));
+    memset(days, 0, sizeof(days));
+    memset(weeks, 0, sizeof(weeks));
+    appliedSequence = 0;
+    dirty = false;
+    SPIFFS.remove(STATS_FILE);
+    release();
+}
+
+void StatsRollups::apply(const LedgerEvent& event, uint32_t sequence) {
+    acquire();
+    appliedSequence = sequence;
+    if (event.timestamp != 0) {
+        for (uint8_t scale = 0; scale < ROLLUP_SCALE_COUNT; scale++) {
+            applyTo((RollupScale)scale, event);
+        }
+    }
+    dirty = true;
+    release();
+}
+
+bool StatsRollups::getBucket(RollupScale scale, uint32_t period, RollupBucket& out) {
+    acquire();
+    const RollupBucket& bucket = table(scale)[period % capacity(scale)];
+    bool found = period != 0 && bucket.period == period;
+    if (found) out = bucket;
+    release();
+    return found;
+}
+
+uint16_t StatsRollups::capacity(RollupScale scale) {
+    switch (scale) {
+        case ROLLUP_HOURLY: return STATS_HOURS;
+        case ROLLUP_DAILY: return STATS_DAYS;
+        default: return STATS_WEEKS;
+    }
+}
+
+uint32_t StatsRollups::periodOf(RollupScale scale, uint32_t timestamp) {
+    if (timestamp == 0) return 0;
+    uint32_t local = timestamp + GMT_OFFSET_SEC + DAYLIGHT_OFFSET_SEC;
+    switch (scale) {
+        case ROLLUP_HOURLY: return local / 3600UL;
+        case ROLLUP_DAILY: return local / 86400UL;
+        // 01/01/1970 foi uma quinta-feira: +3 faz as semanas começarem na segunda
+        default: return (local / 86400UL + 3) / 7;
+    }
+}
+
+uint32_t StatsRollups::currentPeriod(RollupScale scale) {
+    time_t now = time(nullptr);
+    return now >= (time_t)AUTH_MIN_VALID_EPOCH ? periodOf(scale, (uint32_t)now) : 0;
+}
+
+uint32_t StatsRollups::periodStart(RollupScale scale, uint32_t period) {
+    switch (scale) {
+        case ROLLUP_HOURLY: return period * 3600UL;
+        case ROLLUP_DAILY: return period * 86400UL;
+        default: return (period * 7 - 3) * 86400UL;
+    }
+}
+
+// Métodos privados
+
+RollupBucket* StatsRollups::table(RollupScale scale) {
+    switch (scale) {
+        case ROLLUP_HOURLY: return hours;
+        case ROLLUP_DAILY: return days;
+        default: return weeks;
+    }
+}
+
+void StatsRollups::applyTo(RollupScale scale, const LedgerEvent& event) {
+    uint32_t period = periodOf(scale, event.timestamp);
+    RollupBucket& bucket = table(scale)[period % capacity(scale)];
+    if (bucket.period != period) {
+        // Slot já ocupado por um período mais recente: evento antigo demais
+        if (bucket.period > period) return;
+        memset(&bucket, 0, sizeof(RollupBucket));
+        bucket.period = period;
+    }
+
+    if (event.type == LEDGER_REFILL) {
+        if (bucket.refills < UINT8_MAX) bucket.refills++;
+        return;
+    }
+
+    if (bucket.served < UINT16_MAX) bucket.served++;
+    bucket.serveTimeMs += event.durationMs;
+    if (event.user < LEDGER_MAX_USERS) {
+        uint32_t& word = bucket.users[event.user / 32];
+        uint32_t bit = 1UL << (event.user % 32);
+        if (!(word & bit)) {
+            word |= bit;
+            bucket.uniqueUsers++;
+        }
+    }
+}
+
+void StatsRollups::acquire() {
+    if (lock) xSemaphoreTake(lock, portMAX_DELAY);
+}
+
+void StatsRollups::release() {
+    if (lock) xSemaphoreGive(lock);
+}
@@ -1,7 +1,9 @@
 // src/system_utils.cpp
 #include "system_utils.h"
+#include "ws_protocol.h"
 #include <Arduino.h>
 #include <WiFi.h>
+#include <esp_system.h>
 
 // Updated function to build the full JSON object
 void systemStatusToJson(JsonDocument &doc, 
@@ -22,6 +24,7 @@ void systemStatusToJson(JsonDocument &doc,
     coffeeInfo["remaining"] = coffee.getRemainingCoffees();
     coffeeInfo["totalServed"] = coffee.getTotalServed();
     coffeeInfo["isBusy"] = coffee.isBusy();
+    coffeeInfo["queued"] = coffee.getQueueLength();
     coffeeInfo["maxCapacity"] = MAX_COFFEES;
 
     // Users Info
@@ -38,4 +41,145 @@ void systemStatusToJson(JsonDocument &doc,
     logInfo["total"] = logger.getTotalLogCount();
     logInfo["errors"] = logger.getLogCountByLevel(LOG_ERROR);
     logInfo["warnings"] = logger.getLogCountByLevel(LOG_WARNING);
-}
\ No newline at end of file
+}
+
+/* -------------------- StatusSnapshot -------------------- */
+StatusSnapshot::StatusSnapshot(Logger &log, CoffeeController &coffeeCtrl, UserManager &users, AuthManager &auth)
+    : logger(log), coffee(coffeeCtrl), userManager(users), authManager(auth),
+      bodyLength(0), sequence(0),
+      coffeeVersion(0), usersVersion(0), logVersion(0), sessionCount(-1),
+      wifiConnected(false), builtAt(0), generation(0),
+      bootId(0), valid(false), lock(nullptr) {
+    buffer[0] = '\0';
+    etag[0] = '\0';
+}
+
+void StatusSnapshot::begin() {
+    // Prefixo aleatório no ETag: um reboot nunca repete uma versão já em cache
+    bootId = esp_random();
+    lock = xSemaphoreCreateMutex();
+}
+
+void StatusSnapshot::acquire() {
+    if (lock) xSemaphoreTake(lock, portMAX_DELAY);
+}
+
+void StatusSnapshot::release() {
+    if (lock) xSemaphoreGive(lock);
+}
+
+bool StatusSnapshot::rebuildIfNeeded() {
+    uint32_t currentCoffee = coffee.getStateVersion();
+    uint32_t currentUsers = userManager.getStateVersion();
+    uint32_t currentLogs = logger.getStateVersion();
+    int currentSessions = authManager.getActiveSessionCount();
+    bool currentWifi = (WiFi.status() == WL_CONNECTED);
+
+    bool changed = !valid ||
+                   currentCoffee != coffeeVersion ||
+                   currentUsers != usersVersion ||
+                   currentLogs != logVersion ||
+                   currentSessions != sessionCount ||
+                   currentWifi != wifiConnected;
+
+    if (!changed && millis() - builtAt < STATUS_SNAPSHOT_MAX_AGE_MS) {
+        return false;
+    }
+
+    StaticJsonDocument<STATUS_DOC_SIZE> doc;
+    systemStatusToJson(doc, logger, coffee, userManager, authManager);
+
+    size_t len = serializeJson(doc, buffer, sizeof(buffer));
+    if (len == 0 || len >= sizeof(buffer) - 1) {
+        DEBUG_PRINTLN("Snapshot de status excede STATUS_SNAPSHOT_BUFFER");
+        valid = false;
+        return false;
+    }
+    bodyLength = len;
+
+    mergeChanges(doc);
+    latest = doc;
+
+    coffeeVersion = currentCoffee;
+    usersVersion = currentUsers;
+    logVersion = currentLogs;
+    sessionCount = currentSessions;
+    wifiConnected = currentWifi;
+    builtAt = millis();
+    generation++;
+    valid = true;
+    snprintf(etag, sizeof(etag), "\"%08lx-%lx\"", (unsigned long)bootId, (unsigned long)generation);
+    return true;
+}
+
+void StatusSnapshot::mergeChanges(JsonDocument &next) {
+    // Compara campo a campo com o snapshot anterior; só os escalares que
+    // mudaram entram no patch pendente (sobrescrevendo valores antigos)
+    for (JsonPair topic : next.as<JsonObject>()) {
+        JsonObjectConst previous = latest[topic.key()];
+        for (JsonPair field : topic.value().as<JsonObject>()) {
+            JsonVariantConst oldValue = previous[field.key()];
+            if (oldValue.isNull() || oldValue != field.value()) {
+                JsonObject patchTopic = pendingPatch[topic.key()];
+                if (patchTopic.isNull()) {
+                    patchTopic = pendingPatch.createNestedObject(topic.key());
+                }
+                patchTopic[field.key()] = field.value();
+            }
+        }
+    }
+}
+
+void StatusSnapshot::copyBody(String &body, String &etagOut) {
+    acquire();
+    rebuildIfNeeded();
+    body = "";
+    if (valid) {
+        body.concat(buffer, bodyLength);
+    }
+    etagOut = valid ? etag : "";
+    release();
+}
+
+String StatusSnapshot::copyFrame() {
+    acquire();
+    rebuildIfNeeded();
+    String frame;
+    if (valid) {
+        frame.reserve(bodyLength + 48);
+        frame = "{\"type\":\"system_status\",\"seq\":";
+        frame += (unsigned long)sequence;
+        frame += ",\"data\":";
+        frame.concat(buffer, bodyLength);
+        frame += '}';
+    }
+    release();
+    return frame;
+}
+
+bool StatusSnapshot::takePatch(String &frame) {
+    acquire();
+    rebuildIfNeeded();
+    bool hasPatch = pendingPatch.size() > 0;
+    if (hasPatch) {
+        String data;
+        serializeJson(pendingPatch, data);
+        sequence++;
+        frame = "{\"type\":\"status_patch\",\"seq\":";
+        frame += (unsigned long)sequence;
+        frame += ",\"data\":";
+        frame += data;
+        frame += '}';
+        pendingPatch.clear();
+    }
+    release();
+    return hasPatch;
+}
+
+size_t StatusSnapshot::copyBinary(uint8_t *out, size_t capacity) {
+    acquire();
+    rebuildIfNeeded();
+    size_t length = valid ? wsEncodeStatus(latest, sequence, out, capacity) : 0;
+    release();
+    return length;
+}
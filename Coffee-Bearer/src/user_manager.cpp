@@ -1,86 +1,104 @@
 #include "user_manager.h"
+#include "stats_rollups.h"
 #include <Preferences.h>
 #include <algorithm>
 #include <ArduinoJson.h>
+#include <time.h>
 
-UserManager::UserManager() : 
+// Segura o lock do UserManager até o fim do escopo (métodos com vários retornos)
+class UserLock {
+public:
+    explicit UserLock(UserManager& users) : users(users) { users.acquire(); }
+    ~UserLock() { users.release(); }
+
+private:
+    UserManager& users;
+};
+
+UserManager::UserManager(bool persistent) : 
+    persistent(persistent),
     lastWeeklyReset(0),
     lastSave(0),
-    dataChanged(false) {
+    dataChanged(false),
+    stateVersion(0),
+    lock(nullptr),
+    scheduler(nullptr),
+    saveJob(-1) {
 }
 
 bool UserManager::begin() {
+    lock = xSemaphoreCreateRecursiveMutex();
     loadFromPreferences();
     
     // Se não há registro de reset semanal, definir para agora
     if (lastWeeklyReset == 0) {
         lastWeeklyReset = millis();
-        dataChanged = true;
+        markChanged();
         saveToPreferences();
     }
     
     DEBUG_PRINTLN("User Manager inicializado");
-    DEBUG_PRINTF("Usuários carregados: %d\n", users.size());
+    DEBUG_PRINTF("Usuários carregados: %d\n", uids.size());
     DEBUG_PRINTF("Último reset semanal: %lu\n", lastWeeklyReset);
     
     return true;
 }
 
 void UserManager::clearAllData() {
+    UserLock guard(*this);
     Preferences prefs;
     prefs.begin("users", false);
     prefs.clear();
     prefs.end();
     
-    users.clear();
+    clearTable();
+    rebuildIndex();
     lastWeeklyReset = millis();
-    dataChanged = true;
+    markChanged();
     
     DEBUG_PRINTLN("Todos os dados de usuários foram limpos");
 }
 
 bool UserManager::addUser(const String& uid, const String& name) {
-    if (users.size() >= MAX_USERS) {
+    UserLock guard(*this);
+    if (uids.size() >= MAX_USERS) {
         DEBUG_PRINTLN("Máximo de usuários atingido");
         return false;
     }
     
-    if (!isValidUID(uid) || name.length() == 0) {
+    PackedUID packed;
+    if (!isValidUID(uid) || !packUID(uid, packed) || name.length() == 0) {
         DEBUG_PRINTLN("UID ou nome inválido");
         return false;
     }
     
     // Verificar se usuário já existe
-    if (userExists(uid)) {
+    if (findPacked(packed) != -1) {
         DEBUG_PRINTLN("Usuário já existe");
         return false;
     }
     
-    UserCredits newUser;
-    newUser.uid = uid.c_str();
-    newUser.name = sanitizeName(name);
-    newUser.credits = INITIAL_CREDITS;
-    newUser.lastUsed = 0;
-    newUser.isActive = true;
-    
-    users.push_back(newUser);
-    dataChanged = true;
+    int position = appendUser(packed, sanitizeName(name), INITIAL_CREDITS, 0, true);
+    indexInsert(position);
+    markChanged();
     
     DEBUG_PRINTF("Usuário adicionado: %s (UID: %s)\n", 
-                newUser.name.c_str(), newUser.uid.c_str());
+                names[position].c_str(), uidToString(packed).c_str());
     
     return true;
 }
 
 bool UserManager::removeUser(const String& uid) {
+    UserLock guard(*this);
     int index = findUserByUID(uid);
     if (index == -1) {
         return false;
     }
     
-    String userName = users[index].name;
-    users.erase(users.begin() + index);
-    dataChanged = true;
+    String userName = names[index];
+    eraseUser(index);
+    rebuildIndex();
+    markChanged();
     
     DEBUG_PRINTF("Usuário removido: %s (UID: %s)\n", 
                 userName.c_str(), uid.c_str());
@@ -89,138 +107,356 @@ bool UserManager::removeUser(const String& uid) {
 }
 
 bool UserManager::updateUser(const String& uid, const String& newName) {
-    UserCredits* user = getUserByUID(uid);
-    if (!user || newName.length() == 0) {
+    UserLock guard(*this);
+    int index = findUserByUID(uid);
+    if (index == -1 || newName.length() == 0) {
         return false;
     }
     
-    String oldName = user->name;
-    user->name = sanitizeName(newName);
-    dataChanged = true;
+    String oldName = names[index];
+    names[index] = sanitizeName(newName);
+    markChanged();
     
     DEBUG_PRINTF("Usuário atualizado: %s -> %s (UID: %s)\n", 
-                oldName.c_str(), user->name.c_str(), uid.c_str());
+                oldName.c_str(), names[index].c_str(), uid.c_str());
     
     return true;
 }
 
 bool UserManager::userExists(const String& uid) {
+    UserLock guard(*this);
     return findUserByUID(uid) != -1;
 }
 
-UserCredits* UserManager::getUserByUID(const String& uid) {
+UserBatchOpType UserManager::batchOpFromString(const char* op) {
+    if (strcmp(op, "add") == 0) return BATCH_ADD;
+    if (strcmp(op, "remove") == 0) return BATCH_REMOVE;
+    if (strcmp(op, "setCredits") == 0) return BATCH_SET_CREDITS;
+    if (strcmp(op, "rename") == 0) return BATCH_RENAME;
+    return BATCH_INVALID;
+}
+
+int UserManager::applyBatch(const UserBatch& batch, std::vector<UserBatchResult>& results) {
+    UserLock guard(*this);
+    // Remoções viram lápides (UID de tamanho zero) durante o lote; a
+    // compactação e a reconstrução do índice acontecem uma única vez no final
+    const std::vector<UserBatchOp>& ops = batch.ops;
+    results.clear();
+    results.reserve(ops.size());
+    
+    int applied = 0;
+    int removed = 0;
+    size_t liveCount = uids.size();
+    
+    for (const auto& op : ops) {
+        UserBatchResult result = { false, nullptr };
+        bool validUID = op.uid.len > 0;
+        int index = validUID ? findPacked(op.uid) : -1;
+        
+        switch (op.type) {
+            case BATCH_ADD:
+                if (!validUID || op.nameLength == 0) {
+                    result.error = "invalid";
+                } else if (index != -1) {
+                    result.error = "exists";
+                } else if (liveCount >= MAX_USERS) {
+                    result.error = "limit";
+                } else {
+                    indexInsert(appendUser(op.uid, sanitizeName(batch.nameOf(op)), INITIAL_CREDITS, 0, true));
+                    liveCount++;
+                    result.success = true;
+                }
+                break;
+                
+            case BATCH_REMOVE:
+                if (index == -1) {
+                    result.error = "not_found";
+                } else {
+                    uids[index].len = 0;
+                    liveCount--;
+                    removed++;
+                    result.success = true;
+                }
+                break;
+                
+            case BATCH_SET_CREDITS:
+                if (op.credits < 0) {
+                    result.error = "invalid";
+                } else if (index == -1) {
+                    result.error = "not_found";
+                } else {
+                    credits[index] = clampCredits(op.credits);
+                    result.success = true;
+                }
+                break;
+                
+            case BATCH_RENAME:
+                if (op.nameLength == 0) {
+                    result.error = "invalid";
+                } else if (index == -1) {
+                    result.error = "not_found";
+                } else {
+                    names[index] = sanitizeName(batch.nameOf(op));
+                    result.success = true;
+                }
+                break;
+                
+            default:
+                result.error = "unknown_op";
+                break;
+        }
+        
+        if (result.success) applied++;
+        results.push_back(result);
+    }
+    
+    if (removed > 0) {
+        compactRemoved();
+        rebuildIndex();
+    }
+    
+    if (applied > 0) {
+        markChanged();
+        requestSave();
+    }
+    
+    DEBUG_PRINTF("Lote de usuários: %d/%d operações aplicadas\n", applied, ops.size());
+    return applied;
+}
+
+void UserManager::benchmarkBatch(uint16_t opCount, Print& out) {
+    // Mede o caminho do /api/users/batch (recorte + decodificação do corpo e
+    // aplicação) numa tabela de rascunho, sem tocar nos usuários nem na NVS.
+    // As operações percorrem MAX_USERS UIDs em ciclos de add, setCredits,
+    // rename e remove, então todas são aplicadas.
+    static const char* const kinds[] = { "add", "setCredits", "rename", "remove" };
+    UserManager scratch(false);
+    UserBatch batch;
+    std::vector<UserBatchResult> results;
+    char text[USER_BATCH_OP_MAX];
+    
+    unsigned long parseUs = 0;
+    unsigned long startUs = micros();
+    batch.feed((const uint8_t*)"{\"ops\":[", 8);
+    parseUs += micros() - startUs;
+    
+    for (uint16_t i = 0; i < opCount; i++) {
+        uint16_t user = i % MAX_USERS;
+        const char* kind = kinds[(i / MAX_USERS) % 4];
+        int len = snprintf(text, sizeof(text),
+                           "%s{\"op\":\"%s\",\"uid\":\"C0 FF EE %02X %02X\",\"name\":\"Usuario %u\",\"credits\":%u}",
+                           i ? "," : "", kind, user >> 8, user & 0xFF, user, i % 100);
+        startUs = micros();
+        batch.feed((const uint8_t*)text, len);
+        parseUs += micros() - startUs;
+    }
+    
+    startUs = micros();
+    batch.feed((const uint8_t*)"]}", 2);
+    bool ok = batch.finish();
+    parseUs += micros() - startUs;
+    
+    if (!ok) {
+        out.printf("Benchmark do lote falhou: %s\n", batch.getError());
+        return;
+    }
+    
+    startUs = micros();
+    int applied = scratch.applyBatch(batch, results);
+    unsigned long applyUs = micros() - startUs;
+    
+    out.printf("Lote de %u operações (%d aplicadas): leitura %lu us, aplicação %lu us, %.1f us/op\n",
+               opCount, applied, parseUs, applyUs, opCount ? (float)(parseUs + applyUs) / opCount : 0.0f);
+    out.println("A gravação única na NVS (users.save) não entra na medida");
+}
+
+void UserManager::benchmarkScan(uint16_t userCount, Print& out) {
+    // Compara as varreduras das estatísticas (ativos no dia, total de
+    // créditos, uso mais recente) na tabela em arrays com as mesmas
+    // varreduras num std::vector<UserCredits>, o layout anterior
+    static const int rounds = 20;
+    size_t needed = (size_t)userCount * USER_BENCH_BYTES_PER_USER;
+    if (ESP.getFreeHeap() < needed + USER_BENCH_HEAP_RESERVE) {
+        out.printf("Heap insuficiente para %u usuários (livre: %u bytes)\n", userCount, ESP.getFreeHeap());
+        return;
+    }
+    
+    UserManager scratch(false);
+    uint32_t base = AUTH_MIN_VALID_EPOCH;
+    for (uint16_t i = 0; i < userCount; i++) {
+        PackedUID uid = { 5, { 0xC0, 0xFF, 0xEE, (uint8_t)(i >> 8), (uint8_t)(i & 0xFF) } };
+        scratch.appendUser(uid, "Usuario " + String(i), i % 20, base - (i % 14) * 86400UL, true);
+    }
+    scratch.rebuildIndex();
+    std::vector<UserCredits> rows = scratch.getAllUsers();
+    uint32_t day = StatsRollups::periodOf(ROLLUP_DAILY, base);
+    
+    volatile long sink = 0;
+    unsigned long startUs = micros();
+    for (int r = 0; r < rounds; r++) {
+        sink += scratch.countActiveOn(day) + scratch.getTotalCreditsInSystem() +
+                scratch.getMostActiveUser().credits;
+    }
+    unsigned long tableUs = (micros() - startUs) / rounds;
+    
+    startUs = micros();
+    for (int r = 0; r < rounds; r++) {
+        int active = 0;
+        long total = 0;
+        int best = -1;
+        for (size_t i = 0; i < rows.size(); i++) {
+            if (rows[i].lastUsed != 0 && StatsRollups::periodOf(ROLLUP_DAILY, rows[i].lastUsed) == day) {
+                active++;
+            }
+            total += rows[i].credits;
+            if (rows[i].lastUsed > (best == -1 ? 0 : rows[best].lastUsed)) {
+                best = i;
+            }
+        }
+        UserCredits mostActive = best != -1 ? rows[best] : UserCredits();
+        sink += active + total + mostActive.credits;
+    }
+    unsigned long rowsUs = (micros() - startUs) / rounds;
+    
+    out.printf("Varredura de %u usuários (média de %d rodadas): arrays %lu us, vetor de UserCredits %lu us\n",
+               userCount, rounds, tableUs, rowsUs);
+}
+
+bool UserManager::getUser(const String& uid, UserCredits& out) {
+    UserLock guard(*this);
     int index = findUserByUID(uid);
-    return (index != -1) ? &users[index] : nullptr;
+    if (index == -1) {
+        return false;
+    }
+    fillUser(index, out);
+    return true;
 }
 
 String UserManager::getUserName(const String& uid) {
-    UserCredits* user = getUserByUID(uid);
-    return user ? user->name : "";
+    UserLock guard(*this);
+    int index = findUserByUID(uid);
+    return (index != -1) ? names[index] : "";
 }
 
 int UserManager::getUserCredits(const String& uid) {
-    UserCredits* user = getUserByUID(uid);
-    return user ? user->credits : -1;
+    UserLock guard(*this);
+    int index = findUserByUID(uid);
+    return (index != -1) ? credits[index] : -1;
 }
 
 std::vector<UserCredits> UserManager::getAllUsers() {
-    return users;
+    UserLock guard(*this);
+    std::vector<UserCredits> all(uids.size());
+    for (size_t i = 0; i < uids.size(); i++) {
+        fillUser(i, all[i]);
+    }
+    return all;
 }
 
 std::vector<UserCredits> UserManager::getActiveUsers() {
+    UserLock guard(*this);
     std::vector<UserCredits> activeUsers;
-    for (const auto& user : users) {
-        if (user.isActive && user.credits > 0) {
-            activeUsers.push_back(user);
+    for (size_t i = 0; i < uids.size(); i++) {
+        if ((flags[i] & USER_FLAG_ACTIVE) && credits[i] > 0) {
+            activeUsers.emplace_back();
+            fillUser(i, activeUsers.back());
         }
     }
     return activeUsers;
 }
 
 bool UserManager::consumeCredit(const String& uid) {
-    UserCredits* user = getUserByUID(uid);
-    if (!user || user->credits <= 0) {
+    UserLock guard(*this);
+    int index = findUserByUID(uid);
+    if (index == -1 || credits[index] <= 0) {
         return false;
     }
     
-    user->credits--;
-    updateLastUsed(uid);
-    dataChanged = true;
+    credits[index]--;
+    touchLastUsed(index);
+    flags[index] |= USER_FLAG_ACTIVE;
+    markChanged();
     
     DEBUG_PRINTF("Crédito consumido: %s (%d restantes)\n", 
-                user->name.c_str(), user->credits);
+                names[index].c_str(), credits[index]);
     
     return true;
 }
 
-bool UserManager::addCredits(const String& uid, int credits) {
-    if (credits <= 0) return false;
+bool UserManager::addCredits(const String& uid, int amount) {
+    UserLock guard(*this);
+    if (amount <= 0) return false;
     
-    UserCredits* user = getUserByUID(uid);
-    if (!user) return false;
+    int index = findUserByUID(uid);
+    if (index == -1) return false;
     
-    user->credits += credits;
-    dataChanged = true;
+    credits[index] = clampCredits((long)credits[index] + amount);
+    markChanged();
     
     DEBUG_PRINTF("Créditos adicionados: %s (+%d = %d total)\n", 
-                user->name.c_str(), credits, user->credits);
+                names[index].c_str(), amount, credits[index]);
     
     return true;
 }
 
-bool UserManager::setCredits(const String& uid, int credits) {
-    if (credits < 0) return false;
+bool UserManager::setCredits(const String& uid, int amount) {
+    UserLock guard(*this);
+    if (amount < 0) return false;
     
-    UserCredits* user = getUserByUID(uid);
-    if (!user) return false;
+    int index = findUserByUID(uid);
+    if (index == -1) return false;
     
-    int oldCredits = user->credits;
-    user->credits = credits;
-    dataChanged = true;
+    int oldCredits = credits[index];
+    credits[index] = clampCredits(amount);
+    markChanged();
     
     DEBUG_PRINTF("Créditos definidos: %s (%d -> %d)\n", 
-                user->name.c_str(), oldCredits, credits);
+                names[index].c_str(), oldCredits, credits[index]);
     
     return true;
 }
 
 int UserManager::getTotalCreditsInSystem() {
+    UserLock guard(*this);
     int total = 0;
-    for (const auto& user : users) {
-        total += user.credits;
+    for (int16_t value : credits) {
+        total += value;
     }
     return total;
 }
 
 bool UserManager::shouldPerformWeeklyReset() {
+    UserLock guard(*this);
     unsigned long currentTime = millis();
     
     // Verificar overflow do millis()
     if (currentTime < lastWeeklyReset) {
         lastWeeklyReset = currentTime;
-        dataChanged = true;
+        markChanged();
     }
     
     return (currentTime - lastWeeklyReset) >= WEEKLY_RESET_INTERVAL_MS;
 }
 
 void UserManager::performWeeklyReset() {
+    UserLock guard(*this);
     int usersReset = 0;
     
-    for (auto& user : users) {
-        if (user.credits < INITIAL_CREDITS) {
-            user.credits = INITIAL_CREDITS;
+    for (auto& value : credits) {
+        if (value < INITIAL_CREDITS) {
+            value = INITIAL_CREDITS;
             usersReset++;
         }
     }
     
     lastWeeklyReset = millis();
-    dataChanged = true;
+    markChanged();
     
     DEBUG_PRINTF("Reset semanal executado: %d usuários resetados\n", usersReset);
 }
 
 unsigned long UserManager::getTimeSinceLastReset() {
+    UserLock guard(*this);
     unsigned long currentTime = millis();
     if (currentTime < lastWeeklyReset) {
         return 0; // Overflow detectado
@@ -229,17 +465,20 @@ unsigned long UserManager::getTimeSinceLastReset() {
 }
 
 unsigned long UserManager::getNextResetTime() {
+    UserLock guard(*this);
     return lastWeeklyReset + WEEKLY_RESET_INTERVAL_MS;
 }
 
 int UserManager::getTotalUsers() {
-    return users.size();
+    UserLock guard(*this);
+    return uids.size();
 }
 
 int UserManager::getActiveUsersCount() {
+    UserLock guard(*this);
     int count = 0;
-    for (const auto& user : users) {
-        if (user.isActive && user.credits > 0) {
+    for (size_t i = 0; i < flags.size(); i++) {
+        if ((flags[i] & USER_FLAG_ACTIVE) && credits[i] > 0) {
             count++;
         }
     }
@@ -247,62 +486,89 @@ int UserManager::getActiveUsersCount() {
 }
 
 int UserManager::getActiveTodayCount() {
-    unsigned long oneDayAgo = millis() - MILLIS_PER_DAY;
+    UserLock guard(*this);
+    // Dia local corrente; sem relógio sincronizado não há "hoje"
+    uint32_t today = StatsRollups::currentPeriod(ROLLUP_DAILY);
+    return today ? countActiveOn(today) : 0;
+}
+
+int UserManager::countActiveOn(uint32_t day) {
+    // Só o vetor lastUsed é lido
     int count = 0;
-    
-    for (const auto& user : users) {
-        if (user.lastUsed > oneDayAgo) {
+    for (uint32_t used : lastUsed) {
+        if (used != 0 && StatsRollups::periodOf(ROLLUP_DAILY, used) == day) {
             count++;
         }
     }
     return count;
 }
 
+void UserManager::touchLastUsed(int index) {
+    // Epoch em segundos (comparável entre reinicializações); sem NTP o
+    // último valor conhecido é mantido (0 = nunca usou)
+    time_t now = time(nullptr);
+    if (now >= (time_t)AUTH_MIN_VALID_EPOCH) {
+        lastUsed[index] = (uint32_t)now;
+    }
+}
+
 UserCredits UserManager::getMostActiveUser() {
+    UserLock guard(*this);
     UserCredits mostActive;
     mostActive.uid = "";
+    mostActive.credits = 0;
     mostActive.lastUsed = 0;
+    mostActive.isActive = false;
     
-    for (const auto& user : users) {
-        if (user.lastUsed > mostActive.lastUsed) {
-            mostActive = user;
+    int best = -1;
+    for (size_t i = 0; i < lastUsed.size(); i++) {
+        if (lastUsed[i] > (best == -1 ? 0 : lastUsed[best])) {
+            best = i;
         }
     }
     
+    if (best != -1) {
+        fillUser(best, mostActive);
+    }
     return mostActive;
 }
 
 std::vector<UserCredits> UserManager::getTopUsers(int count) {
-    std::vector<UserCredits> sortedUsers = users;
+    UserLock guard(*this);
+    // Ordena apenas posições pelo vetor lastUsed e monta os registros no fim
+    std::vector<uint16_t> order(uids.size());
+    for (size_t i = 0; i < order.size(); i++) {
+        order[i] = i;
+    }
     
-    // Ordenar por última utilização (mais recente primeiro)
-    std::sort(sortedUsers.begin(), sortedUsers.end(), 
-        [](const UserCredits& a, const UserCredits& b) {
-            return a.lastUsed > b.lastUsed;
+    size_t limit = std::min(order.size(), (size_t)std::max(count, 0));
+    std::partial_sort(order.begin(), order.begin() + limit, order.end(),
+        [this](uint16_t a, uint16_t b) {
+            return lastUsed[a] > lastUsed[b];
         });
     
-    // Limitar ao número solicitado
-    if (sortedUsers.size() > count) {
-        sortedUsers.resize(count);
+    std::vector<UserCredits> topUsers(limit);
+    for (size_t i = 0; i < limit; i++) {
+        fillUser(order[i], topUsers[i]);
     }
-    
-    return sortedUsers;
+    return topUsers;
 }
 
 void UserManager::printUserList() {
-    DEBUG_PRINTF("\n=== LISTA DE USUÁRIOS (%d/%d) ===\n", users.size(), MAX_USERS);
+    UserLock guard(*this);
+    DEBUG_PRINTF("\n=== LISTA DE USUÁRIOS (%d/%d) ===\n", uids.size(), MAX_USERS);
     
-    if (users.empty()) {
+    if (uids.empty()) {
         DEBUG_PRINTLN("Nenhum usuário cadastrado");
         return;
     }
     
-    for (const auto& user : users) {
+    for (size_t i = 0; i < uids.size(); i++) {
         DEBUG_PRINTF("UID: %s | Nome: %s | Créditos: %d | Ativo: %s\n",
-                    user.uid.c_str(),
-                    user.name.c_str(),
-                    user.credits,
-                    user.isActive ? "Sim" : "Não");
+                    uidToString(uids[i]).c_str(),
+                    names[i].c_str(),
+                    credits[i],
+                    (flags[i] & USER_FLAG_ACTIVE) ? "Sim" : "Não");
     }
     
     DEBUG_PRINTF("Total de créditos no sistema: %d\n", getTotalCreditsInSystem());
@@ -310,11 +576,12 @@ void UserManager::printUserList() {
 }
 
 void UserManager::updateLastUsed(const String& uid) {
-    UserCredits* user = getUserByUID(uid);
-    if (user) {
-        user->lastUsed = millis();
-        user->isActive = true;
-        dataChanged = true;
+    UserLock guard(*this);
+    int index = findUserByUID(uid);
+    if (index != -1) {
+        touchLastUsed(index);
+        flags[index] |= USER_FLAG_ACTIVE;
+        markChanged();
     }
 }
 
@@ -323,14 +590,9 @@ bool UserManager::isValidUID(const String& uid) {
         return false;
     }
     
-    // Verificar se contém apenas caracteres hexadecimais e espaços
-    for (char c : uid) {
-        if (!isxdigit(c) && c != ' ') {
-            return false;
-        }
-    }
-    
-    return true;
+    // Apenas dígitos hexadecimais e espaços, formando bytes inteiros
+    PackedUID packed;
+    return packUID(uid, packed);
 }
 
 String UserManager::sanitizeName(const String& name) {
@@ -353,47 +615,189 @@ String UserManager::sanitizeName(const String& name) {
 }
 
 String UserManager::exportUsers() {
-    // Implementar exportação JSON dos usuários para backup
-    String json = "{\"users\":[";
+    UserLock guard(*this);
+    // Exportação NDJSON (um usuário por linha), mesmo formato do backup
+    String out;
+    char line[BACKUP_LINE_MAX];
     
-    for (size_t i = 0; i < users.size(); i++) {
-        if (i > 0) json += ",";
-        json += "{";
-        json += "\"uid\":\"" + users[i].uid + "\",";
-        json += "\"name\":\"" + users[i].name + "\",";
-        json += "\"credits\":" + String(users[i].credits) + ",";
-        json += "\"lastUsed\":" + String(users[i].lastUsed) + ",";
-        json += "\"isActive\":" + String(users[i].isActive ? "true" : "false");
-        json += "}";
+    for (size_t i = 0; i < uids.size(); i++) {
+        StaticJsonDocument<BACKUP_LINE_MAX> doc;
+        doc["type"] = "user";
+        doc["uid"] = uidToString(uids[i]);
+        doc["name"] = names[i];
+        doc["credits"] = credits[i];
+        doc["lastUsed"] = lastUsed[i];
+        doc["isActive"] = (flags[i] & USER_FLAG_ACTIVE) != 0;
+        
+        size_t len = serializeJson(doc, line, sizeof(line));
+        out.concat(line, len);
+        out += '\n';
     }
     
-    json += "],\"lastWeeklyReset\":" + String(lastWeeklyReset) + "}";
-    return json;
+    return out;
 }
 
 bool UserManager::importUsers(const String& data) {
-    // Implementar importação JSON dos usuários (backup restore)
-    // Esta é uma implementação simplificada
-    DEBUG_PRINTLN("Importação de usuários não implementada completamente");
-    return false;
+    // Importação NDJSON: cada linha "user" é validada e deduplicada,
+    // e a tabela só é substituída se o conjunto inteiro for válido
+    std::vector<UserCredits> imported;
+    imported.reserve(MAX_USERS);
+    UIDSet seen(MAX_USERS + 1);
+    
+    int start = 0;
+    while (start < (int)data.length()) {
+        int end = data.indexOf('\n', start);
+        if (end == -1) end = data.length();
+        
+        String line = data.substring(start, end);
+        start = end + 1;
+        line.trim();
+        if (line.length() == 0) continue;
+        
+        StaticJsonDocument<BACKUP_LINE_MAX> doc;
+        if (deserializeJson(doc, line)) {
+            DEBUG_PRINTLN("Importação: linha inválida");
+            return false;
+        }
+        if (doc["type"] != "user") continue;
+        
+        UserCredits user;
+        user.uid = doc["uid"] | "";
+        user.name = doc["name"] | "";
+        user.credits = doc["credits"] | INITIAL_CREDITS;
+        user.lastUsed = doc["lastUsed"] | 0UL;
+        user.isActive = doc["isActive"] | true;
+        
+        if (!normalizeImportedUser(user)) {
+            DEBUG_PRINTF("Importação: usuário inválido (%s)\n", user.uid.c_str());
+            return false;
+        }
+        PackedUID packed;
+        packUID(user.uid, packed);
+        if (!seen.insert(packed)) {
+            continue; // Duplicado: mantém a primeira ocorrência
+        }
+        if (imported.size() >= MAX_USERS) {
+            DEBUG_PRINTLN("Importação: máximo de usuários excedido");
+            return false;
+        }
+        imported.push_back(user);
+    }
+    
+    return applyImportedUsers(imported, true, lastWeeklyReset);
 }
 
-void UserManager::maintenance() {
-    // Salvar dados se necessário
-    if (dataChanged && (millis() - lastSave > DATA_SAVE_INTERVAL_MS)) {
-        saveToPreferences();
+bool UserManager::getUserAt(size_t index, UserCredits& out) {
+    UserLock guard(*this);
+    if (index >= uids.size()) {
+        return false;
     }
+    fillUser(index, out);
+    return true;
+}
+
+bool UserManager::normalizeImportedUser(UserCredits& user) {
+    // UID reescrito na forma canônica ("A1 B2 C3 D4"), usada na deduplicação
+    PackedUID packed;
+    user.uid.trim();
+    user.name = sanitizeName(user.name);
     
-    // Verificar e executar reset semanal se necessário
-    if (shouldPerformWeeklyReset()) {
-        performWeeklyReset();
+    if (!isValidUID(user.uid) || !packUID(user.uid, packed) || user.name.length() == 0 || user.credits < 0) {
+        return false;
     }
+    user.uid = uidToString(packed);
+    return true;
+}
+
+bool UserManager::applyImportedUsers(const std::vector<UserCredits>& imported, bool overwrite, unsigned long lastReset) {
+    UserLock guard(*this);
+    // Monta a tabela final antes de tocar na atual (aplicação atômica)
+    std::vector<UserCredits> merged;
+    
+    if (overwrite) {
+        merged = imported;
+    } else {
+        merged = getAllUsers();
+        UIDSet seen(uids.size() + imported.size());
+        for (size_t i = 0; i < uids.size(); i++) {
+            seen.insert(uids[i]);
+        }
+        for (const auto& user : imported) {
+            PackedUID packed;
+            if (packUID(user.uid, packed) && seen.insert(packed)) {
+                merged.push_back(user);
+            }
+        }
+    }
+    
+    if (merged.size() > MAX_USERS) {
+        DEBUG_PRINTF("Importação rejeitada: %d usuários excede o máximo\n", merged.size());
+        return false;
+    }
+    
+    std::vector<PackedUID> packed(merged.size());
+    for (size_t i = 0; i < merged.size(); i++) {
+        if (!packUID(merged[i].uid, packed[i])) {
+            DEBUG_PRINTF("Importação rejeitada: UID inválido (%s)\n", merged[i].uid.c_str());
+            return false;
+        }
+    }
+    
+    clearTable();
+    for (size_t i = 0; i < merged.size(); i++) {
+        appendUser(packed[i], merged[i].name, merged[i].credits, merged[i].lastUsed, merged[i].isActive);
+    }
+    rebuildIndex();
+    if (overwrite && lastReset > 0) {
+        lastWeeklyReset = lastReset;
+    }
+    markChanged();
+    requestSave();
+    
+    DEBUG_PRINTF("Importação concluída: %d usuários\n", uids.size());
+    return true;
+}
+
+void UserManager::registerJobs(MaintenanceScheduler& jobs) {
+    // saveToPreferences() não faz nada sem alterações pendentes
+    scheduler = &jobs;
+    saveJob = jobs.every("users.save", DATA_SAVE_INTERVAL_MS, [this]() { saveToPreferences(); });
+    jobs.every("users.weekly_reset", WEEKLY_RESET_CHECK_INTERVAL, [this]() {
+        if (!shouldPerformWeeklyReset()) return;
+        DEBUG_PRINTLN("Executando reset semanal de créditos...");
+        performWeeklyReset();
+        if (weeklyResetHandler) weeklyResetHandler();
+    });
 }
 
 // Métodos privados
 
+void UserManager::requestSave() {
+    // Com o agendador, a NVS só é gravada pela tarefa de manutenção (um único
+    // escritor, sem segurar o lock durante a gravação); antes dele, direto
+    if (scheduler) {
+        scheduler->trigger(saveJob);
+    } else {
+        saveToPreferences();
+    }
+}
+
 void UserManager::saveToPreferences() {
-    if (!dataChanged) return;
+    if (!persistent) return;
+    
+    // Cópia da tabela sob o lock; a gravação na NVS acontece fora dele
+    std::vector<UserCredits> snapshot;
+    unsigned long resetTime;
+    {
+        UserLock guard(*this);
+        if (!dataChanged) return;
+        snapshot.resize(uids.size());
+        for (size_t i = 0; i < uids.size(); i++) {
+            fillUser(i, snapshot[i]);
+        }
+        resetTime = lastWeeklyReset;
+        dataChanged = false;
+    }
     
     Preferences prefs;
     prefs.begin("users", false);
@@ -402,26 +806,24 @@ void UserManager::saveToPreferences() {
     prefs.clear();
     
     // Salvar configurações gerais
-    prefs.putULong("lastReset", lastWeeklyReset);
-    prefs.putUInt("userCount", users.size());
+    prefs.putULong("lastReset", resetTime);
+    prefs.putUInt("userCount", snapshot.size());
     
-    // Salvar cada usuário
-    for (size_t i = 0; i < users.size(); i++) {
+    // Salvar cada usuário (mesmo formato de chaves de antes da tabela em arrays)
+    for (size_t i = 0; i < snapshot.size(); i++) {
         String prefix = "u" + String(i) + "_";
         
-        prefs.putString((prefix + "uid").c_str(), users[i].uid);
-        prefs.putString((prefix + "name").c_str(), users[i].name);
-        prefs.putInt((prefix + "credits").c_str(), users[i].credits);
-        prefs.putULong((prefix + "lastUsed").c_str(), users[i].lastUsed);
-        prefs.putBool((prefix + "isActive").c_str(), users[i].isActive);
+        prefs.putString((prefix + "uid").c_str(), snapshot[i].uid);
+        prefs.putString((prefix + "name").c_str(), snapshot[i].name);
+        prefs.putInt((prefix + "credits").c_str(), snapshot[i].credits);
+        prefs.putULong((prefix + "lastUsed").c_str(), snapshot[i].lastUsed);
+        prefs.putBool((prefix + "isActive").c_str(), snapshot[i].isActive);
     }
     
     prefs.end();
-    
-    dataChanged = false;
     lastSave = millis();
     
-    DEBUG_PRINTF("Dados de usuários salvos (%d usuários)\n", users.size());
+    DEBUG_PRINTF("Dados de usuários salvos (%d usuários)\n", snapshot.size());
 }
 
 void UserManager::loadFromPreferences() {
@@ -433,38 +835,398 @@ void UserManager::loadFromPreferences() {
     unsigned int userCount = prefs.getUInt("userCount", 0);
     
     // Carregar usuários
-    users.clear();
-    users.reserve(userCount);
+    clearTable();
+    uids.reserve(userCount);
+    credits.reserve(userCount);
+    lastUsed.reserve(userCount);
+    flags.reserve(userCount);
+    names.reserve(userCount);
     
     for (unsigned int i = 0; i < userCount; i++) {
         String prefix = "u" + String(i) + "_";
         
-        UserCredits user;
-        user.uid = prefs.getString((prefix + "uid").c_str(), "");
-        user.name = prefs.getString((prefix + "name").c_str(), "");
-        user.credits = prefs.getInt((prefix + "credits").c_str(), INITIAL_CREDITS);
-        user.lastUsed = prefs.getULong((prefix + "lastUsed").c_str(), 0);
-        user.isActive = prefs.getBool((prefix + "isActive").c_str(), true);
+        String uid = prefs.getString((prefix + "uid").c_str(), "");
+        String name = prefs.getString((prefix + "name").c_str(), "");
+        PackedUID packed;
         
-        if (user.uid.length() > 0 && user.name.length() > 0) {
-            users.push_back(user);
+        if (name.length() == 0 || !packUID(uid, packed)) {
+            DEBUG_PRINTF("Usuário ignorado na carga (UID: %s)\n", uid.c_str());
+            continue;
         }
+        
+        appendUser(packed, name,
+                   prefs.getInt((prefix + "credits").c_str(), INITIAL_CREDITS),
+                   prefs.getULong((prefix + "lastUsed").c_str(), 0),
+                   prefs.getBool((prefix + "isActive").c_str(), true));
     }
     
     prefs.end();
+    rebuildIndex();
     
-    DEBUG_PRINTF("Dados de usuários carregados (%d usuários)\n", users.size());
+    DEBUG_PRINTF("Dados de usuários carregados (%d usuários)\n", uids.size());
+}
+
+void UserManager::acquire() {
+    if (lock) xSemaphoreTakeRecursive(lock, portMAX_DELAY);
+}
+
+void UserManager::release() {
+    if (lock) xSemaphoreGiveRecursive(lock);
 }
 
 int UserManager::findUserByUID(const String& uid) {
-    for (size_t i = 0; i < users.size(); i++) {
-        if (users[i].uid.equalsIgnoreCase(uid)) {
-            return i;
+    PackedUID packed;
+    if (!packUID(uid, packed)) {
+        return -1;
+    }
+    return findPacked(packed);
+}
+
+int UserManager::findPacked(const PackedUID& uid) {
+    if (uidIndex.empty()) {
+        return -1;
+    }
+    
+    size_t mask = uidIndex.size() - 1;
+    size_t slot = hashUID(uid) & mask;
+    
+    // Sondagem linear; a posição é sempre conferida contra o UID binário
+    while (uidIndex[slot] != -1) {
+        int position = uidIndex[slot];
+        if (position < (int)uids.size() && uids[position].len == uid.len &&
+            memcmp(uids[position].bytes, uid.bytes, uid.len) == 0) {
+            return position;
         }
+        slot = (slot + 1) & mask;
     }
     return -1;
 }
 
+uint32_t UserManager::hashUID(const PackedUID& uid) {
+    // FNV-1a sobre os bytes do UID
+    uint32_t hash = 2166136261UL;
+    for (uint8_t i = 0; i < uid.len; i++) {
+        hash ^= uid.bytes[i];
+        hash *= 16777619UL;
+    }
+    return hash;
+}
+
+bool UserManager::packUID(const String& uid, PackedUID& out) {
+    // Aceita "A1 B2 C3 D4", "a1b2c3d4" etc.; exige número par de dígitos
+    out.len = 0;
+    uint8_t nibbles = 0;
+    uint8_t current = 0;
+    
+    for (char c : uid) {
+        if (c == ' ') continue;
+        if (!isxdigit(c)) return false;
+        
+        uint8_t value = isdigit(c) ? c - '0' : (toupper(c) - 'A' + 10);
+        current = (current << 4) | value;
+        if (++nibbles == 2) {
+            if (out.len >= USER_UID_MAX_BYTES) return false;
+            out.bytes[out.len++] = current;
+            nibbles = 0;
+            current = 0;
+        }
+    }
+    
+    return nibbles == 0 && out.len >= 4;
+}
+
+String UserManager::uidToString(const PackedUID& uid) {
+    // Mesmo formato produzido pelo leitor RFID
+    char text[USER_UID_MAX_BYTES * 3];
+    size_t pos = 0;
+    for (uint8_t i = 0; i < uid.len; i++) {
+        pos += snprintf(text + pos, sizeof(text) - pos, i ? " %02X" : "%02X", uid.bytes[i]);
+    }
+    text[pos] = '\0';
+    return String(text);
+}
+
+int16_t UserManager::clampCredits(long value) {
+    if (value < 0) return 0;
+    if (value > INT16_MAX) return INT16_MAX;
+    return (int16_t)value;
+}
+
+int UserManager::appendUser(const PackedUID& uid, const String& name, int userCredits, uint32_t used, bool active) {
+    // Valores de firmwares antigos (millis() desde o boot) não são datas: viram 0
+    uids.push_back(uid);
+    credits.push_back(clampCredits(userCredits));
+    lastUsed.push_back(used >= AUTH_MIN_VALID_EPOCH ? used : 0);
+    flags.push_back(active ? USER_FLAG_ACTIVE : 0);
+    names.push_back(name);
+    return uids.size() - 1;
+}
+
+void UserManager::eraseUser(int position) {
+    uids.erase(uids.begin() + position);
+    credits.erase(credits.begin() + position);
+    lastUsed.erase(lastUsed.begin() + position);
+    flags.erase(flags.begin() + position);
+    names.erase(names.begin() + position);
+}
+
+void UserManager::compactRemoved() {
+    // Remove as lápides de todos os vetores numa única passada
+    size_t out = 0;
+    for (size_t i = 0; i < uids.size(); i++) {
+        if (uids[i].len == 0) continue;
+        if (out != i) {
+            uids[out] = uids[i];
+            credits[out] = credits[i];
+            lastUsed[out] = lastUsed[i];
+            flags[out] = flags[i];
+            names[out] = std::move(names[i]);
+        }
+        out++;
+    }
+    uids.resize(out);
+    credits.resize(out);
+    lastUsed.resize(out);
+    flags.resize(out);
+    names.resize(out);
+}
+
+void UserManager::clearTable() {
+    uids.clear();
+    credits.clear();
+    lastUsed.clear();
+    flags.clear();
+    names.clear();
+}
+
+void UserManager::fillUser(int position, UserCredits& out) {
+    out.uid = uidToString(uids[position]);
+    out.name = names[position];
+    out.credits = credits[position];
+    out.lastUsed = lastUsed[position];
+    out.isActive = (flags[position] & USER_FLAG_ACTIVE) != 0;
+}
+
+void UserManager::rebuildIndex() {
+    // Fator de carga máximo de 50% para sondas curtas
+    size_t size = 16;
+    while (size < uids.size() * 2) {
+        size <<= 1;
+    }
+    uidIndex.assign(size, -1);
+    
+    size_t mask = size - 1;
+    for (size_t i = 0; i < uids.size(); i++) {
+        if (uids[i].len == 0) continue;
+        size_t slot = hashUID(uids[i]) & mask;
+        while (uidIndex[slot] != -1) {
+            slot = (slot + 1) & mask;
+        }
+        uidIndex[slot] = i;
+    }
+}
+
+void UserManager::indexInsert(int position) {
+    if (uidIndex.empty() || (size_t)(position + 1) * 2 > uidIndex.size()) {
+        rebuildIndex();
+        return;
+    }
+    
+    size_t mask = uidIndex.size() - 1;
+    size_t slot = hashUID(uids[position]) & mask;
+    while (uidIndex[slot] != -1) {
+        slot = (slot + 1) & mask;
+    }
+    uidIndex[slot] = position;
+}
+
+UIDSet::UIDSet(size_t capacity) {
+    reset(capacity);
+}
+
+void UIDSet::reset(size_t capacity) {
+    slots.clear();
+    slots.shrink_to_fit();
+    if (capacity == 0) return;
+    
+    // Fator de carga máximo de 50%, como o índice da tabela
+    size_t size = 16;
+    while (size < capacity * 2) {
+        size <<= 1;
+    }
+    PackedUID empty = {};
+    slots.assign(size, empty);
+}
+
+bool UIDSet::insert(const PackedUID& uid) {
+    size_t mask = slots.size() - 1;
+    size_t slot = UserManager::hashUID(uid) & mask;
+    
+    while (slots[slot].len != 0) {
+        if (slots[slot].len == uid.len && memcmp(slots[slot].bytes, uid.bytes, uid.len) == 0) {
+            return false;
+        }
+        slot = (slot + 1) & mask;
+    }
+    
+    slots[slot] = uid;
+    return true;
+}
+
+/* -------------------- Lote em streaming -------------------- */
+
+UserBatch::UserBatch() :
+    objectLength(0),
+    keyLength(0),
+    depth(0),
+    inString(false),
+    escaped(false),
+    inOps(false),
+    sawOps(false),
+    error(nullptr),
+    errorCode(0) {
+    key[0] = '\0';
+    names.reserve(1024);
+}
+
+void UserBatch::fail(int code, const char* message) {
+    if (error) return;
+    error = message;
+    errorCode = code;
+}
+
+void UserBatch::feed(const uint8_t* data, size_t len) {
+    // Acompanha a profundidade fora de strings; objetos no nível 3
+    // ({ "ops": [ {...} ] }) são recortados e decodificados um a um
+    for (size_t i = 0; i < len && !error; i++) {
+        char c = (char)data[i];
+        bool capturing = inOps && depth >= 3;
+        
+        if (capturing) {
+            if (objectLength >= sizeof(object)) {
+                fail(413, "Operation too long");
+                return;
+            }
+            object[objectLength++] = c;
+        }
+        
+        if (inString) {
+            if (escaped) {
+                escaped = false;
+            } else if (c == '\\') {
+                escaped = true;
+            } else if (c == '"') {
+                inString = false;
+                if (depth == 1) key[keyLength] = '\0';
+            } else if (depth == 1 && keyLength < sizeof(key) - 1) {
+                key[keyLength++] = c;
+            }
+            continue;
+        }
+        
+        switch (c) {
+            case '"':
+                inString = true;
+                if (depth == 1) keyLength = 0;
+                break;
+                
+            case '{':
+            case '[':
+                if (depth == 0 && c != '{') {
+                    fail(400, "Body must be a JSON object");
+                    return;
+                }
+                if (depth == 1 && c == '[' && strcmp(key, "ops") == 0) {
+                    inOps = true;
+                    sawOps = true;
+                }
+                if (inOps && depth == 2) {
+                    if (c != '{') {
+                        fail(400, "Operations must be objects");
+                        return;
+                    }
+                    if (ops.size() >= USER_BATCH_MAX_OPS) {
+                        fail(413, "Too many operations");
+                        return;
+                    }
+                    objectLength = 0;
+                    object[objectLength++] = c;
+                }
+                if (depth == UINT8_MAX) {
+                    fail(400, "JSON nested too deep");
+                    return;
+                }
+                depth++;
+                break;
+                
+            case '}':
+            case ']':
+                if (depth == 0) {
+                    fail(400, "Malformed JSON");
+                    return;
+                }
+                depth--;
+                if (inOps && depth == 2) {
+                    parseOp();
+                } else if (inOps && depth == 1) {
+                    inOps = false;
+                }
+                break;
+        }
+    }
+}
+
+bool UserBatch::finish() {
+    if (!error && (depth != 0 || inString)) {
+        fail(400, "Malformed JSON");
+    }
+    if (!error && !sawOps) {
+        fail(400, "Missing ops array");
+    }
+    return error == nullptr;
+}
+
+void UserBatch::parseOp() {
+    // Objeto malformado ou com campos errados vira uma operação inválida,
+    // reportada no resultado daquele item como no restante do lote
+    UserBatchOp op = {};
+    op.type = BATCH_INVALID;
+    op.credits = -1;
+    
+    StaticJsonDocument<JSON_OBJECT_SIZE(8) + USER_BATCH_OP_MAX> doc;
+    if (!deserializeJson(doc, (const char*)object, objectLength)) {
+        op.type = UserManager::batchOpFromString(doc["op"] | "");
+        op.credits = doc["credits"] | -1;
+        
+        String uid = doc["uid"] | "";
+        uid.trim();
+        if (!UserManager::isValidUID(uid) || !UserManager::packUID(uid, op.uid)) {
+            op.uid.len = 0;
+        }
+        
+        const char* name = doc["name"] | "";
+        size_t nameLength = strnlen(name, UINT8_MAX);
+        if (names.size() + nameLength > USER_BATCH_NAME_ARENA) {
+            fail(413, "Names too long");
+            return;
+        }
+        op.nameOffset = names.size();
+        op.nameLength = nameLength;
+        names.insert(names.end(), name, name + nameLength);
+    }
+    
+    ops.push_back(op);
+}
+
+String UserBatch::nameOf(const UserBatchOp& op) const {
+    String name;
+    name.reserve(op.nameLength);
+    for (uint8_t i = 0; i < op.nameLength; i++) {
+        name += names[op.nameOffset + i];
+    }
+    return name;
+}
+
 // Converte um único usuário para JSON
 String UserManager::userToJson(const UserCredits &user) {
     StaticJsonDocument<256> doc;
@@ -480,16 +1242,17 @@ String UserManager::userToJson(const UserCredits &user) {
 
 // Lista todos os usuários em JSON
 String UserManager::listUsersJson() {
+    UserLock guard(*this);
     StaticJsonDocument<1024> doc;   // tamanho ajustável
     JsonArray arr = doc.createNestedArray("users");
 
-    for (const auto &user : users) {
+    for (size_t i = 0; i < uids.size(); i++) {
         JsonObject obj = arr.createNestedObject();
-        obj["uid"] = user.uid;
-        obj["name"] = user.name;
-        obj["credits"] = user.credits;
-        obj["lastUsed"] = user.lastUsed;
-        obj["isActive"] = user.isActive;
+        obj["uid"] = uidToString(uids[i]);
+        obj["name"] = names[i];
+        obj["credits"] = credits[i];
+        obj["lastUsed"] = lastUsed[i];
+        obj["isActive"] = (flags[i] & USER_FLAG_ACTIVE) != 0;
     }
 
     String out;
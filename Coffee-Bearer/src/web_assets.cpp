@@ -0,0 +1,16 @@
+#include "web_assets.h"
+#include "web_assets_data.h"   // Gerado por compress_data.py
+
+const WebAsset* findWebAsset(const char* path) {
+    for (size_t i = 0; i < WEB_ASSET_COUNT; i++) {
+        if (strcmp(WEB_ASSETS[i].path, path) == 0) {
+            return &WEB_ASSETS[i];
+        }
+    }
+    return nullptr;
+}
+
+const WebAsset* getWebAssets(size_t& count) {
+    count = WEB_ASSET_COUNT;
+    return WEB_ASSETS;
+}
@@ -1,98 +1,289 @@
 #include "web_server.h"
+#include "backup_manager.h"
+#include "ws_protocol.h"
+#include <memory>
 
 extern RFIDManager rfidManager;
 extern FeedbackManager feedbackManager; // ADD THIS EXTERN
 
+// Fila de serviço: pedido em preparo + um objeto por pedido (nome até 50 + UID)
+static const size_t SERVE_QUEUE_JSON_SIZE = JSON_OBJECT_SIZE(4) + JSON_OBJECT_SIZE(2) +
+                                            JSON_ARRAY_SIZE(SERVE_QUEUE_MAX) +
+                                            SERVE_QUEUE_MAX * (JSON_OBJECT_SIZE(6) + 96);
+
+// Resposta do /api/users/batch, gerada em partes a partir dos resultados
+struct UserBatchReplyCursor {
+    std::vector<UserBatchResult> results;
+    int applied = 0;
+    unsigned long elapsedUs = 0;
+    size_t next = 0;
+    bool headerSent = false;
+    bool done = false;
+    char line[96];
+    size_t lineLength = 0;
+    size_t linePosition = 0;
+};
+
+static size_t fillUserBatchReply(UserBatchReplyCursor &cursor, uint8_t *buffer, size_t maxLen) {
+    size_t written = 0;
+    while (written < maxLen) {
+        if (cursor.linePosition >= cursor.lineLength) {
+            int len;
+            if (!cursor.headerSent) {
+                len = snprintf(cursor.line, sizeof(cursor.line),
+                               "{\"success\":true,\"applied\":%d,\"failed\":%d,\"elapsedUs\":%lu,\"results\":[",
+                               cursor.applied, (int)cursor.results.size() - cursor.applied, cursor.elapsedUs);
+                cursor.headerSent = true;
+            } else if (cursor.next < cursor.results.size()) {
+                const UserBatchResult &result = cursor.results[cursor.next];
+                const char *sep = cursor.next ? "," : "";
+                if (result.success) {
+                    len = snprintf(cursor.line, sizeof(cursor.line), "%s{\"index\":%u,\"success\":true}",
+                                   sep, (unsigned)cursor.next);
+                } else {
+                    len = snprintf(cursor.line, sizeof(cursor.line), "%s{\"index\":%u,\"success\":false,\"error\":\"%s\"}",
+                                   sep, (unsigned)cursor.next, result.error);
+                }
+                cursor.next++;
+            } else if (!cursor.done) {
+                len = snprintf(cursor.line, sizeof(cursor.line), "]}");
+                cursor.done = true;
+            } else {
+                break;
+            }
+            cursor.lineLength = len;
+            cursor.linePosition = 0;
+        }
+        size_t chunk = std::min(maxLen - written, cursor.lineLength - cursor.linePosition);
+        memcpy(buffer + written, cursor.line + cursor.linePosition, chunk);
+        written += chunk;
+        cursor.linePosition += chunk;
+    }
+    return written;
+}
+
 // Constructor
-WebServerManager::WebServerManager(AuthManager &auth, Logger &log, UserManager &users, CoffeeController &coffee, FeedbackManager &feedback)
-    : server(80), ws("/ws"), authManager(auth), logger(log), userManager(users), coffeeController(coffee), feedbackManager(feedback) {}
+WebServerManager::WebServerManager(AuthManager &auth, Logger &log, UserManager &users, CoffeeController &coffee, FeedbackManager &feedback, BackupManager &backup, MaintenanceScheduler &jobs)
+    : server(80), ws("/ws"), events("/api/events"), eventStream(events),
+      metricsExporter(log, coffee, users, auth, rfidManager, metrics, broadcaster, eventStream, jobs), authManager(auth), logger(log), userManager(users), coffeeController(coffee), feedbackManager(feedback), backupManager(backup),
+      scheduler(jobs), statusSnapshot(log, coffee, users, auth), statusJob(-1),
+      userBatch(nullptr), userBatchId(0), nextUserBatchId(1), userBatchActivity(0) {}
 
 void WebServerManager::begin() {
     if (!SPIFFS.begin(true)) {
         Serial.println("⚠️ SPIFFS mount failed");
     }
 
+    statusSnapshot.begin();
+    broadcaster.begin();
+    broadcaster.setResyncHandler([this](AsyncWebSocketClient *client, bool binary) {
+        this->sendStatusSnapshot(client, binary);
+    });
+    eventStream.begin();
+    eventStream.setSnapshotProvider([this]() { return this->statusSnapshot.copyFrame(); });
+
     setupStaticRoutes();
     setupAuthRoutes();
     setupApiRoutes();
+    setupBackupRoutes();
     setupWebSocket();
+    setupEventStream();
 
     server.begin();
     Serial.println("🌐 Web server started");
 }
 
+/* -------------------- Route Metrics -------------------- */
+// Middleware: every route goes through metered(), every response through reply()
+ArRequestHandlerFunction WebServerManager::metered(int slot, ArRequestHandlerFunction handler) {
+    return [this, slot, handler](AsyncWebServerRequest *req) {
+        this->metrics.begin(slot);
+        handler(req);
+        this->metrics.end();
+    };
+}
+
+void WebServerManager::on(const char *uri, WebRequestMethodComposite method, ArRequestHandlerFunction handler, const char *label) {
+    server.on(uri, method, metered(metrics.add(label ? label : uri, method), handler));
+}
+
+void WebServerManager::on(const char *uri, WebRequestMethodComposite method, ArRequestHandlerFunction handler, ArUploadHandlerFunction upload) {
+    server.on(uri, method, metered(metrics.add(uri, method), handler), upload);
+}
+
+void WebServerManager::on(const char *uri, WebRequestMethodComposite method, ArRequestHandlerFunction handler, ArBodyHandlerFunction body) {
+    server.on(uri, method, metered(metrics.add(uri, method), handler), nullptr, body);
+}
+
+AsyncCallbackJsonWebHandler *WebServerManager::onJson(const char *uri, ArJsonRequestHandlerFunction handler, size_t jsonBufferSize) {
+    int slot = metrics.add(uri, HTTP_ANY);
+    AsyncCallbackJsonWebHandler *jsonHandler = new AsyncCallbackJsonWebHandler(uri,
+        [this, slot, handler](AsyncWebServerRequest *req, JsonVariant &json) {
+            this->metrics.begin(slot);
+            handler(req, json);
+            this->metrics.end();
+        }, jsonBufferSize);
+    server.addHandler(jsonHandler);
+    return jsonHandler;
+}
+
+void WebServerManager::reply(AsyncWebServerRequest *req, int code, const String &type, const String &body) {
+    reply(req, req->beginResponse(code, type, body));
+}
+
+void WebServerManager::reply(AsyncWebServerRequest *req, AsyncWebServerResponse *res) {
+    // Lidos antes do envio: a biblioteca apaga respostas sem fonte válida
+    int code = RouteMetrics::responseCode(res);
+    metrics.recordResponse(code, RouteMetrics::responseLength(res));
+    if (code >= 500) {
+        logger.logWebRequest(req->methodToString(), req->url(), req->client()->remoteIP().toString(), code);
+    }
+    addRefreshedCookie(req, res);
+    req->send(res);
+}
+
+void WebServerManager::reply(AsyncWebServerRequest *req, AsyncResponseStream *res) {
+    // O tamanho de um stream só é fixado no envio (e streams nunca são apagados ali)
+    addRefreshedCookie(req, res);
+    req->send(res);
+    metrics.recordResponse(RouteMetrics::responseCode(res), RouteMetrics::responseLength(res));
+}
+
+// Token sem estado renovado ao responder (expiração deslizante)
+void WebServerManager::addRefreshedCookie(AsyncWebServerRequest *req, AsyncWebServerResponse *res) {
+    String cookie = authManager.refreshedCookieFor(req);
+    if (cookie.length() > 0) {
+        res->addHeader("Set-Cookie", cookie);
+    }
+}
+
 /* -------------------- Static Routes (Corrected & Simplified) -------------------- */
+// Hashed URLs never change content; everything else is revalidated through the ETag
+#define CACHE_IMMUTABLE "public, max-age=31536000, immutable"
+#define CACHE_REVALIDATE "no-cache"
+
+// Serve a copy embedded in flash: no filesystem lookup, keeps working with SPIFFS damaged
+void WebServerManager::sendWebAsset(AsyncWebServerRequest *request, const WebAsset *asset, const char *cacheControl) {
+    // Brotli when the browser offers it (in practice only over HTTPS/localhost), gzip otherwise
+    bool brotli = asset->brData && request->hasHeader("Accept-Encoding") &&
+                  request->header("Accept-Encoding").indexOf("br") != -1;
+    const char *etag = brotli ? asset->brEtag : asset->etag;
+
+    AsyncWebServerResponse *response;
+    if (request->hasHeader("If-None-Match") && request->header("If-None-Match").indexOf(etag) != -1) {
+        response = request->beginResponse(304);
+    } else if (brotli) {
+        response = request->beginResponse_P(200, asset->contentType, asset->brData, asset->brLength);
+        response->addHeader("Content-Encoding", "br");
+    } else {
+        response = request->beginResponse_P(200, asset->contentType, asset->data, asset->length);
+        if (asset->gzipped) {
+            response->addHeader("Content-Encoding", "gzip");
+        }
+    }
+    response->addHeader("ETag", etag);
+    response->addHeader("Cache-Control", cacheControl);
+    if (asset->brData) {
+        response->addHeader("Vary", "Accept-Encoding");
+    }
+    this->reply(request, response);
+}
+
 void WebServerManager::setupStaticRoutes() {
-    // Helper lambda to send a gzipped HTML file if it exists, otherwise the plain version
-    auto serveHtml = [](AsyncWebServerRequest *request, const String& path) {
+    // Helper lambda: embedded page first, then gzipped SPIFFS file, then the plain version
+    auto serveHtml = [this](AsyncWebServerRequest *request, const String& path) {
+        const WebAsset *asset = findWebAsset(path.c_str() + strlen(WEB_ROOT_PATH));
+        if (asset) {
+            this->sendWebAsset(request, asset, CACHE_REVALIDATE);
+            return;
+        }
+
         String gzPath = path + ".gz";
         if (SPIFFS.exists(gzPath)) {
             AsyncWebServerResponse *response = request->beginResponse(SPIFFS, gzPath, "text/html");
             response->addHeader("Content-Encoding", "gzip");
-            request->send(response);
+            this->reply(request, response);
         } else if (SPIFFS.exists(path)) {
-            request->send(SPIFFS, path, "text/html");
+            this->reply(request, request->beginResponse(SPIFFS, path, "text/html"));
         } else {
-            request->send(404, "text/plain", "Page Not Found");
+            this->reply(request, 404, "text/plain", "Page Not Found");
         }
     };
 
     // --- Explicit Page Routes ---
-    server.on("/", HTTP_GET, [serveHtml](AsyncWebServerRequest *request) {
+    on("/", HTTP_GET, [serveHtml](AsyncWebServerRequest *request) {
         serveHtml(request, "/web/login.html");
     });
-    server.on("/admin/dashboard", HTTP_GET, [serveHtml](AsyncWebServerRequest *request) {
+    on("/admin/dashboard", HTTP_GET, [serveHtml](AsyncWebServerRequest *request) {
         serveHtml(request, "/web/admin/dashboard.html");
     });
-    server.on("/admin/users", HTTP_GET, [serveHtml](AsyncWebServerRequest *request) {
+    on("/admin/users", HTTP_GET, [serveHtml](AsyncWebServerRequest *request) {
         serveHtml(request, "/web/admin/users.html");
     });
-    server.on("/admin/settings", HTTP_GET, [serveHtml](AsyncWebServerRequest *request) {
+    on("/admin/settings", HTTP_GET, [serveHtml](AsyncWebServerRequest *request) {
         serveHtml(request, "/web/admin/settings.html");
     });
-    server.on("/admin/logs", HTTP_GET, [serveHtml](AsyncWebServerRequest *request) {
+    on("/admin/logs", HTTP_GET, [serveHtml](AsyncWebServerRequest *request) {
         serveHtml(request, "/web/admin/logs.html");
     });
-    server.on("/admin/stats", HTTP_GET, [serveHtml](AsyncWebServerRequest *request) {
+    on("/admin/stats", HTTP_GET, [serveHtml](AsyncWebServerRequest *request) {
         serveHtml(request, "/web/admin/stats.html");
     });
 
     // --- User pages ---
-     server.on("/user/dashboard", HTTP_GET, [serveHtml](AsyncWebServerRequest *request) {
+     on("/user/dashboard", HTTP_GET, [serveHtml](AsyncWebServerRequest *request) {
         serveHtml(request, "/web/user/dashboard.html");
     });
-     server.on("/user/profile", HTTP_GET, [serveHtml](AsyncWebServerRequest *request) {
+     on("/user/profile", HTTP_GET, [serveHtml](AsyncWebServerRequest *request) {
         serveHtml(request, "/web/user/profile.html");
     });
-     server.on("/user/history", HTTP_GET, [serveHtml](AsyncWebServerRequest *request) {
+     on("/user/history", HTTP_GET, [serveHtml](AsyncWebServerRequest *request) {
         serveHtml(request, "/web/user/history.html");
     });
 
 
+    // --- Embedded static assets (registered before SPIFFS so they take precedence) ---
+    size_t assetCount;
+    const WebAsset *assets = getWebAssets(assetCount);
+    for (size_t i = 0; i < assetCount; i++) {
+        const WebAsset *asset = &assets[i];
+        if (strcmp(asset->contentType, "text/html") == 0) continue;  // Pages have explicit routes
+
+        // Hashed URL referenced by the embedded HTML
+        on(asset->url, HTTP_GET, [this, asset](AsyncWebServerRequest *request) {
+            this->sendWebAsset(request, asset, CACHE_IMMUTABLE);
+        }, "(assets)");
+        // Plain URL (SPIFFS pages, /favicon.ico requested by the browser itself)
+        on(asset->path, HTTP_GET, [this, asset](AsyncWebServerRequest *request) {
+            this->sendWebAsset(request, asset, CACHE_REVALIDATE);
+        }, "(assets)");
+    }
+
     // --- Static Asset Handler (for CSS, JS, etc.) ---
     // This will automatically handle .gz compression if the file exists
-    server.serveStatic("/css", SPIFFS, "/web/css").setCacheControl("max-age=31536000");
-    server.serveStatic("/js", SPIFFS, "/web/js").setCacheControl("max-age=31536000");
+    // Plain URLs change content on every update: let the browser revalidate
+    server.serveStatic("/css", SPIFFS, "/web/css").setCacheControl(CACHE_REVALIDATE);
+    server.serveStatic("/js", SPIFFS, "/web/js").setCacheControl(CACHE_REVALIDATE);
     server.serveStatic("/favicon.ico", SPIFFS, "/web/favicon.ico");
 
     // --- Not Found Handler ---
-    server.onNotFound([](AsyncWebServerRequest *request) {
+    server.onNotFound(metered(metrics.add("(not found)", HTTP_ANY), [this](AsyncWebServerRequest *request) {
         Serial.printf("❗ 404 Not Found: %s\n", request->url().c_str());
-        request->send(404, "text/plain", "Not Found");
-    });
+        this->reply(request, 404, "text/plain", "Not Found");
+    }));
 }
 
 /* -------------------- Auth Routes -------------------- */
 void WebServerManager::setupAuthRoutes() {
-    server.on("/auth/login", HTTP_POST, [this](AsyncWebServerRequest *req) {
+    on("/auth/login", HTTP_POST, [this](AsyncWebServerRequest *req) {
         if (!req->hasParam("username", true) || !req->hasParam("password", true)) {
-            req->send(400, "application/json", "{\"success\":false,\"message\":\"Missing credentials\"}");
+            this->reply(req, 400, "application/json", "{\"success\":false,\"message\":\"Missing credentials\"}");
             return;
         }
 
         String username = req->getParam("username", true)->value();
         String password = req->getParam("password", true)->value();
-        String ip = req->client()->remoteIP().toString();
+        uint32_t ip = req->client()->remoteIP();
 
         String sessionId = this->authManager.login(username, password, ip);
         if (sessionId.length() > 0) {
@@ -102,51 +293,68 @@ void WebServerManager::setupAuthRoutes() {
             AsyncWebServerResponse *res = req->beginResponse(200, "application/json",
                 "{\"success\":true,\"redirectUrl\":\"" + redirectUrl + "\"}");
             res->addHeader("Set-Cookie", this->authManager.createSessionCookie(sessionId));
-            req->send(res);
+            this->reply(req, res);
+        } else if (unsigned long remaining = this->authManager.getBlockTimeRemaining(ip)) {
+            AsyncWebServerResponse *res = req->beginResponse(429, "application/json",
+                "{\"success\":false,\"blocked\":true,\"remainingTime\":" + String(remaining) + "}");
+            res->addHeader("Retry-After", String(remaining / 1000 + 1));
+            this->reply(req, res);
         } else {
-            req->send(401, "application/json", "{\"success\":false,\"message\":\"Invalid credentials\"}");
+            this->reply(req, 401, "application/json", "{\"success\":false,\"message\":\"Invalid credentials\"}");
         }
     });
 
-    server.on("/auth/logout", HTTP_POST, [this](AsyncWebServerRequest *req) {
+    on("/auth/logout", HTTP_POST, [this](AsyncWebServerRequest *req) {
         String sessionId = this->authManager.getSessionIdFromRequest(req);
         if (!sessionId.isEmpty()) {
             this->authManager.logout(sessionId);
         }
-        req->send(200, "application/json", "{\"success\":true}");
+        this->reply(req, 200, "application/json", "{\"success\":true}");
     });
 
-    server.on("/auth/check", HTTP_GET, [this](AsyncWebServerRequest *req) {
-        String sessionId = this->authManager.getSessionIdFromRequest(req);
-        bool ok = this->authManager.isValidSession(sessionId);
-        String role = ok ? this->authManager.roleToString(this->authManager.getSessionRole(sessionId)) : "";
-        String username = ok ? this->authManager.getSession(sessionId)->username : "";
+    on("/auth/check", HTTP_GET, [this](AsyncWebServerRequest *req) {
+        AuthSession session;
+        bool ok = this->authManager.getSessionFromRequest(req, session);
+        String role = ok ? this->authManager.roleToString(session.role) : "";
+        String username = ok ? session.username : "";
         
         String json = "{\"authenticated\":" + String(ok ? "true" : "false") +
                       ",\"role\":\"" + role + "\"" +
                       ",\"username\":\"" + username + "\"}";
-        req->send(200, "application/json", json);
+        this->reply(req, 200, "application/json", json);
     });
 }
 
 /* -------------------- API Routes -------------------- */
 void WebServerManager::setupApiRoutes() {
-    server.on("/api/status", HTTP_GET, [this](AsyncWebServerRequest *req) {
+    on("/api/status", HTTP_GET, [this](AsyncWebServerRequest *req) {
         if (!this->authManager.isAuthenticated(req)) {
-            req->send(401, "application/json", "{\"error\":\"Unauthorized\"}");
+            this->reply(req, 401, "application/json", "{\"error\":\"Unauthorized\"}");
             return;
         }
-        StaticJsonDocument<1024> doc;
-        systemStatusToJson(doc, this->logger, this->coffeeController, this->userManager, this->authManager);
-        String json;
-        serializeJson(doc, json);
-        req->send(200, "application/json", json);
+        // Snapshot compartilhado; o navegador revalida com If-None-Match
+        String json, etag;
+        this->statusSnapshot.copyBody(json, etag);
+        if (json.length() == 0) {
+            this->reply(req, 500, "application/json", "{\"error\":\"Status unavailable\"}");
+            return;
+        }
+
+        AsyncWebServerResponse *res;
+        if (req->hasHeader("If-None-Match") && req->header("If-None-Match").indexOf(etag) != -1) {
+            res = req->beginResponse(304);
+        } else {
+            res = req->beginResponse(200, "application/json", json);
+        }
+        res->addHeader("ETag", etag);
+        res->addHeader("Cache-Control", "no-cache");
+        this->reply(req, res);
     });
     
     // --- LED Brightness Endpoint ---
-    AsyncCallbackJsonWebHandler* ledHandler = new AsyncCallbackJsonWebHandler("/api/led/brightness", [this](AsyncWebServerRequest *request, JsonVariant &json) {
+    onJson("/api/led/brightness", [this](AsyncWebServerRequest *request, JsonVariant &json) {
         if (!this->authManager.isAuthenticated(request, ROLE_ADMIN)) {
-            request->send(403, "application/json", "{\"error\":\"Forbidden\"}");
+            this->reply(request, 403, "application/json", "{\"error\":\"Forbidden\"}");
             return;
         }
 
@@ -154,16 +362,15 @@ void WebServerManager::setupApiRoutes() {
         if (jsonObj.containsKey("brightness")) {
             uint8_t brightness = jsonObj["brightness"];
             this->feedbackManager.setBrightness(brightness);
-            request->send(200, "application/json", "{\"success\":true}");
+            this->reply(request, 200, "application/json", "{\"success\":true}");
         } else {
-            request->send(400, "application/json", "{\"success\":false, \"message\":\"Missing brightness value\"}");
+            this->reply(request, 400, "application/json", "{\"success\":false, \"message\":\"Missing brightness value\"}");
         }
     });
-    server.addHandler(ledHandler);
     
-    AsyncCallbackJsonWebHandler* systemSettingsHandler = new AsyncCallbackJsonWebHandler("/api/system/settings", [this](AsyncWebServerRequest *request, JsonVariant &json) {
+    onJson("/api/system/settings", [this](AsyncWebServerRequest *request, JsonVariant &json) {
         if (!this->authManager.isAuthenticated(request, ROLE_ADMIN)) {
-            request->send(403, "application/json", "{\"error\":\"Forbidden\"}");
+            this->reply(request, 403, "application/json", "{\"error\":\"Forbidden\"}");
             return;
         }
 
@@ -182,26 +389,113 @@ void WebServerManager::setupApiRoutes() {
         }
         
         // For now, just send a success response
-        request->send(200, "application/json", "{\"success\":true, \"message\":\"Settings received\"}");
+        this->reply(request, 200, "application/json", "{\"success\":true, \"message\":\"Settings received\"}");
     });
-    server.addHandler(systemSettingsHandler);
     
     // --- User Management Endpoint ---
     
     // GET /api/users - List all users
-    server.on("/api/users", HTTP_GET, [this](AsyncWebServerRequest *req) {
+    on("/api/users", HTTP_GET, [this](AsyncWebServerRequest *req) {
         if (!this->authManager.isAuthenticated(req, ROLE_ADMIN)) {
-            req->send(403, "application/json", "{\"error\":\"Forbidden\"}");
+            this->reply(req, 403, "application/json", "{\"error\":\"Forbidden\"}");
             return;
         }
         String json = this->userManager.listUsersJson();
-        req->send(200, "application/json", json);
+        this->reply(req, 200, "application/json", json);
     });
 
+    // POST /api/users/batch - many add/remove/setCredits/rename ops, one save at the end.
+    // The body is split into op objects as it arrives, so up to USER_BATCH_MAX_OPS fit.
+    // Must be registered before the /api/users JSON handler, which also matches sub-paths.
+    on("/api/users/batch", HTTP_POST,
+        [this](AsyncWebServerRequest *request) {
+            if (!this->authManager.isAuthenticated(request, ROLE_ADMIN)) {
+                if (this->userBatchId && userBatchIdOf(request) == this->userBatchId) this->dropUserBatch();
+                this->reply(request, 403, "application/json", "{\"error\":\"Forbidden\"}");
+                return;
+            }
+            if (!this->userBatchId || userBatchIdOf(request) != this->userBatchId || !this->userBatch) {
+                bool busy = this->userBatchId != 0;
+                this->reply(request, busy ? 409 : 400, "application/json",
+                            busy ? "{\"success\":false, \"message\":\"Another batch is in progress\"}"
+                                 : "{\"success\":false, \"message\":\"Missing ops array\"}");
+                return;
+            }
+
+            std::unique_ptr<UserBatch> batch(this->userBatch);
+            this->userBatch = nullptr;
+            this->userBatchId = 0;
+
+            if (!batch->finish()) {
+                StaticJsonDocument<128> doc;
+                doc["success"] = false;
+                doc["message"] = batch->getError();
+                String json;
+                serializeJson(doc, json);
+                this->reply(request, batch->getErrorCode(), "application/json", json);
+                return;
+            }
+
+            auto cursor = std::make_shared<UserBatchReplyCursor>();
+            unsigned long startUs = micros();
+            cursor->applied = this->userManager.applyBatch(*batch, cursor->results);
+            cursor->elapsedUs = micros() - startUs;
+            batch.reset();
+
+            // Resultados enviados por item, sem montar um documento do lote inteiro
+            AsyncWebServerResponse *res = request->beginChunkedResponse("application/json",
+                [cursor](uint8_t *buffer, size_t maxLen, size_t index) -> size_t {
+                    return fillUserBatchReply(*cursor, buffer, maxLen);
+                });
+            this->reply(request, res);
+
+            this->logger.info("Operação em lote de usuários",
+                              String(cursor->applied) + "/" + String(cursor->results.size()) + " aplicadas em " + String(cursor->elapsedUs) + " us");
+            if (cursor->applied > 0) {
+                this->pushStatus();
+            }
+        },
+        [this](AsyncWebServerRequest *request, uint8_t *data, size_t len, size_t index, size_t total) {
+            if (index == 0) {
+                if (!this->authManager.isAuthenticated(request, ROLE_ADMIN)) return;
+                // Um lote abandonado (cliente caiu) expira após o timeout
+                if (this->userBatchId != 0 &&
+                    millis() - this->userBatchActivity < USER_BATCH_TIMEOUT_MS) {
+                    return;
+                }
+                this->dropUserBatch();
+                // Número do lote na requisição (liberado junto com ela pela biblioteca)
+                uint32_t *token = (uint32_t *)malloc(sizeof(uint32_t));
+                if (!token) return;
+                this->userBatch = new (std::nothrow) UserBatch();
+                if (!this->userBatch) {
+                    free(token);
+                    return;
+                }
+                *token = this->nextUserBatchId++;
+                if (this->nextUserBatchId == 0) this->nextUserBatchId = 1;
+                free(request->_tempObject);
+                request->_tempObject = token;
+                this->userBatchId = *token;
+                // Cliente caiu no meio do envio: o lote sai na hora, sem esperar o timeout
+                uint32_t id = *token;
+                request->onDisconnect([this, id]() {
+                    if (this->userBatchId == id) this->dropUserBatch();
+                });
+                if (total > USER_BATCH_MAX_BODY) {
+                    this->userBatch->fail(413, "Request body too large");
+                }
+            }
+            if (this->userBatchId && userBatchIdOf(request) == this->userBatchId && this->userBatch) {
+                this->userBatchActivity = millis();
+                this->userBatch->feed(data, len);
+            }
+        });
+
     // This single handler will process POST (add) and DELETE (remove) with a JSON body
-    AsyncCallbackJsonWebHandler* userHandler = new AsyncCallbackJsonWebHandler("/api/users", [this](AsyncWebServerRequest *request, JsonVariant &json) {
+    onJson("/api/users", [this](AsyncWebServerRequest *request, JsonVariant &json) {
         if (!this->authManager.isAuthenticated(request, ROLE_ADMIN)) {
-            request->send(403, "application/json", "{\"error\":\"Forbidden\"}");
+            this->reply(request, 403, "application/json", "{\"error\":\"Forbidden\"}");
             return;
         }
 
@@ -212,57 +506,420 @@ void WebServerManager::setupApiRoutes() {
             String uid = jsonObj["uid"];
             String name = jsonObj["name"];
             if (this->userManager.addUser(uid, name)) {
-                request->send(200, "application/json", "{\"success\":true}");
+                this->reply(request, 200, "application/json", "{\"success\":true}");
             } else {
-                request->send(400, "application/json", "{\"success\":false, \"message\":\"Failed to add user\"}");
+                this->reply(request, 400, "application/json", "{\"success\":false, \"message\":\"Failed to add user\"}");
             }
         }
         // REMOVE USER (DELETE)
         else if (request->method() == HTTP_DELETE) {
             String uid = jsonObj["uid"];
             if (this->userManager.removeUser(uid)) {
-                request->send(200, "application/json", "{\"success\":true}");
+                this->reply(request, 200, "application/json", "{\"success\":true}");
             } else {
-                request->send(400, "application/json", "{\"success\":false, \"message\":\"User not found\"}");
+                this->reply(request, 400, "application/json", "{\"success\":false, \"message\":\"User not found\"}");
             }
         }
         else {
-            request->send(405, "application/json", "{\"error\":\"Method Not Allowed\"}");
+            this->reply(request, 405, "application/json", "{\"error\":\"Method Not Allowed\"}");
+        }
+    });
+
+    // --- Web Accounts Endpoint ---
+
+    // GET /api/accounts - List web accounts (never the password hashes)
+    on("/api/accounts", HTTP_GET, [this](AsyncWebServerRequest *req) {
+        if (!this->authManager.isAuthenticated(req, ROLE_ADMIN)) {
+            this->reply(req, 403, "application/json", "{\"error\":\"Forbidden\"}");
+            return;
+        }
+
+        AsyncResponseStream *res = req->beginResponseStream("application/json");
+        res->print("{\"accounts\":[");
+        bool first = true;
+        for (size_t i = 0; i < this->authManager.getAccountSlotCount(); i++) {
+            AuthAccount account;
+            if (!this->authManager.getAccountAt(i, account)) continue;
+            StaticJsonDocument<192> doc;
+            doc["username"] = (const char*)account.username;
+            doc["role"] = this->authManager.roleToString((UserRole)account.role);
+            doc["rfidUid"] = (const char*)account.rfidUid;
+            if (!first) res->print(",");
+            serializeJson(doc, *res);
+            first = false;
+        }
+        res->printf("],\"max\":%d}", AUTH_MAX_ACCOUNTS);
+        this->reply(req, res);
+    });
+
+    // POST creates, PUT updates (empty password keeps the current one), DELETE removes
+    AsyncCallbackJsonWebHandler* accountHandler = onJson("/api/accounts", [this](AsyncWebServerRequest *request, JsonVariant &json) {
+        if (!this->authManager.isAuthenticated(request, ROLE_ADMIN)) {
+            this->reply(request, 403, "application/json", "{\"error\":\"Forbidden\"}");
+            return;
+        }
+
+        JsonObject jsonObj = json.as<JsonObject>();
+        String username = jsonObj["username"] | "";
+        String password = jsonObj["password"] | "";
+        String rfidUid = jsonObj["rfidUid"] | "";
+        UserRole role = this->authManager.stringToRole(jsonObj["role"] | "user");
+
+        bool success;
+        if (request->method() == HTTP_POST) {
+            success = this->authManager.addAccount(username, password, role, rfidUid);
+        } else if (request->method() == HTTP_PUT) {
+            success = this->authManager.updateAccount(username, password, role, rfidUid);
+        } else {
+            success = this->authManager.removeAccount(username);
+        }
+
+        if (success) {
+            this->logger.logSystemEvent("Conta web alterada", username);
+            this->reply(request, 200, "application/json", "{\"success\":true}");
+        } else {
+            this->reply(request, 400, "application/json", "{\"success\":false, \"message\":\"Invalid account data\"}");
+        }
+    });
+    accountHandler->setMethod(HTTP_POST | HTTP_PUT | HTTP_DELETE);
+
+    // GET /api/me - The logged-in account and its linked RFID user, if any
+    on("/api/me", HTTP_GET, [this](AsyncWebServerRequest *req) {
+        AuthSession session;
+        if (!this->authManager.getSessionFromRequest(req, session)) {
+            this->reply(req, 401, "application/json", "{\"error\":\"Unauthorized\"}");
+            return;
+        }
+
+        StaticJsonDocument<384> doc;
+        doc["username"] = (const char*)session.username;
+        doc["role"] = this->authManager.roleToString(session.role);
+        doc["initialCredits"] = INITIAL_CREDITS;
+
+        AuthAccount account;
+        UserCredits user;
+        bool linked = this->authManager.findAccount(session.username, account) &&
+                      account.rfidUid[0] && this->userManager.getUser(account.rfidUid, user);
+        doc["linked"] = linked;
+        if (linked) {
+            doc["uid"] = user.uid;
+            doc["name"] = user.name;
+            doc["credits"] = user.credits;
+            doc["isActive"] = user.isActive;
+            time_t now = time(nullptr);
+            if (user.lastUsed > 0 && now >= (time_t)AUTH_MIN_VALID_EPOCH && (uint32_t)now >= user.lastUsed) {
+                doc["lastUsedAgo"] = ((uint32_t)now - user.lastUsed) * 1000ULL;
+            }
+        }
+
+        String json;
+        serializeJson(doc, json);
+        this->reply(req, 200, "application/json", json);
+    });
+
+    on("/api/serve-coffee", HTTP_POST, [this](AsyncWebServerRequest *req) {
+        AuthSession session;
+        if (!this->authManager.getSessionFromRequest(req, session) || session.role < ROLE_USER) {
+            this->reply(req, 401, "application/json", "{\"error\":\"Unauthorized\"}");
+            return;
         }
+        // Ocupado: o pedido entra na fila e a resposta traz o número para cancelar.
+        // A conta fica no pedido: só ela (ou um admin) pode cancelá-lo
+        ServeTicket ticket = this->coffeeController.requestServe(SERVE_SOURCE_WEB, "", session.username);
+        bool success = ticket.result == SERVE_STARTED || ticket.result == SERVE_QUEUED;
+        AsyncResponseStream *res = req->beginResponseStream("application/json");
+        res->printf("{\"success\":%s,\"result\":\"%s\",\"ticket\":%u,\"position\":%u}",
+                    success ? "true" : "false", CoffeeController::serveResultName(ticket.result),
+                    (unsigned)ticket.ticket, ticket.position);
+        this->reply(req, res);
     });
-    server.addHandler(userHandler);
 
-    server.on("/api/serve-coffee", HTTP_POST, [this](AsyncWebServerRequest *req) {
+    // GET /api/serve-queue - pedido em preparo e fila na ordem de atendimento
+    on("/api/serve-queue", HTTP_GET, [this](AsyncWebServerRequest *req) {
         if (!this->authManager.isAuthenticated(req, ROLE_USER)) {
-            req->send(401, "application/json", "{\"error\":\"Unauthorized\"}");
+            this->reply(req, 401, "application/json", "{\"error\":\"Unauthorized\"}");
             return;
         }
-        bool success = this->coffeeController.serveCoffee("WEB_MANUAL", nullptr);
-        req->send(200, "application/json", String("{\"success\":") + (success ? "true" : "false") + "}");
+        DynamicJsonDocument doc(SERVE_QUEUE_JSON_SIZE);
+        this->buildServeQueueJson(doc.to<JsonObject>());
+        AsyncResponseStream *res = req->beginResponseStream("application/json");
+        serializeJson(doc, *res);
+        this->reply(req, res);
     });
 
-    server.on("/api/logs", HTTP_GET, [this](AsyncWebServerRequest *req) {
+    // POST /api/serve-queue/cancel?ticket=N - admin cancela qualquer pedido;
+    // usuário, os que fez pela web e os do próprio cartão. Crédito devolvido
+    on("/api/serve-queue/cancel", HTTP_POST, [this](AsyncWebServerRequest *req) {
+        AuthSession session;
+        if (!this->authManager.getSessionFromRequest(req, session)) {
+            this->reply(req, 401, "application/json", "{\"error\":\"Unauthorized\"}");
+            return;
+        }
+        if (!req->hasParam("ticket") && !req->hasParam("ticket", true)) {
+            this->reply(req, 400, "application/json", "{\"error\":\"Missing ticket\"}");
+            return;
+        }
+        uint32_t ticket = (req->hasParam("ticket", true) ? req->getParam("ticket", true) : req->getParam("ticket"))->value().toInt();
+
+        ServeRequest queue[SERVE_QUEUE_MAX];
+        uint8_t count = this->coffeeController.getQueue(queue, SERVE_QUEUE_MAX);
+        const ServeRequest* request = nullptr;
+        for (uint8_t i = 0; i < count; i++) {
+            if (queue[i].ticket == ticket) request = &queue[i];
+        }
+        if (!request) {
+            this->reply(req, 404, "application/json", "{\"error\":\"Ticket not queued\"}");
+            return;
+        }
+
+        if (session.role != ROLE_ADMIN) {
+            bool owner;
+            if (request->source == SERVE_SOURCE_WEB) {
+                owner = request->requestedBy[0] && strcmp(request->requestedBy, session.username) == 0;
+            } else {
+                AuthAccount account;
+                PackedUID own;
+                owner = this->authManager.findAccount(session.username, account) && request->uid.len > 0 &&
+                        UserManager::packUID(account.rfidUid, own) && own.len == request->uid.len &&
+                        memcmp(own.bytes, request->uid.bytes, own.len) == 0;
+            }
+            if (!owner) {
+                this->reply(req, 403, "application/json", "{\"error\":\"Forbidden\"}");
+                return;
+            }
+        }
+
+        bool cancelled = this->coffeeController.cancelServe(ticket);
+        if (cancelled) {
+            this->logger.info("Pedido #" + String(ticket) + " cancelado por " + String(session.username));
+        }
+        this->reply(req, cancelled ? 200 : 404, "application/json",
+                    cancelled ? "{\"success\":true}" : "{\"error\":\"Ticket not queued\"}");
+    });
+
+    // POST /api/emergency-stop - desliga o relé na hora e esvazia a fila (admin).
+    // Dose interrompida não conta como servida; créditos cobrados são devolvidos
+    on("/api/emergency-stop", HTTP_POST, [this](AsyncWebServerRequest *req) {
+        AuthSession session;
+        if (!this->authManager.getSessionFromRequest(req, session) || session.role != ROLE_ADMIN) {
+            this->reply(req, 403, "application/json", "{\"error\":\"Forbidden\"}");
+            return;
+        }
+        this->coffeeController.emergencyStop();
+        this->logger.warning("Parada de emergência por " + String(session.username));
+        this->pushStatus();
+        this->reply(req, 200, "application/json", "{\"success\":true}");
+    });
+
+    on("/api/logs", HTTP_GET, [this](AsyncWebServerRequest *req) {
         if (!this->authManager.isAuthenticated(req, ROLE_ADMIN)) {
-            req->send(403, "application/json", "{\"error\":\"Forbidden\"}");
+            this->reply(req, 403, "application/json", "{\"error\":\"Forbidden\"}");
             return;
         }
         int limit = req->hasParam("limit") ? req->getParam("limit")->value().toInt() : 50;
         String json = this->logger.getLogsAsJson(limit);
-        req->send(200, "application/json", "{\"logs\":" + json + "}");
+        this->reply(req, 200, "application/json", "{\"logs\":" + json + "}");
+    });
+
+    // Estatísticas de consumo a partir dos agregados pré-calculados:
+    // range=<N>h|<N>d|<N>w (horas, dias ou semanas) ou all (todas as semanas)
+    on("/api/stats", HTTP_GET, [this](AsyncWebServerRequest *req) {
+        if (!this->authManager.isAuthenticated(req, ROLE_ADMIN)) {
+            this->reply(req, 403, "application/json", "{\"error\":\"Forbidden\"}");
+            return;
+        }
+        String range = req->hasParam("range") ? req->getParam("range")->value() : "7d";
+        RollupScale scale = ROLLUP_DAILY;
+        long count = range.toInt();
+        if (range == "all") {
+            scale = ROLLUP_WEEKLY;
+            count = STATS_WEEKS;
+        } else if (range.endsWith("h")) {
+            scale = ROLLUP_HOURLY;
+        } else if (range.endsWith("w")) {
+            scale = ROLLUP_WEEKLY;
+        } else if (!range.endsWith("d")) {
+            this->reply(req, 400, "application/json", "{\"error\":\"Invalid range\"}");
+            return;
+        }
+        count = constrain(count, 1L, (long)StatsRollups::capacity(scale));
+        AsyncResponseStream *res = req->beginResponseStream("application/json");
+        this->writeStatsJson(*res, scale, count, range == "all");
+        this->reply(req, res);
+    });
+
+    on("/api/security", HTTP_GET, [this](AsyncWebServerRequest *req) {
+        if (!this->authManager.isAuthenticated(req, ROLE_ADMIN)) {
+            this->reply(req, 403, "application/json", "{\"error\":\"Forbidden\"}");
+            return;
+        }
+        LoginSecurityStats stats = this->authManager.getSecurityStats();
+        std::vector<LoginAttempt> attempts = this->authManager.getLoginAttempts();
+
+        AsyncResponseStream *res = req->beginResponseStream("application/json");
+        res->printf("{\"failedLogins\":%u,\"lockouts\":%u,\"blockedAttempts\":%u,\"evictions\":%u,"
+                    "\"trackedIps\":%u,\"lockedIps\":%u,\"capacity\":%u,\"attempts\":[",
+                    (unsigned)stats.failedLogins, (unsigned)stats.lockouts,
+                    (unsigned)stats.blockedAttempts, (unsigned)stats.evictions,
+                    stats.trackedIps, stats.lockedIps, LOGIN_ATTEMPT_SLOTS);
+        unsigned long now = millis();
+        for (size_t i = 0; i < attempts.size(); i++) {
+            const LoginAttempt& attempt = attempts[i];
+            // Diferença com sinal: imune à volta do millis() e a prazos já vencidos
+            long lockedFor = attempt.lockoutUntil ? (long)(attempt.lockoutUntil - now) : 0;
+            res->printf("%s{\"ip\":\"%s\",\"count\":%u,\"lockedFor\":%lu}",
+                        i ? "," : "",
+                        IPAddress(attempt.ipAddress).toString().c_str(),
+                        attempt.attemptCount,
+                        lockedFor > 0 ? (unsigned long)lockedFor : 0UL);
+        }
+        res->print("]}");
+        this->reply(req, res);
+    });
+
+    // Métricas por rota: requisições, status, bytes e histograma do tempo de handler
+    on("/api/metrics", HTTP_GET, [this](AsyncWebServerRequest *req) {
+        if (!this->authManager.isAuthenticated(req, ROLE_ADMIN)) {
+            this->reply(req, 403, "application/json", "{\"error\":\"Forbidden\"}");
+            return;
+        }
+        AsyncResponseStream *res = req->beginResponseStream("application/json");
+        this->metrics.writeJson(*res);
+        this->reply(req, res);
+    });
+
+    // Exposição Prometheus de todos os subsistemas, gerada linha a linha.
+    // Coletores usam o token de METRICS_BEARER_TOKEN (ou METRICS_PUBLIC)
+    on("/metrics", HTTP_GET, [this](AsyncWebServerRequest *req) {
+        if (!METRICS_PUBLIC && !this->authManager.hasMetricsToken(req) &&
+            !this->authManager.isAuthenticated(req, ROLE_ADMIN)) {
+            AsyncWebServerResponse *res = req->beginResponse(401, "text/plain", "Unauthorized");
+            res->addHeader("WWW-Authenticate", "Bearer realm=\"metrics\"");
+            this->reply(req, res);
+            return;
+        }
+        auto cursor = this->metricsExporter.beginScrape();
+        AsyncWebServerResponse *res = req->beginChunkedResponse("text/plain; version=0.0.4",
+            [this, cursor](uint8_t *buffer, size_t maxLen, size_t index) -> size_t {
+                return this->metricsExporter.fill(*cursor, buffer, maxLen);
+            });
+        res->addHeader("Cache-Control", "no-store");
+        this->reply(req, res);
+    });
+
+    // Jobs de manutenção: prazos, execuções e tempo gasto em cada um
+    on("/api/scheduler", HTTP_GET, [this](AsyncWebServerRequest *req) {
+        if (!this->authManager.isAuthenticated(req, ROLE_ADMIN)) {
+            this->reply(req, 403, "application/json", "{\"error\":\"Forbidden\"}");
+            return;
+        }
+        AsyncResponseStream *res = req->beginResponseStream("application/json");
+        this->scheduler.writeJson(*res);
+        this->reply(req, res);
+    });
+
+    // Métricas do difusor WebSocket (filas, descartes, quadros agrupados)
+    on("/api/websocket", HTTP_GET, [this](AsyncWebServerRequest *req) {
+        if (!this->authManager.isAuthenticated(req, ROLE_ADMIN)) {
+            this->reply(req, 403, "application/json", "{\"error\":\"Forbidden\"}");
+            return;
+        }
+        WsBroadcastStats stats = this->broadcaster.getStats();
+
+        AsyncResponseStream *res = req->beginResponseStream("application/json");
+        res->printf("{\"clients\":%u,\"binaryClients\":%u,\"sseClients\":%u,\"backedUpClients\":%u,\"maxQueueDepth\":%u,\"queueBudget\":%u,"
+                    "\"pendingEvents\":%u,\"buffersInFlight\":%u,\"eventsQueued\":%u,\"eventsCoalesced\":%u,"
+                    "\"framesBuilt\":%u,\"framesSent\":%u,\"bytesSent\":%u,\"drops\":%u,\"resyncs\":%u}",
+                    stats.clients, stats.binaryClients, (unsigned)this->eventStream.clients(), stats.backedUpClients, stats.maxQueueDepth, WS_CLIENT_QUEUE_BUDGET,
+                    stats.pendingEvents, stats.buffersInFlight,
+                    (unsigned)stats.eventsQueued, (unsigned)stats.eventsCoalesced,
+                    (unsigned)stats.framesBuilt, (unsigned)stats.framesSent, (unsigned)stats.bytesSent,
+                    (unsigned)stats.drops, (unsigned)stats.resyncs);
+        this->reply(req, res);
     });
     
 }
 
 
+/* -------------------- Backup Routes -------------------- */
+void WebServerManager::setupBackupRoutes() {
+    // GET /api/backup - streams one NDJSON record per chunk, never the whole file
+    on("/api/backup", HTTP_GET, [this](AsyncWebServerRequest *req) {
+        if (!this->authManager.isAuthenticated(req, ROLE_ADMIN)) {
+            this->reply(req, 403, "application/json", "{\"error\":\"Forbidden\"}");
+            return;
+        }
+
+        auto cursor = std::make_shared<BackupExportCursor>();
+        this->backupManager.beginExport(*cursor);
+
+        AsyncWebServerResponse *res = req->beginChunkedResponse("application/x-ndjson",
+            [this, cursor](uint8_t *buffer, size_t maxLen, size_t index) -> size_t {
+                return this->backupManager.fillExport(*cursor, buffer, maxLen);
+            });
+        res->addHeader("Content-Disposition", "attachment; filename=\"cafeteira_backup.jsonl\"");
+        res->addHeader("Cache-Control", "no-store");
+        this->reply(req, res);
+        this->logger.logSystemEvent("Backup exportado", "IP: " + req->client()->remoteIP().toString());
+    });
+
+    // POST /api/restore - multipart upload parsed line by line as it arrives
+    on("/api/restore", HTTP_POST,
+        [this](AsyncWebServerRequest *req) {
+            if (!this->authManager.isAuthenticated(req, ROLE_ADMIN)) {
+                this->backupManager.abortRestore(req);
+                this->reply(req, 403, "application/json", "{\"error\":\"Forbidden\"}");
+                return;
+            }
+
+            bool overwriteUsers = req->hasParam("overwriteUsers", true) &&
+                                  req->getParam("overwriteUsers", true)->value() == "true";
+            bool restoreSettings = req->hasParam("restoreSettings", true) &&
+                                   req->getParam("restoreSettings", true)->value() == "true";
+
+            String message;
+            bool ok = this->backupManager.finishRestore(req, overwriteUsers, restoreSettings, message);
+
+            StaticJsonDocument<256> doc;
+            doc["success"] = ok;
+            doc["message"] = message;
+            String json;
+            serializeJson(doc, json);
+            this->reply(req, ok ? 200 : 400, "application/json", json);
+
+            if (ok) {
+                this->logger.logSystemEvent("Backup restaurado", message);
+                this->pushStatus();
+            } else {
+                this->logger.warning("Falha ao restaurar backup", message);
+            }
+        },
+        [this](AsyncWebServerRequest *req, const String &filename, size_t index, uint8_t *data, size_t len, bool final) {
+            if (index == 0) {
+                if (!this->authManager.isAuthenticated(req, ROLE_ADMIN)) return;
+                if (!this->backupManager.beginRestore(req)) return;
+            }
+            if (this->backupManager.isRestoreOwner(req)) {
+                this->backupManager.feedRestore(data, len);
+            }
+        });
+}
+
 /* -------------------- WebSocket -------------------- */
 void WebServerManager::setupWebSocket() {
     ws.onEvent([this](AsyncWebSocket *server, AsyncWebSocketClient *client,
                       AwsEventType type, void *arg, uint8_t *data, size_t len) {
         if (type == WS_EVT_CONNECT) {
             Serial.printf("🔌 WS client %u connected\n", client->id());
-            this->pushStatus();
+            if (!this->broadcaster.addClient(client)) {
+                client->close(1013, "Too many clients");
+                return;
+            }
+            // Todo cliente começa em JSON; o binário é pedido com "set_protocol"
+            this->sendStatusSnapshot(client, false);
         } else if (type == WS_EVT_DISCONNECT) {
             Serial.printf("❌ WS client %u disconnected\n", client->id());
+            this->broadcaster.removeClient(client);
         } else if (type == WS_EVT_DATA) {
             // --- START OF MODIFIED LOGIC ---
             AwsFrameInfo *info = (AwsFrameInfo*)arg;
@@ -278,6 +935,14 @@ void WebServerManager::setupWebSocket() {
                 if (msgType == "start_scan_for_add") {
                     Serial.println("🌐 WS: Recebido pedido para iniciar leitura de novo cartão.");
                     rfidManager.setScanMode(SCAN_FOR_ADD);
+                } else if (msgType == "status_resync") {
+                    // Cliente detectou lacuna na sequência de patches
+                    this->sendStatusSnapshot(client, this->broadcaster.isBinary(client));
+                } else if (msgType == "set_protocol") {
+                    // Negociação dentro do canal (ver ws_protocol.h)
+                    bool binary = doc["data"]["protocol"] == WS_BINARY_PROTOCOL;
+                    this->broadcaster.setBinary(client, binary);
+                    this->sendStatusSnapshot(client, binary);
                 } else {
                     Serial.printf("📩 WS received: %s\n", msg.c_str());
                 }
@@ -288,34 +953,299 @@ void WebServerManager::setupWebSocket() {
     server.addHandler(&ws);
 }
 
+/* -------------------- Server-Sent Events -------------------- */
+void WebServerManager::setupEventStream() {
+    // Mesmos eventos do WebSocket, sem buffers de recepção por cliente
+    events.setFilter([this](AsyncWebServerRequest *req) {
+        return this->authManager.isAuthenticated(req);
+    });
+    server.addHandler(&events);
+}
+
+bool WebServerManager::wantsJsonEvents() {
+    return broadcaster.hasTextClients() || eventStream.wantsEvents();
+}
+
+void WebServerManager::publishEvent(const char *type, const String &frame) {
+    broadcaster.send(frame);
+    eventStream.publish(type, frame);
+}
+
+void WebServerManager::sendStatusSnapshot(AsyncWebSocketClient *client, bool binary) {
+    if (binary) {
+        uint8_t record[WS_STATUS_RECORD_SIZE];
+        size_t len = statusSnapshot.copyBinary(record, sizeof(record));
+        if (len > 0) {
+            client->binary(record, len);
+        }
+        return;
+    }
+
+    String frame = statusSnapshot.copyFrame();
+    if (frame.length() > 0) {
+        client->text(frame);
+    }
+}
+
+void WebServerManager::writeStatsJson(Print &out, RollupScale scale, uint16_t count, bool lifetime) {
+    static const char *WEEKDAYS[7] = {
+        "Domingo", "Segunda-feira", "Terça-feira", "Quarta-feira", "Quinta-feira", "Sexta-feira", "Sábado"
+    };
+    static const char *SCALES[ROLLUP_SCALE_COUNT] = { "hour", "day", "week" };
+    static const uint16_t HOURS_PER_BUCKET[ROLLUP_SCALE_COUNT] = { 1, 24, 24 * 7 };
+
+    CoffeeLedger &ledger = this->coffeeController.getLedger();
+    StatsRollups &rollups = ledger.getRollups();
+    LedgerTotals totals = ledger.getTotals();
+    uint32_t current = StatsRollups::currentPeriod(scale);
+    uint32_t rangeHours = (uint32_t)count * HOURS_PER_BUCKET[scale];
+    float rangeDays = max(rangeHours / 24.0f, 1.0f);
+
+    // Baldes do intervalo, mais antigo primeiro (vazios onde não houve eventos)
+    std::vector<RollupBucket> buckets(current ? count : 0);
+    uint32_t rangeUsers[2] = {0, 0};
+    uint32_t rangeServed = 0, rangeServeTime = 0, rangeRefills = 0;
+    for (uint16_t i = 0; i < buckets.size(); i++) {
+        RollupBucket &bucket = buckets[i];
+        if (!rollups.getBucket(scale, current - (count - 1 - i), bucket)) {
+            memset(&bucket, 0, sizeof(bucket));
+        }
+        rangeServed += bucket.served;
+        rangeServeTime += bucket.serveTimeMs;
+        rangeRefills += bucket.refills;
+        // Usuários únicos do intervalo inteiro: união dos bitmaps
+        rangeUsers[0] |= bucket.users[0];
+        rangeUsers[1] |= bucket.users[1];
+    }
+
+    out.printf("{\"scale\":\"%s\",\"buckets\":%u,\"clockValid\":%s,\"consumption\":{\"labels\":[",
+               SCALES[scale], count, current ? "true" : "false");
+    for (uint16_t i = 0; i < buckets.size(); i++) {
+        time_t start = StatsRollups::periodStart(scale, current - (count - 1 - i));
+        struct tm date;
+        gmtime_r(&start, &date);
+        if (scale == ROLLUP_HOURLY) {
+            out.printf("%s\"%02dh\"", i ? "," : "", date.tm_hour);
+        } else {
+            out.printf("%s\"%02d/%02d\"", i ? "," : "", date.tm_mday, date.tm_mon + 1);
+        }
+    }
+    out.print("],\"values\":[");
+    for (uint16_t i = 0; i < buckets.size(); i++) {
+        out.printf("%s%u", i ? "," : "", buckets[i].served);
+    }
+    out.print("],\"users\":[");
+    for (uint16_t i = 0; i < buckets.size(); i++) {
+        out.printf("%s%u", i ? "," : "", buckets[i].uniqueUsers);
+    }
+    out.print("],\"refills\":[");
+    for (uint16_t i = 0; i < buckets.size(); i++) {
+        out.printf("%s%u", i ? "," : "", buckets[i].refills);
+    }
+    out.print("],\"avgServeMs\":[");
+    for (uint16_t i = 0; i < buckets.size(); i++) {
+        const RollupBucket &bucket = buckets[i];
+        out.printf("%s%u", i ? "," : "", (unsigned)(bucket.served ? bucket.serveTimeMs / bucket.served : 0));
+    }
+
+    // Perfil por hora do dia a partir da tabela horária (no máximo STATS_HOURS horas)
+    uint16_t profileHours = min(rangeHours, (uint32_t)STATS_HOURS);
+    float profileDays = max(profileHours / 24.0f, 1.0f);
+    uint32_t hourTotals[24] = {0};
+    uint32_t hourNow = StatsRollups::currentPeriod(ROLLUP_HOURLY);
+    for (uint16_t i = 0; hourNow != 0 && i < profileHours; i++) {
+        RollupBucket bucket;
+        if (rollups.getBucket(ROLLUP_HOURLY, hourNow - i, bucket)) {
+            hourTotals[(hourNow - i) % 24] += bucket.served;
+        }
+    }
+    out.printf("]},\"hourly\":{\"days\":%.1f,\"labels\":[", profileDays);
+    for (uint8_t h = 0; h < 24; h++) {
+        out.printf("%s\"%02uh\"", h ? "," : "", h);
+    }
+    out.print("],\"values\":[");
+    for (uint8_t h = 0; h < 24; h++) {
+        out.printf("%s%.1f", h ? "," : "", hourTotals[h] / profileDays);
+    }
+
+    // Dia da semana de pico a partir da tabela diária (no máximo STATS_DAYS dias)
+    uint32_t weekdayTotals[7] = {0};
+    uint32_t dayNow = StatsRollups::currentPeriod(ROLLUP_DAILY);
+    uint16_t peakDays = min((uint32_t)ceilf(rangeDays), (uint32_t)STATS_DAYS);
+    for (uint16_t i = 0; dayNow != 0 && i < peakDays; i++) {
+        RollupBucket bucket;
+        if (rollups.getBucket(ROLLUP_DAILY, dayNow - i, bucket)) {
+            // Dia 0 (01/01/1970) foi uma quinta-feira
+            weekdayTotals[(dayNow - i + 4) % 7] += bucket.served;
+        }
+    }
+    uint8_t peak = 0;
+    for (uint8_t d = 1; d < 7; d++) {
+        if (weekdayTotals[d] > weekdayTotals[peak]) peak = d;
+    }
+
+    // Mais consumidores desde sempre (o dicionário do ledger guarda UIDs
+    // removidos também); nomes passam pelo ArduinoJson para o escape
+    LedgerUser top[STATS_TOP_USERS];
+    uint8_t topCount = ledger.getTopUsers(top, STATS_TOP_USERS);
+    DynamicJsonDocument topDoc(JSON_ARRAY_SIZE(STATS_TOP_USERS) +
+                               STATS_TOP_USERS * (JSON_OBJECT_SIZE(3) + 96));  // Nome (até 50) + UID
+    JsonArray topUsers = topDoc.to<JsonArray>();
+    for (uint8_t i = 0; i < topCount; i++) {
+        String uid = UserManager::uidToString(top[i].uid);
+        String name = this->userManager.getUserName(uid);
+        JsonObject entry = topUsers.createNestedObject();
+        entry["name"] = name.isEmpty() ? uid : name;
+        entry["uid"] = uid;
+        entry["count"] = top[i].served;
+    }
+
+    out.printf("]},\"kpis\":{\"totalServed\":%u,\"dailyAverage\":\"%.1f\",\"peakDay\":\"%s\",\"topUser\":",
+               (unsigned)(lifetime ? totals.served : rangeServed), rangeServed / rangeDays,
+               weekdayTotals[peak] ? WEEKDAYS[peak] : "N/A");
+    if (topCount) {
+        serializeJson(topUsers[0]["name"], out);
+    } else {
+        out.print("\"N/A\"");
+    }
+    out.printf(",\"uniqueUsers\":%u,\"refills\":%u,\"avgServeMs\":%u},\"topUsers\":",
+               (unsigned)(__builtin_popcount(rangeUsers[0]) + __builtin_popcount(rangeUsers[1])),
+               (unsigned)(lifetime ? totals.refills : rangeRefills),
+               (unsigned)(rangeServed ? rangeServeTime / rangeServed : 0));
+    serializeJson(topUsers, out);
+
+    out.print(",\"sources\":{");
+    for (uint8_t i = 0; i < SERVE_SOURCE_COUNT; i++) {
+        out.printf("%s\"%s\":%u", i ? "," : "", CoffeeLedger::sourceName(i), (unsigned)totals.bySource[i]);
+    }
+
+    // Ativos com créditos, inativos e ativos sem créditos
+    unsigned active = 0, inactive = 0, noCredits = 0;
+    for (const UserCredits &user : this->userManager.getAllUsers()) {
+        if (!user.isActive) inactive++;
+        else if (user.credits <= 0) noCredits++;
+        else active++;
+    }
+    out.printf("},\"users\":{\"values\":[%u,%u,%u]}}", active, inactive, noCredits);
+}
+
 void WebServerManager::pushScannedUID(const String &uid) {
-    StaticJsonDocument<128> doc;
-    doc["type"] = "new_rfid_uid";
-    JsonObject data = doc.createNestedObject("data");
-    data["uid"] = uid;
+    if (wantsJsonEvents()) {
+        StaticJsonDocument<128> doc;
+        doc["type"] = "new_rfid_uid";
+        JsonObject data = doc.createNestedObject("data");
+        data["uid"] = uid;
 
-    String json;
-    serializeJson(doc, json);
-    ws.textAll(json);
+        String json;
+        serializeJson(doc, json);
+        publishEvent("new_rfid_uid", json);
+    }
+
+    if (broadcaster.hasBinaryClients()) {
+        uint8_t record[2 + USER_UID_MAX_BYTES];
+        broadcaster.sendBinary(record, wsEncodeScannedUid(uid, record, sizeof(record)));
+    }
 }
 
 
-void WebServerManager::pushStatus() {
-    StaticJsonDocument<1024> doc;
-    systemStatusToJson(doc, this->logger, this->coffeeController, this->userManager, this->authManager);
+void WebServerManager::dropUserBatch() {
+    delete userBatch;
+    userBatch = nullptr;
+    userBatchId = 0;
+}
+
+uint32_t WebServerManager::userBatchIdOf(AsyncWebServerRequest *request) {
+    return request->_tempObject ? *(const uint32_t *)request->_tempObject : 0;
+}
+
+void WebServerManager::buildServeQueueJson(JsonObject data) {
+    ServeRequest queue[SERVE_QUEUE_MAX];
+    uint8_t count = this->coffeeController.getQueue(queue, SERVE_QUEUE_MAX);
+    uint32_t serving = this->coffeeController.getServingTicket();
+    int64_t now = esp_timer_get_time();
+
+    if (serving) {
+        JsonObject current = data.createNestedObject("serving");
+        current["ticket"] = serving;
+        current["remainingMs"] = this->coffeeController.getServeTimeRemaining();
+    } else {
+        data["serving"] = nullptr;
+    }
+    data["capacity"] = SERVE_QUEUE_MAX;
+    data["cooldownMs"] = COOLDOWN_TIME_MS;
+
+    JsonArray entries = data.createNestedArray("entries");
+    for (uint8_t i = 0; i < count; i++) {
+        JsonObject entry = entries.createNestedObject();
+        entry["ticket"] = queue[i].ticket;
+        entry["position"] = i + 1;
+        entry["source"] = CoffeeLedger::sourceName(queue[i].source);
+        if (queue[i].uid.len) {
+            String uid = UserManager::uidToString(queue[i].uid);
+            entry["uid"] = uid;
+            entry["name"] = this->userManager.getUserName(uid);
+        }
+        entry["waitedMs"] = (uint32_t)((now - queue[i].queuedAt) / 1000);
+    }
+}
+
+void WebServerManager::pushServeQueue() {
+    // Sem registro no protocolo binário: a contagem vai no status (coffee.queued)
+    if (!wantsJsonEvents()) return;
+
+    DynamicJsonDocument doc(SERVE_QUEUE_JSON_SIZE + JSON_OBJECT_SIZE(2));
+    doc["type"] = "serve_queue";
+    buildServeQueueJson(doc.createNestedObject("data"));
+
     String json;
     serializeJson(doc, json);
-    ws.textAll("{\"type\":\"system_status\",\"data\":" + json + "}");
+    publishEvent("serve_queue", json);
+}
+
+void WebServerManager::pushStatus() {
+    // Só os campos alterados; clientes novos recebem o snapshot completo na conexão
+    String frame;
+    if (statusSnapshot.takePatch(frame)) {
+        publishEvent("status_patch", frame);
+
+        if (broadcaster.hasBinaryClients()) {
+            uint8_t record[WS_STATUS_RECORD_SIZE];
+            broadcaster.sendBinary(record, statusSnapshot.copyBinary(record, sizeof(record)));
+        }
+    }
+}
+
+void WebServerManager::registerJobs() {
+    statusJob = scheduler.every("web.status", STATUS_PUSH_INTERVAL_MS, [this]() { this->pushStatus(); });
+    scheduler.every("ws.flush", WS_BROADCAST_TICK_MS, [this]() { this->broadcaster.flush(); });
+}
+
+void WebServerManager::requestStatusPush() {
+    scheduler.trigger(statusJob);
 }
 
 void WebServerManager::pushLog(const String &log) {
-    ws.textAll("{\"type\":\"log_entry\",\"data\":" + log + "}");
+    if (wantsJsonEvents()) {
+        publishEvent("log_entry", "{\"type\":\"log_entry\",\"data\":" + log + "}");
+    }
+
+    if (broadcaster.hasBinaryClients()) {
+        std::vector<uint8_t> record(log.length() + 6);
+        broadcaster.sendBinary(record.data(), wsEncodeLogEntry(log, record.data(), record.size()));
+    }
 }
 
 void WebServerManager::pushUserUpdate(const String &uid) {
-    UserCredits* user = this->userManager.getUserByUID(uid);
-    if(user){
-        String userJson = this->userManager.userToJson(*user);
-        ws.textAll("{\"type\":\"user_activity\",\"data\":" + userJson + "}");
+    UserCredits user;
+    if(this->userManager.getUser(uid, user)){
+        if (wantsJsonEvents()) {
+            String userJson = this->userManager.userToJson(user);
+            publishEvent("user_activity", "{\"type\":\"user_activity\",\"data\":" + userJson + "}");
+        }
+
+        if (broadcaster.hasBinaryClients()) {
+            std::vector<uint8_t> record(user.name.length() + 32);
+            broadcaster.sendBinary(record.data(), wsEncodeUserActivity(user, record.data(), record.size()));
+        }
     }
 }
\ No newline at end of file
@@ -0,0 +1,293 @@
+#include "ws_broadcaster.h"
+
+WsBroadcaster::WsBroadcaster() :
+    clientCount(0),
+    binaryCount(0),
+    pendingCount(0),
+    pendingBinaryCount(0),
+    lock(nullptr) {
+    memset(clients, 0, sizeof(clients));
+    memset(&stats, 0, sizeof(stats));
+}
+
+void WsBroadcaster::begin() {
+    lock = xSemaphoreCreateMutex();
+    pending.reserve(WS_BROADCAST_MAX_FRAME);
+}
+
+void WsBroadcaster::acquire() {
+    if (lock) xSemaphoreTake(lock, portMAX_DELAY);
+}
+
+void WsBroadcaster::release() {
+    if (lock) xSemaphoreGive(lock);
+}
+
+bool WsBroadcaster::addClient(AsyncWebSocketClient* client) {
+    acquire();
+    int slot = findClient(client->id());
+    if (slot == -1) {
+        for (int i = 0; i < WS_BROADCAST_MAX_CLIENTS; i++) {
+            if (!clients[i].used) {
+                slot = i;
+                clientCount++;
+                break;
+            }
+        }
+    } else if (clients[slot].binary) {
+        binaryCount--;
+    }
+    if (slot != -1) {
+        clients[slot].client = client;
+        clients[slot].id = client->id();
+        clients[slot].drops = 0;
+        clients[slot].used = true;
+        clients[slot].binary = false;
+        clients[slot].needsResync = false;
+    }
+    release();
+    return slot != -1;
+}
+
+void WsBroadcaster::removeClient(AsyncWebSocketClient* client) {
+    acquire();
+    int slot = findClient(client->id());
+    if (slot != -1) {
+        if (clients[slot].binary) binaryCount--;
+        clients[slot].used = false;
+        clients[slot].client = nullptr;
+        clientCount--;
+    }
+    release();
+}
+
+bool WsBroadcaster::setBinary(AsyncWebSocketClient* client, bool binary) {
+    acquire();
+    int slot = findClient(client->id());
+    if (slot != -1 && clients[slot].binary != binary) {
+        clients[slot].binary = binary;
+        if (binary) binaryCount++; else binaryCount--;
+    }
+    release();
+    return slot != -1;
+}
+
+bool WsBroadcaster::isBinary(AsyncWebSocketClient* client) {
+    acquire();
+    int slot = findClient(client->id());
+    bool binary = slot != -1 && clients[slot].binary;
+    release();
+    return binary;
+}
+
+void WsBroadcaster::send(const String& message) {
+    if (message.length() == 0) return;
+
+    acquire();
+    stats.eventsQueued++;
+    if (clientCount == binaryCount) {
+        // Ninguém ouvindo em JSON: clientes novos recebem o snapshot na conexão
+        release();
+        return;
+    }
+
+    if (pending.length() + message.length() + 2 > WS_BROADCAST_MAX_FRAME) {
+        // Rajada maior que um quadro: descarta o lote e todos se ressincronizam
+        DEBUG_PRINTLN("WS: lote excedeu WS_BROADCAST_MAX_FRAME, forçando resync");
+        stats.drops += pendingCount;
+        pending = "";
+        pendingCount = 0;
+        markAllForResync();
+        if (message.length() + 2 > WS_BROADCAST_MAX_FRAME) {
+            release();
+            return;
+        }
+    }
+
+    if (pendingCount > 0) pending += ',';
+    pending += message;
+    pendingCount++;
+    release();
+}
+
+void WsBroadcaster::sendBinary(const uint8_t* record, size_t len) {
+    if (len == 0) return;
+
+    acquire();
+    stats.eventsQueued++;
+    if (binaryCount == 0) {
+        release();
+        return;
+    }
+
+    if (pendingBinary.size() + len > WS_BROADCAST_MAX_FRAME) {
+        DEBUG_PRINTLN("WS: lote binário excedeu WS_BROADCAST_MAX_FRAME, forçando resync");
+        stats.drops += pendingBinaryCount;
+        pendingBinary.clear();
+        pendingBinaryCount = 0;
+        markAllForResync();
+        if (len > WS_BROADCAST_MAX_FRAME) {
+            release();
+            return;
+        }
+    }
+
+    pendingBinary.insert(pendingBinary.end(), record, record + len);
+    pendingBinaryCount++;
+    release();
+}
+
+void WsBroadcaster::flush() {
+    acquire();
+    reapBuffers();
+
+    // JSON: um evento segue como está; vários viram um array no mesmo quadro
+    AsyncWebSocketMessageBuffer* textBuffer = nullptr;
+    if (pendingCount > 0) {
+        static const uint8_t open = '[';
+        static const uint8_t close = ']';
+        bool batched = pendingCount > 1;
+        textBuffer = makeShared(batched ? &open : nullptr,
+                                (const uint8_t*)pending.c_str(), pending.length(),
+                                batched ? &close : nullptr);
+        if (textBuffer) {
+            if (batched) stats.eventsCoalesced += pendingCount;
+        } else {
+            stats.drops += pendingCount;
+        }
+        pending = "";
+        pendingCount = 0;
+    }
+
+    // Binário: os registros já são autodelimitados, basta concatenar
+    AsyncWebSocketMessageBuffer* binaryBuffer = nullptr;
+    if (pendingBinaryCount > 0) {
+        binaryBuffer = makeShared(nullptr, pendingBinary.data(), pendingBinary.size(), nullptr);
+        if (binaryBuffer) {
+            if (pendingBinaryCount > 1) stats.eventsCoalesced += pendingBinaryCount;
+        } else {
+            stats.drops += pendingBinaryCount;
+        }
+        pendingBinary.clear();
+        pendingBinaryCount = 0;
+    }
+
+    uint16_t backedUp = 0;
+    uint16_t maxDepth = 0;
+    for (int i = 0; i < WS_BROADCAST_MAX_CLIENTS; i++) {
+        ClientBudget& budget = clients[i];
+        if (!budget.used) continue;
+
+        // Ponteiro registrado, não ws.client(): a lista da biblioteca muda no async_tcp
+        AsyncWebSocketClient* client = budget.client;
+        if (!client || client->status() != WS_CONNECTED) continue;
+
+        AsyncWebSocketMessageBuffer* buffer = budget.binary ? binaryBuffer : textBuffer;
+
+        size_t depth = client->queueLen();
+        if (depth > maxDepth) maxDepth = depth;
+
+        // Fila acima do orçamento: não acumula mais nada nesse cliente
+        if (depth >= WS_CLIENT_QUEUE_BUDGET || client->queueIsFull()) {
+            backedUp++;
+            if (buffer) {
+                budget.drops++;
+                budget.needsResync = true;
+                stats.drops++;
+            }
+            continue;
+        }
+
+        if (budget.needsResync && resyncHandler) {
+            resyncHandler(client, budget.binary);
+            budget.needsResync = false;
+            stats.resyncs++;
+        }
+
+        if (buffer) {
+            if (budget.binary) {
+                client->binary(buffer);
+            } else {
+                client->text(buffer);
+            }
+            stats.framesSent++;
+            stats.bytesSent += buffer->length();
+        }
+    }
+    stats.backedUpClients = backedUp;
+    stats.maxQueueDepth = maxDepth;
+
+    // As filas dos clientes mantêm suas próprias referências
+    AsyncWebSocketMessageBuffer* built[] = { textBuffer, binaryBuffer };
+    for (AsyncWebSocketMessageBuffer* buffer : built) {
+        if (!buffer) continue;
+        buffer->unlock();
+        if (buffer->canDelete()) {
+            delete buffer;
+        } else {
+            inFlight.push_back(buffer);
+        }
+    }
+
+    release();
+}
+
+WsBroadcastStats WsBroadcaster::getStats() {
+    acquire();
+    WsBroadcastStats current = stats;
+    current.clients = clientCount;
+    current.binaryClients = binaryCount;
+    current.pendingEvents = pendingCount + pendingBinaryCount;
+    current.buffersInFlight = inFlight.size();
+    release();
+    return current;
+}
+
+// Métodos privados
+
+int WsBroadcaster::findClient(uint32_t id) {
+    for (int i = 0; i < WS_BROADCAST_MAX_CLIENTS; i++) {
+        if (clients[i].used && clients[i].id == id) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+void WsBroadcaster::markAllForResync() {
+    for (int i = 0; i < WS_BROADCAST_MAX_CLIENTS; i++) {
+        clients[i].needsResync = clients[i].used;
+    }
+}
+
+AsyncWebSocketMessageBuffer* WsBroadcaster::makeShared(const uint8_t* prefix, const uint8_t* data, size_t len, const uint8_t* suffix) {
+    // Uma única cópia do quadro, travada até todas as filas pegarem sua referência
+    size_t total = len + (prefix ? 1 : 0) + (suffix ? 1 : 0);
+    AsyncWebSocketMessageBuffer* buffer = new AsyncWebSocketMessageBuffer(total);
+    if (!buffer || !buffer->get()) {
+        delete buffer;
+        return nullptr;
+    }
+
+    uint8_t* out = buffer->get();
+    if (prefix) *out++ = *prefix;
+    memcpy(out, data, len);
+    if (suffix) out[len] = *suffix;
+
+    buffer->lock();
+    stats.framesBuilt++;
+    return buffer;
+}
+
+void WsBroadcaster::reapBuffers() {
+    // Libera os buffers cujas mensagens já saíram de todas as filas
+    size_t kept = 0;
+    for (size_t i = 0; i < inFlight.size(); i++) {
+        if (inFlight[i]->canDelete()) {
+            delete inFlight[i];
+        } else {
+            inFlight[kept++] = inFlight[i];
+        }
+    }
+    inFlight.resize(kept);
+}
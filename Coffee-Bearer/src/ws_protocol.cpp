@@ -0,0 +1,117 @@
+#include "ws_protocol.h"
+#include <WiFi.h>
+
+void WsBinaryWriter::u8(uint8_t value) {
+    if (position + 1 > capacity) {
+        overflowed = true;
+        return;
+    }
+    data[position++] = value;
+}
+
+void WsBinaryWriter::u16(uint16_t value) {
+    u8(value & 0xFF);
+    u8(value >> 8);
+}
+
+void WsBinaryWriter::u32(uint32_t value) {
+    u16(value & 0xFFFF);
+    u16(value >> 16);
+}
+
+void WsBinaryWriter::varint(uint32_t value) {
+    while (value >= 0x80) {
+        u8((value & 0x7F) | 0x80);
+        value >>= 7;
+    }
+    u8(value);
+}
+
+void WsBinaryWriter::bytes(const uint8_t* src, size_t len) {
+    if (position + len > capacity) {
+        overflowed = true;
+        return;
+    }
+    memcpy(data + position, src, len);
+    position += len;
+}
+
+void WsBinaryWriter::string(const String& value) {
+    varint(value.length());
+    bytes((const uint8_t*)value.c_str(), value.length());
+}
+
+static uint16_t clampU16(long value) {
+    if (value < 0) return 0;
+    return value > 0xFFFF ? 0xFFFF : value;
+}
+
+size_t wsEncodeStatus(const JsonDocument& status, uint32_t seq, uint8_t* out, size_t capacity) {
+    // Mesmos campos do JSON de systemStatusToJson(), em posições fixas
+    JsonVariantConst system = status["system"];
+    JsonVariantConst coffee = status["coffee"];
+    JsonVariantConst users = status["users"];
+    JsonVariantConst logs = status["logs"];
+
+    IPAddress ip;
+    ip.fromString(system["wifiIP"].as<const char*>());
+
+    uint8_t flags = 0;
+    if (system["wifiConnected"].as<bool>()) flags |= 0x01;
+    if (coffee["isBusy"].as<bool>()) flags |= 0x02;
+
+    WsBinaryWriter writer(out, capacity);
+    writer.u8(WS_RECORD_STATUS);
+    writer.u32(seq);
+    writer.u32(system["uptime"].as<uint32_t>());
+    writer.u32(system["freeHeap"].as<uint32_t>());
+    for (int i = 0; i < 4; i++) {
+        writer.u8(ip[i]);
+    }
+    writer.u8(flags);
+    writer.u16(clampU16(coffee["remaining"].as<long>()));
+    writer.u16(clampU16(coffee["maxCapacity"].as<long>()));
+    writer.u32(coffee["totalServed"].as<uint32_t>());
+    writer.u16(clampU16(users["total"].as<long>()));
+    writer.u16(clampU16(users["activeToday"].as<long>()));
+    writer.u16(clampU16(status["auth"]["activeSessions"].as<long>()));
+    writer.u16(clampU16(logs["total"].as<long>()));
+    writer.u16(clampU16(logs["errors"].as<long>()));
+    writer.u16(clampU16(logs["warnings"].as<long>()));
+    return writer.length();
+}
+
+size_t wsEncodeScannedUid(const String& uid, uint8_t* out, size_t capacity) {
+    PackedUID packed;
+    if (!UserManager::packUID(uid, packed)) {
+        return 0;
+    }
+    WsBinaryWriter writer(out, capacity);
+    writer.u8(WS_RECORD_SCANNED_UID);
+    writer.u8(packed.len);
+    writer.bytes(packed.bytes, packed.len);
+    return writer.length();
+}
+
+size_t wsEncodeUserActivity(const UserCredits& user, uint8_t* out, size_t capacity) {
+    PackedUID packed;
+    if (!UserManager::packUID(user.uid, packed)) {
+        return 0;
+    }
+    WsBinaryWriter writer(out, capacity);
+    writer.u8(WS_RECORD_USER_ACTIVITY);
+    writer.u8(packed.len);
+    writer.bytes(packed.bytes, packed.len);
+    writer.varint(user.credits > 0 ? user.credits : 0);
+    writer.varint(user.lastUsed);
+    writer.u8(user.isActive ? 0x01 : 0x00);
+    writer.string(user.name);
+    return writer.length();
+}
+
+size_t wsEncodeLogEntry(const String& json, uint8_t* out, size_t capacity) {
+    WsBinaryWriter writer(out, capacity);
+    writer.u8(WS_RECORD_LOG_ENTRY);
+    writer.string(json);
+    return writer.length();
+}
@@ -336,7 +336,9 @@ async function serveCoffee() {
             method: 'POST'
         });
 
-        if (response && response.success) {
+        if (response && response.result === 'queued') {
+            showAlert(`Pedido #${response.ticket} na fila (posição ${response.position})`, 'info');
+        } else if (response && response.success) {
             showAlert('Café servido manualmente!', 'success');
             loadDashboardData(); // Atualizar dados
         } else {
@@ -417,7 +419,7 @@ async function exportData() {
             const url = window.URL.createObjectURL(blob);
             const a = document.createElement('a');
             a.href = url;
-            a.download = `cafeteira_backup_${new Date().toISOString().split('T')[0]}.json`;
+            a.download = `cafeteira_backup_${new Date().toISOString().split('T')[0]}.jsonl`;
             document.body.appendChild(a);
             a.click();
             document.body.removeChild(a);
@@ -548,17 +550,25 @@ function clearLogs() {
 
 function initializeStatsPage() {
     loadStatsData();
-    initializeCharts();
+    // A página de estatísticas cria os próprios gráficos
+    if (typeof updateAllStats !== 'function') {
+        initializeCharts();
+    }
 }
 
 async function loadStatsData() {
     try {
         showLoading(true);
 
-        const response = await apiRequest('/api/stats');
+        const rangeFilter = document.getElementById('timeRangeFilter');
+        const range = rangeFilter ? rangeFilter.value : '7d';
+        const response = await apiRequest(`/api/stats?range=${encodeURIComponent(range)}`);
 
         if (response) {
-            // updateStatsCharts(response); // This function was missing, so it's commented out.
+            adminData.stats = { ...adminData.stats, history: response };
+            if (typeof updateAllStats === 'function') {
+                updateAllStats(response);
+            }
         }
     } catch (error) {
         console.error('Erro ao carregar estatísticas:', error);
@@ -785,11 +795,12 @@ function getLast7Days() {
     return days;
 }
 
+// lastUsed vem do firmware em segundos (epoch); 0 = nunca usado
 function isActiveToday(timestamp) {
     if (!timestamp) return false;
     const today = new Date();
     today.setHours(0, 0, 0, 0);
-    return timestamp >= today.getTime();
+    return timestamp * 1000 >= today.getTime();
 }
 
 function setupAdminEventHandlers() {
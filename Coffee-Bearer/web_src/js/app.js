@@ -11,11 +11,18 @@ let websocket = null;
 let isAuthenticated = false;
 let autoRefreshInterval = null;
 
+// Status reconstruído a partir do snapshot completo + patches sequenciais
+let statusState = null;
+let statusSeq = 0;
+let statusResyncPending = false;
+
 // Configurações
 const CONFIG = {
     websocket: {
         reconnectInterval: 5000,
-        maxReconnectAttempts: 10
+        maxReconnectAttempts: 10,
+        // Protocolo binário compacto (ws_protocol.h); o JSON continua sendo o padrão
+        binary: localStorage.getItem('wsProtocol') === 'binary'
     },
     alerts: {
         autoHideDelay: 5000
@@ -159,21 +166,38 @@ function initWebSocket() {
 
     try {
         websocket = new WebSocket(wsUrl);
+        websocket.binaryType = 'arraybuffer';
 
         websocket.onopen = function(event) {
             console.log('WebSocket conectado');
+            statusState = null;
+            statusResyncPending = false;
             showAlert('Conectado ao sistema em tempo real', 'success');
 
             sendWebSocketMessage('auth', {
                 username: currentUser?.username,
                 role: currentUser?.role
             });
+
+            if (CONFIG.websocket.binary) {
+                sendWebSocketMessage('set_protocol', { protocol: WS_BINARY_PROTOCOL });
+            }
         };
 
         websocket.onmessage = function(event) {
             try {
+                if (event.data instanceof ArrayBuffer) {
+                    decodeBinaryFrame(event.data).forEach(handleWebSocketMessage);
+                    return;
+                }
+
                 const data = JSON.parse(event.data);
-                handleWebSocketMessage(data);
+                // O servidor agrupa os eventos de um mesmo tick em um array
+                if (Array.isArray(data)) {
+                    data.forEach(handleWebSocketMessage);
+                } else {
+                    handleWebSocketMessage(data);
+                }
             } catch (error) {
                 console.error('Erro ao processar mensagem WebSocket:', error);
             }
@@ -218,7 +242,13 @@ function handleWebSocketMessage(message) {
 
     switch (message.type) {
         case 'system_status':
-            updateSystemStatus(message.data);
+            statusState = message.data;
+            statusSeq = message.seq || 0;
+            statusResyncPending = false;
+            updateSystemStatus(statusState);
+            break;
+        case 'status_patch':
+            applyStatusPatch(message);
             break;
         case 'user_activity':
             updateUserActivity(message.data);
@@ -235,6 +265,11 @@ function handleWebSocketMessage(message) {
         case 'alert':
             showAlert(message.data.message, message.data.type);
             break;
+        case 'serve_queue':
+            if (typeof window.handleServeQueue === 'function') {
+                window.handleServeQueue(message.data);
+            }
+            break;
         case 'new_rfid_uid': // ADDED THIS CASE
             if (typeof window.handleNewRfidUid === 'function') {
                 window.handleNewRfidUid(message.data.uid);
@@ -403,8 +438,104 @@ function setupGlobalEventHandlers() {
     });
 }
 
+// ============== PROTOCOLO BINÁRIO ==============
+
+const WS_BINARY_PROTOCOL = 'cb-bin.1';
+
+// Converte um quadro binário (um ou mais registros) nas mesmas mensagens do JSON
+function decodeBinaryFrame(buffer) {
+    const view = new DataView(buffer);
+    const bytes = new Uint8Array(buffer);
+    const text = new TextDecoder();
+    const messages = [];
+    let pos = 0;
+
+    const u8 = () => view.getUint8(pos++);
+    const u16 = () => { const v = view.getUint16(pos, true); pos += 2; return v; };
+    const u32 = () => { const v = view.getUint32(pos, true); pos += 4; return v; };
+    const varint = () => {
+        let value = 0;
+        let shift = 0;
+        let b;
+        do {
+            b = u8();
+            value += (b & 0x7F) * Math.pow(2, shift);
+            shift += 7;
+        } while (b & 0x80);
+        return value;
+    };
+    const raw = (len) => { const v = bytes.subarray(pos, pos + len); pos += len; return v; };
+    const str = () => text.decode(raw(varint()));
+    const uid = () => Array.from(raw(u8()), b => b.toString(16).toUpperCase().padStart(2, '0')).join(' ');
+
+    while (pos < bytes.length) {
+        const type = u8();
+        switch (type) {
+            case 0x01: {
+                const seq = u32();
+                const uptime = u32();
+                const freeHeap = u32();
+                const wifiIP = Array.from(raw(4)).join('.');
+                const flags = u8();
+                messages.push({
+                    type: 'system_status',
+                    seq: seq,
+                    data: {
+                        system: { uptime, freeHeap, wifiConnected: !!(flags & 0x01), wifiIP },
+                        coffee: { remaining: u16(), maxCapacity: u16(), totalServed: u32(), isBusy: !!(flags & 0x02) },
+                        users: { total: u16(), activeToday: u16() },
+                        auth: { activeSessions: u16() },
+                        logs: { total: u16(), errors: u16(), warnings: u16() }
+                    }
+                });
+                break;
+            }
+            case 0x02:
+                messages.push({ type: 'new_rfid_uid', data: { uid: uid() } });
+                break;
+            case 0x03: {
+                const data = { uid: uid(), credits: varint(), lastUsed: varint() };
+                data.isActive = !!(u8() & 0x01);
+                data.name = str();
+                messages.push({ type: 'user_activity', data: data });
+                break;
+            }
+            case 0x04:
+                messages.push({ type: 'log_entry', data: JSON.parse(str()) });
+                break;
+            default:
+                // Tipo desconhecido: o tamanho não é conhecido, descarta o resto do quadro
+                console.warn('Registro binário desconhecido:', type);
+                return messages;
+        }
+    }
+    return messages;
+}
+
 // ============== HANDLERS WEBSOCKET ESPECÍFICOS ==============
 
+function applyStatusPatch(message) {
+    // Patch antigo (já coberto pelo snapshot): ignorar
+    if (statusState && message.seq <= statusSeq) {
+        return;
+    }
+
+    // Lacuna na sequência (ou ainda sem snapshot): pedir o status completo
+    if (!statusState || message.seq !== statusSeq + 1) {
+        if (!statusResyncPending) {
+            statusResyncPending = true;
+            sendWebSocketMessage('status_resync', { lastSeq: statusSeq });
+        }
+        return;
+    }
+
+    statusSeq = message.seq;
+    for (const [topic, fields] of Object.entries(message.data || {})) {
+        statusState[topic] = Object.assign({}, statusState[topic], fields);
+    }
+    updateSystemStatus(statusState);
+}
+
 function updateSystemStatus(data) {
     if (typeof handleSystemStatusUpdate === 'function') {
         handleSystemStatusUpdate(data);